@@ -0,0 +1,23 @@
+#!/bin/bash
+# Throughput of small appends against the number of client requests the
+# leader takes per event loop tick (--client-batch), 1 handling them one at
+# a time.
+#
+#   make && ./bench/batch.sh [clients] [batch...]
+
+clients=${1:-4}
+batches=("${@:2}")
+[ ${#batches[@]} -eq 0 ] && batches=(1 4 16 64 256)
+duration=${DURATION:-5}
+MPIRUN=${MPIRUN:-"mpirun --oversubscribe"}
+
+for batch in "${batches[@]}"; do
+    rm -rf afs_data
+    # The REPL reads stdin: keep it open until the run is over.
+    result=$( (sleep $((duration + 10)) | timeout $((duration + 8)) \
+        $MPIRUN -np $((3 + clients + 1)) ./bin/afs 3 "$clients" \
+        --autostart=1 --duration-s="$duration" --mix=load:2,append:98 \
+        --payload=fixed:128 --outstanding=16 --client-batch="$batch" 2>&1) |
+        grep -a "ops/s")
+    echo "client_batch=$batch $result"
+done
@@ -0,0 +1,23 @@
+#!/bin/bash
+# Throughput and READ latency of a read-mostly mix without and with the
+# client cache, whose copies the leaders invalidate with callback breaks.
+#
+#   make && ./bench/cache.sh [clients] [payload]
+
+clients=${1:-2}
+payload=${2:-uniform:1000-200000}
+duration=${DURATION:-5}
+MPIRUN=${MPIRUN:-"mpirun --oversubscribe"}
+
+for layout in uncached --cache-mb=64; do
+    rm -rf afs_data
+    options=()
+    [ "$layout" != uncached ] && options=("$layout")
+    # The REPL reads stdin: keep it open until the run is over.
+    output=$( (sleep $((duration + 10)) | timeout $((duration + 8)) \
+        $MPIRUN -np $((3 + clients + 1)) ./bin/afs 3 "$clients" \
+        --autostart=1 --duration-s="$duration" --mix=load:10,read:80,append:10 \
+        --payload="$payload" "${options[@]}" "${@:3}" 2>&1))
+    echo "$layout $(grep -a "ops/s" <<< "$output")"
+    grep -a "^READ \|^cache:" <<< "$output"
+done
@@ -0,0 +1,25 @@
+#!/bin/bash
+# Throughput and bytes stored without and with content-defined chunk
+# deduplication, for clients loading and appending repeated payloads that
+# fit in one message.
+#
+#   make && ./bench/dedup.sh [clients] [payload]
+
+clients=${1:-2}
+payload=${2:-uniform:1000-60000}
+duration=${DURATION:-5}
+MPIRUN=${MPIRUN:-"mpirun --oversubscribe"}
+
+for layout in files --dedup-kb=8; do
+    rm -rf afs_data
+    options=()
+    [ "$layout" != files ] && options=("$layout")
+    # The REPL reads stdin: keep it open until the run is over.
+    result=$( (sleep $((duration + 10)) | timeout $((duration + 8)) \
+        $MPIRUN -np $((3 + clients + 1)) ./bin/afs 3 "$clients" \
+        --autostart=1 --duration-s="$duration" --mix=load:50,append:40,read:10 \
+        --payload="$payload" "${options[@]}" "${@:3}" 2>&1) |
+        grep -a "ops/s")
+    stored=$(du -sb afs_data/server_* afs_data/chunks_* 2>/dev/null | awk '{s += $1} END {print s + 0}')
+    echo "$layout $result, $stored bytes stored"
+done
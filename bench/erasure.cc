@@ -0,0 +1,75 @@
+// Reed-Solomon encode and decode throughput of each GF(2^8) kernel, in GB/s
+// of data, for a few k + m layouts. Decoding rebuilds the m first data
+// fragments, the worst case for a degraded read.
+//
+//   make bench && ./bin/bench_erasure [chunk_kb] [iterations]
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "erasure_code.hh"
+
+using bench_clock = std::chrono::steady_clock;
+
+static double gb_per_s(bench_clock::time_point start, size_t bytes)
+{
+    double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    return bytes / seconds / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t chunk = (argc > 1 ? std::stoul(argv[1]) : 1024) << 10;
+    int iterations = argc > 2 ? std::stoi(argv[2]) : 200;
+
+    std::mt19937_64 rng(42);
+    std::string data(chunk, '\0');
+    for (char &c : data)
+        c = static_cast<char>(rng());
+
+    std::cout << std::left << std::setw(8) << "k+m" << std::setw(8) << "kernel" << std::right
+              << std::setw(14) << "encode GB/s" << std::setw(14) << "decode GB/s" << std::endl;
+
+    std::vector<std::pair<int, int>> layouts = {{2, 1}, {4, 2}, {6, 3}, {10, 4}};
+    for (auto [k, m] : layouts)
+    {
+        for (auto kernel : {ec::Kernel::SCALAR, ec::Kernel::SSSE3, ec::Kernel::AVX2})
+        {
+            if (!ec::supported(kernel))
+                continue;
+            ec::ReedSolomon code(k, m, kernel);
+            std::vector<std::string> fragments = code.split(data);
+            size_t size = fragments[0].size();
+            std::vector<uint8_t *> pointers;
+            for (auto &fragment : fragments)
+                pointers.push_back(reinterpret_cast<uint8_t *>(fragment.data()));
+
+            auto start = bench_clock::now();
+            for (int i = 0; i < iterations; i++)
+                code.encode(pointers.data(), pointers.data() + k, size);
+            double encode = gb_per_s(start, chunk * iterations);
+
+            std::vector<std::string> expected = fragments;
+            std::vector<bool> present(k + m, true);
+            for (int j = 0; j < m && j < k; j++)
+            {
+                present[j] = false;
+                fragments[j].assign(size, '\0');
+            }
+            start = bench_clock::now();
+            for (int i = 0; i < iterations; i++)
+                code.reconstruct(pointers.data(), present, size);
+            double decode = gb_per_s(start, chunk * iterations);
+
+            std::cout << std::left << std::setw(8) << (std::to_string(k) + "+" + std::to_string(m))
+                      << std::setw(8) << ec::kernel_name(kernel) << std::right << std::fixed
+                      << std::setprecision(2) << std::setw(14) << encode << std::setw(14) << decode
+                      << (fragments == expected ? "" : "  MISMATCH") << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Upload throughput and bytes stored with 3-way replication and with a
+# 2 + 1 Reed-Solomon code, for large files sent in chunks.
+#
+#   make && ./bench/erasure.sh [clients] [payload]
+
+clients=${1:-2}
+payload=${2:-uniform:1000000-4000000}
+duration=${DURATION:-5}
+MPIRUN=${MPIRUN:-"mpirun --oversubscribe"}
+
+for layout in replicated --ec=2+1; do
+    rm -rf afs_data
+    options=()
+    [ "$layout" != replicated ] && options=("$layout")
+    # The REPL reads stdin: keep it open until the run is over.
+    result=$( (sleep $((duration + 10)) | timeout $((duration + 8)) \
+        $MPIRUN -np $((3 + clients + 1)) ./bin/afs 3 "$clients" \
+        --autostart=1 --duration-s="$duration" --mix=load:80,read:20 \
+        --payload="$payload" "${options[@]}" "${@:3}" 2>&1) |
+        grep -a "ops/s")
+    stored=$(du -sb afs_data/server_* afs_data/fragments_* 2>/dev/null | awk '{s += $1} END {print s + 0}')
+    echo "$layout $result, $stored bytes stored"
+done
@@ -0,0 +1,30 @@
+#!/bin/bash
+# Write outage when the leader crashes: the REPL crashes rank 1, which leads
+# the first term, in the middle of a write-heavy run. The clients report
+# the longest time without a successful write, that is until the elected
+# leader committed their retried requests. Election timeouts, heartbeats,
+# leases and client retries are scaled down together, for each election_ms.
+#
+#   make && ./bench/failover.sh [servers] [clients] [election_ms...]
+
+servers=${1:-3}
+clients=${2:-2}
+timeouts=("${@:3}")
+[ ${#timeouts[@]} -eq 0 ] && timeouts=(20 50 150)
+duration=${DURATION:-4}
+crash_at=${CRASH_AT:-2}
+MPIRUN=${MPIRUN:-"mpirun --oversubscribe"}
+
+for election in "${timeouts[@]}"; do
+    rm -rf afs_data
+    heartbeat=$((election / 4 > 0 ? election / 4 : 1))
+    # The REPL reads stdin: keep it open until the run is over.
+    output=$( ( sleep "$crash_at"; printf "CRASH\n1\n"; sleep $((duration + 10)) ) |
+        timeout $((duration + 8)) $MPIRUN -np $((servers + clients + 1)) ./bin/afs \
+        "$servers" "$clients" --autostart=1 --duration-s="$duration" \
+        --mix=load:10,append:90 --payload=fixed:256 --election-ms="$election" \
+        --heartbeat-ms="$heartbeat" --lease-ms=$((election / 2)) \
+        --request-timeout-ms="$election" 2>&1)
+    echo "election_ms=$election $(grep -a "serves writes" <<< "$output" | tail -1)"
+    grep -a "ops/s\|without a successful write" <<< "$output"
+done
@@ -0,0 +1,91 @@
+// Create, lookup, delete and LIST over the metadata index, against the
+// std::map with a linear scan for a free uid it replaces.
+//
+//   make bench && ./bin/bench_metadata [entries]
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "metadata_index.hh"
+
+using bench_clock = std::chrono::steady_clock;
+
+static void report(const std::string &name, bench_clock::time_point start, size_t operations)
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start);
+    std::cout << std::left << std::setw(28) << name << std::right << std::setw(10) << operations
+              << std::setw(12) << std::fixed << std::setprecision(1)
+              << static_cast<double>(elapsed.count()) / operations << " ns/op" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    std::mt19937 rng(42);
+
+    std::vector<std::string> names(n);
+    for (size_t i = 0; i < n; i++)
+        names[i] = "file_" + std::to_string(i);
+    std::vector<int> order(n);
+    for (size_t i = 0; i < n; i++)
+        order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+
+    raft::MetadataIndex index;
+    size_t sink = 0;
+
+    auto start = bench_clock::now();
+    for (size_t i = 0; i < n; i++)
+        sink += index.create(names[i]).uid;
+    report("index create", start, n);
+
+    start = bench_clock::now();
+    for (int uid : order)
+        sink += index.find(uid)->size;
+    report("index lookup", start, n);
+
+    start = bench_clock::now();
+    for (int uid : order)
+        sink += index.find(uid + static_cast<int>(n)) == nullptr;
+    report("index lookup miss", start, n);
+
+    start = bench_clock::now();
+    for (size_t i = 0; i < n / 2; i++)
+        sink += index.erase(order[i]);
+    report("index delete", start, n / 2);
+
+    start = bench_clock::now();
+    for (size_t i = 0; i < n / 2; i++)
+        sink += index.create(names[i]).uid;
+    report("index create (reuse)", start, n / 2);
+
+    start = bench_clock::now();
+    sink += index.list().size();
+    report("index list", start, n);
+
+    // The scan makes each create O(n log n): keep the baseline small.
+    size_t m = std::min<size_t>(n, 20000);
+    std::map<int, std::string> uids;
+    start = bench_clock::now();
+    for (size_t i = 0; i < m; i++)
+    {
+        int uid = 0;
+        while (uids.find(uid) != uids.end())
+            uid++;
+        uids[uid] = names[i];
+    }
+    report("map scan create", start, m);
+
+    start = bench_clock::now();
+    for (size_t i = 0; i < m; i++)
+        sink += uids.find(order[i] % m)->second.size();
+    report("map lookup", start, m);
+
+    return sink == 0;
+}
@@ -0,0 +1,21 @@
+#!/bin/bash
+# Write throughput of the load generator as the servers are split in more
+# Raft groups, each replicating its own shard of the files.
+#
+#   make && ./bench/multiraft.sh [servers] [clients] [max_groups]
+
+servers=${1:-6}
+clients=${2:-4}
+max_groups=${3:-3}
+duration=${DURATION:-5}
+MPIRUN=${MPIRUN:-"mpirun --oversubscribe"}
+
+for groups in $(seq 1 "$max_groups"); do
+    rm -rf afs_data
+    # The REPL reads stdin: keep it open until the run is over.
+    result=$( (sleep $((duration + 10)) | timeout $((duration + 8)) \
+        $MPIRUN -np $((servers + clients + 1)) ./bin/afs "$servers" "$clients" \
+        --groups="$groups" --autostart=1 --duration-s="$duration" --mix=load:5,append:95 "${@:4}" 2>&1) |
+        grep -a "ops/s")
+    echo "groups=$groups $result"
+done
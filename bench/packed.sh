@@ -0,0 +1,23 @@
+#!/bin/bash
+# Throughput of small LOAD, APPEND and DELETE with a file per file and with
+# the files packed in segments.
+#
+#   make && ./bench/packed.sh [clients] [payload]
+
+clients=${1:-2}
+payload=${2:-uniform:64-4000}
+duration=${DURATION:-5}
+MPIRUN=${MPIRUN:-"mpirun --oversubscribe"}
+
+for layout in files --packed-kb=4; do
+    rm -rf afs_data
+    options=()
+    [ "$layout" != files ] && options=("$layout")
+    # The REPL reads stdin: keep it open until the run is over.
+    result=$( (sleep $((duration + 10)) | timeout $((duration + 8)) \
+        $MPIRUN -np $((3 + clients + 1)) ./bin/afs 3 "$clients" \
+        --autostart=1 --duration-s="$duration" --mix=load:50,append:30,delete:20 \
+        --payload="$payload" "${options[@]}" "${@:3}" 2>&1) |
+        grep -a "ops/s")
+    echo "$layout $result"
+done
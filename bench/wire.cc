@@ -0,0 +1,70 @@
+// Compares the binary and JSON wire formats: bytes per message and
+// encode/decode time for each message type.
+//
+//   make bench && ./bin/bench_wire [iterations]
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "client_message.hh"
+#include "handshake_message.hh"
+#include "repl_message.hh"
+
+using bench_clock = std::chrono::steady_clock;
+
+static double ns_per_op(bench_clock::time_point start, int iterations)
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start);
+    return static_cast<double>(elapsed.count()) / iterations;
+}
+
+static void run(const std::string &name, const message::Message &message, int iterations)
+{
+    for (auto format : {wire::Format::BINARY, wire::Format::JSON})
+    {
+        message::Message::set_wire_format(format);
+        std::string encoded = message.serialize();
+
+        size_t sink = 0;
+        auto start = bench_clock::now();
+        for (int i = 0; i < iterations; i++)
+            sink += message.serialize().size();
+        double encode_ns = ns_per_op(start, iterations);
+
+        std::vector<char> received(encoded.begin(), encoded.end());
+        start = bench_clock::now();
+        for (int i = 0; i < iterations; i++)
+            sink += message::Message::deserialize(received.data(), received.size())->get_target_rank();
+        double decode_ns = ns_per_op(start, iterations);
+
+        std::cout << std::left << std::setw(22) << name
+                  << std::setw(8) << (format == wire::Format::BINARY ? "binary" : "json")
+                  << std::right << std::setw(10) << encoded.size()
+                  << std::setw(14) << std::fixed << std::setprecision(1) << encode_ns
+                  << std::setw(14) << decode_ns
+                  << (sink == 0 ? " " : "") << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? std::stoi(argv[1]) : 200000;
+
+    std::vector<int> uids(64);
+    for (int i = 0; i < 64; i++)
+        uids[i] = i;
+
+    std::cout << std::left << std::setw(22) << "message" << std::setw(8) << "format"
+              << std::right << std::setw(10) << "bytes" << std::setw(14) << "encode ns"
+              << std::setw(14) << "decode ns" << std::endl;
+
+    run("repl/speed", repl::REPL_message(2, 0, repl::ReplSpeed::MEDIUM), iterations);
+    run("handshake/uid", message::Handshake_message(message::SUCCESS, 5, 1, 42), iterations);
+    run("handshake/list64", message::Handshake_message(message::SUCCESS, 5, 1, uids), iterations);
+    run("client/append64", message::Client_message(message::APPEND, 1, 5, 42, "", std::string(64, 'a')), iterations);
+    run("client/load4k", message::Client_message(message::LOAD, 1, 5, -1, "file.txt", std::string(4096, 'a')), iterations / 10);
+    return 0;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "sha256.hh"
+
+namespace raft
+{
+    // Content address of a chunk: the SHA-256 digest of its bytes. Chunks
+    // of different files with the same id are shared, so the digest must
+    // resist clients crafting collisions.
+    struct ChunkId
+    {
+        Sha256Digest digest;
+
+        static ChunkId of(std::string_view data) { return ChunkId{sha256(data)}; }
+        // The id of hex(), throws std::invalid_argument if it is not one.
+        static ChunkId from_hex(std::string_view hex);
+        std::string hex() const;
+
+        bool operator==(const ChunkId &other) const { return digest == other.digest; }
+    };
+
+    struct ChunkIdHash
+    {
+        size_t operator()(const ChunkId &id) const
+        {
+            size_t hash;
+            std::memcpy(&hash, id.digest.data(), sizeof(hash));
+            return hash;
+        }
+    };
+
+    // A chunk of a file or of a log entry.
+    struct ChunkRef
+    {
+        ChunkId id;
+        uint32_t size;
+        // In a log entry: the bytes of the chunk are in its content, else
+        // the server receiving the entry stores the chunk already.
+        bool inlined;
+    };
+
+    // Content-defined chunking: cuts data where a gear rolling hash of the
+    // bytes before matches a mask, so an insertion only moves the cuts near
+    // it. Chunks are about average bytes, from average / 4 to average * 4.
+    std::vector<ChunkRef> cut_chunks(std::string_view data, size_t average);
+
+    // Content-addressed chunk store of the deduplicated files of a server,
+    // with a reference count per chunk, and the chunk list (recipe) of
+    // every such file. A chunk is a file of dir named after its id.
+    //
+    // Unreferenced chunks stay on disk until collect(), called after a
+    // snapshot: entries sent before then may still refer to them.
+    class ChunkStore
+    {
+    public:
+        explicit ChunkStore(std::string dir);
+
+        std::string path(const ChunkId &id) const;
+        // Forgets every recipe and registers the chunks found in dir,
+        // without references.
+        void reload();
+
+        // Whether the chunk is on disk or being written.
+        bool has(const ChunkId &id) const { return chunks.count(id) > 0; }
+        // Whether its bytes are on disk.
+        bool ready(const ChunkId &id) const;
+        // Whether the chunk was stored before the entry at index applied.
+        bool known_before(const ChunkId &id, uint64_t index) const;
+        void set_ready(const ChunkId &id);
+
+        const std::vector<ChunkRef> &recipe(int uid) const;
+        // Appends refs to the recipe of uid, taking a reference on each.
+        // Returns the chunks new to the store, whose bytes must be written.
+        std::vector<ChunkRef> add(int uid, const std::vector<ChunkRef> &refs, uint64_t index);
+        // Drops the recipe of uid and its references.
+        void erase(int uid);
+
+        // Referenced chunks, with their size.
+        std::vector<ChunkRef> referenced() const;
+        // Deletes the unreferenced chunks but those of keep. Returns how many.
+        size_t collect(const std::unordered_set<ChunkId, ChunkIdHash> &keep);
+
+        // Bytes of the deduplicated files, and of the chunks they reference.
+        uint64_t logical_bytes() const { return logical; }
+        uint64_t stored_bytes() const { return stored; }
+
+    private:
+        struct Chunk
+        {
+            uint32_t size;
+            uint32_t refs;
+            // Index of the entry that added the chunk, 0 if found on disk.
+            uint64_t since;
+            bool ready;
+        };
+
+        std::string dir;
+        std::unordered_map<ChunkId, Chunk, ChunkIdHash> chunks;
+        std::unordered_map<int, std::vector<ChunkRef>> recipes;
+        uint64_t logical;
+        uint64_t stored;
+    };
+}
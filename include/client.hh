@@ -0,0 +1,183 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <map>
+#include <optional>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "server.hh"
+#include "options.hh"
+#include "client_message.hh"
+#include "handshake_message.hh"
+#include "histogram.hh"
+#include "client_cache.hh"
+#include "routing.hh"
+
+namespace client
+{
+using steady_time = std::chrono::steady_clock::time_point;
+
+// Load generator run by the client ranks. It issues a random mix of
+// LOAD/LIST/APPEND/DELETE/READ requests for options.duration_s seconds,
+// either closed loop (options.outstanding operations always in flight) or
+// open loop at options.rate operations/s, and records the latency of each
+// operation. LOADs larger than a chunk are uploaded in chunks, READs
+// download the whole file in chunks. With options.cache_mb, downloaded
+// files and file lists are cached, and reads of an unchanged file are
+// answered without any message.
+class Client : public Server {
+    public:
+      // clients holds the client ranks only, for report().
+      Client(MPI_Comm com, MPI_Comm clients, int nb_servers, const Options &options);
+
+      void on_message_callback(std::shared_ptr<message::Message> message) override;
+
+      void work() override;
+
+      std::chrono::steady_clock::time_point next_deadline() override;
+
+      void visit(std::shared_ptr<message::Handshake_message> message) override;
+
+      // Merges the results of every client rank, the first one prints
+      // p50/p99/p999 latencies and the throughput.
+      void report();
+
+    private:
+        struct Request
+        {
+            message::ClientAction action;
+            int group;
+            // Scheduled send time: in open loop, a request sent late counts
+            // its delay in the latency.
+            steady_time start;
+            // Chunked transfer the request belongs to, 0 if none.
+            uint64_t transfer;
+            uint64_t offset;
+            uint64_t length;
+            // Bytes of a READ answered so far: large ranges and striped
+            // files are answered in several parts.
+            uint64_t received;
+            // Callback breaks of its group received before a LIST was
+            // sent: its answer is only cached if none came since.
+            uint64_t breaks;
+            // LIST operation the request is the part of one group of, 0
+            // if none.
+            uint64_t list;
+        };
+
+        // A LIST asks every group whose list is not cached for its files:
+        // the namespace is the union of their answers. It completes with
+        // the last one, and fails if any did.
+        struct List
+        {
+            steady_time start;
+            int waiting;
+            bool failed;
+        };
+
+        // Upload or download of one file in chunks, with at most
+        // options.window chunks in flight. done is the prefix of the file
+        // known to be transferred, where the transfer resumes after a lost
+        // chunk.
+        struct Transfer
+        {
+            bool upload;
+            int group;
+            // -1 until UPLOAD_BEGIN is answered.
+            int uid;
+            std::string filename;
+            // Unknown for a download until its first chunk arrives.
+            uint64_t size;
+            char fill;
+            uint64_t next;
+            uint64_t done;
+            // Downloaded chunks past done, by offset: their size.
+            std::map<uint64_t, uint64_t> completed;
+            int inflight;
+            steady_time start;
+            // Download kept for the cache, unless the file changed during it.
+            bool cacheable;
+            std::string data;
+        };
+
+        void issue(steady_time start);
+        message::ClientAction pick_action();
+        size_t payload_size();
+        std::string make_payload();
+        void expire(steady_time now);
+
+        void start_transfer(Transfer transfer);
+        // Sends the next chunks of a transfer, or commits it.
+        void pump(uint64_t id);
+        void send_chunk_request(uint64_t id, message::ClientAction action, uint64_t offset,
+                                uint64_t length);
+        void on_transfer_reply(const Request &request,
+                               const std::shared_ptr<message::Handshake_message> &message);
+        // Restarts a transfer from its done prefix after a timeout.
+        void resume(uint64_t id);
+        void finish(uint64_t id, bool success);
+        void on_list_reply(const Request &request,
+                           const std::shared_ptr<message::Handshake_message> &message,
+                           steady_time now);
+        // Answers a READ or LIST from the cache, false on a miss.
+        bool serve_cached(message::ClientAction action, int uid, steady_time start);
+        bool listed(int group, steady_time now) const;
+        // Drops the cached copies a callback break, or a write of this
+        // client, makes stale: uid may be message::ALL_FILES of group.
+        void invalidate(int uid, int group);
+        // The promises of group are its leader's: copies it handed out go
+        // stale when another server leads.
+        void set_leader(int group, int rank);
+
+        Options options;
+        MPI_Comm clients;
+        std::mt19937_64 rng;
+        std::discrete_distribution<int> mix;
+
+        raft::RoutingTable routing;
+        // Server believed to lead each group: replies come from it.
+        std::vector<int> leaders;
+        uint64_t next_request_id;
+        uint64_t next_file;
+        // Highest log index this client saw in each group, its
+        // read-your-writes token there.
+        std::vector<uint64_t> last_index;
+        std::unordered_map<uint64_t, Request> inflight;
+        // Operations in progress: plain requests and transfers.
+        size_t operations;
+        std::unordered_map<uint64_t, Transfer> transfers;
+        uint64_t next_transfer;
+        std::unordered_map<uint64_t, List> lists;
+        uint64_t next_list;
+        // Files created by this client and not deleted.
+        std::vector<int> files;
+        // Those of files appends can go to: not the coded uploads.
+        std::vector<int> appendable;
+
+        ClientCache cache;
+        // File list of each group, if cached, and until when.
+        std::vector<std::optional<std::pair<std::vector<int>, steady_time>>> listings;
+        std::vector<uint64_t> list_breaks;
+        uint64_t callback_breaks;
+
+        steady_time begin;
+        steady_time end;
+        steady_time next_send;
+        steady_time last_reply;
+        // Last successful write, and the longest time without one: how
+        // long the group could not take writes, across a failover.
+        steady_time last_write;
+        steady_time::duration write_gap;
+
+        std::array<stats::Histogram, message::MIXED_ACTIONS> latency;
+        std::array<uint64_t, message::MIXED_ACTIONS> errors;
+        uint64_t timeouts;
+        // Open loop requests sent over an interval after their scheduled
+        // time, the client itself falling behind.
+        uint64_t late_sends;
+  };
+
+} // namespace client
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+namespace client
+{
+    // Whole-file cache of a client, as in AFS: a file downloaded once is
+    // read locally until its server breaks the callback promise made when
+    // sending it, or the copy expires. The least recently used files are
+    // evicted to keep the cached bytes within a budget.
+    class ClientCache
+    {
+    public:
+        using time_point = std::chrono::steady_clock::time_point;
+
+        explicit ClientCache(uint64_t budget);
+
+        // The content of uid, nullptr if it is not cached or expired.
+        const std::string *find(int uid, time_point now);
+        // Files larger than the budget are not cached.
+        void insert(int uid, std::string data, time_point expires);
+        void erase(int uid);
+        // Erases the files whose uid matches.
+        void erase_if(const std::function<bool(int)> &match);
+
+        uint64_t capacity() const { return budget; }
+
+        uint64_t bytes() const { return used; }
+        uint64_t hits() const { return hit_count; }
+        uint64_t misses() const { return miss_count; }
+        uint64_t evictions() const { return eviction_count; }
+
+    private:
+        struct Entry
+        {
+            int uid;
+            std::string data;
+            time_point expires;
+        };
+
+        void drop(std::list<Entry>::iterator it);
+
+        uint64_t budget;
+        uint64_t used;
+        // Most recently used first.
+        std::list<Entry> lru;
+        std::unordered_map<int, std::list<Entry>::iterator> entries;
+
+        uint64_t hit_count;
+        uint64_t miss_count;
+        uint64_t eviction_count;
+    };
+}
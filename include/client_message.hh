@@ -11,18 +11,76 @@ namespace message
         LIST,
         APPEND,
         DELETE,
+        // Reads length bytes of uid from offset, at most one chunk.
+        READ,
+        // Chunked upload: UPLOAD_BEGIN creates the file (or, with the uid
+        // of an unfinished upload, asks where to resume), UPLOAD_CHUNK
+        // writes content at offset and UPLOAD_COMMIT publishes the file
+        // once its length bytes arrived.
+        UPLOAD_BEGIN,
+        UPLOAD_CHUNK,
+        UPLOAD_COMMIT,
+        // Appended by a new leader, never sent by clients: committing an
+        // entry of its term commits those of the terms before.
+        NOOP,
     };
+
+    // Actions the load generator mixes, indexes of Options::mix.
+    static constexpr int MIXED_ACTIONS = ClientAction::READ + 1;
     
     class Client_message : public Message
     {
     public:
         Client_message(ClientAction action, int target_rank, int sender_rank);
+        Client_message(ClientAction action, int target_rank, int sender_rank,
+                       int uid, std::string filename, std::string content,
+                       uint64_t request_id = 0);
+
+        ClientAction get_action() const { return action; }
+        int get_uid() const { return uid; }
+        const std::string &get_filename() const { return filename; }
+        const std::string &get_content() const { return content; }
+        // Chosen by the client, echoed in the reply.
+        uint64_t get_request_id() const { return request_id; }
+
+        // Bounds of a relaxed LIST that any server may answer: once it
+        // applied min_index, with data at most staleness_ms old (0: no
+        // bound). Both 0 asks for a linearizable read from the leader.
+        uint64_t get_min_index() const { return min_index; }
+        uint32_t get_staleness_ms() const { return staleness_ms; }
+        void set_read_bounds(uint64_t min_index, uint32_t staleness_ms);
+        bool is_relaxed_read() const { return min_index > 0 || staleness_ms > 0; }
+        bool is_read() const { return action == LIST || action == READ; }
+
+        // Byte range of READ, UPLOAD_CHUNK (length is the content size)
+        // and UPLOAD_COMMIT (offset 0, length the file size).
+        uint64_t get_offset() const { return offset; }
+        uint64_t get_length() const { return length; }
+        void set_range(uint64_t offset, uint64_t length);
+
+        // READ or LIST of a client that caches the answer: the leader
+        // promises to send it a CALLBACK_BREAK once the file, or the file
+        // list, changes.
+        bool get_callback() const { return callback; }
+        void set_callback(bool callback) { this->callback = callback; }
 
+        void accept(Visitor &visitor) override;
 
+        static std::shared_ptr<Client_message> deserialize(const json &j);
         static std::shared_ptr<Client_message>
-        deserialize(const std::string &message);
+        deserialize(wire::Reader &reader, int sender_rank, int target_rank);
         virtual json serialize_json() const;
+        virtual void serialize_payload(wire::Writer &writer) const;
     private:
         ClientAction action;
+        int uid;
+        std::string filename;
+        std::string content;
+        uint64_t request_id;
+        uint64_t min_index = 0;
+        uint32_t staleness_ms = 0;
+        uint64_t offset = 0;
+        uint64_t length = 0;
+        bool callback = false;
     };
 }
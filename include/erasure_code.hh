@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ec
+{
+    // Implementation of the GF(2^8) multiply-accumulate loop the codec
+    // spends its time in. The SIMD ones look up the products of the low
+    // and high nibbles of 16 or 32 bytes at a time with byte shuffles.
+    enum class Kernel
+    {
+        SCALAR = 0,
+        SSSE3,
+        AVX2,
+    };
+
+    // Best kernel the CPU supports.
+    Kernel best_kernel();
+    bool supported(Kernel kernel);
+    const char *kernel_name(Kernel kernel);
+
+    // Systematic Reed-Solomon code over GF(2^8): k data fragments, which
+    // are the data itself, and m parity fragments. Any k of the k + m
+    // fragments rebuild the others: the parity rows of the generator matrix
+    // form a Cauchy matrix, so every k x k submatrix of it is invertible.
+    class ReedSolomon
+    {
+    public:
+        ReedSolomon(int k, int m, Kernel kernel = best_kernel());
+
+        int data_fragments() const { return k; }
+        int parity_fragments() const { return m; }
+        int fragments() const { return k + m; }
+
+        // Bytes of each fragment of a chunk of chunk_size bytes.
+        size_t fragment_size(size_t chunk_size) const { return (chunk_size + k - 1) / k; }
+
+        // Computes the m parity fragments of the k data fragments, all of
+        // size bytes.
+        void encode(const uint8_t *const *data, uint8_t *const *parity, size_t size) const;
+        // Rebuilds the missing fragments in place. fragments holds k + m
+        // buffers of size bytes, present tells which ones hold their
+        // fragment. False if fewer than k are present.
+        bool reconstruct(uint8_t *const *fragments, const std::vector<bool> &present,
+                         size_t size) const;
+
+        // The k + m fragments of chunk: the chunk cut in k, the last piece
+        // zero padded, then the parity.
+        std::vector<std::string> split(std::string_view chunk) const;
+
+    private:
+        // dst ^= c * src over size bytes.
+        void mul_add(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size) const;
+
+        int k;
+        int m;
+        Kernel kernel;
+        // (k + m) x k generator matrix, row major: identity then Cauchy.
+        std::vector<uint8_t> generator;
+    };
+}
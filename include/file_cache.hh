@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <mpi.h>
+
+#include "mapped_file.hh"
+
+namespace raft
+{
+    // LRU cache of open file handles and read-only mappings, keyed by uid.
+    // Appends to a hot file reuse its handle instead of paying an open and
+    // a close each time, reads reuse its mapping. A cache is not thread
+    // safe: each I/O worker owns one shard.
+    class FileCache
+    {
+    public:
+        explicit FileCache(size_t capacity);
+        ~FileCache();
+
+        FileCache(const FileCache &) = delete;
+        FileCache &operator=(const FileCache &) = delete;
+
+        // The cached handle of uid, or path opened with amode, closing the
+        // least recently used handle if the cache is full. MPI_FILE_NULL,
+        // and nothing closed, if the open failed.
+        MPI_File open(int uid, const std::string &path, int amode);
+        // The cached mapping of uid if it covers size bytes, or a new
+        // mapping of path. nullptr, and nothing closed, if the file cannot
+        // be mapped.
+        std::shared_ptr<MappedFile> map(int uid, const std::string &path, uint64_t size);
+        void evict(int uid);
+        // Closes every handle on path, whatever its uid.
+        void evict_path(const std::string &path);
+        void close_all();
+
+        uint64_t hits() const { return hit_count.load(std::memory_order_relaxed); }
+        uint64_t misses() const { return miss_count.load(std::memory_order_relaxed); }
+
+    private:
+        struct Handle
+        {
+            int uid;
+            std::string path;
+            // MPI_FILE_NULL while the file was only mapped.
+            MPI_File file;
+            std::shared_ptr<MappedFile> mapping;
+        };
+
+        // The entry of uid, moved to the front, or a new empty one.
+        Handle &entry(int uid, const std::string &path);
+        void close(Handle &handle);
+
+        size_t capacity;
+        // Most recently used first.
+        std::list<Handle> lru;
+        std::unordered_map<int, std::list<Handle>::iterator> handles;
+
+        std::atomic<uint64_t> hit_count;
+        std::atomic<uint64_t> miss_count;
+    };
+}
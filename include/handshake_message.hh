@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 #include "message.hh"
 
 namespace message
@@ -9,20 +10,61 @@ namespace message
     {
         SUCCESS = 0,
         FAILURE,
+        // Unsolicited, from the leader of a group: the file uid, or the
+        // file list of the group if uid is -1, changed at index. Cached
+        // copies are stale. A new leader sends ALL_FILES: the promises of
+        // the previous one were lost with it.
+        CALLBACK_BREAK,
     };
+
+    constexpr int ALL_FILES = -2;
     
     class Handshake_message : public Message
     {
     public:
         Handshake_message(HandshakeStatus status, int target_rank, int sender_rank);
-        Handshake_message(HandshakeStatus status, int target_rank, int sender_rank, json custom_data);
+        Handshake_message(HandshakeStatus status, int target_rank, int sender_rank, int uid);
+        Handshake_message(HandshakeStatus status, int target_rank, int sender_rank, std::vector<int> uids);
+
+        HandshakeStatus get_status() const { return status; }
+        int get_uid() const { return uid; }
+        const std::vector<int> &get_uids() const { return uids; }
+        // Request id of the client message answered, 0 for REPL commands.
+        uint64_t get_request_id() const { return request_id; }
+        void set_request_id(uint64_t id) { request_id = id; }
+        // Log index of an applied mutation, or applied index a read saw:
+        // clients pass it back as the min_index of their next reads.
+        uint64_t get_index() const { return index; }
+        void set_index(uint64_t index) { this->index = index; }
+        // Size of the file after the operation: for uploads, the bytes
+        // received so far, where an interrupted upload resumes.
+        uint64_t get_size() const { return size; }
+        void set_size(uint64_t size) { this->size = size; }
+        // Bytes returned by READ, found at offset in the file.
+        uint64_t get_offset() const { return offset; }
+        std::string_view get_data() const { return data; }
+        void set_data(uint64_t offset, std::string data);
+        // Refers to memory kept alive by owner, a file mapping: the bytes
+        // are sent from there without being copied.
+        void set_data(uint64_t offset, std::string_view data, std::shared_ptr<const void> owner);
+        std::string_view get_trailer() const override { return data; }
 
+        void accept(Visitor &visitor) override;
 
+        static std::shared_ptr<Handshake_message> deserialize(const json &j);
         static std::shared_ptr<Handshake_message>
-        deserialize(const std::string &message);
+        deserialize(wire::Reader &reader, int sender_rank, int target_rank);
         virtual json serialize_json() const;
+        virtual void serialize_payload(wire::Writer &writer) const;
     private:
         HandshakeStatus status;
-        json custom_data;
+        int uid;
+        std::vector<int> uids;
+        uint64_t request_id = 0;
+        uint64_t index = 0;
+        uint64_t size = 0;
+        uint64_t offset = 0;
+        std::string_view data;
+        std::shared_ptr<const void> data_owner;
     };
 }
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <mpi.h>
+
+namespace stats
+{
+    // HDR-style log-linear histogram of non-negative integer values (e.g.
+    // latencies in nanoseconds). Values below 2^PRECISION are counted
+    // exactly, larger ones fall into 2^PRECISION linear sub-buckets per
+    // power of two, so the relative error stays under 2^-PRECISION.
+    class Histogram
+    {
+    public:
+        static constexpr int PRECISION = 7;
+        static constexpr uint64_t SUB_BUCKETS = uint64_t(1) << PRECISION;
+        static constexpr size_t BUCKETS = (65 - PRECISION) * SUB_BUCKETS;
+
+        Histogram();
+
+        void record(uint64_t value);
+        void merge(const Histogram &other);
+        // Sums every rank's histogram of comm into the one of root.
+        void reduce(MPI_Comm comm, int root);
+        void clear();
+
+        uint64_t count() const { return total; }
+        uint64_t max() const { return max_value; }
+        // Smallest value at or above the fraction q of the recorded values,
+        // rounded up to its bucket.
+        uint64_t percentile(double q) const;
+
+        // Non-empty buckets as (bucket, count) pairs, a compact copy to send
+        // that from_buckets() turns back into the histogram.
+        std::vector<std::pair<uint64_t, uint64_t>> buckets() const;
+        static Histogram from_buckets(const std::vector<std::pair<uint64_t, uint64_t>> &buckets,
+                                      uint64_t max);
+
+    private:
+        static size_t bucket_of(uint64_t value);
+        static uint64_t highest_of(size_t bucket);
+
+        std::vector<uint64_t> counts;
+        uint64_t total;
+        uint64_t max_value;
+    };
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace raft
+{
+    // Bounded pool of threads running file operations off the event loop.
+    // Operations submitted with the same key run in submission order on the
+    // same worker, operations on different keys run in parallel. Finished
+    // operations wait in a completion queue until the event loop polls it,
+    // so their callbacks run on the event loop thread.
+    //
+    // Worker threads call MPI-IO, which needs MPI_THREAD_MULTIPLE: without
+    // it, or with no worker, operations run inline in submit().
+    class IoPool
+    {
+    public:
+        using Task = std::function<bool()>;
+        using Callback = std::function<void(bool success)>;
+
+        IoPool(int workers, size_t queue_capacity);
+        ~IoPool();
+
+        IoPool(const IoPool &) = delete;
+        IoPool &operator=(const IoPool &) = delete;
+
+        // False, and nothing is queued, when the worker of key already has
+        // queue_capacity operations waiting.
+        bool submit(size_t key, Task task, Callback done);
+        bool full(size_t key) const;
+
+        // Operations of a key all run on worker shard_of(key), among
+        // shards() of them (a single one when running inline).
+        size_t shards() const { return std::max<size_t>(workers.size(), 1); }
+        size_t shard_of(size_t key) const { return key % shards(); }
+
+        // Runs the callbacks of every finished operation, returns how many.
+        size_t poll();
+        bool has_completions() const { return ready.load() > 0; }
+        // Operations submitted whose callback did not run yet.
+        size_t pending() const { return submitted - polled; }
+
+        // Blocks until every submitted operation finished. Their callbacks
+        // still wait for poll().
+        void drain();
+        // Drops the callbacks of finished operations.
+        void discard();
+
+    private:
+        struct Job
+        {
+            Task task;
+            Callback done;
+            // Metrics::now() at submit().
+            uint64_t queued_at;
+        };
+
+        struct Worker
+        {
+            std::mutex mutex;
+            std::condition_variable wakeup;
+            std::deque<Job> jobs;
+            std::thread thread;
+        };
+
+        void run(Worker &worker);
+        void complete(Job &&job, bool success);
+
+        size_t capacity;
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::atomic<bool> stopping;
+
+        std::mutex completion_mutex;
+        std::condition_variable idle;
+        std::vector<std::pair<Callback, bool>> completions;
+        std::atomic<size_t> ready;
+        // Operations queued or running on a worker.
+        size_t running;
+
+        size_t submitted;
+        size_t polled;
+    };
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <iostream>
+
+namespace logging
+{
+    enum class Level
+    {
+        ERROR = 0,
+        WARN,
+        INFO,
+        DEBUG,
+    };
+
+    // Set once from the options, before any thread starts.
+    inline Level level = Level::INFO;
+
+    inline bool enabled(Level at)
+    {
+        return at <= level;
+    }
+}
+
+// Prints the << separated items on a line if the log level allows it. The
+// items are not evaluated otherwise, so a disabled line costs a branch.
+#define AFS_LOG(at, items)                                                    \
+    do                                                                        \
+    {                                                                         \
+        if (logging::enabled(logging::Level::at))                             \
+            std::cout << items << std::endl;                                  \
+    } while (0)
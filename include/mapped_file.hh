@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace raft
+{
+    // Read-only shared mapping of a whole file, READ answers are sent
+    // straight from its pages. Stored files only grow or get unlinked while
+    // mapped, never truncated, so the pages stay valid as long as the
+    // mapping lives.
+    class MappedFile
+    {
+    public:
+        // nullptr if path is empty or cannot be mapped.
+        static std::shared_ptr<MappedFile> map(const std::string &path);
+        ~MappedFile();
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        const char *data() const { return base; }
+        // Size of the file when it was mapped.
+        uint64_t size() const { return length; }
+
+        // Asks the kernel to read [offset, offset + size) in. A read that
+        // starts where the previous one ended also gets the pages after it
+        // read ahead. Not thread safe: called by the I/O worker owning the
+        // mapping.
+        void advise(uint64_t offset, uint64_t size);
+
+    private:
+        MappedFile(char *base, uint64_t length);
+
+        char *base;
+        uint64_t length;
+        // End of the last advised read.
+        uint64_t read_end;
+        bool sequential;
+    };
+}
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <memory>
+
 #include "nlohmann/json.hpp"
+#include "wire.hh"
 
 using json = nlohmann::json;
 
@@ -10,8 +13,52 @@ using json = nlohmann::json;
 //
 
 
+namespace repl
+{
+    class REPL_message;
+}
+
+namespace rpc
+{
+    class AppendEntries;
+    class AppendEntriesResponse;
+    class InstallSnapshot;
+    class InstallSnapshotResponse;
+    class FragmentRequest;
+    class FragmentResponse;
+    class RequestVote;
+    class RequestVoteResponse;
+    class TimeoutNow;
+    class LeaderNotice;
+}
+
 namespace message
 {
+    class Handshake_message;
+    class Client_message;
+
+    // Typed dispatch: Message::accept calls the overload matching the
+    // concrete class, so handlers read fields directly from the decoded
+    // object. Unhandled message kinds are ignored.
+    class Visitor
+    {
+    public:
+        virtual ~Visitor() = default;
+        virtual void visit(std::shared_ptr<repl::REPL_message>) {}
+        virtual void visit(std::shared_ptr<Handshake_message>) {}
+        virtual void visit(std::shared_ptr<Client_message>) {}
+        virtual void visit(std::shared_ptr<rpc::AppendEntries>) {}
+        virtual void visit(std::shared_ptr<rpc::AppendEntriesResponse>) {}
+        virtual void visit(std::shared_ptr<rpc::InstallSnapshot>) {}
+        virtual void visit(std::shared_ptr<rpc::InstallSnapshotResponse>) {}
+        virtual void visit(std::shared_ptr<rpc::FragmentRequest>) {}
+        virtual void visit(std::shared_ptr<rpc::FragmentResponse>) {}
+        virtual void visit(std::shared_ptr<rpc::RequestVote>) {}
+        virtual void visit(std::shared_ptr<rpc::RequestVoteResponse>) {}
+        virtual void visit(std::shared_ptr<rpc::TimeoutNow>) {}
+        virtual void visit(std::shared_ptr<rpc::LeaderNotice>) {}
+    };
+
     enum MessageType
     {
         REPL = 0,
@@ -20,21 +67,45 @@ namespace message
         CLIENT,
     };
 
-    class Message
+    class Message : public std::enable_shared_from_this<Message>
     {
     public:
         explicit Message(MessageType type, int sender_rank, int target_rank);
         virtual ~Message() = default;
         int get_target_rank() const { return target_rank; }
+        int get_sender_rank() const { return sender_rank; }
+        MessageType get_type() const { return type; }
 
+        // Encodes with the process wide wire format (binary unless the
+        // JSON debug mode was selected).
         std::string serialize() const;
+        // Appends one binary frame (header + payload) to the buffer. Without
+        // the trailer, the frame is complete once get_trailer() follows it.
+        void serialize_binary(std::string &buffer, bool with_trailer = true) const;
+
+        static std::shared_ptr<Message> deserialize(const char *data, size_t size);
         static std::shared_ptr<Message> deserialize(const std::string &message);
+        // Decodes the frame at the reader position and advances past it.
+        static std::shared_ptr<Message> deserialize_binary(wire::Reader &reader);
+
+        virtual void accept(Visitor &visitor) = 0;
+
         virtual json serialize_json() const = 0;
+        virtual void serialize_payload(wire::Writer &writer) const = 0;
+        // Bytes ending the binary payload that serialize_payload leaves
+        // out, so Server::send can hand them to MPI without a copy.
+        virtual std::string_view get_trailer() const { return {}; }
+
+        static void set_wire_format(wire::Format format);
+        static wire::Format get_wire_format();
 
     protected:
         const MessageType type;
         const int sender_rank;
         const int target_rank;
+
+    private:
+        static std::shared_ptr<Message> deserialize_json(const json &j);
     };
 }
 
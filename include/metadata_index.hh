@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace raft
+{
+    // State of the on-disk replica of a file on this server.
+    enum class ReplicaState : uint8_t
+    {
+        // An operation on the file is queued in the I/O pool.
+        PENDING = 0,
+        CLEAN,
+        // The last operation failed, the replica is not trusted.
+        FAILED,
+    };
+
+    struct FileMeta
+    {
+        int uid;
+        std::string name;
+        uint64_t size;
+        // Log index of the last operation applied to the file.
+        uint64_t version;
+        ReplicaState state;
+        // Created by UPLOAD_BEGIN and not committed yet: size counts the
+        // bytes received from the start, the file is not listed.
+        bool uploading;
+        // Stored in stripes shared by the group (see StripeLayout) rather
+        // than whole in each replica. created, the log index of the entry
+        // that created the file, tells its stripes from those of an older
+        // file with the same name.
+        bool striped;
+        // Stored as erasure code fragments, one per member of the group,
+        // found with created as well.
+        bool coded;
+        // Stored as a list of chunks in the ChunkStore of the server.
+        bool deduped;
+        // Stored in the SegmentStore of the server.
+        bool packed;
+        uint64_t created;
+    };
+
+    // Table of the files of a server, indexed by uid.
+    //
+    // Uids come from a free list of deleted uids, then from a counter
+    // stepping by uid_stride from first_uid (the uids a Raft group owns), so
+    // allocation is O(1) and every replica allocates the same uids as long
+    // as it applies the same operations from the same allocator state.
+    //
+    // Metadata lives in a dense vector, which LIST walks in one pass. An
+    // open addressing table with linear probing maps a uid to its position.
+    // Erasing moves the last entry into the hole and uses backward shift
+    // deletion, so there are no tombstones.
+    class MetadataIndex
+    {
+    public:
+        explicit MetadataIndex(int first_uid = 0, int uid_stride = 1);
+
+        // Allocates a uid for a new file.
+        FileMeta &create(std::string name);
+        // Adds a file with a known uid, when restoring a snapshot. The
+        // allocator state is restored separately.
+        FileMeta &insert(int uid, std::string name, uint64_t size);
+        FileMeta *find(int uid);
+        const FileMeta *find(int uid) const;
+        bool erase(int uid);
+        void clear();
+
+        size_t size() const { return files.size(); }
+        // Every file, in no particular order.
+        const std::vector<FileMeta> &entries() const { return files; }
+        // Uids of the committed files.
+        std::vector<int> list() const;
+
+        // Allocator state, part of snapshots.
+        int next_uid() const { return next; }
+        const std::vector<int> &free_uids() const { return free_list; }
+        void restore_allocator(int next_uid, std::vector<int> free_uids);
+
+    private:
+        struct Slot
+        {
+            int32_t uid;
+            // Position in files, EMPTY if the slot is free.
+            int32_t position;
+        };
+        static constexpr int32_t EMPTY = -1;
+
+        size_t home(int uid) const;
+        // Slot holding uid, or the free slot where it would go.
+        size_t probe(int uid) const;
+        void grow();
+
+        std::vector<FileMeta> files;
+        std::vector<Slot> slots;
+        size_t mask;
+
+        int first;
+        int stride;
+        int next;
+        std::vector<int> free_list;
+    };
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include "histogram.hh"
+#include "nlohmann/json.hpp"
+
+namespace stats
+{
+    // Messages counted apart: the message types, RPCs by their own type.
+    enum MessageKind
+    {
+        REPL_MESSAGE = 0,
+        HANDSHAKE_MESSAGE,
+        CLIENT_MESSAGE,
+        APPEND_ENTRIES_MESSAGE,
+        APPEND_ENTRIES_RESPONSE_MESSAGE,
+        INSTALL_SNAPSHOT_MESSAGE,
+        INSTALL_SNAPSHOT_RESPONSE_MESSAGE,
+        FRAGMENT_REQUEST_MESSAGE,
+        FRAGMENT_RESPONSE_MESSAGE,
+        REQUEST_VOTE_MESSAGE,
+        REQUEST_VOTE_RESPONSE_MESSAGE,
+        TIMEOUT_NOW_MESSAGE,
+        LEADER_NOTICE_MESSAGE,
+        MESSAGE_KINDS,
+    };
+
+    enum Counter
+    {
+        BYTES_RECEIVED = 0,
+        BYTES_SENT,
+        ELECTIONS,
+        COUNTERS,
+    };
+
+    // Latest values, set by the event loop.
+    enum Gauge
+    {
+        // Client requests waiting for the log.
+        MESSAGE_QUEUE = 0,
+        // File operations queued or running in the I/O pool.
+        IO_PENDING,
+        // Entries in the log not committed yet, and committed not applied.
+        COMMIT_LAG,
+        APPLY_LAG,
+        GAUGES,
+    };
+
+    // In nanoseconds.
+    enum Latency
+    {
+        SERIALIZE = 0,
+        DESERIALIZE,
+        // Time a file operation waited for its I/O worker, then ran.
+        IO_WAIT,
+        FILE_IO,
+        LATENCIES,
+    };
+
+    // Metrics of this rank. Counters and latencies are kept per thread, in
+    // a shard only that thread writes, and summed by snapshot(): recording
+    // takes no shared lock. Every rank is a process, so a single registry
+    // serves the whole rank.
+    class Metrics
+    {
+    public:
+        static Metrics &instance();
+
+        Metrics(const Metrics &) = delete;
+        Metrics &operator=(const Metrics &) = delete;
+
+        void count(Counter counter, uint64_t n = 1) { add(local().counters[counter], n); }
+        void received(MessageKind kind, uint64_t bytes);
+        void sent(MessageKind kind, uint64_t bytes);
+        void set(Gauge gauge, int64_t value) { gauges[gauge].store(value, std::memory_order_relaxed); }
+        void record(Latency latency, uint64_t nanoseconds);
+
+        // Every metric, the shards of all threads summed.
+        nlohmann::json snapshot() const;
+        // Prints the snapshots of several ranks: counters and latencies
+        // summed over them, gauges per rank.
+        static void print(std::ostream &out, const std::vector<nlohmann::json> &snapshots);
+
+        static const char *name_of(MessageKind kind);
+
+        static uint64_t now()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+
+    private:
+        Metrics() = default;
+
+        struct Shard
+        {
+            std::array<std::atomic<uint64_t>, MESSAGE_KINDS> received{};
+            std::array<std::atomic<uint64_t>, MESSAGE_KINDS> sent{};
+            std::array<std::atomic<uint64_t>, COUNTERS> counters{};
+            // Held by the thread recording and by snapshot().
+            std::mutex mutex;
+            std::array<Histogram, LATENCIES> latencies;
+        };
+
+        // Only the owner thread writes the value: no atomic read-modify-write.
+        static void add(std::atomic<uint64_t> &value, uint64_t n)
+        {
+            value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+        Shard &local();
+
+        mutable std::mutex shards_mutex;
+        // Shards outlive their thread, so the counts stay.
+        std::vector<std::unique_ptr<Shard>> shards;
+        std::array<std::atomic<int64_t>, GAUGES> gauges{};
+    };
+
+    inline Metrics &metrics()
+    {
+        return Metrics::instance();
+    }
+
+    // Records the time from its creation to its destruction.
+    class ScopedTimer
+    {
+    public:
+        explicit ScopedTimer(Latency latency)
+            : latency(latency)
+            , start(Metrics::now())
+        {}
+        ~ScopedTimer() { metrics().record(latency, Metrics::now() - start); }
+
+        ScopedTimer(const ScopedTimer &) = delete;
+        ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+    private:
+        Latency latency;
+        uint64_t start;
+    };
+}
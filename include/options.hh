@@ -0,0 +1,140 @@
+#pragma once
+
+#include <array>
+#include <string>
+
+#include "log.hh"
+#include "wire.hh"
+
+// Optional command line settings, passed after the positional
+// `nb_servers nb_clients` arguments as --name=value.
+struct Options
+{
+    enum class FsyncPolicy
+    {
+        ALWAYS = 0,
+        GROUP,
+        NONE,
+    };
+
+    enum class Payload
+    {
+        FIXED = 0,
+        UNIFORM,
+        EXPONENTIAL,
+    };
+
+    wire::Format wire_format = wire::Format::BINARY;
+    // Lines printed: per-message traces only at DEBUG.
+    logging::Level log_level = logging::Level::INFO;
+
+    // Each server keeps its replica of the files in data_dir/server_<rank>.
+    std::string data_dir = "afs_data";
+
+    // Replication: AppendEntries kept in flight per follower, entries packed
+    // in a single AppendEntries, and idle heartbeat period.
+    int max_inflight = 4;
+    int max_batch = 256;
+    int heartbeat_ms = 10;
+    // The leader takes up to client_batch queued client requests per event
+    // loop tick, those on the same file together, and writes the appends
+    // to a file committed in a row, as many, at once.
+    int client_batch = 64;
+    // Independent Raft groups the servers are split into, each owning a
+    // share of the files (see RoutingTable).
+    int groups = 1;
+    // The leader serves reads without a log round trip for lease_ms after
+    // a quorum acknowledged it, otherwise it confirms its leadership with a
+    // heartbeat round (ReadIndex). Must stay below the election timeout
+    // minus the clock drift; 0 always uses ReadIndex.
+    int lease_ms = 100;
+    // A follower that heard from no leader for a random time in
+    // [election_ms, 2 * election_ms) asks the group whether it would elect
+    // it (pre-vote), then runs the election. Members that heard from the
+    // leader within election_ms refuse, so it must exceed lease_ms and
+    // heartbeat_ms.
+    int election_ms = 150;
+
+    // Write-ahead log durability: fsync every entry, once per group of
+    // group_entries entries or group_us microseconds, or never.
+    FsyncPolicy fsync = FsyncPolicy::GROUP;
+    int group_entries = 64;
+    int group_us = 1000;
+    int segment_mb = 64;
+
+    // A snapshot is taken every snapshot_entries applied entries and sent
+    // to lagging followers in snapshot_chunk_kb chunks.
+    int snapshot_entries = 10000;
+    int snapshot_chunk_kb = 64;
+
+    // File I/O threads applying committed entries (0 applies them inline)
+    // and operations queued per thread before applying pauses.
+    int io_workers = 4;
+    int io_queue = 1024;
+    // Open file handles kept across appends, split between the I/O threads.
+    int file_cache = 64;
+    // Uploaded files are striped over the servers of their group in units
+    // of stripe_kb, each server storing every group size-th unit in
+    // data_dir/stripes_<group> (see StripeLayout). 0 replicates them whole.
+    int stripe_kb = 0;
+    // Uploaded files are Reed-Solomon coded instead, ec_data + ec_parity
+    // being the group size: each server stores one fragment of every chunk
+    // in data_dir/fragments_<rank>, and followers only receive theirs.
+    // ec_data must not exceed a quorum, so committed chunks can be rebuilt.
+    // 0 disables it, it takes precedence over stripe_kb.
+    int ec_data = 0;
+    int ec_parity = 0;
+    // Files created by LOAD are stored as content-defined chunks of about
+    // dedup_kb in data_dir/chunks_<rank>, each distinct chunk once (see
+    // ChunkStore), and followers are only sent the chunks they lack. 0
+    // stores them whole.
+    int dedup_kb = 0;
+    // Files created by LOAD with at most packed_kb are packed in segments
+    // of pack_segment_mb in data_dir/segments_<rank> (see SegmentStore)
+    // rather than stored in a file each. 0 disables it, it takes precedence
+    // over dedup_kb.
+    int packed_kb = 0;
+    int pack_segment_mb = 32;
+
+    // Every rank records spans of message handling and file I/O, the last
+    // trace_events of them, and they are written to the Chrome trace file
+    // trace at shutdown (see stats::Trace). Empty disables tracing.
+    std::string trace;
+    int trace_events = 1 << 18;
+
+    // Servers start without waiting for the REPL START command.
+    bool autostart = false;
+
+    // Client ranks run a load generator for duration_s seconds. Requests
+    // are picked with the weights of mix, indexed by message::ClientAction
+    // (LOAD, LIST, APPEND, DELETE, READ). Closed loop keeps outstanding requests
+    // in flight, a non-zero rate (requests/s per client) runs open loop,
+    // sending on schedule however many requests are in flight.
+    int duration_s = 10;
+    int outstanding = 8;
+    double rate = 0;
+    std::array<int, 5> mix = {5, 10, 80, 5, 0};
+    // Payload sizes of LOAD and APPEND: payload_min bytes (FIXED), uniform
+    // in [payload_min, payload_max] (UNIFORM) or exponential with mean
+    // payload_min and capped at payload_max (EXPONENTIAL).
+    Payload payload = Payload::FIXED;
+    int payload_min = 64;
+    int payload_max = 64;
+    int request_timeout_ms = 1000;
+    // Files larger than chunk_kb are uploaded, and read back, in chunks of
+    // chunk_kb with at most window chunks in flight per transfer.
+    int chunk_kb = 64;
+    int window = 8;
+    // Clients send LIST to a random server, with the index of their last
+    // write as read-your-writes token and staleness_ms as staleness bound.
+    bool follower_reads = false;
+    int staleness_ms = 0;
+    // Clients cache the files they read whole, and the file lists, in at
+    // most cache_mb (0: no cache). The leader breaks the callback promise
+    // of a cached copy when it changes, and a copy is trusted for at most
+    // callback_ms, in case the promise was lost with a leader.
+    int cache_mb = 0;
+    int callback_ms = 10000;
+
+    static Options parse(int argc, char *argv[], int first);
+};
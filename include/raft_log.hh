@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "chunk_store.hh"
+#include "client_message.hh"
+#include "wire.hh"
+
+namespace raft
+{
+    // One replicated client operation.
+    struct LogEntry
+    {
+        uint64_t term;
+        message::ClientAction action;
+        int uid;
+        std::string filename;
+        std::string content;
+        // Rank to answer once the entry is applied, -1 if nobody waits.
+        int client_rank;
+        uint64_t request_id;
+        // Range of UPLOAD_CHUNK and UPLOAD_COMMIT.
+        uint64_t offset;
+        uint64_t length;
+        // UPLOAD_CHUNK of an erasure-coded or striped file: WHOLE on the
+        // leader, which holds the whole chunk of length bytes, or the index
+        // of the member whose fragment or stripe units content holds on a
+        // follower. MISSING when the leader, elected after the chunk was
+        // logged, only holds its own part: the follower rebuilds its
+        // fragment from the others, its stripe units were written by the
+        // old leader.
+        int fragment;
+        // LOAD and APPEND of a deduplicated file: content cut in chunks.
+        // Those a follower stores already are sent without their bytes.
+        std::vector<ChunkRef> chunks;
+
+        static constexpr int PLAIN = -1;
+        static constexpr int WHOLE = -2;
+        static constexpr int MISSING = -3;
+
+        void serialize(wire::Writer &writer) const;
+        static LogEntry deserialize(wire::Reader &reader);
+        json serialize_json() const;
+        static LogEntry deserialize(const json &j);
+
+        size_t size() const
+        {
+            return filename.size() + content.size() + chunks.size() * sizeof(ChunkRef) + 32;
+        }
+        // Bytes the entry writes: its content, or its chunks.
+        uint64_t bytes() const;
+    };
+
+    using EntryPtr = std::shared_ptr<const LogEntry>;
+
+    // In-memory Raft log. Indexes start at 1. Entries up to start_index()
+    // were compacted into a snapshot, only their last term is kept.
+    class RaftLog
+    {
+    public:
+        RaftLog();
+
+        uint64_t start_index() const { return base_index; }
+        uint64_t last_index() const { return base_index + entries.size(); }
+        uint64_t last_term() const { return term_at(last_index()); }
+        // 0 for indexes outside the log (compacted or not written yet).
+        uint64_t term_at(uint64_t index) const;
+        const EntryPtr &at(uint64_t index) const { return entries[index - base_index - 1]; }
+
+        uint64_t append(EntryPtr entry);
+        // Removes every entry from index (included) to the end.
+        void truncate_from(uint64_t index);
+        // Entries starting at index, at most max_entries of them and about
+        // max_bytes of payload, but always at least one.
+        std::vector<EntryPtr> slice(uint64_t index, size_t max_entries, size_t max_bytes) const;
+
+        // Frees the content of the entry at index, which is kept elsewhere
+        // (the WAL): at() then returns it without. slice() still counts
+        // the bytes of the content.
+        void release(uint64_t index);
+        bool released(uint64_t index) const { return released_sizes.count(index) > 0; }
+
+        // Drops the entries up to index, now covered by a snapshot.
+        void compact(uint64_t index);
+        // Discards everything and restarts right after a snapshot.
+        void reset(uint64_t index, uint64_t term);
+
+    private:
+        std::deque<EntryPtr> entries;
+        // size() of the released entries, by index.
+        std::map<uint64_t, size_t> released_sizes;
+        uint64_t base_index;
+        uint64_t base_term;
+    };
+}
@@ -1,34 +1,409 @@
 #pragma once
 
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <optional>
 #include <queue>
+#include <set>
 
 #include "server.hh"
+#include "options.hh"
 #include "repl_message.hh"
+#include "client_message.hh"
+#include "handshake_message.hh"
+#include "rpc_message.hh"
+#include "wal.hh"
+#include "snapshot.hh"
+#include "io_pool.hh"
+#include "file_cache.hh"
+#include "metadata_index.hh"
+#include "routing.hh"
+#include "stripe_layout.hh"
+#include "erasure_code.hh"
+#include "chunk_store.hh"
+#include "segment_store.hh"
 
 namespace raft
 {
+using steady_time = std::chrono::steady_clock::time_point;
+
+// Leader side replication progress of one follower.
+struct Peer
+{
+    uint64_t next_index = 1;
+    uint64_t match_index = 0;
+    // AppendEntries or snapshot chunks sent and not answered yet.
+    int inflight = 0;
+    // Commit index carried by the last AppendEntries.
+    uint64_t sent_commit = 0;
+    steady_time last_sent;
+    steady_time last_response;
+    // Send time of the latest AppendEntries the follower answered in the
+    // current term: it followed this leader at least until then.
+    steady_time acked_sent;
+
+    // Set while the follower is behind the compacted log and receives the
+    // snapshot ending at snapshot_index instead of entries.
+    bool sending_snapshot = false;
+    uint64_t snapshot_index = 0;
+    uint64_t snapshot_offset = 0;
+    uint64_t snapshot_acked = 0;
+
+    // Entries up to this index go with the bytes of all their chunks: the
+    // follower lacked some sent by reference.
+    uint64_t whole_until = 0;
+};
+
+// A batch of client requests, those on the same file moved next to each
+// other so their appends commit in a row. A request only moves ahead of
+// requests of other clients: each client's requests stay in the order it
+// sent them, whatever their files.
+std::vector<std::shared_ptr<message::Client_message>>
+group_by_file(std::vector<std::shared_ptr<message::Client_message>> batch);
+
+// Leader: the commit index once each member, the leader included, stored
+// its log up to matches. Only an entry of the current term is committed by
+// counting its replicas, those of earlier terms are committed with it.
+uint64_t quorum_commit_index(RaftState &state, std::vector<uint64_t> matches);
+
+// Follower: how many of the entries sent after prev_index the log holds
+// already, or were compacted into a snapshot. The first one whose term
+// differs from the log's conflicts: the log is truncated from its index,
+// set in truncated (0 if nothing was).
+size_t skip_present_entries(RaftLog &log, uint64_t prev_index,
+                            const std::vector<EntryPtr> &entries, uint64_t &truncated);
+
+// Follower: index the leader retries from after the entry at prev_index
+// turned out to be of another term, the first one of that term.
+uint64_t conflict_retry_index(const RaftLog &log, uint64_t prev_index);
+
+// Member: whether it takes part in the election request, a vote or a
+// pre-vote, is about. Not in an older term, nor while it still hears from a
+// leader (leader_alive), unless the leader hands its leadership over.
+bool hears_campaign(RaftState &state, const rpc::RequestVote &request, bool leader_alive);
+// Member that hears the campaign, and adopted its term for a vote: whether
+// it grants request, to a candidate whose log is at least as up to date as
+// its own and, for a vote, if it did not vote for another one in the term.
+bool grants_vote(RaftState &state, const rpc::RequestVote &request);
+
 class RaftServer : public Server {
     public:
-      RaftServer(MPI_Comm com, int nb_servers);
-      
+      // group is the sub-communicator of the servers of this Raft group.
+      RaftServer(MPI_Comm com, MPI_Comm group, int nb_servers, const Options &options);
+      ~RaftServer() override;
+
       void on_message_callback(std::shared_ptr<message::Message> message) override;
-      
+
       void work() override;
+
+      std::chrono::steady_clock::time_point next_deadline() override;
+
+      void visit(std::shared_ptr<repl::REPL_message> message) override;
+      void visit(std::shared_ptr<message::Client_message> message) override;
+      void visit(std::shared_ptr<rpc::AppendEntries> message) override;
+      void visit(std::shared_ptr<rpc::AppendEntriesResponse> message) override;
+      void visit(std::shared_ptr<rpc::InstallSnapshot> message) override;
+      void visit(std::shared_ptr<rpc::InstallSnapshotResponse> message) override;
+      void visit(std::shared_ptr<rpc::FragmentRequest> message) override;
+      void visit(std::shared_ptr<rpc::FragmentResponse> message) override;
+      void visit(std::shared_ptr<rpc::RequestVote> message) override;
+      void visit(std::shared_ptr<rpc::RequestVoteResponse> message) override;
+      void visit(std::shared_ptr<rpc::TimeoutNow> message) override;
+      void visit(std::shared_ptr<rpc::LeaderNotice> message) override;
     private:
+        Options options;
+        RoutingTable routing;
+        // Raft group of this server in routing.
+        int group;
+        // Latest leader each group announced, with its term: requests about
+        // another group's files go there. Its first member until then.
+        std::vector<std::pair<uint64_t, int>> group_leaders;
         bool crashed;
         bool started;
         repl::ReplSpeed speed;
-        std::map<int, std::string> uids;
-        
-        std::queue<std::shared_ptr<message::Message>> message_queue;
-        
-        void on_receive_repl(std::shared_ptr<message::Message> message);
+        MetadataIndex files;
+        std::string storage_dir;
+
+        std::map<int, Peer> peers;
+
+        // Election this server runs: the pre-vote for term, then the vote
+        // itself, and the members that granted it, this server included.
+        struct Campaign
+        {
+            bool pre_vote;
+            uint64_t term;
+            bool transfer;
+            std::set<int> granted;
+        };
+        std::optional<Campaign> campaign;
+        // Leader: follower the leadership is handed over to, -1 if none,
+        // until transfer_deadline. New requests wait meanwhile.
+        int transfer_to;
+        steady_time transfer_deadline;
+        bool transfer_sent;
+        // Leader: a TimeoutNow went out, so another leader may be elected
+        // before the lease ends.
+        bool lease_revoked;
+        // Leader: an entry of its term committed, so it serves writes.
+        bool serving;
+
+        Wal wal;
+        // Successful AppendEntries answers held until the entries they
+        // acknowledge are durable: (leader, match index).
+        struct PendingAck
+        {
+            int leader;
+            uint64_t index;
+            uint64_t sent_at;
+        };
+        std::deque<PendingAck> pending_acks;
+        // Entries below this index were replayed from the WAL, their
+        // clients are not waiting anymore.
+        uint64_t reply_floor;
+        // The chunks of the entries up to this index were released from
+        // the log once applied: the WAL keeps them.
+        uint64_t released_until;
+
+        std::string snapshot_path;
+        SnapshotMeta snapshot;
+        // Snapshot being received from the leader.
+        uint64_t receiving_index;
+        uint64_t receiving_offset;
+
+        std::queue<std::shared_ptr<message::Client_message>> message_queue;
+
+        // Read-only requests (LIST, READ) waiting for the state machine to reach
+        // read_index and, on the leader without a lease, for a heartbeat
+        // round started after they arrived to confirm the leadership.
+        struct PendingRead
+        {
+            std::shared_ptr<message::Client_message> message;
+            uint64_t read_index;
+            steady_time received;
+        };
+        std::deque<PendingRead> pending_reads;
+        // Last index the log had when this server became leader: entries
+        // up to it may have been committed by a previous leader.
+        uint64_t read_floor;
+        // Last AppendEntries or snapshot chunk accepted from the leader,
+        // bounds the staleness of follower reads.
+        steady_time leader_contact;
+
+        // Runs the file operations of applied entries, one worker per file.
+        IoPool io;
+        // Open handles of each I/O worker, used only by that worker.
+        std::vector<std::unique_ptr<FileCache>> file_caches;
+        // Layout of striped files over the group, null unless
+        // options.stripe_kb is set. Their stripes live in stripe_dir, which
+        // every member of the group shares and recover() keeps.
+        std::unique_ptr<StripeLayout> stripes;
+        std::string stripe_dir;
+        // Position of this server in its group.
+        int member;
+
+        // Erasure code of uploaded files, null unless options.ec_data is
+        // set. Chunk c of a coded file is cut in fragments of
+        // fragment_size(chunk) bytes, member i stores fragment i at
+        // c * fragment_size(options.chunk_kb KiB) in its file of
+        // fragment_dir, which recover() keeps.
+        std::unique_ptr<ec::ReedSolomon> code;
+        std::string fragment_dir;
+        // Leader: the per-member fragments of the coded chunks in the log,
+        // by index, made once for every follower.
+        std::map<uint64_t, std::vector<EntryPtr>> fragment_entries;
+
+        using RebuildCallback =
+            std::function<void(bool success, const std::vector<std::string> &fragments)>;
+        // A chunk of a coded file rebuilt from the fragments of k members,
+        // for a degraded read or to repair a lost fragment.
+        struct Rebuild
+        {
+            std::vector<std::string> fragments;
+            std::vector<bool> present;
+            // Fragments asked for and not answered yet.
+            int waiting;
+            size_t size;
+            steady_time started;
+            RebuildCallback done;
+        };
+        std::map<uint64_t, Rebuild> rebuilds;
+        uint64_t next_rebuild;
+        // Chunks whose fragment this server lost, (uid, chunk), repaired in
+        // the background one at a time.
+        std::deque<std::pair<int, uint64_t>> repairs;
+        uint64_t repairing;
+        uint64_t repairing_chunk;
+        steady_time next_repair;
+        // Chunks of the deduplicated files, null unless options.dedup_kb is
+        // set. Kept by recover().
+        std::unique_ptr<ChunkStore> chunk_store;
+        // Segments of the packed files, null unless options.packed_kb is
+        // set. Rebuilt by recover() like the other files.
+        std::unique_ptr<SegmentStore> segments;
+
+        // Leader: clients caching each file, and the file list (uid -1).
+        std::unordered_map<int, std::vector<int>> callbacks;
+
+        // Fragment requests waiting for this server to apply their
+        // min_index, with the time they came.
+        std::deque<std::pair<std::shared_ptr<rpc::FragmentRequest>, steady_time>>
+            fragment_requests;
+
+        void on_receive_repl(std::shared_ptr<repl::REPL_message> message);
+        // Leader: hands the leadership over to the follower to, once it
+        // has every entry.
+        void transfer_leadership(std::shared_ptr<repl::REPL_message> message);
+        void tick_transfer(steady_time now);
+        // Publishes the queue depths and log lags to the metrics registry.
+        void update_gauges();
+
+        // Leader: takes up to options.client_batch queued requests, grouped
+        // with group_by_file().
+        std::vector<std::shared_ptr<message::Client_message>> take_client_batch();
+        void process_message_client(std::shared_ptr<message::Client_message> message);
+
+        // Rebuilds the log from the WAL. The file replicas are derived
+        // state: they are dropped and re-applied as entries commit.
+        void recover();
+        void send_durable_acks();
+
+        // Asks the group for its votes, first without changing term with
+        // pre_vote. A transfer campaign skips the pre-vote.
+        void start_campaign(bool pre_vote, bool transfer, steady_time now);
+        void become_leader();
+        // Adopts term, following leader (-1 if unknown): a leader steps down.
+        void follow(uint64_t term, int leader);
+        // Heard from the leader within the election timeout: the server
+        // does not help replacing it.
+        bool leader_alive(steady_time now);
+        // Leader heard from within two heartbeats, -1 otherwise: followers
+        // hold client requests rather than send them to a leader that may
+        // be gone.
+        int reachable_leader(steady_time now);
+
+        // Leader: sends AppendEntries to every follower with room in its
+        // pipeline, heartbeats idle ones.
+        void replicate();
+        void send_append_entries(int rank, Peer &peer, steady_time now);
+        // Frees the chunks of the applied UPLOAD_CHUNK entries that every
+        // follower up has, with their fragments: the log holds about a
+        // pipeline of them. A follower that comes back gets them from the
+        // WAL.
+        void release_entries(steady_time now);
+        void send_snapshot_chunk(int rank, Peer &peer, steady_time now);
+        void advance_commit_index();
+
+        // Latest time a quorum, this server included, is known to have
+        // followed this leader.
+        steady_time quorum_ack(steady_time now) const;
+        bool lease_valid(steady_time now) const;
+        // Answers the pending reads that are now safe, in arrival order.
+        void serve_reads();
+        // Follower: answers the relaxed reads it caught up with, forwards
+        // the others to the leader.
+        void serve_local_reads(steady_time now);
+        // False when the read has to wait for room in the I/O pool.
+        bool serve_read(const std::shared_ptr<message::Client_message> &message);
+        void reply_list(const std::shared_ptr<message::Client_message> &message);
+        // Leader: remembers that client caches uid, or the file list if uid
+        // is -1, and tells it when that changes at index.
+        void promise_callback(int uid, int client);
+        void break_callbacks(int uid, uint64_t index);
+        // Answers a READ from a mapping of the file made by the I/O pool,
+        // in chunks sent without copying the mapped bytes.
+        bool read_range(const std::shared_ptr<message::Client_message> &message);
+        // Answers with the pieces of a striped file this server stores. The
+        // leader first hands the range to the other members storing some.
+        bool read_stripes(const std::shared_ptr<message::Client_message> &message,
+                          const FileMeta &file, uint64_t offset, uint64_t length);
+        // Answers with the data fragments this server stores. The leader
+        // hands the range to the other data members, and rebuilds the
+        // fragments of those that are down.
+        bool read_coded(const std::shared_ptr<message::Client_message> &message,
+                        const FileMeta &file, uint64_t offset, uint64_t length);
+
+        // Leader: entry as sent to member, only its fragment of a coded chunk.
+        EntryPtr fragment_entry(uint64_t index, const EntryPtr &entry, int member);
+        // Leader: entry as sent to member, only its stripe units of a chunk
+        // of a striped file, back to back.
+        EntryPtr stripe_entry(const EntryPtr &entry, int member) const;
+        // Members whose stripe units of entry, a chunk of a striped file,
+        // this server writes: its own, and when it holds the chunk whole
+        // those of the members that did not get it, which a snapshot may
+        // skip. The leader knows who got it, an old leader replaying its
+        // log writes them all.
+        std::vector<int> stripe_writers(uint64_t index, const LogEntry &entry);
+        static bool write_units(MPI_File file, const StripeLayout &layout, const LogEntry &entry,
+                                const std::vector<int> &writers);
+        // Writes the stripe units of the chunks logged after applied that
+        // the snapshot meta skips: the leader left them to this server.
+        void write_skipped_stripes(uint64_t applied, const SnapshotMeta &meta);
+        // Reads this server's fragment of chunk of a coded file.
+        void read_fragment(const FileMeta &file, uint64_t chunk,
+                           std::function<void(bool success, std::string data)> done);
+        // Asks the other members for their fragment of chunk, once they
+        // applied min_index, and rebuilds the others from the first k.
+        void rebuild_chunk(const FileMeta &file, uint64_t chunk, uint64_t min_index,
+                           bool use_own, RebuildCallback done);
+        void add_fragment(uint64_t token, int fragment, bool success, std::string data);
+        void answer_fragment(const std::shared_ptr<rpc::FragmentRequest> &request);
+        // Answers the fragment requests this server caught up with, fails
+        // the rebuilds that waited too long, starts the next repair.
+        void tick_rebuilds(steady_time now);
+        // Queues the chunks missing from the fragment files after a restart,
+        // and every chunk of the coded files changed after applied, whose
+        // entries a snapshot skipped.
+        void find_lost_fragments(uint64_t applied);
+        // Whether this server's fragment of chunk is still to be repaired:
+        // its reads rebuild it instead.
+        bool fragment_lost(int uid, uint64_t chunk) const;
+        bool member_up(int rank, steady_time now) const;
+
+        // Adds the chunks of a LOAD or APPEND to the recipe of uid. The
+        // task writes those new to the store, listed in fresh.
+        IoPool::Task store_chunks(uint64_t index, const EntryPtr &entry, int uid,
+                                  std::vector<ChunkId> &fresh);
+        // Answers with the chunks of a deduplicated file, once they are
+        // written.
+        bool read_chunks(const std::shared_ptr<message::Client_message> &message,
+                         const FileMeta &file, uint64_t offset, uint64_t length);
+        // Leader: entry as sent to a follower, without the bytes of the
+        // chunks stored before index.
+        EntryPtr chunk_references(uint64_t index, const EntryPtr &entry) const;
+        // Chunks with their bytes in the log entries not applied yet.
+        std::unordered_set<ChunkId, ChunkIdHash> unapplied_chunks();
+
+        // Answers with the bytes of a packed file, read from its segments.
+        bool read_packed(const std::shared_ptr<message::Client_message> &message,
+                         const FileMeta &file, uint64_t offset, uint64_t length);
+        // Queues the copy of the files left in the most wasteful segment, as
+        // many as the I/O pool takes.
+        void compact_segments();
 
-        void on_receive_rpc(std::shared_ptr<message::Message> message);
+        void apply_committed();
+        // Committed APPENDs to the same plain file in a row from index, at
+        // most options.client_batch of them and about a chunk of bytes, 0
+        // if the entry at index is not one.
+        size_t append_run(uint64_t index);
+        // Applies them with a single write, and answers their clients together.
+        bool apply_appends(uint64_t first, size_t count);
+        // Snapshots the applied state and compacts the log behind it once
+        // snapshot_entries entries were applied since the last one.
+        void maybe_take_snapshot();
+        void install_snapshot(SnapshotMeta meta);
+        // Updates the uid table for a committed entry and hands its file
+        // operation to the I/O pool, which answers the client once done.
+        // False when the worker of that file is full: retry later.
+        bool apply(uint64_t index, const EntryPtr &entry);
+        std::string path_of(const std::string &filename) const;
+        std::string path_of(const FileMeta &file) const;
+        // Waits for the I/O pool and closes every cached handle.
+        void close_files();
 
-        void process_message_client(std::shared_ptr<message::Message> message);
-        
-        void broadcast_to_servers(std::shared_ptr<message::Message> message);
+        // Group owning the file a client request is about.
+        int owner_group(const message::Client_message &message) const;
   };
 
-} // namespace raft
\ No newline at end of file
+} // namespace raft
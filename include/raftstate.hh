@@ -3,9 +3,12 @@
 #include <chrono>
 #include <cstddef>
 #include <optional>
+#include <random>
+#include <vector>
 
 #include <mpi.h>
 #include "message.hh"
+#include "raft_log.hh"
 
 enum class Role
 {
@@ -14,26 +17,33 @@ enum class Role
     LEADER
 };
 
-using chrono_time = std::chrono::time_point<std::chrono::system_clock>;
-using std::chrono::microseconds;
-using namespace std::chrono_literals;
-
 class RaftState
 {
-
-    const microseconds INITIAL_TIMEOUT = 10000us;
+    using steady_time = std::chrono::steady_clock::time_point;
 
 private:
     Role role;
-    size_t clock;
     int leader_uid;
 
-    chrono_time last_checked;
-    microseconds timeout;
     int nb_states;
     MPI_Comm comm;
     
     int nb_servers;
+    // Ranks of the servers of this Raft group, in comm.
+    std::vector<int> members;
+
+    uint64_t term;
+    // Member this server voted for in term, -1 if none.
+    int voted_for;
+    uint64_t commit_index;
+    uint64_t last_applied;
+    raft::RaftLog log;
+
+    // Election timeouts are drawn in [election_timeout, 2 * election_timeout)
+    // so that members rarely time out together.
+    std::chrono::milliseconds election_timeout;
+    steady_time election_deadline;
+    std::minstd_rand rng;
 
 protected:
     int uid;
@@ -43,7 +53,7 @@ public:
 
     inline bool is_leader()
     {
-        return leader_uid == uid;
+        return role == Role::LEADER;
     }
     
     inline int get_rank()
@@ -61,10 +71,89 @@ public:
         return comm;
     }
 
-    inline int get_nb_servers()
+    inline int get_nb_servers() const
     {
         return nb_servers;
     }
 
-    void update();
+    inline const std::vector<int> &get_members() const
+    {
+        return members;
+    }
+
+    // -1 while no leader is known in the current term.
+    inline int get_leader()
+    {
+        return leader_uid;
+    }
+
+    inline uint64_t get_term()
+    {
+        return term;
+    }
+
+    inline int get_voted_for()
+    {
+        return voted_for;
+    }
+
+    inline raft::RaftLog &get_log()
+    {
+        return log;
+    }
+
+    inline uint64_t get_commit_index()
+    {
+        return commit_index;
+    }
+
+    inline void set_commit_index(uint64_t index)
+    {
+        commit_index = index;
+    }
+
+    inline uint64_t get_last_applied()
+    {
+        return last_applied;
+    }
+
+    inline void set_last_applied(uint64_t index)
+    {
+        last_applied = index;
+    }
+
+    // Number of servers (leader included) needed for a majority.
+    inline int get_quorum() const
+    {
+        return members.size() / 2 + 1;
+    }
+
+    // Restricts the Raft group to the ranks of group_comm, a sub-communicator
+    // of comm.
+    void set_group(MPI_Comm group_comm);
+
+    // Drops the volatile state, as after a process restart: the server
+    // follows no one until restore() or bootstrap().
+    void restart();
+    // Term and vote saved before the restart.
+    void restore(uint64_t saved_term, int saved_vote);
+    // A group that never ran has no election: its first member leads
+    // term 1, as if every member voted for it.
+    void bootstrap();
+
+    // Adopts a newer term (or the current one) announced by leader, -1 if
+    // unknown. A newer term clears the vote.
+    void follow(uint64_t new_term, int leader);
+    // Starts an election in the next term, voting for itself.
+    void become_candidate();
+    void become_leader();
+    void vote(int candidate);
+
+    void set_election_timeout(std::chrono::milliseconds timeout);
+    // Draws the next election deadline from now.
+    void reset_election_timer(steady_time now);
+    inline steady_time get_election_deadline() const
+    {
+        return election_deadline;
+    }
 };
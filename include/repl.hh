@@ -1,8 +1,10 @@
 #pragma once
 #include "repl_message.hh"
+#include "handshake_message.hh"
 #include "server.hh"
 
 #include <mpi.h>
+#include <vector>
 
 namespace repl
 {
@@ -13,10 +15,19 @@ namespace repl
 
         void work() override;
 
+        std::chrono::steady_clock::time_point next_deadline() override;
+
         void on_message_callback(std::shared_ptr<message::Message> message) override;
 
+        void visit(std::shared_ptr<message::Handshake_message> message) override;
+
     private:
         std::shared_ptr<REPL_message> process_message(std::string input);
+        // Asks one server, or all of them, for their metrics.
+        bool request_stats();
         bool running;
+        // Metrics answers still expected, and those received.
+        int awaiting_stats;
+        std::vector<json> stats_replies;
     };
 }
\ No newline at end of file
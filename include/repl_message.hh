@@ -10,6 +10,13 @@ enum ReplType {
   CRASH = 0,
   SPEED,
   START,
+  RECOVER,
+  // The server answers with the snapshot of its metrics, as JSON in the
+  // data of a handshake.
+  STATS,
+  // Sent to a follower, which hands it to its leader: the leader makes
+  // that follower the next leader.
+  TRANSFER,
 };
 
 
@@ -24,11 +31,18 @@ public:
   explicit REPL_message(ReplType type, int target_rank, int sender_rank);
   REPL_message(int target_rank, int sender_rank, ReplSpeed speed);
 
-  static std::shared_ptr<REPL_message> deserialize(const std::string &message);
+  ReplType get_repl_type() const { return repl_type; }
+  ReplSpeed get_speed() const { return speed; }
+
+  void accept(Visitor &visitor) override;
+
+  static std::shared_ptr<REPL_message> deserialize(const json &j);
+  static std::shared_ptr<REPL_message> deserialize(wire::Reader &reader, int sender_rank, int target_rank);
   virtual json serialize_json() const;
+  virtual void serialize_payload(wire::Writer &writer) const;
 
 private:
   ReplType repl_type;
   ReplSpeed speed;
 };
-} // namespace repl
\ No newline at end of file
+} // namespace repl
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace raft
+{
+    // Static map of the file namespace onto independent Raft groups.
+    //
+    // Server ranks 1..nb_servers are split into `groups` groups of
+    // consecutive ranks. Group g owns the uids equal to g modulo groups, and
+    // a new file goes to the group its name hashes to. Every rank builds the
+    // same table from the command line, so clients route without asking.
+    class RoutingTable
+    {
+    public:
+        RoutingTable(int nb_servers, int groups);
+
+        int groups() const { return group_members.size(); }
+        // -1 for ranks that are not servers.
+        int group_of_rank(int rank) const;
+        int group_of_uid(int uid) const { return uid % groups(); }
+        int group_of_name(const std::string &filename) const;
+        // World ranks of the servers of group, the first one leads it at
+        // startup.
+        const std::vector<int> &members(int group) const { return group_members[group]; }
+
+    private:
+        std::vector<std::vector<int>> group_members;
+    };
+}
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "message.hh"
+#include "raft_log.hh"
+
+using namespace message;
+
+namespace rpc {
+enum RpcType {
+  APPEND_ENTRIES = 0,
+  APPEND_ENTRIES_RESPONSE,
+  INSTALL_SNAPSHOT,
+  INSTALL_SNAPSHOT_RESPONSE,
+  FRAGMENT_REQUEST,
+  FRAGMENT_RESPONSE,
+  REQUEST_VOTE,
+  REQUEST_VOTE_RESPONSE,
+  TIMEOUT_NOW,
+  LEADER_NOTICE,
+};
+
+// Common part of every Raft RPC: its kind and the sender's term.
+class RPC_message : public Message {
+public:
+  RPC_message(RpcType rpc_type, int target_rank, int sender_rank, uint64_t term);
+
+  RpcType get_rpc_type() const { return rpc_type; }
+  uint64_t get_term() const { return term; }
+
+  static std::shared_ptr<RPC_message> deserialize(const json &j);
+  static std::shared_ptr<RPC_message> deserialize(wire::Reader &reader, int sender_rank, int target_rank);
+  json serialize_json() const override;
+  void serialize_payload(wire::Writer &writer) const override;
+
+protected:
+  virtual void serialize_rpc_json(json &data) const = 0;
+  virtual void serialize_rpc_payload(wire::Writer &writer) const = 0;
+
+  RpcType rpc_type;
+  uint64_t term;
+};
+
+class AppendEntries : public RPC_message {
+public:
+  AppendEntries(int target_rank, int sender_rank, uint64_t term,
+                uint64_t prev_log_index, uint64_t prev_log_term,
+                uint64_t leader_commit, std::vector<raft::EntryPtr> entries,
+                uint64_t sent_at);
+
+  uint64_t get_prev_log_index() const { return prev_log_index; }
+  uint64_t get_prev_log_term() const { return prev_log_term; }
+  uint64_t get_leader_commit() const { return leader_commit; }
+  const std::vector<raft::EntryPtr> &get_entries() const { return entries; }
+  // Leader clock when sent, echoed in the response: meaningful to the
+  // leader only.
+  uint64_t get_sent_at() const { return sent_at; }
+
+  void accept(Visitor &visitor) override;
+
+  static std::shared_ptr<AppendEntries> deserialize(const json &j, uint64_t term);
+  static std::shared_ptr<AppendEntries> deserialize(wire::Reader &reader, int sender_rank,
+                                                    int target_rank, uint64_t term);
+
+protected:
+  void serialize_rpc_json(json &data) const override;
+  void serialize_rpc_payload(wire::Writer &writer) const override;
+
+private:
+  uint64_t prev_log_index;
+  uint64_t prev_log_term;
+  uint64_t leader_commit;
+  std::vector<raft::EntryPtr> entries;
+  uint64_t sent_at;
+};
+
+class AppendEntriesResponse : public RPC_message {
+public:
+  // On success match_index is the last index known to match the leader,
+  // on failure it is the index the leader should retry from. whole asks
+  // for the entries from there with the bytes of all their chunks: the
+  // follower lacks some sent by reference.
+  AppendEntriesResponse(int target_rank, int sender_rank, uint64_t term,
+                        bool success, uint64_t match_index, uint64_t sent_at,
+                        bool whole = false);
+
+  bool get_success() const { return success; }
+  uint64_t get_match_index() const { return match_index; }
+  bool get_whole() const { return whole; }
+  // sent_at of the AppendEntries answered.
+  uint64_t get_sent_at() const { return sent_at; }
+
+  void accept(Visitor &visitor) override;
+
+  static std::shared_ptr<AppendEntriesResponse> deserialize(const json &j, uint64_t term);
+  static std::shared_ptr<AppendEntriesResponse> deserialize(wire::Reader &reader, int sender_rank,
+                                                            int target_rank, uint64_t term);
+
+protected:
+  void serialize_rpc_json(json &data) const override;
+  void serialize_rpc_payload(wire::Writer &writer) const override;
+
+private:
+  bool success;
+  uint64_t match_index;
+  uint64_t sent_at;
+  bool whole;
+};
+// One fixed-size chunk of the leader's snapshot file.
+class InstallSnapshot : public RPC_message {
+public:
+  InstallSnapshot(int target_rank, int sender_rank, uint64_t term,
+                  uint64_t last_index, uint64_t last_term, uint64_t offset,
+                  std::string data, bool done);
+
+  uint64_t get_last_index() const { return last_index; }
+  uint64_t get_last_term() const { return last_term; }
+  uint64_t get_offset() const { return offset; }
+  const std::string &get_data() const { return data; }
+  bool get_done() const { return done; }
+
+  void accept(Visitor &visitor) override;
+
+  static std::shared_ptr<InstallSnapshot> deserialize(const json &j, uint64_t term);
+  static std::shared_ptr<InstallSnapshot> deserialize(wire::Reader &reader, int sender_rank,
+                                                      int target_rank, uint64_t term);
+
+protected:
+  void serialize_rpc_json(json &data) const override;
+  void serialize_rpc_payload(wire::Writer &writer) const override;
+
+private:
+  uint64_t last_index;
+  uint64_t last_term;
+  uint64_t offset;
+  std::string data;
+  bool done;
+};
+
+class InstallSnapshotResponse : public RPC_message {
+public:
+  // next_offset is the first byte the follower is missing, done is set
+  // once the snapshot is installed.
+  InstallSnapshotResponse(int target_rank, int sender_rank, uint64_t term,
+                          uint64_t last_index, uint64_t next_offset, bool done);
+
+  uint64_t get_last_index() const { return last_index; }
+  uint64_t get_next_offset() const { return next_offset; }
+  bool get_done() const { return done; }
+
+  void accept(Visitor &visitor) override;
+
+  static std::shared_ptr<InstallSnapshotResponse> deserialize(const json &j, uint64_t term);
+  static std::shared_ptr<InstallSnapshotResponse> deserialize(wire::Reader &reader, int sender_rank,
+                                                              int target_rank, uint64_t term);
+
+protected:
+  void serialize_rpc_json(json &data) const override;
+  void serialize_rpc_payload(wire::Writer &writer) const override;
+
+private:
+  uint64_t last_index;
+  uint64_t next_offset;
+  bool done;
+};
+// Asks another member of the group for its fragment of one chunk of an
+// erasure-coded file, to rebuild a missing fragment from k of them.
+class FragmentRequest : public RPC_message {
+public:
+  // created tells the file from an older one with the same uid. The
+  // member answers once it applied min_index, token is echoed back.
+  FragmentRequest(int target_rank, int sender_rank, uint64_t term, int uid,
+                  uint64_t created, uint64_t chunk, uint64_t min_index, uint64_t token);
+
+  int get_uid() const { return uid; }
+  uint64_t get_created() const { return created; }
+  uint64_t get_chunk() const { return chunk; }
+  uint64_t get_min_index() const { return min_index; }
+  uint64_t get_token() const { return token; }
+
+  void accept(Visitor &visitor) override;
+
+  static std::shared_ptr<FragmentRequest> deserialize(const json &j, uint64_t term);
+  static std::shared_ptr<FragmentRequest> deserialize(wire::Reader &reader, int sender_rank,
+                                                      int target_rank, uint64_t term);
+
+protected:
+  void serialize_rpc_json(json &data) const override;
+  void serialize_rpc_payload(wire::Writer &writer) const override;
+
+private:
+  int uid;
+  uint64_t created;
+  uint64_t chunk;
+  uint64_t min_index;
+  uint64_t token;
+};
+
+class FragmentResponse : public RPC_message {
+public:
+  // Without success the member has no valid fragment to give.
+  FragmentResponse(int target_rank, int sender_rank, uint64_t term, uint64_t token,
+                   int fragment, bool success, std::string data);
+
+  uint64_t get_token() const { return token; }
+  int get_fragment() const { return fragment; }
+  bool get_success() const { return success; }
+  const std::string &get_data() const { return data; }
+
+  void accept(Visitor &visitor) override;
+
+  static std::shared_ptr<FragmentResponse> deserialize(const json &j, uint64_t term);
+  static std::shared_ptr<FragmentResponse> deserialize(wire::Reader &reader, int sender_rank,
+                                                       int target_rank, uint64_t term);
+
+protected:
+  void serialize_rpc_json(json &data) const override;
+  void serialize_rpc_payload(wire::Writer &writer) const override;
+
+private:
+  uint64_t token;
+  int fragment;
+  bool success;
+  std::string data;
+};
+// Asks a member for its vote in term. With pre_vote it only asks whether
+// the member would grant it, neither of them changing term: a server cut
+// off from the group does not raise the term of the others when it comes
+// back. transfer is set by the target of a leadership transfer, which the
+// members elect even while they still hear from the leader.
+class RequestVote : public RPC_message {
+public:
+  RequestVote(int target_rank, int sender_rank, uint64_t term,
+              uint64_t last_log_index, uint64_t last_log_term, bool pre_vote,
+              bool transfer);
+
+  uint64_t get_last_log_index() const { return last_log_index; }
+  uint64_t get_last_log_term() const { return last_log_term; }
+  bool get_pre_vote() const { return pre_vote; }
+  bool get_transfer() const { return transfer; }
+
+  void accept(Visitor &visitor) override;
+
+  static std::shared_ptr<RequestVote> deserialize(const json &j, uint64_t term);
+  static std::shared_ptr<RequestVote> deserialize(wire::Reader &reader, int sender_rank,
+                                                  int target_rank, uint64_t term);
+
+protected:
+  void serialize_rpc_json(json &data) const override;
+  void serialize_rpc_payload(wire::Writer &writer) const override;
+
+private:
+  uint64_t last_log_index;
+  uint64_t last_log_term;
+  bool pre_vote;
+  bool transfer;
+};
+
+class RequestVoteResponse : public RPC_message {
+public:
+  // A granted pre-vote carries the term asked for, any other answer the
+  // member's own term.
+  RequestVoteResponse(int target_rank, int sender_rank, uint64_t term, bool granted,
+                      bool pre_vote);
+
+  bool get_granted() const { return granted; }
+  bool get_pre_vote() const { return pre_vote; }
+
+  void accept(Visitor &visitor) override;
+
+  static std::shared_ptr<RequestVoteResponse> deserialize(const json &j, uint64_t term);
+  static std::shared_ptr<RequestVoteResponse> deserialize(wire::Reader &reader, int sender_rank,
+                                                          int target_rank, uint64_t term);
+
+protected:
+  void serialize_rpc_json(json &data) const override;
+  void serialize_rpc_payload(wire::Writer &writer) const override;
+
+private:
+  bool granted;
+  bool pre_vote;
+};
+
+// Sent by a leader handing its leadership over to a follower whose log
+// caught up: the follower starts an election at once, without pre-vote.
+class TimeoutNow : public RPC_message {
+public:
+  TimeoutNow(int target_rank, int sender_rank, uint64_t term);
+
+  void accept(Visitor &visitor) override;
+
+  static std::shared_ptr<TimeoutNow> deserialize(const json &j, uint64_t term);
+  static std::shared_ptr<TimeoutNow> deserialize(wire::Reader &reader, int sender_rank,
+                                                 int target_rank, uint64_t term);
+
+protected:
+  void serialize_rpc_json(json &) const override {}
+  void serialize_rpc_payload(wire::Writer &) const override {}
+};
+
+// Sent by a new leader to the servers of the other groups, which forward
+// the requests about its group's files to it.
+class LeaderNotice : public RPC_message {
+public:
+  LeaderNotice(int target_rank, int sender_rank, uint64_t term);
+
+  void accept(Visitor &visitor) override;
+
+  static std::shared_ptr<LeaderNotice> deserialize(const json &j, uint64_t term);
+  static std::shared_ptr<LeaderNotice> deserialize(wire::Reader &reader, int sender_rank,
+                                                   int target_rank, uint64_t term);
+
+protected:
+  void serialize_rpc_json(json &) const override {}
+  void serialize_rpc_payload(wire::Writer &) const override {}
+};
+} // namespace rpc
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <mpi.h>
+
+namespace raft
+{
+    // A segment file of a SegmentStore, open for reading and writing. It is
+    // closed once the store and every queued operation dropped it, so a
+    // compacted segment can be unlinked while reads of it still wait.
+    struct Segment
+    {
+        Segment(uint64_t id, size_t stream, std::string path);
+        ~Segment();
+
+        Segment(const Segment &) = delete;
+        Segment &operator=(const Segment &) = delete;
+
+        uint64_t id;
+        size_t stream;
+        std::string path;
+        MPI_File file;
+        // Bytes handed out, and those still part of a file.
+        uint64_t size;
+        uint64_t live;
+        // Whether new bytes still go to the end of it.
+        bool open;
+        // Files with bytes in it, kept by the store on the event loop.
+        std::unordered_set<int> files;
+    };
+
+    // Bytes [offset, offset + size) of a segment.
+    struct Extent
+    {
+        std::shared_ptr<Segment> segment;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    // Log-structured store of the small files of a server (packed files):
+    // their content and that of their appends go to the end of large
+    // segment files of dir instead of a file each, and an index maps every
+    // uid to its extents. Creating or deleting a packed file costs no
+    // metadata operation on the file system.
+    //
+    // Each stream has its own open segment. The files of a stream are those
+    // of one I/O worker (stream_of(name) is IoPool::shard_of() for the key
+    // of the file), so a segment is only ever read or written by one thread.
+    //
+    // Deleting a file only makes its extents dead space, a tombstone in the
+    // index. Closed segments left mostly dead are compacted: the files still
+    // in them are rewritten, each in a single extent, at the end of their
+    // stream, and the segment goes once nothing lives in it.
+    class SegmentStore
+    {
+    public:
+        SegmentStore(std::string dir, size_t streams, uint64_t segment_size);
+
+        // Deletes every segment and forgets every file.
+        void reset();
+        size_t stream_of(const std::string &name) const;
+
+        // Reserves size bytes at the end of the open segment of stream for
+        // the next bytes of uid, opening a new segment when it is full.
+        Extent append(int uid, size_t stream, uint64_t size);
+        const std::vector<Extent> &extents(int uid) const;
+        // Extents of [offset, offset + length) of uid.
+        std::vector<Extent> slice(int uid, uint64_t offset, uint64_t length) const;
+        void erase(int uid);
+
+        // The closed segment with the fewest live bytes, if they are under
+        // half of it, else nullptr.
+        std::shared_ptr<Segment> victim() const;
+        // Files with bytes in segment.
+        std::vector<int> files_in(const Segment &segment) const
+        {
+            return std::vector<int>(segment.files.begin(), segment.files.end());
+        }
+        // Gives uid a single extent at the end of stream, in place of the
+        // ones returned: its bytes must be copied over.
+        std::vector<Extent> relocate(int uid, size_t stream);
+
+        static bool write(const Extent &extent, const char *data);
+        // Reads extents back to back into buffer.
+        static bool read(const std::vector<Extent> &extents, char *buffer);
+
+        uint64_t live_bytes() const { return live; }
+        uint64_t stored_bytes() const { return stored; }
+        size_t segment_count() const { return segments.size(); }
+
+    private:
+        // Counts the bytes of extent dead, dropping its segment if closed and
+        // empty.
+        void release(const Extent &extent);
+        void drop(const std::shared_ptr<Segment> &segment);
+
+        std::string dir;
+        size_t streams;
+        uint64_t segment_size;
+        uint64_t next_id;
+        std::vector<std::shared_ptr<Segment>> open_segments;
+        std::map<uint64_t, std::shared_ptr<Segment>> segments;
+        std::unordered_map<int, std::vector<Extent>> files;
+        uint64_t live;
+        uint64_t stored;
+    };
+}
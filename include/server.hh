@@ -1,23 +1,108 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <vector>
+
 #include "raftstate.hh"
 
-class Server {
+class Server : public message::Visitor {
     
 public:
+    // Messages up to RECV_SLOT_SIZE bytes land in pre-posted persistent
+    // receives, bigger ones are sent with TAG_LARGE and probed for. MPI
+    // only orders messages of the same tag: every MPI message starts with
+    // a per-destination sequence number, restoring the order per sender.
+    static constexpr int TAG_SMALL = 0;
+    static constexpr int TAG_LARGE = 1;
+    static constexpr int RECV_SLOTS = 16;
+    static constexpr int RECV_SLOT_SIZE = 256 << 10;
+    // Message trailers from this size on are sent in place, gathered with
+    // the frame by a derived datatype, instead of copied into the batch.
+    static constexpr size_t ZERO_COPY_MIN = 4 << 10;
+    static constexpr size_t SEQUENCE_BYTES = sizeof(uint64_t);
+
     Server(MPI_Comm com, int nb_servers);
+    virtual ~Server();
+
+    Server(const Server &) = delete;
+    Server &operator=(const Server &) = delete;
 
-    std::shared_ptr<message::Message> listen();
+    // Hands every message already received to on_message_callback,
+    // flushes what the callbacks sent and returns how many there were.
+    int poll();
 
+    // Queues the message for target_rank. Binary frames headed to the same
+    // rank are coalesced into one MPI message until flush(), except those
+    // with a large trailer, sent at once in their own MPI message.
     void send(int target_rank, std::shared_ptr<message::Message> message);
+    // Starts a non-blocking send for every queued batch.
+    void flush();
 
     virtual void on_message_callback(std::shared_ptr<message::Message> message) = 0;
 
+    // Runs the event loop until stop() is called.
     void run();
+    // Makes run() return on SIGINT or SIGTERM instead of dying, so that the
+    // rank shuts down cleanly, e.g. to write its trace.
+    static void stop_on_signals();
     
     virtual void work() = 0;
 
+    // When work() has something to do next (timer, pending queue) even if
+    // no message arrives.
+    virtual std::chrono::steady_clock::time_point next_deadline();
+
 protected:
 RaftState state;
 
+    void stop() { stopping = true; }
+
+private:
+    // Waits for messages until the deadline, sleeping with an exponential
+    // backoff while idle, and returns as soon as some were handled.
+    void progress(std::chrono::steady_clock::time_point deadline);
+    // Delivers the MPI message of source numbered sequence, or keeps it
+    // until those before it were delivered.
+    void receive(int source, const char *data, int size);
+    void deliver(const char *data, int size);
+    // Hands a message of bytes bytes to on_message_callback.
+    void dispatch(std::shared_ptr<message::Message> message, size_t bytes);
+
+    std::vector<std::vector<char>> recv_buffers;
+    std::vector<MPI_Request> recv_requests;
+    // Order in which each slot was (re)posted: incoming messages match
+    // the slots in that order.
+    std::vector<uint64_t> recv_posted;
+    uint64_t next_post;
+    bool stopping;
+
+    std::vector<int> completed;
+    std::vector<MPI_Status> completed_status;
+    // Sequence number of the next MPI message to and from each rank, and
+    // those received ahead of it.
+    std::vector<uint64_t> send_sequence;
+    std::vector<uint64_t> receive_sequence;
+    std::vector<std::map<uint64_t, std::vector<char>>> early;
+
+    // Takes the content of buffer (left empty), whose first SEQUENCE_BYTES
+    // are reserved for the sequence number, and sends it with MPI_Isend,
+    // followed by the trailer of message, which stays alive until the send
+    // completes.
+    void post_send(int target_rank, int tag, std::string &buffer,
+                   std::shared_ptr<message::Message> message = nullptr);
+    // Recycles the request slots of completed sends.
+    void complete_sends();
+
+    // Frames waiting to be sent, per destination rank.
+    std::vector<std::string> outbox;
+    std::vector<int> dirty_outboxes;
+    // Pool of in-flight sends: each slot owns its buffer until the
+    // request completes, free slots keep their capacity for reuse.
+    std::vector<std::string> send_buffers;
+    std::vector<std::shared_ptr<message::Message>> send_messages;
+    std::vector<MPI_Request> send_requests;
+    std::vector<int> free_sends;
+    std::vector<int> completed_sends;
 };
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+namespace raft
+{
+    using Sha256Digest = std::array<uint8_t, 32>;
+
+    // Whether the CPU has the SHA extensions, which hash a block in a few
+    // dozen instructions instead of the 64 scalar rounds.
+    bool sha_extensions();
+
+    // SHA-256 (FIPS 180-4) of data, with the SHA extensions if asked and
+    // supported.
+    Sha256Digest sha256(std::string_view data, bool accelerated = sha_extensions());
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "chunk_store.hh"
+#include "metadata_index.hh"
+#include "segment_store.hh"
+
+namespace raft
+{
+    // Point in the log a snapshot covers.
+    struct SnapshotMeta
+    {
+        uint64_t last_index;
+        uint64_t last_term;
+    };
+
+    // A snapshot is a single file holding the metadata index and the
+    // content of every file, so it can be shipped to a follower as an opaque
+    // byte stream:
+    //   u32 magic | u32 version | u64 last index | u64 last term | u32 count
+    //   count x (i32 uid | u32 name length | name | u64 size | u8 flags
+    //            | [u64 created | u64 version] | [u32 chunks | chunks x (32 bytes id | u32)]
+    //            | content)
+    //   u32 chunk count | chunk count x (32 bytes id | u32 size | bytes)
+    //   i32 next uid | u32 free count | free count x i32 free uid
+    // flags has UPLOADING, STRIPED, CODED, DEDUPED and PACKED bits. Striped
+    // and coded files have their created and last changed indexes and no
+    // content: their stripes and fragments stay where the group stores
+    // them, a member installing the snapshot repairs those it missed.
+    // Deduplicated files
+    // have their chunk list, and every chunk they reference follows the
+    // files. Packed files have their content, written back to the segments.
+    class Snapshot
+    {
+    public:
+        // Writes path + ".tmp", syncs it and renames it over path.
+        static void save(const std::string &path, SnapshotMeta meta,
+                         const MetadataIndex &files,
+                         const std::string &storage_dir,
+                         const ChunkStore *chunks,
+                         const SegmentStore *segments);
+
+        // Fills files and recreates their content in storage_dir, the
+        // chunks missing from chunks, which was reloaded, and the packed
+        // files in segments, which was reset.
+        static std::optional<SnapshotMeta> load(const std::string &path,
+                                                MetadataIndex &files,
+                                                const std::string &storage_dir,
+                                                ChunkStore *chunks,
+                                                SegmentStore *segments);
+
+        static std::optional<SnapshotMeta> read_meta(const std::string &path);
+        static uint64_t size(const std::string &path);
+        static std::string read_chunk(const std::string &path, uint64_t offset, size_t size);
+        // Writes data at offset, offset 0 starts a new file. The last chunk
+        // is synced to disk.
+        static void write_chunk(const std::string &path, uint64_t offset,
+                                const std::string &data, bool last);
+    };
+}
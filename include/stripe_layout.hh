@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <mpi.h>
+
+namespace raft
+{
+    // RAID-0 layout of a file over the members of a Raft group: stripe unit
+    // u, the bytes [u * unit, (u + 1) * unit), is stored by member
+    // u % members. Every member writes to the same shared file through a
+    // file view holding only its own units, so the bytes of a large
+    // transfer are split between the disks of the whole group.
+    //
+    // The units of a member are contiguous in its view: the pieces of any
+    // range it stores are read or written with a single call.
+    class StripeLayout
+    {
+    public:
+        // A range of the file stored by this member.
+        struct Piece
+        {
+            uint64_t offset;
+            uint64_t size;
+        };
+
+        StripeLayout(uint64_t unit, int members, int member);
+        ~StripeLayout();
+
+        StripeLayout(const StripeLayout &) = delete;
+        StripeLayout &operator=(const StripeLayout &) = delete;
+
+        // Member storing the byte at offset.
+        int owner(uint64_t offset) const { return offset / unit % members; }
+        // Whether member stores part of [offset, offset + size).
+        bool stores(int member, uint64_t offset, uint64_t size) const;
+        // Pieces of [offset, offset + size) this member stores, in order.
+        std::vector<Piece> pieces(uint64_t offset, uint64_t size) const
+        {
+            return pieces(member, offset, size);
+        }
+        std::vector<Piece> pieces(int member, uint64_t offset, uint64_t size) const;
+
+        // Writes the pieces this member, or member, stores of data, which
+        // starts at offset in the file. The view of file is set to theirs.
+        bool write(MPI_File file, uint64_t offset, const char *data, uint64_t size) const
+        {
+            return write(file, member, offset, data, size);
+        }
+        bool write(MPI_File file, int member, uint64_t offset, const char *data,
+                   uint64_t size) const;
+        // Writes pieces, from pieces(), from buffer where they are back to
+        // back.
+        bool write(MPI_File file, const std::vector<Piece> &pieces, const char *buffer) const;
+        // Writes every unit of data, those of the other members too. The
+        // view of file is reset to the whole file.
+        bool write_all(MPI_File file, uint64_t offset, const char *data, uint64_t size) const;
+        // Reads pieces, from pieces(), back to back into buffer.
+        bool read(MPI_File file, const std::vector<Piece> &pieces, char *buffer) const;
+
+    private:
+        // Position of offset, a byte this member stores, in its view.
+        MPI_Offset view_offset(uint64_t offset) const;
+        void set_view(MPI_File file, int member) const;
+
+        uint64_t unit;
+        int members;
+        int member;
+        // One unit out of every members units.
+        MPI_Datatype filetype;
+    };
+}
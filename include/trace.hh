@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <mpi.h>
+
+#include "metrics.hh"
+
+namespace stats
+{
+    // Optional timeline of this rank: spans of message handling, sends and
+    // file I/O recorded in a ring of the last events, then written with
+    // those of every rank as one Chrome trace (chrome://tracing, Perfetto),
+    // a process per rank.
+    //
+    // Any thread records: a slot of the ring is claimed with an atomic
+    // increment, no lock. Timestamps are Metrics::now() of the rank, moved
+    // to the MPI_Wtime() clock of rank 0 measured by start().
+    class Trace
+    {
+    public:
+        // Collective over comm. Measures the offset of the MPI_Wtime() clock
+        // of every rank to the one of rank 0, keeping the exchange with the
+        // shortest round trip, and enables tracing in a ring of capacity
+        // events written to path by dump().
+        static void start(MPI_Comm comm, const std::string &path, size_t capacity);
+        static bool enabled() { return active.load(std::memory_order_acquire); }
+
+        // A span from begin to end (Metrics::now()), with an optional
+        // integer argument. Every string must be static.
+        static void record(const char *category, const char *name, uint64_t begin,
+                           uint64_t end, const char *arg_name = nullptr, int64_t arg = 0);
+
+        // A step, now, of the path of the request request_id of client
+        // across ranks, bound to the span it happens in: phase 's' where the
+        // client sends it, 't' where a server handles it, 'f' where the
+        // client gets the answer. The viewers draw the steps as arrows.
+        static void flow(char phase, int client, uint64_t request_id);
+
+        // Collective over the communicator of start(): writes the events of
+        // every rank to the trace file, this rank's process being named
+        // "<role> <rank>". Does nothing if tracing is disabled.
+        static void dump(const std::string &role);
+
+    private:
+        static void write(char phase, const char *category, const char *name, uint64_t begin,
+                          uint64_t end, const char *arg_name, int64_t arg);
+
+        struct Event
+        {
+            // Claimed index + 1 once the event is written, 0 before.
+            std::atomic<uint64_t> sequence;
+            const char *category;
+            const char *name;
+            const char *arg_name;
+            int64_t arg;
+            uint64_t begin;
+            uint64_t end;
+            uint32_t thread;
+            // 'X' for spans, else the phase of a flow step, arg its id.
+            char phase;
+        };
+
+        // Set once the ring and the clock offsets are ready, which the
+        // threads seeing it set may then use.
+        static inline std::atomic<bool> active{false};
+        static inline MPI_Comm comm = MPI_COMM_NULL;
+        static inline std::string path;
+        static inline std::unique_ptr<Event[]> ring;
+        static inline size_t capacity = 0;
+        static inline std::atomic<uint64_t> head{0};
+        static inline std::atomic<uint32_t> threads{0};
+        // Metrics::now() and the rank 0 MPI_Wtime() clock, in microseconds
+        // since the start of the trace, at the same instant.
+        static inline uint64_t base_now = 0;
+        static inline double base_us = 0;
+    };
+
+    // Records its lifetime in the trace, if enabled.
+    class TraceSpan
+    {
+    public:
+        TraceSpan(const char *category, const char *name, const char *arg_name = nullptr,
+                  int64_t arg = 0)
+            : category(category)
+            , name(name)
+            , arg_name(arg_name)
+            , arg(arg)
+            , begin(Trace::enabled() ? Metrics::now() : 0)
+        {}
+        ~TraceSpan()
+        {
+            if (begin != 0)
+                Trace::record(category, name, begin, Metrics::now(), arg_name, arg);
+        }
+
+        TraceSpan(const TraceSpan &) = delete;
+        TraceSpan &operator=(const TraceSpan &) = delete;
+
+    private:
+        const char *category;
+        const char *name;
+        const char *arg_name;
+        int64_t arg;
+        uint64_t begin;
+    };
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+
+#include <mpi.h>
+
+#include "options.hh"
+#include "raft_log.hh"
+
+namespace raft
+{
+    // Append-only write-ahead log of the Raft log, split in segment files
+    // dir/segment_<seq>.wal. Each record is
+    //   u32 body length | u32 crc32(body) | u8 kind | kind specific body
+    // A TRUNCATE record drops every entry from its index on, so conflicting
+    // suffixes are discarded without rewriting older segments. A VOTE
+    // record holds the current term and the member voted for in it, the
+    // last one read being the current.
+    class Wal
+    {
+    public:
+        enum RecordKind
+        {
+            ENTRY = 0,
+            TRUNCATE,
+            VOTE,
+        };
+
+        using EntryCallback = std::function<void(uint64_t index, LogEntry &&entry)>;
+        using TruncateCallback = std::function<void(uint64_t index)>;
+        using VoteCallback = std::function<void(uint64_t term, int voted_for)>;
+
+        Wal(std::string dir, const Options &options);
+        ~Wal();
+
+        Wal(const Wal &) = delete;
+        Wal &operator=(const Wal &) = delete;
+
+        void append(uint64_t index, const LogEntry &entry);
+        void truncate_from(uint64_t index);
+        // Records the term and vote, durable on return: a server must not
+        // vote twice in a term across a crash. Does nothing if unchanged.
+        void save_vote(uint64_t term, int voted_for);
+
+        // Writes buffered records and fsyncs them when the policy asks for
+        // it. Called once per event loop iteration.
+        void tick();
+        void sync();
+
+        // When tick() will next have to write or sync something.
+        std::chrono::steady_clock::time_point next_deadline() const;
+
+        // Every entry up to this index survives a crash.
+        uint64_t durable_index() const { return synced_index; }
+
+        // Reads back the entry at index, appended or replayed and not
+        // compacted since, writing the buffered records first if needed.
+        LogEntry read(uint64_t index);
+
+        // Streams every valid record of every segment, in order. A torn or
+        // corrupted tail is cut off, then the log is reopened for appends.
+        // Records buffered but not written are dropped, as a crash would.
+        void replay(const EntryCallback &on_entry, const TruncateCallback &on_truncate,
+                    const VoteCallback &on_vote);
+
+        // Deletes the segments holding only entries up to index, which a
+        // snapshot now covers.
+        void compact(uint64_t index);
+        // Deletes every segment and restarts after index, once a snapshot
+        // that covers the whole log is durable.
+        void reset(uint64_t index);
+
+    private:
+        void add_record(RecordKind kind, const std::string &body);
+        void add_vote_record();
+        void flush();
+        void open_segment(uint64_t seq);
+        void close_segment();
+        std::string segment_path(uint64_t seq) const;
+        std::vector<uint64_t> list_segments() const;
+
+        std::string dir;
+        Options::FsyncPolicy policy;
+        size_t group_entries;
+        std::chrono::microseconds group_delay;
+        size_t segment_bytes;
+
+        MPI_File file;
+        bool file_open;
+        uint64_t segment_seq;
+        size_t segment_size;
+        // Highest entry index recorded in each segment.
+        std::map<uint64_t, uint64_t> segment_last_index;
+        // Segment and offset of the record of each entry, for read().
+        struct Position
+        {
+            uint64_t segment;
+            uint64_t offset;
+        };
+        std::map<uint64_t, Position> positions;
+
+        std::string buffer;
+        size_t unsynced_entries;
+        std::chrono::steady_clock::time_point first_unsynced;
+        uint64_t buffered_index;
+        uint64_t written_index;
+        uint64_t synced_index;
+
+        // Latest vote saved, and the segment holding it, which compact()
+        // keeps: the vote is recorded again before its segment goes.
+        uint64_t vote_term;
+        int voted_for;
+        bool vote_buffered;
+        uint64_t vote_segment;
+    };
+}
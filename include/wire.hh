@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Binary wire format shared by every message type.
+//
+// A frame is a fixed 16 bytes header followed by a typed payload:
+//   u8 magic | u8 version | u8 message type | u8 reserved
+//   i32 sender | i32 target | u32 payload length
+// Integers are stored in host byte order (MPI jobs run on homogeneous nodes).
+namespace wire
+{
+    enum class Format
+    {
+        BINARY = 0,
+        JSON,
+    };
+
+    constexpr uint8_t MAGIC = 0xAF;
+    constexpr uint8_t VERSION = 1;
+    constexpr size_t HEADER_SIZE = 16;
+
+    struct Header
+    {
+        uint8_t version;
+        uint8_t type;
+        int32_t sender;
+        int32_t target;
+        uint32_t payload_size;
+    };
+
+    class Writer
+    {
+    public:
+        explicit Writer(std::string &buffer)
+            : buffer(buffer)
+        {}
+
+        template <typename T>
+        void put(T value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            const size_t pos = buffer.size();
+            buffer.resize(pos + sizeof(T));
+            std::memcpy(buffer.data() + pos, &value, sizeof(T));
+        }
+
+        void put_bytes(const void *data, size_t size)
+        {
+            buffer.append(static_cast<const char *>(data), size);
+        }
+
+        void put_string(std::string_view s)
+        {
+            put<uint32_t>(s.size());
+            put_bytes(s.data(), s.size());
+        }
+
+        template <typename T>
+        void put_vector(const std::vector<T> &values)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            put<uint32_t>(values.size());
+            put_bytes(values.data(), values.size() * sizeof(T));
+        }
+
+        // Reserves a header, returns its offset so it can be patched once
+        // the payload size is known. The payload ends with trailing bytes
+        // not written in the buffer, sent separately.
+        size_t begin_frame(uint8_t type, int32_t sender, int32_t target);
+        void end_frame(size_t frame_offset, size_t trailing = 0);
+
+        size_t size() const { return buffer.size(); }
+
+    private:
+        std::string &buffer;
+    };
+
+    class Reader
+    {
+    public:
+        Reader(const char *data, size_t size)
+            : data(data)
+            , size(size)
+            , pos(0)
+        {}
+
+        template <typename T>
+        T get()
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            T value;
+            std::memcpy(&value, take(sizeof(T)), sizeof(T));
+            return value;
+        }
+
+        std::string_view get_bytes(size_t n)
+        {
+            return std::string_view(take(n), n);
+        }
+
+        std::string get_string()
+        {
+            const uint32_t n = get<uint32_t>();
+            return std::string(get_bytes(n));
+        }
+
+        template <typename T>
+        std::vector<T> get_vector()
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            const uint32_t n = get<uint32_t>();
+            std::vector<T> values(n);
+            std::memcpy(values.data(), take(n * sizeof(T)), n * sizeof(T));
+            return values;
+        }
+
+        Header get_header();
+
+        size_t remaining() const { return size - pos; }
+        size_t position() const { return pos; }
+
+    private:
+        const char *take(size_t n)
+        {
+            if (n > size - pos)
+                throw std::runtime_error("wire: truncated message");
+            const char *p = data + pos;
+            pos += n;
+            return p;
+        }
+
+        const char *data;
+        size_t size;
+        size_t pos;
+    };
+
+    inline bool is_binary(const char *data, size_t size)
+    {
+        return size >= HEADER_SIZE && static_cast<uint8_t>(data[0]) == MAGIC;
+    }
+}
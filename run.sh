@@ -5,4 +5,4 @@ read -p 'How many clients ? ' clients
 
 echo "localhost slots=$(($servers + $clients + 1))" > hostfile
 
-mpirun -hostfile hostfile ./bin/afs $servers $clients
+mpirun -hostfile hostfile ./bin/afs $servers $clients "$@"
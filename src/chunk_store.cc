@@ -0,0 +1,226 @@
+#include "chunk_store.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+namespace raft
+{
+    static uint64_t mix(uint64_t x)
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    ChunkId ChunkId::from_hex(std::string_view hex)
+    {
+        ChunkId id;
+        if (hex.size() != 2 * id.digest.size())
+            throw std::invalid_argument("ChunkId: not a digest: " + std::string(hex));
+        auto nibble = [hex](char c) {
+            if (c >= '0' && c <= '9')
+                return c - '0';
+            if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+            throw std::invalid_argument("ChunkId: not a digest: " + std::string(hex));
+        };
+        for (size_t i = 0; i < id.digest.size(); i++)
+            id.digest[i] = nibble(hex[2 * i]) << 4 | nibble(hex[2 * i + 1]);
+        return id;
+    }
+
+    std::string ChunkId::hex() const
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string result(2 * digest.size(), '0');
+        for (size_t i = 0; i < digest.size(); i++)
+        {
+            result[2 * i] = digits[digest[i] >> 4];
+            result[2 * i + 1] = digits[digest[i] & 15];
+        }
+        return result;
+    }
+
+    // A random value per byte, the same on every server.
+    static const uint64_t *gear()
+    {
+        static const auto table = [] {
+            std::vector<uint64_t> values(256);
+            uint64_t state = 0x243f6a8885a308d3ULL;
+            for (uint64_t &value : values)
+            {
+                state += 0x9e3779b97f4a7c15ULL;
+                value = mix(state);
+            }
+            return values;
+        }();
+        return table.data();
+    }
+
+    std::vector<ChunkRef> cut_chunks(std::string_view data, size_t average)
+    {
+        size_t min = std::max<size_t>(average / 4, 1);
+        size_t max = average * 4;
+        // log2(average) bits of the hash, the top ones: they depend on the
+        // last 64 bytes.
+        int bits = std::max(1, static_cast<int>(std::bit_width(average)) - 1);
+        uint64_t mask = ~0ULL << (64 - bits);
+        const uint64_t *table = gear();
+
+        std::vector<ChunkRef> chunks;
+        size_t start = 0;
+        while (start < data.size())
+        {
+            size_t end = std::min(data.size(), start + max);
+            size_t cut = end;
+            uint64_t hash = 0;
+            for (size_t i = start + min; i < end; i++)
+            {
+                hash = (hash << 1) + table[static_cast<uint8_t>(data[i])];
+                if ((hash & mask) == 0)
+                {
+                    cut = i + 1;
+                    break;
+                }
+            }
+            std::string_view chunk = data.substr(start, cut - start);
+            chunks.push_back(ChunkRef{ChunkId::of(chunk), static_cast<uint32_t>(chunk.size()), true});
+            start = cut;
+        }
+        return chunks;
+    }
+
+    ChunkStore::ChunkStore(std::string dir)
+        : dir(std::move(dir))
+        , logical(0)
+        , stored(0)
+    {
+        std::filesystem::create_directories(this->dir);
+    }
+
+    std::string ChunkStore::path(const ChunkId &id) const
+    {
+        return dir + "/" + id.hex();
+    }
+
+    void ChunkStore::reload()
+    {
+        chunks.clear();
+        recipes.clear();
+        logical = 0;
+        stored = 0;
+        for (const auto &file : std::filesystem::directory_iterator(dir))
+        {
+            // Chunks are written to a temporary name then renamed.
+            std::string name = file.path().filename().string();
+            ChunkId id;
+            try
+            {
+                id = ChunkId::from_hex(name);
+            }
+            catch (const std::invalid_argument &)
+            {
+                std::filesystem::remove(file.path());
+                continue;
+            }
+            if (!file.is_regular_file())
+            {
+                std::filesystem::remove(file.path());
+                continue;
+            }
+            chunks[id] = Chunk{static_cast<uint32_t>(file.file_size()), 0, 0, true};
+        }
+    }
+
+    bool ChunkStore::ready(const ChunkId &id) const
+    {
+        auto it = chunks.find(id);
+        return it != chunks.end() && it->second.ready;
+    }
+
+    bool ChunkStore::known_before(const ChunkId &id, uint64_t index) const
+    {
+        auto it = chunks.find(id);
+        return it != chunks.end() && it->second.since < index;
+    }
+
+    void ChunkStore::set_ready(const ChunkId &id)
+    {
+        auto it = chunks.find(id);
+        if (it != chunks.end())
+            it->second.ready = true;
+    }
+
+    const std::vector<ChunkRef> &ChunkStore::recipe(int uid) const
+    {
+        static const std::vector<ChunkRef> none;
+        auto it = recipes.find(uid);
+        return it == recipes.end() ? none : it->second;
+    }
+
+    std::vector<ChunkRef> ChunkStore::add(int uid, const std::vector<ChunkRef> &refs,
+                                          uint64_t index)
+    {
+        std::vector<ChunkRef> &recipe = recipes[uid];
+        std::vector<ChunkRef> fresh;
+        for (const ChunkRef &ref : refs)
+        {
+            recipe.push_back(ChunkRef{ref.id, ref.size, false});
+            logical += ref.size;
+            auto [it, inserted] = chunks.try_emplace(ref.id, Chunk{ref.size, 0, index, false});
+            if (it->second.refs++ == 0)
+                stored += ref.size;
+            if (inserted)
+                fresh.push_back(ref);
+        }
+        return fresh;
+    }
+
+    void ChunkStore::erase(int uid)
+    {
+        auto it = recipes.find(uid);
+        if (it == recipes.end())
+            return;
+        for (const ChunkRef &ref : it->second)
+        {
+            logical -= ref.size;
+            auto chunk = chunks.find(ref.id);
+            if (chunk != chunks.end() && chunk->second.refs > 0 && --chunk->second.refs == 0)
+                stored -= ref.size;
+        }
+        recipes.erase(it);
+    }
+
+    std::vector<ChunkRef> ChunkStore::referenced() const
+    {
+        std::vector<ChunkRef> result;
+        for (const auto &[id, chunk] : chunks)
+            if (chunk.refs > 0)
+                result.push_back(ChunkRef{id, chunk.size, false});
+        return result;
+    }
+
+    size_t ChunkStore::collect(const std::unordered_set<ChunkId, ChunkIdHash> &keep)
+    {
+        size_t count = 0;
+        for (auto it = chunks.begin(); it != chunks.end();)
+        {
+            if (it->second.refs == 0 && it->second.ready && keep.count(it->first) == 0)
+            {
+                std::error_code error;
+                std::filesystem::remove(path(it->first), error);
+                it = chunks.erase(it);
+                count++;
+            }
+            else
+                ++it;
+        }
+        return count;
+    }
+}
@@ -0,0 +1,629 @@
+#include "client.hh"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+namespace client {
+static const char *const ACTION_NAMES[] = {"LOAD", "LIST", "APPEND", "DELETE", "READ"};
+
+Client::Client(MPI_Comm com, MPI_Comm clients, int nb_servers, const Options &options)
+    : Server(com, nb_servers), options(options), clients(clients),
+      rng(state.get_rank()), mix(options.mix.begin(), options.mix.end()),
+      routing(nb_servers, options.groups), next_request_id(1), next_file(0),
+      last_index(options.groups, 0), operations(0), next_transfer(1), next_list(1),
+      cache(static_cast<uint64_t>(options.cache_mb) << 20), listings(options.groups),
+      list_breaks(options.groups, 0), callback_breaks(0), write_gap(0), errors{}, timeouts(0),
+      late_sends(0) {
+  for (int group = 0; group < routing.groups(); group++) {
+    leaders.push_back(routing.members(group).front());
+  }
+  begin = std::chrono::steady_clock::now();
+  end = begin + std::chrono::seconds(options.duration_s);
+  next_send = begin;
+  last_reply = begin;
+  last_write = begin;
+}
+
+void Client::on_message_callback(std::shared_ptr<message::Message> message) {
+  message->accept(*this);
+}
+
+void Client::work() {
+  auto now = std::chrono::steady_clock::now();
+  expire(now);
+
+  if (now >= end) {
+    // Wait for the last answers before reporting.
+    if (inflight.empty() && transfers.empty()) {
+      stop();
+    }
+    return;
+  }
+
+  size_t outstanding = options.outstanding;
+  if (options.rate > 0) {
+    // Open loop: requests go out on schedule whatever is in flight, or
+    // slow answers would hold back the requests that measure them.
+    auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(1.0 / options.rate));
+    for (; next_send <= now; next_send += interval) {
+      if (now - next_send >= interval) {
+        late_sends++;
+      }
+      issue(next_send);
+    }
+  } else {
+    // Cache hits complete at once: bounded, or they would never stop.
+    for (size_t issued = 0; operations < outstanding && issued < outstanding; issued++) {
+      issue(now);
+    }
+  }
+}
+
+std::chrono::steady_clock::time_point Client::next_deadline() {
+  auto now = std::chrono::steady_clock::now();
+  // Look for expired requests ten times per timeout.
+  auto deadline = std::min(Server::next_deadline(),
+                           now + std::chrono::milliseconds(options.request_timeout_ms) / 10);
+  if (now >= end) {
+    return inflight.empty() ? now : deadline;
+  }
+  if (options.rate > 0) {
+    deadline = std::min(deadline, next_send);
+  } else if (operations < static_cast<size_t>(options.outstanding)) {
+    deadline = std::min(deadline, now);
+  }
+  return std::min(deadline, end);
+}
+
+message::ClientAction Client::pick_action() {
+  auto action = static_cast<message::ClientAction>(mix(rng));
+  // Nothing to append to, delete or read yet: create a file instead.
+  if (((action == message::ClientAction::DELETE || action == message::ClientAction::READ) &&
+       files.empty()) ||
+      (action == message::ClientAction::APPEND && appendable.empty())) {
+    return message::ClientAction::LOAD;
+  }
+  return action;
+}
+
+size_t Client::payload_size() {
+  size_t size = options.payload_min;
+  if (options.payload == Options::Payload::UNIFORM) {
+    size = std::uniform_int_distribution<size_t>(options.payload_min, options.payload_max)(rng);
+  } else if (options.payload == Options::Payload::EXPONENTIAL) {
+    double value = std::exponential_distribution<double>(1.0 / options.payload_min)(rng);
+    size = std::min<size_t>(value, options.payload_max);
+  }
+  return size;
+}
+
+std::string Client::make_payload() {
+  return std::string(payload_size(), static_cast<char>('a' + rng() % 26));
+}
+
+void Client::issue(steady_time start) {
+  int rank = state.get_rank();
+  uint64_t id = next_request_id++;
+  message::ClientAction action = pick_action();
+
+  std::shared_ptr<message::Client_message> message;
+  int group;
+  size_t chunk = static_cast<size_t>(options.chunk_kb) << 10;
+  if (action == message::ClientAction::LOAD) {
+    std::string filename = "client" + std::to_string(rank) + "_" + std::to_string(next_file);
+    size_t size = payload_size();
+    if (size > chunk) {
+      next_file++;
+      group = routing.group_of_name(filename);
+      invalidate(-1, group);
+      start_transfer(Transfer{true, group, -1, std::move(filename), size,
+                              static_cast<char>('a' + rng() % 26), 0, 0, {}, 0, start,
+                              false, {}});
+      return;
+    }
+  }
+  if (action == message::ClientAction::READ) {
+    int uid = files[rng() % files.size()];
+    if (serve_cached(action, uid, start)) {
+      return;
+    }
+    start_transfer(Transfer{false, routing.group_of_uid(uid), uid, std::string(), 0, 0,
+                            0, 0, {}, 0, start, options.cache_mb > 0, {}});
+    return;
+  }
+
+  if (action == message::ClientAction::LOAD) {
+    std::string filename = "client" + std::to_string(rank) + "_" + std::to_string(next_file++);
+    group = routing.group_of_name(filename);
+    invalidate(-1, group);
+    message = std::make_shared<message::Client_message>(
+        action, leaders[group], rank, -1, std::move(filename), make_payload(), id);
+  } else if (action == message::ClientAction::LIST) {
+    if (serve_cached(action, -1, start)) {
+      return;
+    }
+    uint64_t list = next_list++;
+    List &pending = lists[list] = List{start, 0, false};
+    auto now = std::chrono::steady_clock::now();
+    for (group = 0; group < routing.groups(); group++) {
+      if (listed(group, now)) {
+        continue;
+      }
+      int target = leaders[group];
+      if (options.follower_reads) {
+        const std::vector<int> &members = routing.members(group);
+        target = members[rng() % members.size()];
+      }
+      uint64_t part = pending.waiting == 0 ? id : next_request_id++;
+      message = std::make_shared<message::Client_message>(
+          action, target, rank, -1, std::string(), std::string(), part);
+      if (options.follower_reads) {
+        message->set_read_bounds(last_index[group], options.staleness_ms);
+      } else if (options.cache_mb > 0) {
+        message->set_callback(true);
+      }
+      send(target, message);
+      inflight[part] = Request{action, group, start, 0, 0, 0, 0, list_breaks[group], list};
+      pending.waiting++;
+    }
+    operations++;
+    return;
+  } else {
+    std::vector<int> &from = action == message::ClientAction::APPEND ? appendable : files;
+    int uid = from[rng() % from.size()];
+    group = routing.group_of_uid(uid);
+    std::string payload;
+    // Cached copies of a file this client changes are stale already.
+    invalidate(uid, action == message::ClientAction::DELETE ? group : -1);
+    if (action == message::ClientAction::DELETE) {
+      // Deleted files are not appended to anymore.
+      files.erase(std::find(files.begin(), files.end(), uid));
+      auto it = std::find(appendable.begin(), appendable.end(), uid);
+      if (it != appendable.end()) {
+        appendable.erase(it);
+      }
+    } else {
+      payload = make_payload();
+    }
+    message = std::make_shared<message::Client_message>(
+        action, leaders[group], rank, uid, std::string(), std::move(payload), id);
+  }
+
+  send(message->get_target_rank(), message);
+  inflight[id] = Request{action, group, start, 0, 0, 0, 0, list_breaks[group], 0};
+  operations++;
+}
+
+void Client::start_transfer(Transfer transfer) {
+  uint64_t id = next_transfer++;
+  Transfer &t = transfers.emplace(id, std::move(transfer)).first->second;
+  operations++;
+  if (t.upload) {
+    send_chunk_request(id, message::ClientAction::UPLOAD_BEGIN, 0, 0);
+  } else {
+    // The first chunk tells the size of the file.
+    size_t chunk = static_cast<size_t>(options.chunk_kb) << 10;
+    send_chunk_request(id, message::ClientAction::READ, 0, chunk);
+    t.next = chunk;
+  }
+}
+
+void Client::send_chunk_request(uint64_t id, message::ClientAction action,
+                                uint64_t offset, uint64_t length) {
+  Transfer &t = transfers.at(id);
+  int rank = state.get_rank();
+  uint64_t request_id = next_request_id++;
+  std::string content;
+  if (action == message::ClientAction::UPLOAD_CHUNK) {
+    content.assign(length, t.fill);
+  }
+  auto message = std::make_shared<message::Client_message>(
+      action, leaders[t.group], rank, t.uid,
+      action == message::ClientAction::UPLOAD_BEGIN ? t.filename : std::string(),
+      std::move(content), request_id);
+  message->set_range(offset, length);
+  message->set_callback(action == message::ClientAction::READ && t.cacheable);
+  send(message->get_target_rank(), message);
+  inflight[request_id] =
+      Request{action, t.group, std::chrono::steady_clock::now(), id, offset, length, 0, 0, 0};
+  t.inflight++;
+}
+
+void Client::pump(uint64_t id) {
+  Transfer &t = transfers.at(id);
+  size_t chunk = static_cast<size_t>(options.chunk_kb) << 10;
+  // Every chunk sent was answered but some were lost: go back.
+  if (t.inflight == 0 && t.next > t.done && t.done < t.size) {
+    t.next = t.done;
+  }
+  auto action = t.upload ? message::ClientAction::UPLOAD_CHUNK : message::ClientAction::READ;
+  while (t.inflight < options.window && t.next < t.size) {
+    uint64_t length = std::min<uint64_t>(chunk, t.size - t.next);
+    send_chunk_request(id, action, t.next, length);
+    t.next += length;
+  }
+  if (t.inflight == 0 && t.done >= t.size) {
+    if (t.upload) {
+      send_chunk_request(id, message::ClientAction::UPLOAD_COMMIT, 0, t.size);
+    } else {
+      finish(id, true);
+    }
+  }
+}
+
+void Client::on_transfer_reply(const Request &request,
+                               const std::shared_ptr<message::Handshake_message> &message) {
+  auto it = transfers.find(request.transfer);
+  if (it == transfers.end()) {
+    return;
+  }
+  Transfer &t = it->second;
+  t.inflight--;
+  bool success = message->get_status() == message::HandshakeStatus::SUCCESS;
+
+  switch (request.action) {
+  case message::ClientAction::UPLOAD_BEGIN:
+    if (!success) {
+      finish(request.transfer, false);
+      return;
+    }
+    // A resumed upload goes on from what the servers hold.
+    t.uid = message->get_uid();
+    t.next = message->get_size();
+    t.done = message->get_size();
+    break;
+  case message::ClientAction::UPLOAD_CHUNK:
+    // The servers hold a prefix of message->get_size() bytes, a refused
+    // chunk was past a hole.
+    t.done = std::max(t.done, message->get_size());
+    if (!success) {
+      t.next = std::min(t.next, message->get_size());
+    }
+    break;
+  case message::ClientAction::UPLOAD_COMMIT:
+    if (success) {
+      finish(request.transfer, true);
+      return;
+    }
+    if (message->get_size() >= t.size) {
+      finish(request.transfer, false);
+      return;
+    }
+    t.next = t.done = message->get_size();
+    break;
+  default:
+    if (!success) {
+      finish(request.transfer, false);
+      return;
+    }
+    if (request.offset == 0) {
+      t.size = message->get_size();
+    }
+    // Chunks served by different servers complete out of order. Chunks
+    // after a lost one are fetched again.
+    t.completed[request.offset] = request.received;
+    for (auto c = t.completed.begin(); c != t.completed.end() && c->first <= t.done;
+         c = t.completed.erase(c)) {
+      if (c->first == t.done) {
+        // The file got shorter since the first chunk.
+        if (c->second == 0) {
+          t.size = t.done;
+        }
+        t.done += c->second;
+      }
+    }
+    break;
+  }
+  pump(request.transfer);
+}
+
+void Client::resume(uint64_t id) {
+  Transfer &t = transfers.at(id);
+  for (auto it = inflight.begin(); it != inflight.end();) {
+    it = it->second.transfer == id ? inflight.erase(it) : std::next(it);
+  }
+  t.inflight = 0;
+  t.next = t.done;
+  if (t.upload) {
+    // Asks the servers where to resume, or starts over if the upload
+    // never began.
+    send_chunk_request(id, message::ClientAction::UPLOAD_BEGIN, 0, 0);
+  } else {
+    pump(id);
+  }
+}
+
+void Client::finish(uint64_t id, bool success) {
+  Transfer &t = transfers.at(id);
+  auto action = t.upload ? message::ClientAction::LOAD : message::ClientAction::READ;
+  if (success) {
+    auto now = std::chrono::steady_clock::now();
+    latency[action].record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - t.start).count());
+    if (!t.upload && t.cacheable) {
+      t.data.resize(t.size);
+      cache.insert(t.uid, std::move(t.data),
+                   now + std::chrono::milliseconds(options.callback_ms));
+    }
+    if (t.upload) {
+      files.push_back(t.uid);
+      // Servers refuse appends to coded files.
+      if (options.ec_data == 0) {
+        appendable.push_back(t.uid);
+      }
+    }
+  } else {
+    errors[action]++;
+  }
+  for (auto it = inflight.begin(); it != inflight.end();) {
+    it = it->second.transfer == id ? inflight.erase(it) : std::next(it);
+  }
+  transfers.erase(id);
+  operations--;
+}
+
+bool Client::serve_cached(message::ClientAction action, int uid, steady_time start) {
+  if (options.cache_mb == 0) {
+    return false;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (action == message::ClientAction::READ) {
+    if (!cache.find(uid, now)) {
+      return false;
+    }
+  } else {
+    for (int group = 0; group < routing.groups(); group++) {
+      if (!listed(group, now)) {
+        return false;
+      }
+    }
+  }
+  latency[action].record(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+  last_reply = now;
+  return true;
+}
+
+bool Client::listed(int group, steady_time now) const {
+  return options.cache_mb > 0 && listings[group] && listings[group]->second > now;
+}
+
+void Client::invalidate(int uid, int group) {
+  auto stale = [&](int file) {
+    return uid == message::ALL_FILES ? routing.group_of_uid(file) == group : file == uid;
+  };
+  if (uid >= 0 || uid == message::ALL_FILES) {
+    cache.erase_if(stale);
+    for (auto &[id, t] : transfers) {
+      if (!t.upload && stale(t.uid)) {
+        t.cacheable = false;
+      }
+    }
+  }
+  if (group >= 0) {
+    listings[group].reset();
+    list_breaks[group]++;
+  }
+}
+
+void Client::set_leader(int group, int rank) {
+  if (leaders[group] != rank) {
+    leaders[group] = rank;
+    invalidate(message::ALL_FILES, group);
+  }
+}
+
+void Client::visit(std::shared_ptr<message::Handshake_message> message) {
+  if (message->get_status() == message::HandshakeStatus::CALLBACK_BREAK) {
+    callback_breaks++;
+    int uid = message->get_uid();
+    invalidate(uid, uid < 0 ? routing.group_of_rank(message->get_sender_rank()) : -1);
+    // The sender leads its group: asking it first saves a redirection.
+    if (uid == message::ALL_FILES) {
+      leaders[routing.group_of_rank(message->get_sender_rank())] = message->get_sender_rank();
+    }
+    return;
+  }
+  auto it = inflight.find(message->get_request_id());
+  if (it == inflight.end()) {
+    // Answer to a request that already timed out.
+    return;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  last_reply = now;
+  Request &pending = it->second;
+  if (pending.action == message::ClientAction::READ &&
+      message->get_status() == message::HandshakeStatus::SUCCESS) {
+    pending.received += message->get_data().size();
+    uint64_t size = message->get_size();
+    auto transfer = transfers.find(pending.transfer);
+    if (transfer != transfers.end() && size > cache.capacity()) {
+      // Too large to be cached: the parts are not kept.
+      transfer->second.cacheable = false;
+      std::string().swap(transfer->second.data);
+    }
+    if (transfer != transfers.end() && transfer->second.cacheable) {
+      // Parts of a download land in place, whatever their order.
+      std::string &data = transfer->second.data;
+      std::string_view part = message->get_data();
+      data.resize(std::max<uint64_t>(data.size(), size));
+      if (message->get_offset() + part.size() <= data.size()) {
+        std::copy(part.begin(), part.end(), data.begin() + message->get_offset());
+      } else {
+        transfer->second.cacheable = false;
+      }
+    }
+    uint64_t expected = pending.offset < size ? std::min(pending.length, size - pending.offset) : 0;
+    if (pending.received < expected) {
+      return;
+    }
+  }
+  Request request = pending;
+  inflight.erase(it);
+  // Only the leader answers mutations, reads may come from any server.
+  if (request.action != message::ClientAction::LIST &&
+      request.action != message::ClientAction::READ) {
+    set_leader(request.group, message->get_sender_rank());
+    if (message->get_status() == message::HandshakeStatus::SUCCESS) {
+      write_gap = std::max(write_gap, now - last_write);
+      last_write = now;
+    }
+  }
+  last_index[request.group] = std::max(last_index[request.group], message->get_index());
+  if (request.transfer != 0) {
+    on_transfer_reply(request, message);
+    return;
+  }
+  if (request.list != 0) {
+    on_list_reply(request, message, now);
+    return;
+  }
+  operations--;
+  if (message->get_status() == message::HandshakeStatus::SUCCESS) {
+    latency[request.action].record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - request.start).count());
+    if (request.action == message::ClientAction::LOAD) {
+      files.push_back(message->get_uid());
+      appendable.push_back(message->get_uid());
+    }
+  } else {
+    errors[request.action]++;
+  }
+}
+
+void Client::on_list_reply(const Request &request,
+                           const std::shared_ptr<message::Handshake_message> &message,
+                           steady_time now) {
+  bool success = message->get_status() == message::HandshakeStatus::SUCCESS;
+  // The leader promised to break the callback if the list changes.
+  if (success && options.cache_mb > 0 && !options.follower_reads &&
+      request.breaks == list_breaks[request.group]) {
+    listings[request.group].emplace(
+        message->get_uids(), now + std::chrono::milliseconds(options.callback_ms));
+  }
+  auto it = lists.find(request.list);
+  if (it == lists.end()) {
+    // Another part timed out.
+    return;
+  }
+  List &list = it->second;
+  list.failed = list.failed || !success;
+  if (--list.waiting > 0) {
+    return;
+  }
+  if (list.failed) {
+    errors[request.action]++;
+  } else {
+    latency[request.action].record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - list.start).count());
+  }
+  lists.erase(it);
+  operations--;
+}
+
+void Client::expire(steady_time now) {
+  auto timeout = std::chrono::milliseconds(options.request_timeout_ms);
+  std::vector<bool> expired(routing.groups(), false);
+  std::vector<uint64_t> stalled;
+  for (auto it = inflight.begin(); it != inflight.end();) {
+    if (now - it->second.start > timeout) {
+      expired[it->second.group] = true;
+      if (it->second.transfer != 0) {
+        stalled.push_back(it->second.transfer);
+      } else if (it->second.list == 0 || lists.erase(it->second.list) > 0) {
+        operations--;
+      }
+      it = inflight.erase(it);
+      timeouts++;
+    } else {
+      ++it;
+    }
+  }
+  // The leader may be gone: try the next server of the group.
+  for (int group = 0; group < routing.groups(); group++) {
+    if (expired[group]) {
+      const std::vector<int> &members = routing.members(group);
+      auto it = std::find(members.begin(), members.end(), leaders[group]);
+      set_leader(group, it == members.end() || it + 1 == members.end() ? members.front() : *(it + 1));
+    }
+  }
+  // Transfers go on with the new leader, until the run is over.
+  for (uint64_t id : stalled) {
+    if (transfers.count(id) == 0) {
+      continue;
+    }
+    if (now >= end) {
+      finish(id, false);
+    } else {
+      resume(id);
+    }
+  }
+}
+
+void Client::report() {
+  int rank;
+  MPI_Comm_rank(clients, &rank);
+  bool root = rank == 0;
+
+  double elapsed = std::chrono::duration<double>(last_reply - begin).count();
+  MPI_Reduce(root ? MPI_IN_PLACE : &elapsed, &elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, clients);
+  MPI_Reduce(root ? MPI_IN_PLACE : errors.data(), errors.data(), errors.size(),
+             MPI_UINT64_T, MPI_SUM, 0, clients);
+  MPI_Reduce(root ? MPI_IN_PLACE : &timeouts, &timeouts, 1, MPI_UINT64_T, MPI_SUM, 0, clients);
+  MPI_Reduce(root ? MPI_IN_PLACE : &late_sends, &late_sends, 1, MPI_UINT64_T, MPI_SUM, 0,
+             clients);
+  double gap_ms = std::chrono::duration<double, std::milli>(write_gap).count();
+  MPI_Reduce(root ? MPI_IN_PLACE : &gap_ms, &gap_ms, 1, MPI_DOUBLE, MPI_MAX, 0, clients);
+  std::array<uint64_t, 4> caching = {cache.hits(), cache.misses(), cache.evictions(),
+                                     callback_breaks};
+  MPI_Reduce(root ? MPI_IN_PLACE : caching.data(), caching.data(), caching.size(),
+             MPI_UINT64_T, MPI_SUM, 0, clients);
+  for (auto &histogram : latency) {
+    histogram.reduce(clients, 0);
+  }
+  if (!root) {
+    return;
+  }
+
+  int nb_clients;
+  MPI_Comm_size(clients, &nb_clients);
+  auto us = [](uint64_t ns) { return ns / 1000.0; };
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << std::left << std::setw(8) << "op" << std::right << std::setw(10) << "count"
+            << std::setw(8) << "errors" << std::setw(11) << "p50(us)" << std::setw(11)
+            << "p99(us)" << std::setw(11) << "p999(us)" << std::setw(11) << "max(us)"
+            << std::endl;
+  uint64_t total = 0;
+  for (size_t i = 0; i < latency.size(); i++) {
+    const stats::Histogram &histogram = latency[i];
+    if (histogram.count() == 0 && errors[i] == 0) {
+      continue;
+    }
+    total += histogram.count();
+    std::cout << std::left << std::setw(8) << ACTION_NAMES[i] << std::right
+              << std::setw(10) << histogram.count() << std::setw(8) << errors[i]
+              << std::setw(11) << us(histogram.percentile(0.5))
+              << std::setw(11) << us(histogram.percentile(0.99))
+              << std::setw(11) << us(histogram.percentile(0.999))
+              << std::setw(11) << us(histogram.max()) << std::endl;
+  }
+  std::cout << nb_clients << " clients: " << total << " operations in " << elapsed
+            << " s, " << (elapsed > 0 ? total / elapsed : 0) << " ops/s, " << timeouts
+            << " timeouts" << std::endl;
+  std::cout << "longest time without a successful write: " << gap_ms << " ms" << std::endl;
+  if (options.rate > 0) {
+    std::cout << "open loop: " << late_sends << " requests sent over an interval late"
+              << std::endl;
+  }
+  if (options.cache_mb > 0) {
+    std::cout << "cache: " << caching[0] << " hits, " << caching[1] << " misses, "
+              << caching[2] << " evictions, " << caching[3] << " callback breaks"
+              << std::endl;
+  }
+}
+
+} // namespace client
@@ -0,0 +1,69 @@
+#include "client_cache.hh"
+
+#include <iterator>
+
+namespace client
+{
+    ClientCache::ClientCache(uint64_t budget)
+        : budget(budget)
+        , used(0)
+        , hit_count(0)
+        , miss_count(0)
+        , eviction_count(0)
+    {}
+
+    const std::string *ClientCache::find(int uid, time_point now)
+    {
+        auto it = entries.find(uid);
+        if (it == entries.end() || it->second->expires <= now)
+        {
+            if (it != entries.end())
+                drop(it->second);
+            miss_count++;
+            return nullptr;
+        }
+        lru.splice(lru.begin(), lru, it->second);
+        hit_count++;
+        return &it->second->data;
+    }
+
+    void ClientCache::insert(int uid, std::string data, time_point expires)
+    {
+        erase(uid);
+        if (data.size() > budget)
+            return;
+        while (used + data.size() > budget)
+        {
+            drop(std::prev(lru.end()));
+            eviction_count++;
+        }
+        used += data.size();
+        lru.push_front(Entry{uid, std::move(data), expires});
+        entries[uid] = lru.begin();
+    }
+
+    void ClientCache::erase(int uid)
+    {
+        auto it = entries.find(uid);
+        if (it != entries.end())
+            drop(it->second);
+    }
+
+    void ClientCache::erase_if(const std::function<bool(int)> &match)
+    {
+        for (auto it = lru.begin(); it != lru.end();)
+        {
+            auto next = std::next(it);
+            if (match(it->uid))
+                drop(it);
+            it = next;
+        }
+    }
+
+    void ClientCache::drop(std::list<Entry>::iterator it)
+    {
+        used -= it->data.size();
+        entries.erase(it->uid);
+        lru.erase(it);
+    }
+}
@@ -8,9 +8,33 @@ namespace message
     Client_message::Client_message(ClientAction action, int target_rank, int sender_rank)
         : Message(MessageType::CLIENT, sender_rank, target_rank)
         , action(action)
+        , uid(-1)
+        , request_id(0)
     {}
 
-    
+    Client_message::Client_message(ClientAction action, int target_rank, int sender_rank,
+                                   int uid, std::string filename, std::string content,
+                                   uint64_t request_id)
+        : Message(MessageType::CLIENT, sender_rank, target_rank)
+        , action(action)
+        , uid(uid)
+        , filename(std::move(filename))
+        , content(std::move(content))
+        , request_id(request_id)
+    {}
+
+    void Client_message::set_read_bounds(uint64_t min_index, uint32_t staleness_ms)
+    {
+        this->min_index = min_index;
+        this->staleness_ms = staleness_ms;
+    }
+
+    void Client_message::set_range(uint64_t offset, uint64_t length)
+    {
+        this->offset = offset;
+        this->length = length;
+    }
+
     json Client_message::serialize_json() const
     {
         json j;
@@ -19,16 +43,74 @@ namespace message
         j["TARGET"] = this->target_rank;
         json data;
         data["ACTION"] = this->action;
+        data["UID"] = this->uid;
+        data["FILENAME"] = this->filename;
+        data["SOME_TEXT"] = this->content;
+        data["REQUEST_ID"] = this->request_id;
+        data["MIN_INDEX"] = this->min_index;
+        data["STALENESS_MS"] = this->staleness_ms;
+        data["OFFSET"] = this->offset;
+        data["LENGTH"] = this->length;
+        data["CALLBACK"] = this->callback;
         j["CLIENT"] = data;
 
 
         return j;
     }
 
-    std::shared_ptr<Client_message> Client_message::deserialize(const std::string &message)
+    void Client_message::accept(Visitor &visitor)
+    {
+        visitor.visit(std::static_pointer_cast<Client_message>(shared_from_this()));
+    }
+
+    void Client_message::serialize_payload(wire::Writer &writer) const
+    {
+        writer.put<uint8_t>(this->action);
+        writer.put<int32_t>(this->uid);
+        writer.put_string(this->filename);
+        writer.put_string(this->content);
+        writer.put<uint64_t>(this->request_id);
+        writer.put<uint64_t>(this->min_index);
+        writer.put<uint32_t>(this->staleness_ms);
+        writer.put<uint64_t>(this->offset);
+        writer.put<uint64_t>(this->length);
+        writer.put<uint8_t>(this->callback);
+    }
+
+    std::shared_ptr<Client_message> Client_message::deserialize(const json &j)
+    {
+       const json &data = j["CLIENT"];
+       ClientAction action = static_cast<ClientAction>(data["ACTION"]);
+       auto message = std::make_shared<Client_message>(action, j["TARGET"], j["SENDER"],
+                                                       data.value("UID", -1),
+                                                       data.value("FILENAME", std::string()),
+                                                       data.value("SOME_TEXT", std::string()),
+                                                       data.value("REQUEST_ID", uint64_t(0)));
+       message->set_read_bounds(data.value("MIN_INDEX", uint64_t(0)),
+                                data.value("STALENESS_MS", uint32_t(0)));
+       message->set_range(data.value("OFFSET", uint64_t(0)), data.value("LENGTH", uint64_t(0)));
+       message->set_callback(data.value("CALLBACK", false));
+       return message;
+    }
+
+    std::shared_ptr<Client_message> Client_message::deserialize(wire::Reader &reader, int sender_rank, int target_rank)
     {
-       json j = json::parse(message); 
-       ClientAction action = static_cast<ClientAction>(j["CLIENT"]["ACTION"]);
-       return std::make_shared<Client_message>(action, j["TARGET"], j["SENDER"]);
+       ClientAction action = static_cast<ClientAction>(reader.get<uint8_t>());
+       int uid = reader.get<int32_t>();
+       std::string filename = reader.get_string();
+       std::string content = reader.get_string();
+       uint64_t request_id = reader.get<uint64_t>();
+       uint64_t min_index = reader.get<uint64_t>();
+       uint32_t staleness_ms = reader.get<uint32_t>();
+       uint64_t offset = reader.get<uint64_t>();
+       uint64_t length = reader.get<uint64_t>();
+       bool callback = reader.get<uint8_t>();
+       auto message = std::make_shared<Client_message>(action, target_rank, sender_rank,
+                                                       uid, std::move(filename), std::move(content),
+                                                       request_id);
+       message->set_read_bounds(min_index, staleness_ms);
+       message->set_range(offset, length);
+       message->set_callback(callback);
+       return message;
     }
-}
\ No newline at end of file
+}
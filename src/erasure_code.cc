@@ -0,0 +1,284 @@
+#include "erasure_code.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <immintrin.h>
+
+namespace ec
+{
+    // Log and antilog tables of GF(2^8) with the polynomial 0x11d.
+    struct Field
+    {
+        uint8_t exp[512];
+        uint8_t log[256];
+
+        Field()
+        {
+            int x = 1;
+            for (int i = 0; i < 255; i++)
+            {
+                exp[i] = exp[i + 255] = x;
+                log[x] = i;
+                x <<= 1;
+                if (x & 0x100)
+                    x ^= 0x11d;
+            }
+            exp[510] = exp[511] = exp[0];
+            log[0] = 0;
+        }
+
+        uint8_t mul(uint8_t a, uint8_t b) const
+        {
+            return a == 0 || b == 0 ? 0 : exp[log[a] + log[b]];
+        }
+
+        uint8_t inv(uint8_t a) const { return exp[255 - log[a]]; }
+    };
+
+    static const Field &field()
+    {
+        static const Field instance;
+        return instance;
+    }
+
+    // Products of c with every low nibble and every high nibble: c * x is
+    // low[x & 15] ^ high[x >> 4].
+    static void nibble_tables(uint8_t c, uint8_t low[16], uint8_t high[16])
+    {
+        const Field &f = field();
+        for (int x = 0; x < 16; x++)
+        {
+            low[x] = f.mul(c, x);
+            high[x] = f.mul(c, x << 4);
+        }
+    }
+
+    static void mul_add_scalar(uint8_t *dst, const uint8_t *src, const uint8_t *low,
+                               const uint8_t *high, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+            dst[i] ^= low[src[i] & 15] ^ high[src[i] >> 4];
+    }
+
+    __attribute__((target("ssse3")))
+    static void mul_add_ssse3(uint8_t *dst, const uint8_t *src, const uint8_t *low,
+                              const uint8_t *high, size_t size)
+    {
+        __m128i table_low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(low));
+        __m128i table_high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(high));
+        __m128i mask = _mm_set1_epi8(0x0f);
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            __m128i l = _mm_shuffle_epi8(table_low, _mm_and_si128(s, mask));
+            __m128i h = _mm_shuffle_epi8(table_high, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+            __m128i *d = reinterpret_cast<__m128i *>(dst + i);
+            _mm_storeu_si128(d, _mm_xor_si128(_mm_loadu_si128(d), _mm_xor_si128(l, h)));
+        }
+        mul_add_scalar(dst + i, src + i, low, high, size - i);
+    }
+
+    __attribute__((target("avx2")))
+    static void mul_add_avx2(uint8_t *dst, const uint8_t *src, const uint8_t *low,
+                             const uint8_t *high, size_t size)
+    {
+        __m256i table_low = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(low)));
+        __m256i table_high = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(high)));
+        __m256i mask = _mm256_set1_epi8(0x0f);
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32)
+        {
+            __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+            __m256i l = _mm256_shuffle_epi8(table_low, _mm256_and_si256(s, mask));
+            __m256i h = _mm256_shuffle_epi8(table_high,
+                                            _mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+            __m256i *d = reinterpret_cast<__m256i *>(dst + i);
+            _mm256_storeu_si256(d, _mm256_xor_si256(_mm256_loadu_si256(d), _mm256_xor_si256(l, h)));
+        }
+        mul_add_scalar(dst + i, src + i, low, high, size - i);
+    }
+
+    bool supported(Kernel kernel)
+    {
+        switch (kernel)
+        {
+        case Kernel::AVX2:
+            return __builtin_cpu_supports("avx2");
+        case Kernel::SSSE3:
+            return __builtin_cpu_supports("ssse3");
+        default:
+            return true;
+        }
+    }
+
+    Kernel best_kernel()
+    {
+        if (supported(Kernel::AVX2))
+            return Kernel::AVX2;
+        if (supported(Kernel::SSSE3))
+            return Kernel::SSSE3;
+        return Kernel::SCALAR;
+    }
+
+    const char *kernel_name(Kernel kernel)
+    {
+        switch (kernel)
+        {
+        case Kernel::AVX2:
+            return "avx2";
+        case Kernel::SSSE3:
+            return "ssse3";
+        default:
+            return "scalar";
+        }
+    }
+
+    // Inverts the n x n matrix a in place by Gauss-Jordan elimination.
+    static bool invert(std::vector<uint8_t> &a, int n)
+    {
+        const Field &f = field();
+        std::vector<uint8_t> inverse(n * n, 0);
+        for (int i = 0; i < n; i++)
+            inverse[i * n + i] = 1;
+        for (int col = 0; col < n; col++)
+        {
+            int pivot = col;
+            while (pivot < n && a[pivot * n + col] == 0)
+                pivot++;
+            if (pivot == n)
+                return false;
+            for (int j = 0; j < n; j++)
+            {
+                std::swap(a[col * n + j], a[pivot * n + j]);
+                std::swap(inverse[col * n + j], inverse[pivot * n + j]);
+            }
+            uint8_t scale = f.inv(a[col * n + col]);
+            for (int j = 0; j < n; j++)
+            {
+                a[col * n + j] = f.mul(a[col * n + j], scale);
+                inverse[col * n + j] = f.mul(inverse[col * n + j], scale);
+            }
+            for (int row = 0; row < n; row++)
+            {
+                uint8_t factor = a[row * n + col];
+                if (row == col || factor == 0)
+                    continue;
+                for (int j = 0; j < n; j++)
+                {
+                    a[row * n + j] ^= f.mul(factor, a[col * n + j]);
+                    inverse[row * n + j] ^= f.mul(factor, inverse[col * n + j]);
+                }
+            }
+        }
+        a = std::move(inverse);
+        return true;
+    }
+
+    ReedSolomon::ReedSolomon(int k, int m, Kernel kernel)
+        : k(k)
+        , m(m)
+        , kernel(supported(kernel) ? kernel : Kernel::SCALAR)
+        , generator((k + m) * k, 0)
+    {
+        if (k < 1 || m < 0 || k + m > 255)
+            throw std::invalid_argument("ReedSolomon: bad k + m");
+        const Field &f = field();
+        for (int i = 0; i < k; i++)
+            generator[i * k + i] = 1;
+        // x_i = k + i and y_j = j are distinct, so x_i + y_j is never 0.
+        for (int i = 0; i < m; i++)
+            for (int j = 0; j < k; j++)
+                generator[(k + i) * k + j] = f.inv((k + i) ^ j);
+    }
+
+    void ReedSolomon::mul_add(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size) const
+    {
+        if (c == 0)
+            return;
+        alignas(16) uint8_t low[16];
+        alignas(16) uint8_t high[16];
+        nibble_tables(c, low, high);
+        switch (kernel)
+        {
+        case Kernel::AVX2:
+            mul_add_avx2(dst, src, low, high, size);
+            break;
+        case Kernel::SSSE3:
+            mul_add_ssse3(dst, src, low, high, size);
+            break;
+        default:
+            mul_add_scalar(dst, src, low, high, size);
+            break;
+        }
+    }
+
+    void ReedSolomon::encode(const uint8_t *const *data, uint8_t *const *parity, size_t size) const
+    {
+        for (int i = 0; i < m; i++)
+        {
+            std::memset(parity[i], 0, size);
+            for (int j = 0; j < k; j++)
+                mul_add(parity[i], data[j], generator[(k + i) * k + j], size);
+        }
+    }
+
+    bool ReedSolomon::reconstruct(uint8_t *const *fragments, const std::vector<bool> &present,
+                                  size_t size) const
+    {
+        // The first k fragments present, and their rows of the generator.
+        std::vector<int> sources;
+        for (int i = 0; i < k + m && static_cast<int>(sources.size()) < k; i++)
+            if (present[i])
+                sources.push_back(i);
+        if (static_cast<int>(sources.size()) < k)
+            return false;
+
+        std::vector<uint8_t> decode(k * k);
+        for (int r = 0; r < k; r++)
+            std::memcpy(&decode[r * k], &generator[sources[r] * k], k);
+        if (!invert(decode, k))
+            return false;
+
+        for (int j = 0; j < k; j++)
+        {
+            if (present[j])
+                continue;
+            std::memset(fragments[j], 0, size);
+            for (int r = 0; r < k; r++)
+                mul_add(fragments[j], fragments[sources[r]], decode[j * k + r], size);
+        }
+        // Every data fragment is there now.
+        for (int i = 0; i < m; i++)
+        {
+            if (present[k + i])
+                continue;
+            std::memset(fragments[k + i], 0, size);
+            for (int j = 0; j < k; j++)
+                mul_add(fragments[k + i], fragments[j], generator[(k + i) * k + j], size);
+        }
+        return true;
+    }
+
+    std::vector<std::string> ReedSolomon::split(std::string_view chunk) const
+    {
+        size_t size = fragment_size(chunk.size());
+        std::vector<std::string> result(k + m, std::string(size, '\0'));
+        std::vector<const uint8_t *> data(k);
+        std::vector<uint8_t *> parity(m);
+        for (int j = 0; j < k; j++)
+        {
+            size_t offset = std::min(j * size, chunk.size());
+            chunk.substr(offset, size).copy(result[j].data(), size);
+            data[j] = reinterpret_cast<const uint8_t *>(result[j].data());
+        }
+        for (int i = 0; i < m; i++)
+            parity[i] = reinterpret_cast<uint8_t *>(result[k + i].data());
+        encode(data.data(), parity.data(), size);
+        return result;
+    }
+}
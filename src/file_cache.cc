@@ -0,0 +1,119 @@
+#include "file_cache.hh"
+#include "trace.hh"
+
+#include <algorithm>
+
+namespace raft
+{
+    FileCache::FileCache(size_t capacity)
+        : capacity(std::max<size_t>(capacity, 1))
+        , hit_count(0)
+        , miss_count(0)
+    {}
+
+    FileCache::~FileCache()
+    {
+        close_all();
+    }
+
+    FileCache::Handle &FileCache::entry(int uid, const std::string &path)
+    {
+        auto it = handles.find(uid);
+        if (it != handles.end())
+        {
+            lru.splice(lru.begin(), lru, it->second);
+            return *it->second;
+        }
+
+        if (lru.size() >= capacity)
+        {
+            close(lru.back());
+            handles.erase(lru.back().uid);
+            lru.pop_back();
+        }
+        lru.push_front(Handle{uid, path, MPI_FILE_NULL, nullptr});
+        handles[uid] = lru.begin();
+        return lru.front();
+    }
+
+    void FileCache::close(Handle &handle)
+    {
+        if (handle.file != MPI_FILE_NULL)
+        {
+            stats::TraceSpan span("mpi-io", "MPI_File_close");
+            MPI_File_close(&handle.file);
+        }
+        // Answers still sending from the mapping keep it alive.
+        handle.mapping.reset();
+    }
+
+    MPI_File FileCache::open(int uid, const std::string &path, int amode)
+    {
+        auto it = handles.find(uid);
+        if (it != handles.end() && it->second->file != MPI_FILE_NULL)
+        {
+            hit_count.fetch_add(1, std::memory_order_relaxed);
+            return entry(uid, path).file;
+        }
+        miss_count.fetch_add(1, std::memory_order_relaxed);
+
+        // Opened before taking an entry: a failed open evicts nothing.
+        MPI_File file;
+        {
+            stats::TraceSpan span("mpi-io", "MPI_File_open");
+            if (MPI_File_open(MPI_COMM_SELF, path.c_str(), amode, MPI_INFO_NULL, &file) != MPI_SUCCESS)
+                return MPI_FILE_NULL;
+        }
+        return entry(uid, path).file = file;
+    }
+
+    std::shared_ptr<MappedFile> FileCache::map(int uid, const std::string &path, uint64_t size)
+    {
+        auto it = handles.find(uid);
+        // Appends made the file outgrow the mapping: map it again.
+        if (it != handles.end() && it->second->mapping && it->second->mapping->size() >= size)
+        {
+            hit_count.fetch_add(1, std::memory_order_relaxed);
+            return entry(uid, path).mapping;
+        }
+        miss_count.fetch_add(1, std::memory_order_relaxed);
+
+        std::shared_ptr<MappedFile> mapping = MappedFile::map(path);
+        if (!mapping)
+            return nullptr;
+        return entry(uid, path).mapping = std::move(mapping);
+    }
+
+    void FileCache::evict(int uid)
+    {
+        auto it = handles.find(uid);
+        if (it == handles.end())
+            return;
+        close(*it->second);
+        lru.erase(it->second);
+        handles.erase(it);
+    }
+
+    void FileCache::evict_path(const std::string &path)
+    {
+        for (auto it = lru.begin(); it != lru.end();)
+        {
+            if (it->path != path)
+            {
+                ++it;
+                continue;
+            }
+            close(*it);
+            handles.erase(it->uid);
+            it = lru.erase(it);
+        }
+    }
+
+    void FileCache::close_all()
+    {
+        for (auto &handle : lru)
+            close(handle);
+        lru.clear();
+        handles.clear();
+    }
+}
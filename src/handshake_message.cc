@@ -6,16 +6,38 @@ namespace message
 {
 
     Handshake_message::Handshake_message(HandshakeStatus status, int target_rank, int sender_rank)
-        : Message(MessageType::REPL, sender_rank, target_rank)
+        : Message(MessageType::HANDSHAKE, sender_rank, target_rank)
         , status(status)
+        , uid(-1)
     {}
 
-    Handshake_message::Handshake_message(HandshakeStatus status, int target_rank, int sender_rank, json custom_data)
-        : Message(MessageType::REPL, sender_rank, target_rank)
+    Handshake_message::Handshake_message(HandshakeStatus status, int target_rank, int sender_rank, int uid)
+        : Message(MessageType::HANDSHAKE, sender_rank, target_rank)
         , status(status)
-        , custom_data(custom_data)
+        , uid(uid)
+    {}
+
+    Handshake_message::Handshake_message(HandshakeStatus status, int target_rank, int sender_rank, std::vector<int> uids)
+        : Message(MessageType::HANDSHAKE, sender_rank, target_rank)
+        , status(status)
+        , uid(-1)
+        , uids(std::move(uids))
     {}
     
+    void Handshake_message::set_data(uint64_t offset, std::string data)
+    {
+        auto owned = std::make_shared<const std::string>(std::move(data));
+        set_data(offset, *owned, owned);
+    }
+
+    void Handshake_message::set_data(uint64_t offset, std::string_view data,
+                                     std::shared_ptr<const void> owner)
+    {
+        this->offset = offset;
+        this->data = data;
+        this->data_owner = std::move(owner);
+    }
+
     json Handshake_message::serialize_json() const
     {
         json j;
@@ -24,19 +46,85 @@ namespace message
         j["TARGET"] = this->target_rank;
         json data;
         data["STATUS"] = this->status;
-        data["CUSTOM_DATA"] = this->custom_data;
+        json custom_data;
+        if (this->uid >= 0)
+            custom_data["UID"] = this->uid;
+        if (!this->uids.empty())
+            custom_data["UIDS"] = this->uids;
+        data["CUSTOM_DATA"] = custom_data;
+        if (this->request_id != 0)
+            data["REQUEST_ID"] = this->request_id;
+        if (this->index != 0)
+            data["INDEX"] = this->index;
+        if (this->size != 0)
+            data["SIZE"] = this->size;
+        if (this->offset != 0)
+            data["OFFSET"] = this->offset;
+        if (!this->data.empty())
+            data["DATA"] = std::string(this->data);
         j["HANDSHAKE"] = data;
 
 
         return j;
     }
 
-    std::shared_ptr<Handshake_message> Handshake_message::deserialize(const std::string &message)
+    void Handshake_message::accept(Visitor &visitor)
+    {
+        visitor.visit(std::static_pointer_cast<Handshake_message>(shared_from_this()));
+    }
+
+    void Handshake_message::serialize_payload(wire::Writer &writer) const
+    {
+        writer.put<uint8_t>(this->status);
+        writer.put<int32_t>(this->uid);
+        writer.put_vector(this->uids);
+        writer.put<uint64_t>(this->request_id);
+        writer.put<uint64_t>(this->index);
+        writer.put<uint64_t>(this->size);
+        writer.put<uint64_t>(this->offset);
+        // The bytes follow as the trailer.
+        writer.put<uint32_t>(this->data.size());
+    }
+
+    std::shared_ptr<Handshake_message> Handshake_message::deserialize(const json &j)
     {
-       json j = json::parse(message); 
        HandshakeStatus status = static_cast<HandshakeStatus>(j["HANDSHAKE"]["STATUS"]);
-       auto bite = std::make_shared<Handshake_message>(status, j["TARGET"], j["SENDER"]);
+       const json &custom_data = j["HANDSHAKE"]["CUSTOM_DATA"];
+       std::shared_ptr<Handshake_message> bite;
+       if (custom_data.contains("UIDS"))
+           bite = std::make_shared<Handshake_message>(status, j["TARGET"], j["SENDER"],
+                                                      custom_data["UIDS"].get<std::vector<int>>());
+       else if (custom_data.contains("UID"))
+           bite = std::make_shared<Handshake_message>(status, j["TARGET"], j["SENDER"],
+                                                      custom_data["UID"].get<int>());
+       else
+           bite = std::make_shared<Handshake_message>(status, j["TARGET"], j["SENDER"]);
+       bite->set_request_id(j["HANDSHAKE"].value("REQUEST_ID", uint64_t(0)));
+       bite->set_index(j["HANDSHAKE"].value("INDEX", uint64_t(0)));
+       bite->set_size(j["HANDSHAKE"].value("SIZE", uint64_t(0)));
+       bite->set_data(j["HANDSHAKE"].value("OFFSET", uint64_t(0)),
+                      j["HANDSHAKE"].value("DATA", std::string()));
 
        return bite;
     }
-}
\ No newline at end of file
+
+    std::shared_ptr<Handshake_message> Handshake_message::deserialize(wire::Reader &reader, int sender_rank, int target_rank)
+    {
+       HandshakeStatus status = static_cast<HandshakeStatus>(reader.get<uint8_t>());
+       int uid = reader.get<int32_t>();
+       std::vector<int> uids = reader.get_vector<int>();
+       uint64_t request_id = reader.get<uint64_t>();
+       uint64_t index = reader.get<uint64_t>();
+       uint64_t size = reader.get<uint64_t>();
+       uint64_t offset = reader.get<uint64_t>();
+       std::string data = reader.get_string();
+       auto bite = uids.empty()
+           ? std::make_shared<Handshake_message>(status, target_rank, sender_rank, uid)
+           : std::make_shared<Handshake_message>(status, target_rank, sender_rank, std::move(uids));
+       bite->set_request_id(request_id);
+       bite->set_index(index);
+       bite->set_size(size);
+       bite->set_data(offset, std::move(data));
+       return bite;
+    }
+}
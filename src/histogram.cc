@@ -0,0 +1,105 @@
+#include "histogram.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <stdexcept>
+
+namespace stats
+{
+    Histogram::Histogram()
+        : counts(BUCKETS)
+        , total(0)
+        , max_value(0)
+    {}
+
+    size_t Histogram::bucket_of(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+            return value;
+        int shift = std::bit_width(value) - 1 - PRECISION;
+        return SUB_BUCKETS * (shift + 1) + ((value >> shift) - SUB_BUCKETS);
+    }
+
+    uint64_t Histogram::highest_of(size_t bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+            return bucket;
+        int shift = bucket / SUB_BUCKETS - 1;
+        uint64_t lowest = (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+        return lowest + ((uint64_t(1) << shift) - 1);
+    }
+
+    void Histogram::record(uint64_t value)
+    {
+        counts[bucket_of(value)]++;
+        total++;
+        max_value = std::max(max_value, value);
+    }
+
+    void Histogram::merge(const Histogram &other)
+    {
+        for (size_t i = 0; i < BUCKETS; i++)
+            counts[i] += other.counts[i];
+        total += other.total;
+        max_value = std::max(max_value, other.max_value);
+    }
+
+    void Histogram::reduce(MPI_Comm comm, int root)
+    {
+        int rank;
+        MPI_Comm_rank(comm, &rank);
+        const void *send_counts = rank == root ? MPI_IN_PLACE : counts.data();
+        const void *send_total = rank == root ? MPI_IN_PLACE : &total;
+        const void *send_max = rank == root ? MPI_IN_PLACE : &max_value;
+        MPI_Reduce(send_counts, counts.data(), BUCKETS, MPI_UINT64_T, MPI_SUM, root, comm);
+        MPI_Reduce(send_total, &total, 1, MPI_UINT64_T, MPI_SUM, root, comm);
+        MPI_Reduce(send_max, &max_value, 1, MPI_UINT64_T, MPI_MAX, root, comm);
+    }
+
+    void Histogram::clear()
+    {
+        std::fill(counts.begin(), counts.end(), 0);
+        total = 0;
+        max_value = 0;
+    }
+
+    uint64_t Histogram::percentile(double q) const
+    {
+        if (total == 0)
+            return 0;
+        uint64_t rank = std::max<uint64_t>(1, std::ceil(q * total));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; i++)
+        {
+            seen += counts[i];
+            if (seen >= rank)
+                return std::min(highest_of(i), max_value);
+        }
+        return max_value;
+    }
+
+    std::vector<std::pair<uint64_t, uint64_t>> Histogram::buckets() const
+    {
+        std::vector<std::pair<uint64_t, uint64_t>> result;
+        for (size_t i = 0; i < BUCKETS; i++)
+            if (counts[i] > 0)
+                result.emplace_back(i, counts[i]);
+        return result;
+    }
+
+    Histogram Histogram::from_buckets(const std::vector<std::pair<uint64_t, uint64_t>> &buckets,
+                                      uint64_t max)
+    {
+        Histogram histogram;
+        for (const auto &[bucket, count] : buckets)
+        {
+            if (bucket >= BUCKETS)
+                throw std::invalid_argument("Histogram: invalid bucket");
+            histogram.counts[bucket] += count;
+            histogram.total += count;
+        }
+        histogram.max_value = max;
+        return histogram;
+    }
+}
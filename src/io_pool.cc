@@ -0,0 +1,149 @@
+#include "io_pool.hh"
+
+#include <mpi.h>
+
+#include "metrics.hh"
+#include "trace.hh"
+
+namespace raft
+{
+    IoPool::IoPool(int workers, size_t queue_capacity)
+        : capacity(queue_capacity)
+        , stopping(false)
+        , ready(0)
+        , running(0)
+        , submitted(0)
+        , polled(0)
+    {
+        int provided = MPI_THREAD_SINGLE;
+        MPI_Query_thread(&provided);
+        if (provided < MPI_THREAD_MULTIPLE)
+            workers = 0;
+
+        for (int i = 0; i < workers; i++)
+        {
+            this->workers.push_back(std::make_unique<Worker>());
+            Worker &worker = *this->workers.back();
+            worker.thread = std::thread([this, &worker] { run(worker); });
+        }
+    }
+
+    IoPool::~IoPool()
+    {
+        stopping.store(true, std::memory_order_release);
+        for (auto &worker : workers)
+        {
+            // Under the mutex, so a worker about to wait sees the flag.
+            std::lock_guard lock(worker->mutex);
+            worker->wakeup.notify_one();
+        }
+        for (auto &worker : workers)
+            worker->thread.join();
+    }
+
+    bool IoPool::submit(size_t key, Task task, Callback done)
+    {
+        if (full(key))
+            return false;
+        submitted++;
+
+        if (workers.empty())
+        {
+            bool success;
+            {
+                stats::ScopedTimer timer(stats::FILE_IO);
+                success = task();
+            }
+            complete(Job{nullptr, std::move(done), 0}, success);
+            return true;
+        }
+
+        {
+            std::lock_guard lock(completion_mutex);
+            running++;
+        }
+        Worker &worker = *workers[shard_of(key)];
+        std::lock_guard lock(worker.mutex);
+        worker.jobs.push_back(Job{std::move(task), std::move(done), stats::Metrics::now()});
+        worker.wakeup.notify_one();
+        return true;
+    }
+
+    bool IoPool::full(size_t key) const
+    {
+        if (workers.empty())
+            return false;
+        Worker &worker = *workers[shard_of(key)];
+        std::lock_guard lock(worker.mutex);
+        return worker.jobs.size() >= capacity;
+    }
+
+    size_t IoPool::poll()
+    {
+        if (ready.load() == 0)
+            return 0;
+
+        std::vector<std::pair<Callback, bool>> finished;
+        {
+            std::lock_guard lock(completion_mutex);
+            finished.swap(completions);
+            ready = 0;
+        }
+        for (auto &[done, success] : finished)
+        {
+            polled++;
+            if (done)
+                done(success);
+        }
+        return finished.size();
+    }
+
+    void IoPool::drain()
+    {
+        std::unique_lock lock(completion_mutex);
+        idle.wait(lock, [this] { return running == 0; });
+    }
+
+    void IoPool::discard()
+    {
+        drain();
+        std::lock_guard lock(completion_mutex);
+        polled += completions.size();
+        completions.clear();
+        ready = 0;
+    }
+
+    void IoPool::run(Worker &worker)
+    {
+        while (true)
+        {
+            Job job;
+            {
+                std::unique_lock lock(worker.mutex);
+                worker.wakeup.wait(lock, [&] { return stopping.load(std::memory_order_acquire) || !worker.jobs.empty(); });
+                if (worker.jobs.empty())
+                    return;
+                job = std::move(worker.jobs.front());
+                worker.jobs.pop_front();
+            }
+            uint64_t start = stats::Metrics::now();
+            stats::metrics().record(stats::IO_WAIT, start - job.queued_at);
+            bool success;
+            {
+                stats::TraceSpan span("io", "task");
+                success = job.task();
+            }
+            stats::metrics().record(stats::FILE_IO, stats::Metrics::now() - start);
+            complete(std::move(job), success);
+        }
+    }
+
+    void IoPool::complete(Job &&job, bool success)
+    {
+        std::lock_guard lock(completion_mutex);
+        completions.emplace_back(std::move(job.done), success);
+        ready++;
+        if (job.task && --running == 0)
+            idle.notify_all();
+    }
+}
@@ -2,12 +2,18 @@
 #include <string>
 #include "repl.hh"
 #include "raft_server.hh"
+#include "client.hh"
+#include "routing.hh"
+#include "options.hh"
+#include "trace.hh"
 
 int main (int argc, char *argv[])
 {
-    int rank, size;
+    int rank, size, provided;
 
-    MPI_Init(&argc, &argv);
+    // Servers run their file I/O on worker threads, IoPool falls back to
+    // inline I/O when the MPI library cannot provide this level.
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
 
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
@@ -19,22 +25,52 @@ int main (int argc, char *argv[])
     int nb_clients = std::stoi(argv[2]);
     nb_clients = nb_clients;
 
+    Options options = Options::parse(argc, argv, 3);
+    message::Message::set_wire_format(options.wire_format);
+    logging::level = options.log_level;
+    // Traced ranks stop cleanly when the job is interrupted, to write it.
+    if (!options.trace.empty())
+    {
+        stats::Trace::start(MPI_COMM_WORLD, options.trace, options.trace_events);
+        Server::stop_on_signals();
+    }
+
+    // Client ranks merge their results among themselves.
+    MPI_Comm clients;
+    MPI_Comm_split(MPI_COMM_WORLD, rank > nb_servers ? 0 : MPI_UNDEFINED, rank, &clients);
+
+    // Each Raft group gets the communicator of its servers.
+    raft::RoutingTable routing(nb_servers, options.groups);
+    int group_color = routing.group_of_rank(rank);
+    MPI_Comm group;
+    MPI_Comm_split(MPI_COMM_WORLD, group_color >= 0 ? group_color : MPI_UNDEFINED, rank, &group);
+
+    std::string role;
     if (rank == 0)
     {
         //std::cout << rank << ": I'm the REPL" << std::endl;
+        role = "repl";
         repl::REPL repl(MPI_COMM_WORLD, nb_servers);
         repl.run();
     }
     else if (rank < nb_servers + 1)
     {
         //std::cout << rank << ": I'm a server" << std::endl;
-        raft::RaftServer server(MPI_COMM_WORLD, nb_servers);
+        role = "server";
+        raft::RaftServer server(MPI_COMM_WORLD, group, nb_servers, options);
         server.run();
+        MPI_Comm_free(&group);
     }
     else
     {
         //std::cout << rank << ": I'm a client" << std::endl;
+        role = "client";
+        client::Client client(MPI_COMM_WORLD, clients, nb_servers, options);
+        client.run();
+        client.report();
+        MPI_Comm_free(&clients);
     }
+    stats::Trace::dump(role);
     MPI_Finalize();
     
     return 0;
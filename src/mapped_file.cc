@@ -0,0 +1,63 @@
+#include "mapped_file.hh"
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace raft
+{
+    // Pages read ahead of a sequential reader, in multiples of its reads.
+    static constexpr uint64_t READAHEAD_READS = 4;
+
+    std::shared_ptr<MappedFile> MappedFile::map(const std::string &path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return nullptr;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            ::close(fd);
+            return nullptr;
+        }
+        void *base = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        // The mapping keeps the file alive.
+        ::close(fd);
+        if (base == MAP_FAILED)
+            return nullptr;
+        return std::shared_ptr<MappedFile>(new MappedFile(static_cast<char *>(base), info.st_size));
+    }
+
+    MappedFile::MappedFile(char *base, uint64_t length)
+        : base(base)
+        , length(length)
+        , read_end(0)
+        , sequential(false)
+    {}
+
+    MappedFile::~MappedFile()
+    {
+        munmap(base, length);
+    }
+
+    void MappedFile::advise(uint64_t offset, uint64_t size)
+    {
+        static const uint64_t page = sysconf(_SC_PAGESIZE);
+        uint64_t end = std::min(offset + size, length);
+        if (offset == read_end && offset > 0)
+        {
+            if (!sequential)
+                madvise(base, length, MADV_SEQUENTIAL);
+            sequential = true;
+            end = std::min(end + READAHEAD_READS * size, length);
+        }
+        read_end = std::min(offset + size, length);
+
+        uint64_t begin = offset / page * page;
+        if (begin < end)
+            madvise(base + begin, end - begin, MADV_WILLNEED);
+    }
+}
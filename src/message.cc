@@ -3,52 +3,112 @@
 #include <iostream>
 #include "repl_message.hh"
 #include "handshake_message.hh"
+#include "client_message.hh"
+#include "rpc_message.hh"
 
 namespace message
 {
+    static wire::Format wire_format = wire::Format::BINARY;
+
     Message::Message(MessageType type, int sender_rank, int target_rank)
         : type(type)
         , sender_rank(sender_rank)
         , target_rank(target_rank)
     {}
 
+    void Message::set_wire_format(wire::Format format)
+    {
+        wire_format = format;
+    }
+
+    wire::Format Message::get_wire_format()
+    {
+        return wire_format;
+    }
+
     std::string Message::serialize() const
     {
-        json j;
-        switch (type)
+        if (wire_format == wire::Format::JSON)
+            return this->serialize_json().dump();
+
+        std::string buffer;
+        serialize_binary(buffer);
+        return buffer;
+    }
+
+    void Message::serialize_binary(std::string &buffer, bool with_trailer) const
+    {
+        wire::Writer writer(buffer);
+        size_t frame = writer.begin_frame(type, sender_rank, target_rank);
+        this->serialize_payload(writer);
+        std::string_view trailer = get_trailer();
+        if (with_trailer)
+            writer.put_bytes(trailer.data(), trailer.size());
+        writer.end_frame(frame, with_trailer ? 0 : trailer.size());
+    }
+
+    std::shared_ptr<Message> Message::deserialize(const char *data, size_t size)
+    {
+        if (wire::is_binary(data, size))
+        {
+            wire::Reader reader(data, size);
+            return deserialize_binary(reader);
+        }
+        return deserialize_json(json::parse(data, data + size));
+    }
+
+    std::shared_ptr<Message> Message::deserialize(const std::string &message)
+    {
+        return deserialize(message.data(), message.size());
+    }
+
+    std::shared_ptr<Message> Message::deserialize_binary(wire::Reader &reader)
+    {
+        wire::Header header = reader.get_header();
+        const size_t end = reader.position() + header.payload_size;
+
+        std::shared_ptr<Message> message;
+        switch (static_cast<MessageType>(header.type))
         {
         case MessageType::REPL:
-            j = this->serialize_json();
+            message = repl::REPL_message::deserialize(reader, header.sender, header.target);
             break;
         case MessageType::RPC:
-            j = this->serialize_json();
+            message = rpc::RPC_message::deserialize(reader, header.sender, header.target);
             break;
         case MessageType::HANDSHAKE:
-            j = this->serialize_json();
+            message = Handshake_message::deserialize(reader, header.sender, header.target);
+            break;
+        case MessageType::CLIENT:
+            message = Client_message::deserialize(reader, header.sender, header.target);
             break;
         default:
             throw std::runtime_error("Unknown message type");
         }
-        
-        return j.dump();
+
+        if (reader.position() != end)
+            throw std::runtime_error("wire: payload size mismatch");
+        return message;
     }
 
-    std::shared_ptr<Message> Message::deserialize(const std::string &message)
+    std::shared_ptr<Message> Message::deserialize_json(const json &j)
     {
-        json j = json::parse(message);
         MessageType type = static_cast<MessageType>(j["MESSAGE_TYPE"]);
         if (type == MessageType::REPL)
         {
-          return repl::REPL_message::deserialize(message);
+          return repl::REPL_message::deserialize(j);
         }
         else if (type == MessageType::RPC) // RPC
         {
-            // return rpc::RPC_message::deserialize(message);
-            throw std::runtime_error("not implemented");
+            return rpc::RPC_message::deserialize(j);
         }
         else if (type == MessageType::HANDSHAKE)
         {
-            return Handshake_message::deserialize(message);
+            return Handshake_message::deserialize(j);
+        }
+        else if (type == MessageType::CLIENT)
+        {
+            return Client_message::deserialize(j);
         }
         else
         {
@@ -0,0 +1,146 @@
+#include "metadata_index.hh"
+
+#include <stdexcept>
+
+namespace raft
+{
+    static constexpr size_t INITIAL_SLOTS = 64;
+
+    MetadataIndex::MetadataIndex(int first_uid, int uid_stride)
+        : slots(INITIAL_SLOTS, Slot{0, EMPTY})
+        , mask(INITIAL_SLOTS - 1)
+        , first(first_uid)
+        , stride(uid_stride)
+        , next(first_uid)
+    {}
+
+    size_t MetadataIndex::home(int uid) const
+    {
+        // Fibonacci hashing spreads consecutive uids over the table.
+        return (static_cast<uint64_t>(static_cast<uint32_t>(uid)) * 0x9E3779B97F4A7C15ull >> 32) & mask;
+    }
+
+    size_t MetadataIndex::probe(int uid) const
+    {
+        size_t i = home(uid);
+        while (slots[i].position != EMPTY && slots[i].uid != uid)
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    void MetadataIndex::grow()
+    {
+        std::vector<Slot> old = std::move(slots);
+        slots.assign(old.size() * 2, Slot{0, EMPTY});
+        mask = slots.size() - 1;
+        for (const Slot &slot : old)
+        {
+            if (slot.position != EMPTY)
+                slots[probe(slot.uid)] = slot;
+        }
+    }
+
+    FileMeta &MetadataIndex::create(std::string name)
+    {
+        int uid;
+        if (free_list.empty())
+        {
+            uid = next;
+            next += stride;
+        }
+        else
+        {
+            uid = free_list.back();
+            free_list.pop_back();
+        }
+        return insert(uid, std::move(name), 0);
+    }
+
+    FileMeta &MetadataIndex::insert(int uid, std::string name, uint64_t size)
+    {
+        // Keep the load factor under 3/4.
+        if ((files.size() + 1) * 4 > slots.size() * 3)
+            grow();
+
+        size_t i = probe(uid);
+        if (slots[i].position != EMPTY)
+            throw std::runtime_error("MetadataIndex: uid " + std::to_string(uid) + " already used");
+        slots[i] = Slot{uid, static_cast<int32_t>(files.size())};
+        files.push_back(FileMeta{uid, std::move(name), size, 0, ReplicaState::CLEAN, false, false, false, false, false, 0});
+        return files.back();
+    }
+
+    FileMeta *MetadataIndex::find(int uid)
+    {
+        size_t i = probe(uid);
+        return slots[i].position == EMPTY ? nullptr : &files[slots[i].position];
+    }
+
+    const FileMeta *MetadataIndex::find(int uid) const
+    {
+        size_t i = probe(uid);
+        return slots[i].position == EMPTY ? nullptr : &files[slots[i].position];
+    }
+
+    bool MetadataIndex::erase(int uid)
+    {
+        size_t i = probe(uid);
+        if (slots[i].position == EMPTY)
+            return false;
+
+        // Move the last file into the hole to keep files dense.
+        int32_t position = slots[i].position;
+        if (static_cast<size_t>(position) != files.size() - 1)
+        {
+            files[position] = std::move(files.back());
+            slots[probe(files[position].uid)].position = position;
+        }
+        files.pop_back();
+
+        // Backward shift: pull later entries of the probe chain into the
+        // hole unless that would move them before their home slot.
+        size_t hole = i;
+        size_t j = i;
+        while (true)
+        {
+            j = (j + 1) & mask;
+            if (slots[j].position == EMPTY)
+                break;
+            size_t h = home(slots[j].uid);
+            if (((j - h) & mask) >= ((j - hole) & mask))
+            {
+                slots[hole] = slots[j];
+                hole = j;
+            }
+        }
+        slots[hole].position = EMPTY;
+
+        free_list.push_back(uid);
+        return true;
+    }
+
+    void MetadataIndex::clear()
+    {
+        files.clear();
+        slots.assign(INITIAL_SLOTS, Slot{0, EMPTY});
+        mask = INITIAL_SLOTS - 1;
+        next = first;
+        free_list.clear();
+    }
+
+    std::vector<int> MetadataIndex::list() const
+    {
+        std::vector<int> uids;
+        uids.reserve(files.size());
+        for (const FileMeta &file : files)
+            if (!file.uploading)
+                uids.push_back(file.uid);
+        return uids;
+    }
+
+    void MetadataIndex::restore_allocator(int next_uid, std::vector<int> free_uids)
+    {
+        next = next_uid;
+        free_list = std::move(free_uids);
+    }
+}
@@ -0,0 +1,170 @@
+#include "metrics.hh"
+
+#include <iomanip>
+
+namespace stats
+{
+    static const char *const KIND_NAMES[] = {
+        "repl", "handshake", "client", "append_entries", "append_entries_response",
+        "install_snapshot", "install_snapshot_response", "fragment_request", "fragment_response",
+        "request_vote", "request_vote_response", "timeout_now", "leader_notice",
+    };
+    static const char *const COUNTER_NAMES[] = {"bytes_received", "bytes_sent", "elections"};
+    static const char *const GAUGE_NAMES[] = {"message_queue", "io_pending", "commit_lag",
+                                              "apply_lag"};
+    static const char *const LATENCY_NAMES[] = {"serialize", "deserialize", "io_wait", "file_io"};
+
+    Metrics &Metrics::instance()
+    {
+        static Metrics registry;
+        return registry;
+    }
+
+    const char *Metrics::name_of(MessageKind kind)
+    {
+        return KIND_NAMES[kind];
+    }
+
+    Metrics::Shard &Metrics::local()
+    {
+        thread_local Shard *shard = nullptr;
+        if (!shard)
+        {
+            std::lock_guard lock(shards_mutex);
+            shards.push_back(std::make_unique<Shard>());
+            shard = shards.back().get();
+        }
+        return *shard;
+    }
+
+    void Metrics::received(MessageKind kind, uint64_t bytes)
+    {
+        Shard &shard = local();
+        add(shard.received[kind], 1);
+        add(shard.counters[BYTES_RECEIVED], bytes);
+    }
+
+    void Metrics::sent(MessageKind kind, uint64_t bytes)
+    {
+        Shard &shard = local();
+        add(shard.sent[kind], 1);
+        add(shard.counters[BYTES_SENT], bytes);
+    }
+
+    void Metrics::record(Latency latency, uint64_t nanoseconds)
+    {
+        Shard &shard = local();
+        std::lock_guard lock(shard.mutex);
+        shard.latencies[latency].record(nanoseconds);
+    }
+
+    nlohmann::json Metrics::snapshot() const
+    {
+        std::array<uint64_t, MESSAGE_KINDS> received{};
+        std::array<uint64_t, MESSAGE_KINDS> sent{};
+        std::array<uint64_t, COUNTERS> counters{};
+        std::array<Histogram, LATENCIES> latencies;
+        {
+            std::lock_guard lock(shards_mutex);
+            for (const auto &shard : shards)
+            {
+                for (int i = 0; i < MESSAGE_KINDS; i++)
+                {
+                    received[i] += shard->received[i].load(std::memory_order_relaxed);
+                    sent[i] += shard->sent[i].load(std::memory_order_relaxed);
+                }
+                for (int i = 0; i < COUNTERS; i++)
+                    counters[i] += shard->counters[i].load(std::memory_order_relaxed);
+                std::lock_guard shard_lock(shard->mutex);
+                for (int i = 0; i < LATENCIES; i++)
+                    latencies[i].merge(shard->latencies[i]);
+            }
+        }
+
+        nlohmann::json j;
+        for (int i = 0; i < MESSAGE_KINDS; i++)
+        {
+            j["RECEIVED"][KIND_NAMES[i]] = received[i];
+            j["SENT"][KIND_NAMES[i]] = sent[i];
+        }
+        for (int i = 0; i < COUNTERS; i++)
+            j["COUNTERS"][COUNTER_NAMES[i]] = counters[i];
+        for (int i = 0; i < GAUGES; i++)
+            j["GAUGES"][GAUGE_NAMES[i]] = gauges[i].load(std::memory_order_relaxed);
+        for (int i = 0; i < LATENCIES; i++)
+        {
+            j["LATENCIES"][LATENCY_NAMES[i]]["MAX"] = latencies[i].max();
+            j["LATENCIES"][LATENCY_NAMES[i]]["BUCKETS"] = latencies[i].buckets();
+        }
+        return j;
+    }
+
+    void Metrics::print(std::ostream &out, const std::vector<nlohmann::json> &snapshots)
+    {
+        std::array<uint64_t, MESSAGE_KINDS> received{};
+        std::array<uint64_t, MESSAGE_KINDS> sent{};
+        std::array<uint64_t, COUNTERS> counters{};
+        std::array<Histogram, LATENCIES> latencies;
+        for (const nlohmann::json &j : snapshots)
+        {
+            for (int i = 0; i < MESSAGE_KINDS; i++)
+            {
+                received[i] += j["RECEIVED"].value(KIND_NAMES[i], uint64_t(0));
+                sent[i] += j["SENT"].value(KIND_NAMES[i], uint64_t(0));
+            }
+            for (int i = 0; i < COUNTERS; i++)
+                counters[i] += j["COUNTERS"].value(COUNTER_NAMES[i], uint64_t(0));
+            for (int i = 0; i < LATENCIES; i++)
+            {
+                const nlohmann::json &latency = j["LATENCIES"][LATENCY_NAMES[i]];
+                latencies[i].merge(Histogram::from_buckets(
+                    latency["BUCKETS"].get<std::vector<std::pair<uint64_t, uint64_t>>>(),
+                    latency["MAX"].get<uint64_t>()));
+            }
+        }
+
+        out << std::fixed << std::setprecision(1);
+        out << "ranks:";
+        for (const nlohmann::json &j : snapshots)
+            out << " " << j.value("RANK", -1);
+        out << std::endl;
+
+        out << std::left << std::setw(28) << "message" << std::right << std::setw(12)
+            << "received" << std::setw(12) << "sent" << std::endl;
+        for (int i = 0; i < MESSAGE_KINDS; i++)
+        {
+            if (received[i] == 0 && sent[i] == 0)
+                continue;
+            out << std::left << std::setw(28) << KIND_NAMES[i] << std::right << std::setw(12)
+                << received[i] << std::setw(12) << sent[i] << std::endl;
+        }
+        for (int i = 0; i < COUNTERS; i++)
+            out << (i > 0 ? ", " : "") << COUNTER_NAMES[i] << ": " << counters[i];
+        out << std::endl;
+
+        out << std::left << std::setw(28) << "gauge" << std::right;
+        for (const nlohmann::json &j : snapshots)
+            out << std::setw(12) << ("rank " + std::to_string(j.value("RANK", -1)));
+        out << std::endl;
+        for (int i = 0; i < GAUGES; i++)
+        {
+            out << std::left << std::setw(28) << GAUGE_NAMES[i] << std::right;
+            for (const nlohmann::json &j : snapshots)
+                out << std::setw(12) << j["GAUGES"].value(GAUGE_NAMES[i], int64_t(0));
+            out << std::endl;
+        }
+
+        auto us = [](uint64_t ns) { return ns / 1000.0; };
+        out << std::left << std::setw(28) << "latency" << std::right << std::setw(12) << "count"
+            << std::setw(12) << "p50(us)" << std::setw(12) << "p99(us)" << std::setw(12)
+            << "max(us)" << std::endl;
+        for (int i = 0; i < LATENCIES; i++)
+        {
+            const Histogram &histogram = latencies[i];
+            out << std::left << std::setw(28) << LATENCY_NAMES[i] << std::right << std::setw(12)
+                << histogram.count() << std::setw(12) << us(histogram.percentile(0.5))
+                << std::setw(12) << us(histogram.percentile(0.99)) << std::setw(12)
+                << us(histogram.max()) << std::endl;
+        }
+    }
+}
@@ -0,0 +1,194 @@
+#include "options.hh"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string_view>
+
+// load:5,list:10,append:80,delete:5,read:0, missing actions get no weight.
+static std::array<int, 5> parse_mix(const std::string &value)
+{
+    static const char *const names[] = {"load", "list", "append", "delete", "read"};
+    std::array<int, 5> mix = {0, 0, 0, 0, 0};
+    size_t begin = 0;
+    while (begin < value.size())
+    {
+        size_t end = value.find(',', begin);
+        if (end == std::string::npos)
+            end = value.size();
+        std::string item = value.substr(begin, end - begin);
+        size_t colon = item.find(':');
+        if (colon == std::string::npos)
+            throw std::invalid_argument("Invalid mix: " + value);
+
+        auto name = std::find(std::begin(names), std::end(names), item.substr(0, colon));
+        if (name == std::end(names))
+            throw std::invalid_argument("Invalid mix action: " + item);
+        mix[name - std::begin(names)] = std::stoi(item.substr(colon + 1));
+        begin = end + 1;
+    }
+    return mix;
+}
+
+// fixed:<size>, uniform:<min>-<max> or exp:<mean>[-<max>].
+static void parse_payload(const std::string &value, Options &options)
+{
+    size_t colon = value.find(':');
+    std::string kind = value.substr(0, colon);
+    std::string sizes = colon == std::string::npos ? "" : value.substr(colon + 1);
+    size_t dash = sizes.find('-');
+    if (sizes.empty())
+        throw std::invalid_argument("Invalid payload: " + value);
+    options.payload_min = std::stoi(sizes.substr(0, dash));
+
+    if (kind == "fixed")
+    {
+        options.payload = Options::Payload::FIXED;
+        options.payload_max = options.payload_min;
+    }
+    else if (kind == "uniform" && dash != std::string::npos)
+    {
+        options.payload = Options::Payload::UNIFORM;
+        options.payload_max = std::stoi(sizes.substr(dash + 1));
+    }
+    else if (kind == "exp")
+    {
+        options.payload = Options::Payload::EXPONENTIAL;
+        options.payload_max = dash == std::string::npos ? 16 * options.payload_min
+                                                        : std::stoi(sizes.substr(dash + 1));
+    }
+    else
+        throw std::invalid_argument("Invalid payload: " + value);
+}
+
+Options Options::parse(int argc, char *argv[], int first)
+{
+    Options options;
+    for (int i = first; i < argc; i++)
+    {
+        std::string_view arg(argv[i]);
+        size_t eq = arg.find('=');
+        if (arg.substr(0, 2) != "--" || eq == std::string_view::npos)
+            throw std::invalid_argument("Invalid option: " + std::string(arg));
+
+        std::string_view name = arg.substr(2, eq - 2);
+        std::string value(arg.substr(eq + 1));
+
+        if (name == "wire")
+        {
+            if (value == "binary")
+                options.wire_format = wire::Format::BINARY;
+            else if (value == "json")
+                options.wire_format = wire::Format::JSON;
+            else
+                throw std::invalid_argument("Invalid wire format: " + value);
+        }
+        else if (name == "log-level")
+        {
+            if (value == "error")
+                options.log_level = logging::Level::ERROR;
+            else if (value == "warn")
+                options.log_level = logging::Level::WARN;
+            else if (value == "info")
+                options.log_level = logging::Level::INFO;
+            else if (value == "debug")
+                options.log_level = logging::Level::DEBUG;
+            else
+                throw std::invalid_argument("Invalid log level: " + value);
+        }
+        else if (name == "data-dir")
+            options.data_dir = value;
+        else if (name == "max-inflight")
+            options.max_inflight = std::stoi(value);
+        else if (name == "max-batch")
+            options.max_batch = std::stoi(value);
+        else if (name == "client-batch")
+            options.client_batch = std::stoi(value);
+        else if (name == "groups")
+            options.groups = std::stoi(value);
+        else if (name == "heartbeat-ms")
+            options.heartbeat_ms = std::stoi(value);
+        else if (name == "lease-ms")
+            options.lease_ms = std::stoi(value);
+        else if (name == "election-ms")
+            options.election_ms = std::stoi(value);
+        else if (name == "fsync")
+        {
+            if (value == "always")
+                options.fsync = FsyncPolicy::ALWAYS;
+            else if (value == "group")
+                options.fsync = FsyncPolicy::GROUP;
+            else if (value == "none")
+                options.fsync = FsyncPolicy::NONE;
+            else
+                throw std::invalid_argument("Invalid fsync policy: " + value);
+        }
+        else if (name == "group-entries")
+            options.group_entries = std::stoi(value);
+        else if (name == "group-us")
+            options.group_us = std::stoi(value);
+        else if (name == "segment-mb")
+            options.segment_mb = std::stoi(value);
+        else if (name == "snapshot-entries")
+            options.snapshot_entries = std::stoi(value);
+        else if (name == "snapshot-chunk-kb")
+            options.snapshot_chunk_kb = std::stoi(value);
+        else if (name == "io-workers")
+            options.io_workers = std::stoi(value);
+        else if (name == "io-queue")
+            options.io_queue = std::stoi(value);
+        else if (name == "file-cache")
+            options.file_cache = std::stoi(value);
+        else if (name == "stripe-kb")
+            options.stripe_kb = std::stoi(value);
+        else if (name == "ec")
+        {
+            // <k>+<m>
+            size_t plus = value.find('+');
+            if (plus == std::string::npos)
+                throw std::invalid_argument("Invalid erasure code: " + value);
+            options.ec_data = std::stoi(value.substr(0, plus));
+            options.ec_parity = std::stoi(value.substr(plus + 1));
+        }
+        else if (name == "dedup-kb")
+            options.dedup_kb = std::stoi(value);
+        else if (name == "packed-kb")
+            options.packed_kb = std::stoi(value);
+        else if (name == "pack-segment-mb")
+            options.pack_segment_mb = std::stoi(value);
+        else if (name == "trace")
+            options.trace = value;
+        else if (name == "trace-events")
+            options.trace_events = std::stoi(value);
+        else if (name == "autostart")
+            options.autostart = value == "1" || value == "true";
+        else if (name == "duration-s")
+            options.duration_s = std::stoi(value);
+        else if (name == "outstanding")
+            options.outstanding = std::stoi(value);
+        else if (name == "rate")
+            options.rate = std::stod(value);
+        else if (name == "mix")
+            options.mix = parse_mix(value);
+        else if (name == "payload")
+            parse_payload(value, options);
+        else if (name == "request-timeout-ms")
+            options.request_timeout_ms = std::stoi(value);
+        else if (name == "chunk-kb")
+            options.chunk_kb = std::stoi(value);
+        else if (name == "window")
+            options.window = std::stoi(value);
+        else if (name == "follower-reads")
+            options.follower_reads = value == "1" || value == "true";
+        else if (name == "staleness-ms")
+            options.staleness_ms = std::stoi(value);
+        else if (name == "cache-mb")
+            options.cache_mb = std::stoi(value);
+        else if (name == "callback-ms")
+            options.callback_ms = std::stoi(value);
+        else
+        {
+            throw std::invalid_argument("Unknown option: " + std::string(name));
+        }
+    }
+    return options;
+}
@@ -0,0 +1,191 @@
+#include "raft_log.hh"
+
+#include <algorithm>
+
+namespace raft
+{
+    void LogEntry::serialize(wire::Writer &writer) const
+    {
+        writer.put<uint64_t>(term);
+        writer.put<uint8_t>(action);
+        writer.put<int32_t>(uid);
+        writer.put_string(filename);
+        writer.put_string(content);
+        writer.put<int32_t>(client_rank);
+        writer.put<uint64_t>(request_id);
+        writer.put<uint64_t>(offset);
+        writer.put<uint64_t>(length);
+        writer.put<int32_t>(fragment);
+        writer.put<uint32_t>(chunks.size());
+        for (const ChunkRef &chunk : chunks)
+        {
+            writer.put(chunk.id.digest);
+            writer.put<uint32_t>(chunk.size);
+            writer.put<uint8_t>(chunk.inlined);
+        }
+    }
+
+    LogEntry LogEntry::deserialize(wire::Reader &reader)
+    {
+        LogEntry entry;
+        entry.term = reader.get<uint64_t>();
+        entry.action = static_cast<message::ClientAction>(reader.get<uint8_t>());
+        entry.uid = reader.get<int32_t>();
+        entry.filename = reader.get_string();
+        entry.content = reader.get_string();
+        entry.client_rank = reader.get<int32_t>();
+        entry.request_id = reader.get<uint64_t>();
+        entry.offset = reader.get<uint64_t>();
+        entry.length = reader.get<uint64_t>();
+        entry.fragment = reader.get<int32_t>();
+        entry.chunks.resize(reader.get<uint32_t>());
+        for (ChunkRef &chunk : entry.chunks)
+        {
+            chunk.id.digest = reader.get<Sha256Digest>();
+            chunk.size = reader.get<uint32_t>();
+            chunk.inlined = reader.get<uint8_t>();
+        }
+        return entry;
+    }
+
+    json LogEntry::serialize_json() const
+    {
+        json j;
+        j["TERM"] = term;
+        j["ACTION"] = action;
+        j["UID"] = uid;
+        j["FILENAME"] = filename;
+        // Fragments are raw bytes, not UTF-8 text.
+        if (fragment >= 0)
+            j["SOME_TEXT"] = std::vector<uint8_t>(content.begin(), content.end());
+        else
+            j["SOME_TEXT"] = content;
+        j["CLIENT"] = client_rank;
+        j["REQUEST_ID"] = request_id;
+        j["OFFSET"] = offset;
+        j["LENGTH"] = length;
+        j["FRAGMENT"] = fragment;
+        if (!chunks.empty())
+        {
+            json array = json::array();
+            for (const ChunkRef &chunk : chunks)
+                array.push_back({chunk.id.hex(), chunk.size, chunk.inlined});
+            j["CHUNKS"] = array;
+        }
+        return j;
+    }
+
+    LogEntry LogEntry::deserialize(const json &j)
+    {
+        LogEntry entry;
+        entry.term = j["TERM"];
+        entry.action = static_cast<message::ClientAction>(j["ACTION"]);
+        entry.uid = j["UID"];
+        entry.filename = j["FILENAME"];
+        entry.client_rank = j["CLIENT"];
+        entry.request_id = j.value("REQUEST_ID", uint64_t(0));
+        entry.offset = j.value("OFFSET", uint64_t(0));
+        entry.length = j.value("LENGTH", uint64_t(0));
+        entry.fragment = j.value("FRAGMENT", LogEntry::PLAIN);
+        if (entry.fragment >= 0)
+        {
+            std::vector<uint8_t> bytes = j["SOME_TEXT"];
+            entry.content.assign(bytes.begin(), bytes.end());
+        }
+        else
+            entry.content = j["SOME_TEXT"];
+        if (j.contains("CHUNKS"))
+            for (const json &chunk : j["CHUNKS"])
+                entry.chunks.push_back(ChunkRef{ChunkId::from_hex(chunk[0].get<std::string>()),
+                                                chunk[1], chunk[2]});
+        return entry;
+    }
+
+    uint64_t LogEntry::bytes() const
+    {
+        if (chunks.empty())
+            return content.size();
+        uint64_t total = 0;
+        for (const ChunkRef &chunk : chunks)
+            total += chunk.size;
+        return total;
+    }
+
+    RaftLog::RaftLog()
+        : base_index(0)
+        , base_term(0)
+    {}
+
+    uint64_t RaftLog::term_at(uint64_t index) const
+    {
+        if (index == base_index)
+            return base_term;
+        if (index < base_index || index > last_index())
+            return 0;
+        return at(index)->term;
+    }
+
+    uint64_t RaftLog::append(EntryPtr entry)
+    {
+        entries.push_back(std::move(entry));
+        return last_index();
+    }
+
+    void RaftLog::truncate_from(uint64_t index)
+    {
+        if (index > base_index && index <= last_index())
+            entries.resize(index - base_index - 1);
+        released_sizes.erase(released_sizes.lower_bound(index), released_sizes.end());
+    }
+
+    void RaftLog::release(uint64_t index)
+    {
+        EntryPtr &entry = entries[index - base_index - 1];
+        if (released(index) || entry->content.empty())
+            return;
+        released_sizes[index] = entry->size();
+        entry = std::make_shared<LogEntry>(LogEntry{
+            entry->term, entry->action, entry->uid, entry->filename, std::string(),
+            entry->client_rank, entry->request_id, entry->offset, entry->length, entry->fragment,
+            entry->chunks});
+    }
+
+    std::vector<EntryPtr> RaftLog::slice(uint64_t index, size_t max_entries, size_t max_bytes) const
+    {
+        if (index <= base_index || index > last_index())
+            return {};
+        size_t count = std::min<size_t>(max_entries, last_index() - index + 1);
+        auto first = entries.begin() + (index - base_index - 1);
+
+        std::vector<EntryPtr> slice;
+        size_t bytes = 0;
+        for (auto it = first; it != first + count; ++it)
+        {
+            auto size = released_sizes.find(index + (it - first));
+            bytes += size == released_sizes.end() ? (*it)->size() : size->second;
+            if (!slice.empty() && bytes > max_bytes)
+                break;
+            slice.push_back(*it);
+        }
+        return slice;
+    }
+
+    void RaftLog::compact(uint64_t index)
+    {
+        if (index <= base_index)
+            return;
+        index = std::min(index, last_index());
+        base_term = term_at(index);
+        entries.erase(entries.begin(), entries.begin() + (index - base_index));
+        released_sizes.erase(released_sizes.begin(), released_sizes.upper_bound(index));
+        base_index = index;
+    }
+
+    void RaftLog::reset(uint64_t index, uint64_t term)
+    {
+        entries.clear();
+        released_sizes.clear();
+        base_index = index;
+        base_term = term;
+    }
+}
@@ -2,12 +2,255 @@
 #include "repl_message.hh"
 #include "handshake_message.hh"
 #include "client_message.hh"
+#include "metrics.hh"
+#include "trace.hh"
+#include "log.hh"
 
+#include <algorithm>
+#include <filesystem>
+#include <optional>
 #include <thread>
 #include <chrono>
 
 namespace raft {
-RaftServer::RaftServer(MPI_Comm com, int nb_servers) : Server(com, nb_servers), crashed(false), started(false),  speed(repl::ReplSpeed::FAST) {}
+// Coded chunks kept encoded for followers lagging behind.
+// A rebuild waiting longer for fragments fails, a repair is retried.
+static constexpr auto REBUILD_TIMEOUT = std::chrono::seconds(1);
+
+RaftServer::RaftServer(MPI_Comm com, MPI_Comm group, int nb_servers, const Options &options)
+    : Server(com, nb_servers), options(options), routing(nb_servers, options.groups),
+      group(routing.group_of_rank(state.get_rank())), crashed(false), started(options.autostart),
+      speed(repl::ReplSpeed::FAST), transfer_to(-1), transfer_sent(false), lease_revoked(false), serving(false),
+      wal(options.data_dir + "/wal_" + std::to_string(state.get_rank()), options),
+      reply_floor(1), snapshot{0, 0}, receiving_index(0), receiving_offset(0), read_floor(0),
+      io(options.io_workers, options.io_queue) {
+  storage_dir = options.data_dir + "/server_" + std::to_string(state.get_rank());
+  snapshot_path = options.data_dir + "/snapshot_" + std::to_string(state.get_rank()) + ".bin";
+  state.set_group(group);
+  if (options.election_ms <= std::max(options.lease_ms, options.heartbeat_ms)) {
+    throw std::invalid_argument("RaftServer: election_ms must exceed lease_ms and heartbeat_ms");
+  }
+  state.set_election_timeout(std::chrono::milliseconds(options.election_ms));
+  for (int g = 0; g < routing.groups(); g++) {
+    group_leaders.emplace_back(0, routing.members(g).front());
+  }
+  const std::vector<int> &members = state.get_members();
+  member = std::find(members.begin(), members.end(), state.get_rank()) - members.begin();
+  stripe_dir = options.data_dir + "/stripes_" + std::to_string(this->group);
+  fragment_dir = options.data_dir + "/fragments_" + std::to_string(state.get_rank());
+  if (options.ec_data > 0) {
+    if (options.ec_data + options.ec_parity != static_cast<int>(members.size()) ||
+        options.ec_data > state.get_quorum()) {
+      throw std::invalid_argument(
+          "RaftServer: the erasure code needs k + m servers per group and k <= quorum");
+    }
+    code = std::make_unique<ec::ReedSolomon>(options.ec_data, options.ec_parity);
+    std::filesystem::create_directories(fragment_dir);
+  }
+  next_rebuild = 1;
+  repairing = 0;
+  repairing_chunk = 0;
+  if (options.stripe_kb > 0) {
+    stripes = std::make_unique<StripeLayout>(static_cast<uint64_t>(options.stripe_kb) << 10,
+                                             members.size(), member);
+    // Every member of the group creates it.
+    std::error_code error;
+    std::filesystem::create_directories(stripe_dir, error);
+  }
+  if (options.dedup_kb > 0) {
+    chunk_store = std::make_unique<ChunkStore>(options.data_dir + "/chunks_" +
+                                               std::to_string(state.get_rank()));
+  }
+  if (options.packed_kb > 0) {
+    segments = std::make_unique<SegmentStore>(
+        options.data_dir + "/segments_" + std::to_string(state.get_rank()), io.shards(),
+        static_cast<uint64_t>(options.pack_segment_mb) << 20);
+  }
+  // Each group allocates the uids it owns.
+  files = MetadataIndex(this->group, routing.groups());
+  size_t per_shard = options.file_cache / io.shards();
+  for (size_t i = 0; i < io.shards(); i++) {
+    file_caches.push_back(std::make_unique<FileCache>(per_shard));
+  }
+  recover();
+}
+
+RaftServer::~RaftServer() {
+  close_files();
+}
+
+void RaftServer::close_files() {
+  io.drain();
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  for (auto &cache : file_caches) {
+    cache->close_all();
+    hits += cache->hits();
+    misses += cache->misses();
+  }
+  if (hits + misses > 0) {
+    AFS_LOG(INFO, "RaftServer(" << state.get_rank() << ") file cache: " << hits << " hits, "
+                                << misses << " misses");
+  }
+  if (chunk_store && chunk_store->logical_bytes() > 0) {
+    AFS_LOG(INFO, "RaftServer(" << state.get_rank() << ") chunk store: "
+                                << chunk_store->logical_bytes() << " bytes of files in "
+                                << chunk_store->stored_bytes() << " bytes of chunks");
+  }
+  if (segments && segments->stored_bytes() > 0) {
+    AFS_LOG(INFO, "RaftServer(" << state.get_rank() << ") segment store: "
+                                << segments->live_bytes() << " live bytes in "
+                                << segments->segment_count() << " segments of "
+                                << segments->stored_bytes() << " bytes");
+  }
+}
+
+void RaftServer::recover() {
+  io.discard();
+  close_files();
+  std::filesystem::remove_all(storage_dir);
+  std::filesystem::create_directories(storage_dir);
+  files.clear();
+  message_queue = {};
+  pending_acks.clear();
+  pending_reads.clear();
+  fragment_requests.clear();
+  fragment_entries.clear();
+  callbacks.clear();
+  rebuilds.clear();
+  repairs.clear();
+  repairing = 0;
+  state.restart();
+
+  RaftLog &log = state.get_log();
+  if (chunk_store) {
+    chunk_store->reload();
+  }
+  if (segments) {
+    segments->reset();
+  }
+  snapshot = Snapshot::load(snapshot_path, files, storage_dir, chunk_store.get(),
+                            segments.get())
+                 .value_or(SnapshotMeta{0, 0});
+  log.reset(snapshot.last_index, snapshot.last_term);
+  state.set_commit_index(snapshot.last_index);
+  state.set_last_applied(snapshot.last_index);
+
+  uint64_t saved_term = 0;
+  int saved_vote = -1;
+  wal.replay(
+      [&log](uint64_t index, LogEntry &&entry) {
+        if (index <= log.start_index()) {
+          return;
+        }
+        log.truncate_from(index);
+        if (index != log.last_index() + 1) {
+          throw std::runtime_error("Wal: gap in log before index " +
+                                   std::to_string(index));
+        }
+        log.append(std::make_shared<LogEntry>(std::move(entry)));
+      },
+      [&log](uint64_t index) { log.truncate_from(index); },
+      [&](uint64_t term, int voted_for) {
+        saved_term = term;
+        saved_vote = voted_for;
+      });
+  if (wal.durable_index() < snapshot.last_index) {
+    wal.reset(snapshot.last_index);
+  }
+  if (saved_term > 0) {
+    state.restore(saved_term, saved_vote);
+  } else if (log.last_index() > 0) {
+    // Written before terms were saved: the entries tell the latest one.
+    state.restore(log.last_term(), -1);
+  } else {
+    state.bootstrap();
+  }
+  wal.save_vote(state.get_term(), state.get_voted_for());
+  campaign.reset();
+  transfer_to = -1;
+  transfer_sent = false;
+  lease_revoked = false;
+  // No leader came before the first one.
+  serving = state.is_leader();
+  state.reset_election_timer(std::chrono::steady_clock::now());
+  reply_floor = log.last_index() + 1;
+  read_floor = log.last_index();
+  released_until = snapshot.last_index;
+  find_lost_fragments(snapshot.last_index);
+
+  AFS_LOG(INFO, "RaftServer(" << state.get_rank() << ") restored snapshot at "
+                              << snapshot.last_index << " and replayed "
+                              << log.last_index() - log.start_index() << " log entries");
+
+  peers.clear();
+  for (int rank : state.get_members()) {
+    if (rank != state.get_rank()) {
+      peers[rank].next_index = log.last_index() + 1;
+    }
+  }
+}
+
+void RaftServer::maybe_take_snapshot() {
+  uint64_t applied = state.get_last_applied();
+  if (applied - snapshot.last_index < static_cast<uint64_t>(options.snapshot_entries)) {
+    return;
+  }
+
+  // The snapshot copies the files: every applied operation must be done.
+  io.drain();
+  snapshot = SnapshotMeta{applied, state.get_log().term_at(applied)};
+  Snapshot::save(snapshot_path, snapshot, files, storage_dir, chunk_store.get(),
+                 segments.get());
+  // Striped and coded files are not in snapshots. The leader wrote the
+  // stripe units of the members missing a chunk when it applied it, and a
+  // member behind the snapshot rebuilds its fragments, see
+  // install_snapshot().
+  state.get_log().compact(applied);
+  wal.compact(applied);
+  // Unreferenced chunks are not in the snapshot, a restart does not need
+  // them anymore. Entries still to apply may.
+  if (chunk_store) {
+    chunk_store->collect(unapplied_chunks());
+  }
+}
+
+void RaftServer::install_snapshot(SnapshotMeta meta) {
+  uint64_t applied = state.get_last_applied();
+  close_files();
+  std::filesystem::remove_all(storage_dir);
+  std::filesystem::create_directories(storage_dir);
+  if (chunk_store) {
+    chunk_store->reload();
+  }
+  if (segments) {
+    segments->reset();
+  }
+  Snapshot::load(snapshot_path, files, storage_dir, chunk_store.get(), segments.get());
+  snapshot = meta;
+  write_skipped_stripes(applied, meta);
+
+  state.get_log().reset(meta.last_index, meta.last_term);
+  state.set_commit_index(meta.last_index);
+  state.set_last_applied(meta.last_index);
+  pending_acks.clear();
+  wal.reset(meta.last_index);
+  released_until = meta.last_index;
+  // The entries skipped wrote fragments this server does not have.
+  repairs.clear();
+  find_lost_fragments(applied);
+}
+
+void RaftServer::send_durable_acks() {
+  while (!pending_acks.empty() &&
+         pending_acks.front().index <= wal.durable_index()) {
+    auto [leader, index, sent_at] = pending_acks.front();
+    pending_acks.pop_front();
+    send(leader, std::make_shared<rpc::AppendEntriesResponse>(
+                     leader, state.get_rank(), state.get_term(), true, index,
+                     sent_at));
+  }
+}
 
 void RaftServer::work()
 {
@@ -16,191 +259,2391 @@ void RaftServer::work()
     return;
   }
   
+  auto now = std::chrono::steady_clock::now();
+  if (!state.is_leader() && now >= state.get_election_deadline())
+  {
+    start_campaign(true, false, now);
+  }
 
   // Do the work
 
-  // we will need to use a queue, 
-  // we will pop the element from the queue and do the work
-  // when a message is received in on_receive_client, we will push it to the queue
-  if (!message_queue.empty())
+  // Requests received since the previous tick go to the log together, at
+  // most client_batch of them.
+  if (!message_queue.empty() && state.is_leader() && transfer_to < 0)
   {
-    std::shared_ptr<message::Message> message = message_queue.front();
-    message_queue.pop();
-    process_message_client(message);
-    // do the work
+    for (const auto &message : take_client_batch())
+    {
+      process_message_client(message);
+    }
+  }
+  else if (!state.is_leader() && reachable_leader(now) > 0)
+  {
+    // Requests that waited for a leader, or came before this one stepped down.
+    while (!message_queue.empty())
+    {
+      send(state.get_leader(), message_queue.front());
+      message_queue.pop();
+    }
+  }
+
+  if (state.is_leader())
+  {
+    tick_transfer(now);
+    replicate();
   }
 
+  // One fsync covers every entry appended since the previous one.
+  wal.tick();
+  send_durable_acks();
+  if (state.is_leader())
+  {
+    advance_commit_index();
+  }
+  apply_committed();
+  compact_segments();
+  serve_reads();
+  tick_rebuilds(std::chrono::steady_clock::now());
+  // Answers the clients whose operations reached the disk.
+  io.poll();
+  release_entries(now);
+  maybe_take_snapshot();
+  update_gauges();
 
   std::this_thread::sleep_for(std::chrono::milliseconds(speed * speed * 1000));
 }
 
-void RaftServer::on_receive_repl(std::shared_ptr<message::Message> message) {
-  std::cout << "RaftServer(" << state.get_rank() << "): Received REPL message"
-            << std::endl;
-  json j = message->serialize_json();
-  
-  json repl_message = j["REPL"];
+std::vector<std::shared_ptr<message::Client_message>>
+group_by_file(std::vector<std::shared_ptr<message::Client_message>> batch) {
+  // Groups in the order they start. A request joins the latest group of
+  // its file unless its sender has a request in a later group already;
+  // new files have no uid yet and start a group each.
+  std::vector<std::vector<size_t>> groups;
+  std::unordered_map<int, size_t> group_of_uid;
+  std::unordered_map<int, size_t> last_group_of_sender;
+  for (size_t i = 0; i < batch.size(); i++) {
+    int uid = batch[i]->get_uid();
+    int sender = batch[i]->get_sender_rank();
+    auto group = uid < 0 ? group_of_uid.end() : group_of_uid.find(uid);
+    auto last = last_group_of_sender.find(sender);
+    size_t g;
+    if (group != group_of_uid.end() &&
+        (last == last_group_of_sender.end() || last->second <= group->second)) {
+      g = group->second;
+    } else {
+      g = groups.size();
+      groups.emplace_back();
+      if (uid >= 0) {
+        group_of_uid[uid] = g;
+      }
+    }
+    groups[g].push_back(i);
+    last_group_of_sender[sender] = g;
+  }
+  std::vector<std::shared_ptr<message::Client_message>> grouped;
+  grouped.reserve(batch.size());
+  for (const std::vector<size_t> &group : groups) {
+    for (size_t i : group) {
+      grouped.push_back(std::move(batch[i]));
+    }
+  }
+  return grouped;
+}
 
-  if (repl_message["REPL_TYPE"] == repl::ReplType::CRASH) 
+uint64_t quorum_commit_index(RaftState &state, std::vector<uint64_t> matches) {
+  std::sort(matches.begin(), matches.end(), std::greater<uint64_t>());
+  uint64_t index = matches[state.get_quorum() - 1];
+  if (index > state.get_commit_index() && state.get_log().term_at(index) == state.get_term()) {
+    return index;
+  }
+  return state.get_commit_index();
+}
+
+size_t skip_present_entries(RaftLog &log, uint64_t prev_index,
+                            const std::vector<EntryPtr> &entries, uint64_t &truncated) {
+  truncated = 0;
+  size_t skipped = 0;
+  for (; skipped < entries.size(); skipped++) {
+    uint64_t index = prev_index + skipped + 1;
+    if (index <= log.start_index()) {
+      continue;
+    }
+    if (index > log.last_index()) {
+      break;
+    }
+    if (log.term_at(index) != entries[skipped]->term) {
+      log.truncate_from(index);
+      truncated = index;
+      break;
+    }
+  }
+  return skipped;
+}
+
+uint64_t conflict_retry_index(const RaftLog &log, uint64_t prev_index) {
+  uint64_t conflict_term = log.term_at(prev_index);
+  uint64_t retry = prev_index;
+  while (retry > 1 && log.term_at(retry - 1) == conflict_term) {
+    retry--;
+  }
+  return retry;
+}
+
+bool hears_campaign(RaftState &state, const rpc::RequestVote &request, bool leader_alive) {
+  return request.get_term() >= state.get_term() && (request.get_transfer() || !leader_alive);
+}
+
+bool grants_vote(RaftState &state, const rpc::RequestVote &request) {
+  RaftLog &log = state.get_log();
+  bool up_to_date = request.get_last_log_term() > log.last_term() ||
+                    (request.get_last_log_term() == log.last_term() &&
+                     request.get_last_log_index() >= log.last_index());
+  int candidate = request.get_sender_rank();
+  return up_to_date && (request.get_pre_vote() || state.get_voted_for() < 0 ||
+                        state.get_voted_for() == candidate);
+}
+
+std::vector<std::shared_ptr<message::Client_message>> RaftServer::take_client_batch() {
+  size_t limit = std::max(options.client_batch, 1);
+  std::vector<std::shared_ptr<message::Client_message>> batch;
+  batch.reserve(std::min(limit, message_queue.size()));
+  while (!message_queue.empty() && batch.size() < limit) {
+    batch.push_back(std::move(message_queue.front()));
+    message_queue.pop();
+  }
+  return group_by_file(std::move(batch));
+}
+
+void RaftServer::update_gauges() {
+  stats::Metrics &metrics = stats::metrics();
+  metrics.set(stats::MESSAGE_QUEUE, message_queue.size());
+  metrics.set(stats::IO_PENDING, io.pending());
+  metrics.set(stats::COMMIT_LAG, state.get_log().last_index() - state.get_commit_index());
+  metrics.set(stats::APPLY_LAG, state.get_commit_index() - state.get_last_applied());
+}
+
+std::chrono::steady_clock::time_point RaftServer::next_deadline() {
+  auto now = std::chrono::steady_clock::now();
+  if (!started || crashed) {
+    return Server::next_deadline();
+  }
+  bool queue_ready = state.is_leader() ? transfer_to < 0 : reachable_leader(now) > 0;
+  if ((!message_queue.empty() && queue_ready) || !pending_acks.empty() ||
+      state.get_commit_index() > state.get_last_applied() ||
+      io.has_completions()) {
+    return now;
+  }
+
+  auto deadline = std::min(Server::next_deadline(), wal.next_deadline());
+  if (io.pending() > 0) {
+    deadline = std::min(deadline, now + std::chrono::microseconds(200));
+  }
+  if (!fragment_requests.empty() || !rebuilds.empty() || !repairs.empty()) {
+    deadline = std::min(deadline, now + std::chrono::milliseconds(1));
+  }
+  if (!state.is_leader()) {
+    deadline = std::min(deadline, state.get_election_deadline());
+  } else if (transfer_to >= 0) {
+    deadline = std::min(deadline, transfer_deadline);
+  }
+  if (state.is_leader()) {
+    auto heartbeat = std::chrono::milliseconds(options.heartbeat_ms);
+    bool confirm_reads = !pending_reads.empty() && !lease_valid(now);
+    for (const auto &[rank, peer] : peers) {
+      bool has_data = peer.sending_snapshot
+                          ? peer.snapshot_offset < Snapshot::size(snapshot_path)
+                          : peer.next_index <= state.get_log().last_index() ||
+                                peer.sent_commit < state.get_commit_index();
+      if (peer.inflight < options.max_inflight) {
+        if (has_data || (confirm_reads && peer.last_sent < pending_reads.back().received)) {
+          return now;
+        }
+        if (!peer.sending_snapshot) {
+          deadline = std::min(deadline, peer.last_sent + heartbeat);
+        }
+      }
+      if (peer.inflight > 0) {
+        deadline = std::min(deadline, peer.last_response + 10 * heartbeat);
+      }
+    }
+  }
+  return deadline;
+}
+
+void RaftServer::on_receive_repl(std::shared_ptr<repl::REPL_message> message) {
+  AFS_LOG(DEBUG, "RaftServer(" << state.get_rank() << "): Received REPL message");
+  int sender = message->get_sender_rank();
+
+  if (message->get_repl_type() == repl::ReplType::CRASH) 
   {
-    std::cout << "RaftServer(" << state.get_rank()
-              << ") is crashing. Bravo Six, going dark" << std::endl;
+    AFS_LOG(INFO, "RaftServer(" << state.get_rank() << ") is crashing. Bravo Six, going dark");
     crashed = true;
-    send(j["SENDER"],
+    close_files();
+    send(sender,
          std::make_shared<message::Handshake_message>(
-             message::HandshakeStatus::SUCCESS, j["SENDER"], state.get_rank()));
+             message::HandshakeStatus::SUCCESS, sender, state.get_rank()));
   }
-  else if (repl_message["REPL_TYPE"] == repl::ReplType::SPEED)
+  else if (message->get_repl_type() == repl::ReplType::SPEED)
   {
-    repl::ReplSpeed newspeed = static_cast<repl::ReplSpeed>(j["REPL"]["SPEED"]);
-    std::cout << "RaftServer(" << state.get_rank()
-              << ") is changing speed from " << speed << " to "
-              << j["REPL"]["SPEED"] << std::endl;
+    repl::ReplSpeed newspeed = message->get_speed();
+    AFS_LOG(INFO, "RaftServer(" << state.get_rank() << ") is changing speed from " << speed
+                                << " to " << newspeed);
     speed = newspeed;
-    send(j["SENDER"],
+    send(sender,
+         std::make_shared<message::Handshake_message>(
+             message::HandshakeStatus::SUCCESS, sender, state.get_rank()));
+  }
+  else if (message->get_repl_type() == repl::ReplType::RECOVER)
+  {
+    AFS_LOG(INFO, "RaftServer(" << state.get_rank() << ") is recovering");
+    crashed = false;
+    recover();
+    send(sender,
          std::make_shared<message::Handshake_message>(
-             message::HandshakeStatus::SUCCESS, j["SENDER"], state.get_rank()));
+             message::HandshakeStatus::SUCCESS, sender, state.get_rank()));
+  }
+  else if (message->get_repl_type() == repl::ReplType::STATS)
+  {
+    update_gauges();
+    auto reply = std::make_shared<message::Handshake_message>(
+        message::HandshakeStatus::SUCCESS, sender, state.get_rank());
+    reply->set_data(0, stats::metrics().snapshot().dump());
+    send(sender, reply);
+  }
+  else if (message->get_repl_type() == repl::ReplType::TRANSFER)
+  {
+    transfer_leadership(message);
   }
-  else if (repl_message["REPL_TYPE"] == repl::ReplType::START)
+  else if (message->get_repl_type() == repl::ReplType::START)
   {
-    std::cout << "RaftServer(" << state.get_rank() << ") is starting"
-              << std::endl;
+    AFS_LOG(INFO, "RaftServer(" << state.get_rank() << ") is starting");
     started = true;
-    send(j["SENDER"],
+    state.reset_election_timer(std::chrono::steady_clock::now());
+    send(sender,
          std::make_shared<message::Handshake_message>(
-             message::HandshakeStatus::SUCCESS, j["SENDER"], state.get_rank()));
+             message::HandshakeStatus::SUCCESS, sender, state.get_rank()));
+  }
+}
+
+// Whether a LOAD makes a packed file.
+static bool packs(const LogEntry &entry, const Options &options) {
+  return options.packed_kb > 0 &&
+         entry.bytes() <= static_cast<uint64_t>(options.packed_kb) << 10;
+}
+
+void RaftServer::process_message_client(std::shared_ptr<message::Client_message> message) {
+  stats::TraceSpan span("raft", "process_message_client", "request", message->get_request_id());
+  int sender = message->get_sender_rank();
+
+  // Mutations are applied once committed, the reply is sent from apply().
+  auto entry = std::make_shared<LogEntry>(LogEntry{
+      state.get_term(), message->get_action(), message->get_uid(),
+      message->get_filename(), message->get_content(), sender,
+      message->get_request_id(), message->get_offset(), message->get_length(),
+      LogEntry::PLAIN, {}});
+  // Chunks of coded and striped files: followers get their fragment or
+  // stripe units only.
+  const FileMeta *file = files.find(entry->uid);
+  if (entry->action == message::ClientAction::UPLOAD_CHUNK && file &&
+      (file->coded || file->striped)) {
+    entry->fragment = LogEntry::WHOLE;
+    entry->length = entry->content.size();
+  }
+  // Content of deduplicated files: followers get the chunks they lack.
+  if (chunk_store && ((entry->action == message::ClientAction::LOAD && !packs(*entry, options)) ||
+                      (entry->action == message::ClientAction::APPEND && file &&
+                       file->deduped))) {
+    stats::TraceSpan cut("raft", "cut_chunks", "bytes", entry->content.size());
+    entry->chunks = cut_chunks(entry->content, static_cast<size_t>(options.dedup_kb) << 10);
+  }
+  uint64_t index;
+  {
+    stats::TraceSpan append("raft", "log_append", "index", state.get_log().last_index() + 1);
+    index = state.get_log().append(entry);
+  }
+  stats::TraceSpan logged("raft", "wal_append", "index", index);
+  wal.append(index, *entry);
+}
+
+// Bytes of the chunk-th chunk of a file of size bytes.
+static uint64_t chunk_length(uint64_t size, uint64_t chunk_size, uint64_t chunk) {
+  return std::min(chunk_size, size - std::min(size, chunk * chunk_size));
+}
+
+// Bytes an UPLOAD_CHUNK adds from its offset on.
+static uint64_t chunk_bytes(const LogEntry &entry) {
+  return entry.fragment == LogEntry::PLAIN ? entry.content.size() : entry.length;
+}
+
+// Whether entry can be applied to file, which is null if its uid is free.
+// Coded files are cut in chunks of chunk_size: chunks must start at one, and
+// there are no appends.
+static bool applicable(const FileMeta *file, const LogEntry &entry, uint64_t chunk_size) {
+  if (file == nullptr) {
+    return false;
+  }
+  switch (entry.action) {
+  case message::ClientAction::APPEND:
+    // Chunks sent by reference only make sense to a deduplicated file.
+    return !file->uploading && !file->coded && (file->deduped || entry.chunks.empty());
+  case message::ClientAction::UPLOAD_CHUNK:
+    if (file->coded &&
+        (entry.offset % chunk_size != 0 || chunk_bytes(entry) > chunk_size)) {
+      return false;
+    }
+    // Chunks past a hole are refused: the client resumes from file->size.
+    return file->uploading && entry.offset <= file->size;
+  case message::ClientAction::UPLOAD_COMMIT:
+    // A client that missed the answer may commit twice.
+    return entry.length == file->size;
+  default:
+    return true;
   }
 }
 
-void RaftServer::on_receive_rpc(std::shared_ptr<message::Message> message) {
-  json j = message->serialize_json();
-  j = j;
+// Writes data at offset in file, only the stripes this server stores when
+// layout is set.
+static bool write_at(MPI_File file, const StripeLayout *layout, uint64_t offset,
+                     const std::string &data) {
+  if (layout) {
+    return layout->write(file, offset, data.data(), data.size());
+  }
+  stats::TraceSpan span("mpi-io", "MPI_File_write_at", "bytes", data.size());
+  return MPI_File_write_at(file, offset, data.data(), data.size(), MPI_CHAR,
+                           MPI_STATUS_IGNORE) == MPI_SUCCESS;
 }
 
-void RaftServer::process_message_client(std::shared_ptr<message::Message> message) {
-  json j = message->serialize_json();
-  json client_message = j["CLIENT"];
-  if (client_message["ACTION"] == message::ClientAction::LOAD) {
-    std::cout << "RaftServer(" << state.get_rank()
-              << ") is cloading file " << client_message["FILENAME"] << std::endl;
-    
+bool RaftServer::apply(uint64_t index, const EntryPtr &entry) {
+  stats::TraceSpan span("raft", "apply", "index", index);
+  if (entry->request_id != 0) {
+    stats::Trace::flow('t', entry->client_rank, entry->request_id);
+  }
+  if (entry->action == message::ClientAction::NOOP) {
+    return true;
+  }
+  // Only the leader answers, followers apply silently.
+  int reply_to = state.is_leader() && index >= reply_floor ? entry->client_rank : -1;
+  int rank = state.get_rank();
+  message::ClientAction action = entry->action;
+  // UPLOAD_BEGIN without a uid starts a new upload, with one it resumes.
+  bool creates = action == message::ClientAction::LOAD ||
+                 (action == message::ClientAction::UPLOAD_BEGIN && entry->uid < 0);
+
+  FileMeta *file = files.find(entry->uid);
+  uint64_t chunk_size = static_cast<uint64_t>(options.chunk_kb) << 10;
+  if (!creates && (!applicable(file, *entry, chunk_size) || (file->coded && !code))) {
+    if (reply_to >= 0) {
+      auto reply = std::make_shared<message::Handshake_message>(
+          message::HandshakeStatus::FAILURE, reply_to, rank);
+      reply->set_request_id(entry->request_id);
+      reply->set_index(index);
+      reply->set_size(file ? file->size : 0);
+      send(reply_to, reply);
+    }
+    return true;
+  }
+
+  // Operations on one file stay in order on the same worker.
+  std::string filename = creates ? entry->filename : file->name;
+  size_t key = std::hash<std::string>{}(filename);
+  if (io.full(key)) {
+    return false;
+  }
+
+  std::string path = creates ? std::string() : path_of(*file);
+  FileCache &cache = *file_caches[io.shard_of(key)];
+  const StripeLayout *layout = file && file->striped ? stripes.get() : nullptr;
+  IoPool::Task task;
+  // Chunks this entry adds to the store, readable once the task is done.
+  std::vector<ChunkId> fresh_chunks;
+  if (creates) {
+    AFS_LOG(DEBUG, "RaftServer(" << rank << ") is cloading file " << entry->filename);
+
+    file = &files.create(entry->filename);
+    file->size = entry->bytes();
+    file->uploading = action == message::ClientAction::UPLOAD_BEGIN;
+    // Uploads are the large files: they are coded or striped.
+    file->coded = code && file->uploading;
+    file->striped = stripes && file->uploading && !file->coded;
+    file->packed = segments && action == message::ClientAction::LOAD && packs(*entry, options);
+    file->deduped = chunk_store && !file->uploading && !file->packed;
+    file->created = index;
+    path = path_of(*file);
+    layout = file->striped ? stripes.get() : nullptr;
+    int uid = file->uid;
+
     //LOAD FILE
+    // A new inode rather than a truncated one: mappings of the old content
+    // may still be sending. Stripes and fragments have a path of their own,
+    // which the other members may already be writing to.
+    if (file->packed) {
+      Extent extent = segments->append(uid, segments->stream_of(filename), entry->content.size());
+      task = [entry, extent] { return SegmentStore::write(extent, entry->content.data()); };
+    } else if (file->deduped) {
+      task = store_chunks(index, entry, uid, fresh_chunks);
+    } else {
+      task = [&cache, path, entry, uid, layout, fresh = file->striped || file->coded] {
+        if (fresh) {
+          cache.evict(uid);
+        } else {
+          cache.evict_path(path);
+          stats::TraceSpan span("mpi-io", "MPI_File_delete");
+          MPI_File_delete(path.c_str(), MPI_INFO_NULL);
+        }
+        MPI_File file = cache.open(uid, path, MPI_MODE_CREATE | MPI_MODE_RDWR);
+        if (file == MPI_FILE_NULL) {
+          return false;
+        }
+        return write_at(file, layout, 0, entry->content);
+      };
+    }
+  }
+  else if (action == message::ClientAction::APPEND) {
+    AFS_LOG(DEBUG, "RaftServer(" << rank << ") is adding " << entry->content
+                                 << " to file with uid " << entry->uid);
+    uint64_t offset = file->size;
+    file->size += entry->bytes();
 
-    std::string filename = client_message["FILENAME"];
-    std::string content = client_message["SOME_TEXT"];
+    //APPEND TO FILE
+    // At the size the metadata knows: cached handles are shared with
+    // uploads and reads, their file pointer is not the end of the file.
+    if (file->packed) {
+      Extent extent =
+          segments->append(file->uid, segments->stream_of(filename), entry->content.size());
+      task = [entry, extent] { return SegmentStore::write(extent, entry->content.data()); };
+    } else if (file->deduped) {
+      task = store_chunks(index, entry, file->uid, fresh_chunks);
+    } else {
+      // Appends are small: the leader writes every stripe unit of theirs,
+      // a member that a snapshot skips past does not miss its own.
+      task = [&cache, path, entry, offset, layout, all = state.is_leader()] {
+        MPI_File file = cache.open(entry->uid, path, MPI_MODE_RDWR);
+        if (file == MPI_FILE_NULL) {
+          return false;
+        }
+        return all && layout ? layout->write_all(file, offset, entry->content.data(),
+                                                 entry->content.size())
+                             : write_at(file, layout, offset, entry->content);
+      };
+    }
+  }
+  else if (action == message::ClientAction::DELETE) {
+    AFS_LOG(DEBUG, "RaftServer(" << rank << ") is deleting file with uid " << entry->uid);
 
-    MPI_File file;
-    MPI_File_open(state.get_comm(), filename.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file);
+    //delete file
+    // The chunks of a deduplicated file go once unreferenced, see
+    // ChunkStore::collect(), the bytes of a packed one with its segments.
+    if (file->deduped) {
+      chunk_store->erase(file->uid);
+      path.clear();
+    }
+    if (file->packed) {
+      segments->erase(file->uid);
+      path.clear();
+    }
+    files.erase(entry->uid);
+    file = nullptr;
+    task = [&cache, path, uid = entry->uid] {
+      cache.evict(uid);
+      if (!path.empty()) {
+        stats::TraceSpan span("mpi-io", "MPI_File_delete");
+        MPI_File_delete(path.c_str(), MPI_INFO_NULL);
+      }
+      return true;
+    };
+  }
+  else if (action == message::ClientAction::UPLOAD_BEGIN) {
+    // Resuming: the answer carries the size received so far, once the
+    // chunks queued before are written. The upload may even be committed
+    // already, if its answer was lost: the client commits again.
+    task = [] { return true; };
+  }
+  else if (action == message::ClientAction::UPLOAD_CHUNK && file->coded &&
+           entry->fragment == LogEntry::MISSING) {
+    file->size = std::max(file->size, entry->offset + entry->length);
+    repairs.emplace_back(file->uid, entry->offset / chunk_size);
+    task = [] { return true; };
+  }
+  else if (action == message::ClientAction::UPLOAD_CHUNK && file->coded) {
+    file->size = std::max(file->size, entry->offset + entry->length);
+    // This server's fragment, at the place of the chunk in its file.
+    EntryPtr mine = entry->fragment >= 0 ? entry
+        : entry->fragment == LogEntry::WHOLE && state.is_leader()
+            ? fragment_entry(index, entry, member)
+            : std::make_shared<LogEntry>(LogEntry{
+                  entry->term, action, entry->uid, entry->filename,
+                  code->split(entry->content)[member], entry->client_rank,
+                  entry->request_id, entry->offset, chunk_bytes(*entry), member, {}});
+    uint64_t slot = entry->offset / chunk_size * code->fragment_size(chunk_size);
+    // The fragment file is new to a member that got the upload in a snapshot.
+    task = [&cache, path, mine, slot] {
+      MPI_File file = cache.open(mine->uid, path, MPI_MODE_CREATE | MPI_MODE_RDWR);
+      if (file == MPI_FILE_NULL) {
+        return false;
+      }
+      return write_at(file, nullptr, slot, mine->content);
+    };
+  }
+  else if (action == message::ClientAction::UPLOAD_CHUNK && file->striped) {
+    file->size = std::max(file->size, entry->offset + chunk_bytes(*entry));
+    std::vector<int> writers = stripe_writers(index, *entry);
+    task = [&cache, path, entry, layout, writers] {
+      MPI_File file = cache.open(entry->uid, path, MPI_MODE_CREATE | MPI_MODE_RDWR);
+      if (file == MPI_FILE_NULL) {
+        return false;
+      }
+      return write_units(file, *layout, *entry, writers);
+    };
+  }
+  else if (action == message::ClientAction::UPLOAD_CHUNK) {
+    file->size = std::max(file->size, entry->offset + entry->content.size());
+    // Chunks land at their offset, a chunk sent twice rewrites the same bytes.
+    task = [&cache, path, entry, layout] {
+      MPI_File file = cache.open(entry->uid, path, MPI_MODE_RDWR);
+      if (file == MPI_FILE_NULL) {
+        return false;
+      }
+      return write_at(file, layout, entry->offset, entry->content);
+    };
+  }
+  else if (action == message::ClientAction::UPLOAD_COMMIT) {
+    AFS_LOG(DEBUG, "RaftServer(" << rank << ") committed upload of " << file->name << " ("
+                                 << file->size << " bytes)");
+    file->uploading = false;
+    task = [&cache, path, uid = entry->uid] {
+      MPI_File file = cache.open(uid, path, MPI_MODE_RDWR);
+      if (file == MPI_FILE_NULL) {
+        return false;
+      }
+      stats::TraceSpan span("mpi-io", "MPI_File_sync");
+      MPI_File_sync(file);
+      return true;
+    };
+  }
 
-    MPI_File_write(file, content.c_str(), content.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+  int uid = file ? file->uid : entry->uid;
+  uint64_t size = file ? file->size : 0;
+  uint64_t version = index;
+  // Clients caching the file, or the file list, learn that it changed.
+  if (state.is_leader()) {
+    if (!creates) {
+      break_callbacks(uid, index);
+    }
+    if (action == message::ClientAction::LOAD || action == message::ClientAction::DELETE ||
+        action == message::ClientAction::UPLOAD_COMMIT) {
+      break_callbacks(-1, index);
+    }
+  }
+  if (file) {
+    file->version = index;
+    file->state = ReplicaState::PENDING;
+  }
+  // Answers that name the file the client goes on with.
+  bool named = creates || action == message::ClientAction::UPLOAD_BEGIN ||
+               action == message::ClientAction::UPLOAD_COMMIT;
 
-    MPI_File_close(&file);
+  uint64_t request_id = entry->request_id;
 
-    int uid = 0;
-    while(uids.find(uid) != uids.end())
-    {
-      uid++;
+  io.submit(key, std::move(task), [this, reply_to, rank, uid, size, version, named, request_id,
+                                   fresh_chunks = std::move(fresh_chunks)](bool success) {
+    for (const ChunkId &id : fresh_chunks) {
+      chunk_store->set_ready(id);
+    }
+    // A later operation on the file owns its state.
+    FileMeta *file = files.find(uid);
+    if (file && file->version == version) {
+      file->state = success ? ReplicaState::CLEAN : ReplicaState::FAILED;
     }
-    uids[uid] = filename;
+    if (reply_to < 0) {
+      return;
+    }
+    auto status = success ? message::HandshakeStatus::SUCCESS
+                          : message::HandshakeStatus::FAILURE;
+    auto reply = named && success
+        ? std::make_shared<message::Handshake_message>(status, reply_to, rank, uid)
+        : std::make_shared<message::Handshake_message>(status, reply_to, rank);
+    reply->set_request_id(request_id);
+    reply->set_index(version);
+    reply->set_size(size);
+    send(reply_to, reply);
+  });
+  return true;
+}
 
-    
-    json custom_data;
-    custom_data["UID"] = uid;
+IoPool::Task RaftServer::store_chunks(uint64_t index, const EntryPtr &entry, int uid,
+                                      std::vector<ChunkId> &fresh) {
+  // Entries made before the file was known to be deduplicated are cut here,
+  // the same way on every server.
+  std::vector<ChunkRef> refs = entry->chunks.empty()
+      ? cut_chunks(entry->content, static_cast<size_t>(options.dedup_kb) << 10)
+      : entry->chunks;
+  // Where the bytes of each chunk carried by the entry start in content.
+  std::unordered_map<ChunkId, uint64_t, ChunkIdHash> carried;
+  uint64_t at = 0;
+  for (const ChunkRef &ref : refs) {
+    if (ref.inlined) {
+      carried.emplace(ref.id, at);
+      at += ref.size;
+    }
+  }
 
-    send(j["SENDER"],
-         std::make_shared<message::Handshake_message>(
-             message::HandshakeStatus::SUCCESS, j["SENDER"], state.get_rank(), custom_data));
+  std::vector<std::pair<std::string, std::string_view>> writes;
+  bool missing = false;
+  for (const ChunkRef &ref : chunk_store->add(uid, refs, index)) {
+    fresh.push_back(ref.id);
+    auto it = carried.find(ref.id);
+    if (it == carried.end()) {
+      // Entries are only accepted once their chunks can be found: the
+      // replica fails, reads of the chunk too.
+      missing = true;
+      continue;
+    }
+    writes.emplace_back(chunk_store->path(ref.id),
+                        std::string_view(entry->content).substr(it->second, ref.size));
+  }
+  // Written under a temporary name: a chunk file is whole.
+  return [entry, writes = std::move(writes), missing] {
+    for (const auto &[path, bytes] : writes) {
+      std::string tmp = path + ".tmp";
+      MPI_File file;
+      if (MPI_File_open(MPI_COMM_SELF, tmp.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                        MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        return false;
+      }
+      int error = MPI_File_write_at(file, 0, bytes.data(), bytes.size(), MPI_CHAR,
+                                    MPI_STATUS_IGNORE);
+      MPI_File_close(&file);
+      std::error_code renamed;
+      std::filesystem::rename(tmp, path, renamed);
+      if (error != MPI_SUCCESS || renamed) {
+        return false;
+      }
+    }
+    return !missing;
+  };
+}
+
+void RaftServer::apply_committed() {
+  RaftLog &log = state.get_log();
+  while (state.get_last_applied() < state.get_commit_index()) {
+    uint64_t index = state.get_last_applied() + 1;
+    size_t count = append_run(index);
+    if (count > 1 ? !apply_appends(index, count) : !apply(index, log.at(index))) {
+      break;
+    }
+    state.set_last_applied(index + std::max<size_t>(count, 1) - 1);
+  }
+}
 
-   //BROADCAST TO SERVERS new file 
+size_t RaftServer::append_run(uint64_t index) {
+  RaftLog &log = state.get_log();
+  const EntryPtr &entry = log.at(index);
+  const FileMeta *file = files.find(entry->uid);
+  uint64_t chunk_size = static_cast<uint64_t>(options.chunk_kb) << 10;
+  // Packed and deduplicated files place every append on its own.
+  if (entry->action != message::ClientAction::APPEND || !applicable(file, *entry, chunk_size) ||
+      file->packed || file->deduped) {
+    return 0;
+  }
+  uint64_t last = std::min(state.get_commit_index(),
+                           index + std::max(options.client_batch, 1) - 1);
+  // Large appends gain nothing from a copy into a common buffer.
+  uint64_t bytes = entry->content.size();
+  size_t count = 1;
+  while (index + count <= last && bytes < chunk_size) {
+    const EntryPtr &next = log.at(index + count);
+    if (next->action != message::ClientAction::APPEND || next->uid != entry->uid ||
+        !next->chunks.empty()) {
+      break;
+    }
+    bytes += next->content.size();
+    count++;
+  }
+  return count;
+}
 
-  } else if (client_message["ACTION"] == message::ClientAction::LIST) {
-    std::cout << "RaftServer(" << state.get_rank()
-              << ") is going to list all files" << std::endl;
+bool RaftServer::apply_appends(uint64_t first, size_t count) {
+  stats::TraceSpan span("raft", "apply_appends", "entries", count);
+  RaftLog &log = state.get_log();
+  int uid = log.at(first)->uid;
+  FileMeta *file = files.find(uid);
+  size_t key = std::hash<std::string>{}(file->name);
+  if (io.full(key)) {
+    return false;
+  }
 
-    //LIST FILES
-    std::vector<int> list_uids;
-    for (const auto& [key, value] : uids) {
-      list_uids.push_back(key);
+  // The appends follow each other in the file: their bytes go in one write.
+  struct Reply
+  {
+    int client;
+    uint64_t request_id;
+    uint64_t index;
+    uint64_t size;
+  };
+  std::vector<Reply> replies;
+  uint64_t offset = file->size;
+  std::string data;
+  for (uint64_t index = first; index < first + count; index++) {
+    const EntryPtr &entry = log.at(index);
+    data += entry->content;
+    file->size += entry->bytes();
+    if (entry->request_id != 0) {
+      stats::Trace::flow('t', entry->client_rank, entry->request_id);
+    }
+    if (state.is_leader() && index >= reply_floor) {
+      replies.push_back(Reply{entry->client_rank, entry->request_id, index, file->size});
     }
+  }
+  uint64_t version = first + count - 1;
+  if (state.is_leader()) {
+    break_callbacks(uid, version);
+  }
+  file->version = version;
+  file->state = ReplicaState::PENDING;
 
-    json custom_data;
-    custom_data["UIDS"] = list_uids;
+  std::string path = path_of(*file);
+  FileCache &cache = *file_caches[io.shard_of(key)];
+  const StripeLayout *layout = file->striped ? stripes.get() : nullptr;
+  int rank = state.get_rank();
+  // The leader writes every stripe unit, as in apply().
+  io.submit(
+      key,
+      [&cache, path, uid, offset, layout, all = state.is_leader(), data = std::move(data)] {
+        MPI_File file = cache.open(uid, path, MPI_MODE_RDWR);
+        if (file == MPI_FILE_NULL) {
+          return false;
+        }
+        return all && layout ? layout->write_all(file, offset, data.data(), data.size())
+                             : write_at(file, layout, offset, data);
+      },
+      [this, uid, version, rank, replies = std::move(replies)](bool success) {
+        FileMeta *file = files.find(uid);
+        if (file && file->version == version) {
+          file->state = success ? ReplicaState::CLEAN : ReplicaState::FAILED;
+        }
+        auto status = success ? message::HandshakeStatus::SUCCESS
+                              : message::HandshakeStatus::FAILURE;
+        for (const Reply &answer : replies) {
+          auto reply = std::make_shared<message::Handshake_message>(status, answer.client, rank);
+          reply->set_request_id(answer.request_id);
+          reply->set_index(answer.index);
+          reply->set_size(answer.size);
+          send(answer.client, reply);
+        }
+      });
+  return true;
+}
 
-    send(j["SENDER"],
-         std::make_shared<message::Handshake_message>(
-             message::HandshakeStatus::SUCCESS, j["SENDER"], state.get_rank(), custom_data));
-  } else if (client_message["ACTION"] == message::ClientAction::APPEND) {
-    std::cout << "RaftServer(" << state.get_rank() << ") is adding " << client_message["SOME_TEXT"] << " to file with uid " << client_message["UID"] << std::endl;
-    
-    //APPEND TO FILE
-    int uid = client_message["UID"];
-    std::string content = client_message["SOME_TEXT"];
+std::string RaftServer::path_of(const std::string &filename) const {
+  return storage_dir + "/" + filename;
+}
+
+std::string RaftServer::path_of(const FileMeta &file) const {
+  if (file.coded) {
+    return fragment_dir + "/" + file.name + "." + std::to_string(file.created);
+  }
+  if (file.striped) {
+    return stripe_dir + "/" + file.name + "." + std::to_string(file.created);
+  }
+  return path_of(file.name);
+}
 
-    MPI_File file;
-    MPI_File_open(state.get_comm(), uids[uid].c_str(), MPI_MODE_APPEND, MPI_INFO_NULL, &file);
+void RaftServer::replicate() {
+  auto now = std::chrono::steady_clock::now();
+  auto heartbeat = std::chrono::milliseconds(options.heartbeat_ms);
+  // A follower that stopped answering gets its pipeline restarted from
+  // the last index known to match.
+  auto rpc_timeout = 10 * heartbeat;
+  // Reads without a lease wait for a heartbeat sent after them.
+  bool confirm_reads = !pending_reads.empty() && !lease_valid(now);
 
-    MPI_File_write(file, content.c_str(), content.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+  for (auto &[rank, peer] : peers) {
+    if (peer.inflight > 0 && now - peer.last_response > rpc_timeout) {
+      peer.inflight = 0;
+      peer.next_index = peer.match_index + 1;
+      peer.snapshot_offset = peer.snapshot_acked;
+    }
 
-    MPI_File_close(&file);
+    // Entries the follower needs were compacted: stream the snapshot.
+    if (peer.next_index <= state.get_log().start_index()) {
+      if (!peer.sending_snapshot || peer.snapshot_index != snapshot.last_index) {
+        peer.sending_snapshot = true;
+        peer.snapshot_index = snapshot.last_index;
+        peer.snapshot_offset = 0;
+        peer.snapshot_acked = 0;
+        peer.inflight = 0;
+      }
+      uint64_t size = Snapshot::size(snapshot_path);
+      while (peer.inflight < options.max_inflight && peer.snapshot_offset < size) {
+        send_snapshot_chunk(rank, peer, now);
+      }
+      continue;
+    }
+    peer.sending_snapshot = false;
 
-    send(j["SENDER"],
-         std::make_shared<message::Handshake_message>(
-             message::HandshakeStatus::SUCCESS, j["SENDER"], state.get_rank()));
-    
-    //BROADCAST TO SERVERS file update
+    bool has_entries = peer.next_index <= state.get_log().last_index();
+    while (peer.inflight < options.max_inflight &&
+           (has_entries || peer.sent_commit < state.get_commit_index() ||
+            now - peer.last_sent >= heartbeat ||
+            (confirm_reads && peer.last_sent < pending_reads.back().received))) {
+      send_append_entries(rank, peer, now);
+      has_entries = peer.next_index <= state.get_log().last_index();
+    }
   }
-  else if (client_message["ACTION"] == message::ClientAction::DELETE) {
-    std::cout << "RaftServer(" << state.get_rank() << ") is deleting file with uid " << client_message["UID"] << std::endl;
-    
-    //delete file
-    MPI_File_delete(uids[client_message["UID"]].c_str(), MPI_INFO_NULL);
-    uids.erase(client_message["UID"]);
+}
 
-    send(j["SENDER"],
-         std::make_shared<message::Handshake_message>(
-             message::HandshakeStatus::SUCCESS, j["SENDER"], state.get_rank()));
-    
-    //BROADCAST TO SERVERS file deleted
+void RaftServer::send_append_entries(int rank, Peer &peer, steady_time now) {
+  RaftLog &log = state.get_log();
+  uint64_t prev_index = peer.next_index - 1;
+  // Keep AppendEntries within a receive slot so they stay in order.
+  std::vector<EntryPtr> entries =
+      log.slice(peer.next_index, options.max_batch, RECV_SLOT_SIZE - 4096);
+  size_t count = entries.size();
+  for (size_t i = 0; i < count; i++) {
+    if (log.released(peer.next_index + i)) {
+      entries[i] = std::make_shared<LogEntry>(wal.read(peer.next_index + i));
+    }
+  }
+  if (code || stripes) {
+    const std::vector<int> &members = state.get_members();
+    int to = std::find(members.begin(), members.end(), rank) - members.begin();
+    for (size_t i = 0; i < count; i++) {
+      const LogEntry &entry = *entries[i];
+      if (entry.fragment == LogEntry::WHOLE) {
+        entries[i] = code ? fragment_entry(peer.next_index + i, entries[i], to)
+                          : stripe_entry(entries[i], to);
+      } else if (entry.fragment >= 0 && entry.fragment != to) {
+        entries[i] = std::make_shared<LogEntry>(LogEntry{
+            entry.term, entry.action, entry.uid, entry.filename, std::string(),
+            entry.client_rank, entry.request_id, entry.offset, entry.length,
+            LogEntry::MISSING, {}});
+      }
+    }
+  }
+  if (chunk_store) {
+    for (size_t i = 0; i < count; i++) {
+      uint64_t index = peer.next_index + i;
+      if (index > peer.whole_until && !entries[i]->chunks.empty()) {
+        entries[i] = chunk_references(index, entries[i]);
+      }
+    }
+  }
+
+  send(rank, std::make_shared<rpc::AppendEntries>(
+                 rank, state.get_rank(), state.get_term(), prev_index,
+                 log.term_at(prev_index), state.get_commit_index(),
+                 std::move(entries),
+                 std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     now.time_since_epoch()).count()));
+
+  // Pipelining: assume success and keep streaming from the next index.
+  peer.next_index += count;
+  if (peer.inflight == 0)
+    peer.last_response = now;
+  peer.inflight++;
+  peer.sent_commit = state.get_commit_index();
+  peer.last_sent = now;
+}
 
+void RaftServer::release_entries(steady_time now) {
+  RaftLog &log = state.get_log();
+  uint64_t until = std::min(state.get_last_applied(), wal.durable_index());
+  if (state.is_leader()) {
+    for (const auto &[rank, peer] : peers) {
+      if (member_up(rank, now)) {
+        until = std::min(until, peer.match_index);
+      }
+    }
   }
-  
+  for (uint64_t index = std::max(released_until, log.start_index()) + 1; index <= until;
+       index++) {
+    if (log.at(index)->action == message::ClientAction::UPLOAD_CHUNK) {
+      log.release(index);
+    }
+  }
+  released_until = std::max(released_until, until);
+  fragment_entries.erase(fragment_entries.begin(), fragment_entries.upper_bound(released_until));
 }
 
-void RaftServer::on_message_callback(
-    std::shared_ptr<message::Message> message) {
-  json j = message->serialize_json();
+EntryPtr RaftServer::fragment_entry(uint64_t index, const EntryPtr &entry, int member) {
+  auto it = fragment_entries.find(index);
+  if (it == fragment_entries.end()) {
+    std::vector<std::string> fragments = code->split(entry->content);
+    std::vector<EntryPtr> entries;
+    for (size_t i = 0; i < fragments.size(); i++) {
+      entries.push_back(std::make_shared<LogEntry>(LogEntry{
+          entry->term, entry->action, entry->uid, entry->filename,
+          std::move(fragments[i]), entry->client_rank, entry->request_id,
+          entry->offset, entry->length, static_cast<int>(i), {}}));
+    }
+    it = fragment_entries.emplace(index, std::move(entries)).first;
+  }
+  return it->second[member];
+}
 
-  if (crashed && j["MESSAGE_TYPE"] != message::MessageType::REPL) {
-    return;
+EntryPtr RaftServer::stripe_entry(const EntryPtr &entry, int member) const {
+  std::string units;
+  for (const StripeLayout::Piece &piece : stripes->pieces(member, entry->offset, entry->length)) {
+    units.append(entry->content, piece.offset - entry->offset, piece.size);
   }
+  return std::make_shared<LogEntry>(LogEntry{
+      entry->term, entry->action, entry->uid, entry->filename, std::move(units),
+      entry->client_rank, entry->request_id, entry->offset, entry->length, member, {}});
+}
 
-  if (j["MESSAGE_TYPE"] == message::MessageType::REPL) {
-    on_receive_repl(message);
+std::vector<int> RaftServer::stripe_writers(uint64_t index, const LogEntry &entry) {
+  if (entry.fragment != LogEntry::WHOLE) {
+    return {member};
+  }
+  const std::vector<int> &members = state.get_members();
+  std::vector<int> writers;
+  for (size_t i = 0; i < members.size(); i++) {
+    auto peer = peers.find(members[i]);
+    if (static_cast<int>(i) == member || !state.is_leader() || peer == peers.end() ||
+        peer->second.match_index < index) {
+      writers.push_back(i);
+    }
   }
+  return writers;
+}
 
-  if (j["MESSAGE_TYPE"] == message::MessageType::RPC) {
-    std::cout << "RaftServer(" << state.get_rank() << "): Received RPC message"
-              << std::endl;
-              on_receive_rpc(message);
+bool RaftServer::write_units(MPI_File file, const StripeLayout &layout, const LogEntry &entry,
+                             const std::vector<int> &writers) {
+  if (entry.fragment == LogEntry::MISSING) {
+    return true;
+  }
+  if (entry.fragment >= 0) {
+    return layout.write(file, layout.pieces(entry.offset, entry.length), entry.content.data());
+  }
+  for (int writer : writers) {
+    if (!layout.write(file, writer, entry.offset, entry.content.data(), entry.content.size())) {
+      return false;
+    }
   }
+  return true;
+}
 
-  if (j["MESSAGE_TYPE"] == message::MessageType::CLIENT) {
-    std::cout << "RaftServer(" << state.get_rank()
-              << "): Received CLIENT message" << std::endl;
-              message_queue.push(message);
+void RaftServer::write_skipped_stripes(uint64_t applied, const SnapshotMeta &meta) {
+  RaftLog &log = state.get_log();
+  // A restarted member does not know which of its entries are committed.
+  // An uncommitted chunk still holds the bytes its client uploads at that
+  // offset of the file, and sends again: writing it does no harm.
+  uint64_t last = std::min(meta.last_index, log.last_index());
+  for (uint64_t index = applied + 1; index <= last; index++) {
+    const EntryPtr &entry = log.at(index);
+    const FileMeta *file = files.find(entry->uid);
+    if (entry->action != message::ClientAction::UPLOAD_CHUNK || !file || !file->striped ||
+        file->created >= index) {
+      continue;
+    }
+    MPI_File handle;
+    if (MPI_File_open(MPI_COMM_SELF, path_of(*file).c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                      MPI_INFO_NULL, &handle) != MPI_SUCCESS) {
+      continue;
+    }
+    write_units(handle, *stripes, *entry, stripe_writers(index, *entry));
+    MPI_File_close(&handle);
   }
 }
-void RaftServer::broadcast_to_servers(std::shared_ptr<message::Message> message)
-{
 
-  // LOG ACTION TO LOGFILE (useful in order to recover changes for crashed server coming back online)
+EntryPtr RaftServer::chunk_references(uint64_t index, const EntryPtr &entry) const {
+  auto known = [this, index](const ChunkRef &ref) {
+    return ref.inlined && chunk_store->known_before(ref.id, index);
+  };
+  if (std::none_of(entry->chunks.begin(), entry->chunks.end(), known)) {
+    return entry;
+  }
+  auto stripped = std::make_shared<LogEntry>(LogEntry{
+      entry->term, entry->action, entry->uid, entry->filename, std::string(),
+      entry->client_rank, entry->request_id, entry->offset, entry->length, entry->fragment,
+      entry->chunks});
+  uint64_t at = 0;
+  for (ChunkRef &ref : stripped->chunks) {
+    if (!ref.inlined) {
+      continue;
+    }
+    if (known(ref)) {
+      ref.inlined = false;
+    } else {
+      stripped->content.append(entry->content, at, ref.size);
+    }
+    at += ref.size;
+  }
+  return stripped;
+}
+
+std::unordered_set<ChunkId, ChunkIdHash> RaftServer::unapplied_chunks() {
+  std::unordered_set<ChunkId, ChunkIdHash> chunks;
+  RaftLog &log = state.get_log();
+  for (uint64_t index = state.get_last_applied() + 1; index <= log.last_index(); index++) {
+    for (const ChunkRef &ref : log.at(index)->chunks) {
+      chunks.insert(ref.id);
+    }
+  }
+  return chunks;
+}
 
-  for (int i = 1; i <= state.get_nb_servers(); i++)
-  {
-    if (i != state.get_rank())
-    {
-      send(i, message);
+void RaftServer::send_snapshot_chunk(int rank, Peer &peer, steady_time now) {
+  uint64_t size = Snapshot::size(snapshot_path);
+  uint64_t offset = peer.snapshot_offset;
+  std::string data = Snapshot::read_chunk(
+      snapshot_path, offset, static_cast<size_t>(options.snapshot_chunk_kb) << 10);
+  bool done = offset + data.size() >= size;
+  peer.snapshot_offset += data.size();
+
+  send(rank, std::make_shared<rpc::InstallSnapshot>(
+                 rank, state.get_rank(), state.get_term(), snapshot.last_index,
+                 snapshot.last_term, offset, std::move(data), done));
+
+  if (peer.inflight == 0)
+    peer.last_response = now;
+  peer.inflight++;
+  peer.last_sent = now;
+}
+
+void RaftServer::advance_commit_index() {
+  // The leader counts itself only for what reached its disk.
+  std::vector<uint64_t> matches = {wal.durable_index()};
+  for (const auto &[rank, peer] : peers) {
+    matches.push_back(peer.match_index);
+  }
+  uint64_t index = quorum_commit_index(state, std::move(matches));
+  if (index > state.get_commit_index()) {
+    state.set_commit_index(index);
+    if (!serving) {
+      serving = true;
+      // The failover time, from when the previous leader went silent.
+      double silent_ms = std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - leader_contact)
+                             .count();
+      AFS_LOG(INFO, "RaftServer(" << state.get_rank() << ") serves writes in term "
+                                  << state.get_term() << ", " << silent_ms
+                                  << " ms after the last leader contact");
+    }
+  }
+}
+
+void RaftServer::visit(std::shared_ptr<rpc::AppendEntries> message) {
+  int leader = message->get_sender_rank();
+  RaftLog &log = state.get_log();
+
+  if (message->get_term() < state.get_term()) {
+    send(leader, std::make_shared<rpc::AppendEntriesResponse>(
+                     leader, state.get_rank(), state.get_term(), false,
+                     log.last_index() + 1, message->get_sent_at()));
+    return;
+  }
+  follow(message->get_term(), leader);
+  leader_contact = std::chrono::steady_clock::now();
+  state.reset_election_timer(leader_contact);
+
+  uint64_t prev_index = message->get_prev_log_index();
+  if (prev_index > log.last_index()) {
+    send(leader, std::make_shared<rpc::AppendEntriesResponse>(
+                     leader, state.get_rank(), state.get_term(), false,
+                     log.last_index() + 1, message->get_sent_at()));
+    return;
+  }
+  if (prev_index >= log.start_index() &&
+      log.term_at(prev_index) != message->get_prev_log_term()) {
+    // Ask the leader to retry from the first entry of the conflicting term.
+    send(leader, std::make_shared<rpc::AppendEntriesResponse>(
+                     leader, state.get_rank(), state.get_term(), false,
+                     conflict_retry_index(log, prev_index), message->get_sent_at()));
+    return;
+  }
+
+  // Chunks sent by reference must be stored here, or come with an entry
+  // before: those of the entries not applied yet, found once needed.
+  std::optional<std::unordered_set<ChunkId, ChunkIdHash>> pending;
+  auto resolvable = [&](const LogEntry &entry) {
+    for (const ChunkRef &ref : entry.chunks) {
+      if (ref.inlined || chunk_store->has(ref.id)) {
+        continue;
+      }
+      if (!pending) {
+        pending = unapplied_chunks();
+      }
+      if (pending->count(ref.id) == 0) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  const std::vector<EntryPtr> &entries = message->get_entries();
+  uint64_t truncated;
+  size_t skipped = skip_present_entries(log, prev_index, entries, truncated);
+  if (truncated > 0) {
+    wal.truncate_from(truncated);
+  }
+  uint64_t index = prev_index + skipped;
+  uint64_t missing = 0;
+  for (size_t i = skipped; i < entries.size(); i++) {
+    const EntryPtr &entry = entries[i];
+    index++;
+    if (!entry->chunks.empty() && chunk_store && !resolvable(*entry)) {
+      missing = index;
+      index--;
+      break;
+    }
+    log.append(entry);
+    wal.append(index, *entry);
+    if (pending) {
+      for (const ChunkRef &ref : entry->chunks) {
+        pending->insert(ref.id);
+      }
     }
   }
+
+  if (message->get_leader_commit() > state.get_commit_index()) {
+    state.set_commit_index(std::min(message->get_leader_commit(), index));
+  }
+  if (missing > 0) {
+    send(leader, std::make_shared<rpc::AppendEntriesResponse>(
+                     leader, state.get_rank(), state.get_term(), false, missing,
+                     message->get_sent_at(), true));
+    return;
+  }
+
+  // Acknowledged only once durable, answers keep the AppendEntries order.
+  pending_acks.push_back(PendingAck{leader, index, message->get_sent_at()});
+  send_durable_acks();
+}
+
+void RaftServer::visit(std::shared_ptr<rpc::AppendEntriesResponse> message) {
+  if (message->get_term() > state.get_term()) {
+    follow(message->get_term(), -1);
+    return;
+  }
+  auto it = peers.find(message->get_sender_rank());
+  if (!state.is_leader() || it == peers.end()) {
+    return;
+  }
+
+  Peer &peer = it->second;
+  peer.inflight = std::max(0, peer.inflight - 1);
+  peer.last_response = std::chrono::steady_clock::now();
+  if (message->get_term() == state.get_term()) {
+    peer.acked_sent = std::max(peer.acked_sent,
+                               steady_time(std::chrono::duration_cast<steady_time::duration>(
+                                   std::chrono::nanoseconds(message->get_sent_at()))));
+  }
+
+  if (message->get_success()) {
+    peer.match_index = std::max(peer.match_index, message->get_match_index());
+    peer.next_index = std::max(peer.next_index, peer.match_index + 1);
+    advance_commit_index();
+  } else {
+    // Drop the pipeline and resume from the follower's hint.
+    peer.next_index = std::max<uint64_t>(
+        1, std::min(peer.next_index, message->get_match_index()));
+    peer.inflight = 0;
+    if (message->get_whole()) {
+      peer.whole_until = std::max(peer.whole_until, state.get_log().last_index());
+    }
+  }
+  serve_reads();
+}
+
+steady_time RaftServer::quorum_ack(steady_time now) const {
+  std::vector<steady_time> acks = {now};
+  for (const auto &[rank, peer] : peers) {
+    acks.push_back(peer.acked_sent);
+  }
+  std::sort(acks.begin(), acks.end(), std::greater<steady_time>());
+  return acks[state.get_quorum() - 1];
+}
+
+bool RaftServer::lease_valid(steady_time now) const {
+  return options.lease_ms > 0 && !lease_revoked &&
+         now < quorum_ack(now) + std::chrono::milliseconds(options.lease_ms);
+}
+
+void RaftServer::serve_reads() {
+  if (pending_reads.empty()) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (!state.is_leader()) {
+    serve_local_reads(now);
+    return;
+  }
+
+  bool lease = lease_valid(now);
+  steady_time confirmed = quorum_ack(now);
+  while (!pending_reads.empty()) {
+    const PendingRead &read = pending_reads.front();
+    if (state.get_last_applied() < read.read_index ||
+        (!lease && confirmed < read.received)) {
+      break;
+    }
+    if (!serve_read(read.message)) {
+      break;
+    }
+    pending_reads.pop_front();
+  }
+}
+
+void RaftServer::serve_local_reads(steady_time now) {
+  for (auto it = pending_reads.begin(); it != pending_reads.end();) {
+    const auto &message = it->message;
+    uint32_t staleness_ms = message->get_staleness_ms();
+    bool ready = state.get_last_applied() >= it->read_index &&
+                 (staleness_ms == 0 ||
+                  state.get_last_applied() >= state.get_commit_index());
+    // Linearizable reads, relaxed ones this follower cannot bound anymore,
+    // and those waiting for entries while cut off from the leader go to
+    // the leader, or wait for one with the other requests.
+    if (!message->is_relaxed_read() ||
+        (staleness_ms > 0 &&
+         now - leader_contact > std::chrono::milliseconds(staleness_ms)) ||
+        (!ready && now - leader_contact > std::chrono::milliseconds(options.election_ms))) {
+      if (reachable_leader(now) > 0) {
+        send(state.get_leader(), message);
+      } else {
+        message_queue.push(message);
+      }
+      it = pending_reads.erase(it);
+      continue;
+    }
+
+    if (ready && serve_read(message)) {
+      it = pending_reads.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool RaftServer::serve_read(const std::shared_ptr<message::Client_message> &message) {
+  if (message->get_action() == message::ClientAction::LIST) {
+    reply_list(message);
+    return true;
+  }
+  return read_range(message);
+}
+
+bool RaftServer::read_range(const std::shared_ptr<message::Client_message> &message) {
+  int sender = message->get_sender_rank();
+  int rank = state.get_rank();
+  const FileMeta *file = files.find(message->get_uid());
+  auto reply = std::make_shared<message::Handshake_message>(
+      file && !file->uploading && (!file->coded || code)
+          ? message::HandshakeStatus::SUCCESS
+          : message::HandshakeStatus::FAILURE,
+      sender, rank);
+  reply->set_request_id(message->get_request_id());
+  reply->set_index(state.get_last_applied());
+  if (reply->get_status() == message::HandshakeStatus::FAILURE) {
+    send(sender, reply);
+    return true;
+  }
+  reply->set_size(file->size);
+  if (message->get_callback() && state.is_leader()) {
+    promise_callback(file->uid, sender);
+  }
+
+  uint64_t offset = std::min(message->get_offset(), file->size);
+  uint64_t length = std::min(message->get_length(), file->size - offset);
+  if (length == 0) {
+    send(sender, reply);
+    return true;
+  }
+  if (file->coded) {
+    return read_coded(message, *file, offset, length);
+  }
+  if (file->deduped) {
+    return read_chunks(message, *file, offset, length);
+  }
+  if (file->packed) {
+    return read_packed(message, *file, offset, length);
+  }
+  if (file->striped && stripes) {
+    return read_stripes(message, *file, offset, length);
+  }
+
+  // Mapped once the writes of the file already applied are done.
+  size_t key = std::hash<std::string>{}(file->name);
+  if (io.full(key)) {
+    return false;
+  }
+  FileCache &cache = *file_caches[io.shard_of(key)];
+  auto mapping = std::make_shared<std::shared_ptr<MappedFile>>();
+  io.submit(
+      key,
+      [&cache, path = path_of(*file), uid = file->uid, offset, length, mapping] {
+        *mapping = cache.map(uid, path, offset + length);
+        if (!*mapping) {
+          return false;
+        }
+        (*mapping)->advise(offset, length);
+        return true;
+      },
+      [this, reply, offset, length, mapping](bool success) {
+        int sender = reply->get_target_rank();
+        if (!success) {
+          auto failure = std::make_shared<message::Handshake_message>(
+              message::HandshakeStatus::FAILURE, sender, state.get_rank());
+          failure->set_request_id(reply->get_request_id());
+          send(sender, failure);
+          return;
+        }
+        // Large ranges go out in chunks, each sent from the mapped pages.
+        const MappedFile &file = **mapping;
+        uint64_t chunk = static_cast<uint64_t>(options.chunk_kb) << 10;
+        uint64_t end = std::min(offset + length, file.size());
+        uint64_t at = std::min(offset, end);
+        do {
+          uint64_t size = std::min(chunk, end - at);
+          auto part = std::make_shared<message::Handshake_message>(
+              message::HandshakeStatus::SUCCESS, sender, state.get_rank());
+          part->set_request_id(reply->get_request_id());
+          part->set_index(reply->get_index());
+          part->set_size(reply->get_size());
+          part->set_data(at, std::string_view(file.data() + at, size), *mapping);
+          send(sender, part);
+          at += size;
+        } while (at < end);
+      });
+  return true;
+}
+
+bool RaftServer::read_stripes(const std::shared_ptr<message::Client_message> &message,
+                              const FileMeta &file, uint64_t offset, uint64_t length) {
+  size_t key = std::hash<std::string>{}(file.name);
+  if (io.full(key)) {
+    return false;
+  }
+  int rank = state.get_rank();
+  if (state.is_leader()) {
+    // Members answer once they applied as much as this server: they see
+    // the same file and serve exactly this range, straight to the client.
+    message->set_range(offset, length);
+    message->set_read_bounds(state.get_last_applied(), 0);
+    const std::vector<int> &members = state.get_members();
+    for (size_t member = 0; member < members.size(); member++) {
+      if (members[member] != rank && stripes->stores(member, offset, length)) {
+        send(members[member], message);
+      }
+    }
+  }
+
+  std::vector<StripeLayout::Piece> pieces = stripes->pieces(offset, length);
+  if (pieces.empty()) {
+    return true;
+  }
+  uint64_t size = 0;
+  for (const auto &piece : pieces) {
+    size += piece.size;
+  }
+  auto buffer = std::make_shared<std::string>(size, '\0');
+  FileCache &cache = *file_caches[io.shard_of(key)];
+  io.submit(
+      key,
+      [&cache, layout = stripes.get(), path = path_of(file), uid = file.uid, pieces, buffer] {
+        MPI_File handle = cache.open(uid, path, MPI_MODE_RDWR);
+        return handle != MPI_FILE_NULL && layout->read(handle, pieces, buffer->data());
+      },
+      [this, sender = message->get_sender_rank(), request_id = message->get_request_id(),
+       index = state.get_last_applied(), file_size = file.size, pieces, buffer](bool success) {
+        int rank = state.get_rank();
+        if (!success) {
+          auto failure = std::make_shared<message::Handshake_message>(
+              message::HandshakeStatus::FAILURE, sender, rank);
+          failure->set_request_id(request_id);
+          send(sender, failure);
+          return;
+        }
+        // A part per piece, sent from the buffer the pieces were read in.
+        size_t at = 0;
+        for (const auto &piece : pieces) {
+          auto part = std::make_shared<message::Handshake_message>(
+              message::HandshakeStatus::SUCCESS, sender, rank);
+          part->set_request_id(request_id);
+          part->set_index(index);
+          part->set_size(file_size);
+          part->set_data(piece.offset, std::string_view(buffer->data() + at, piece.size), buffer);
+          send(sender, part);
+          at += piece.size;
+        }
+      });
+  return true;
+}
+
+bool RaftServer::read_coded(const std::shared_ptr<message::Client_message> &message,
+                            const FileMeta &file, uint64_t offset, uint64_t length) {
+  size_t key = std::hash<std::string>{}(file.name);
+  if (io.full(key)) {
+    return false;
+  }
+  int sender = message->get_sender_rank();
+  uint64_t request_id = message->get_request_id();
+  uint64_t index = state.get_last_applied();
+  uint64_t chunk_size = static_cast<uint64_t>(options.chunk_kb) << 10;
+  uint64_t end = offset + length;
+  uint64_t first = offset / chunk_size;
+  uint64_t last = (end - 1) / chunk_size;
+  // Part of the range in data fragment j of chunk c: where it starts in
+  // the file, its size and where it starts in the fragment.
+  struct Piece {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t skip;
+  };
+  auto piece = [&](int j, uint64_t c) {
+    uint64_t base = c * chunk_size;
+    uint64_t chunk = chunk_length(file.size, chunk_size, c);
+    uint64_t size = code->fragment_size(chunk);
+    uint64_t start = std::max(offset, base + std::min(chunk, j * size));
+    uint64_t stop = std::min(end, base + std::min(chunk, (j + 1) * size));
+    return Piece{start, stop > start ? stop - start : 0, start - base - j * size};
+  };
+  auto failure = [this, sender, request_id] {
+    auto failure = std::make_shared<message::Handshake_message>(
+        message::HandshakeStatus::FAILURE, sender, state.get_rank());
+    failure->set_request_id(request_id);
+    send(sender, failure);
+  };
+
+  // Data fragment j of chunk c rebuilt from the other members, for the
+  // part of the range it holds.
+  auto rebuild = [&](int j, uint64_t c, Piece part, bool use_own) {
+    rebuild_chunk(file, c, index, use_own,
+                  [this, sender, request_id, index, file_size = file.size, j, part,
+                   failure](bool success, const std::vector<std::string> &fragments) {
+                    if (!success) {
+                      failure();
+                      return;
+                    }
+                    auto reply = std::make_shared<message::Handshake_message>(
+                        message::HandshakeStatus::SUCCESS, sender, state.get_rank());
+                    reply->set_request_id(request_id);
+                    reply->set_index(index);
+                    reply->set_size(file_size);
+                    reply->set_data(part.offset, fragments[j].substr(part.skip, part.size));
+                    send(sender, reply);
+                  });
+  };
+
+  if (state.is_leader()) {
+    // The data members serve their fragments like stripes. Those of a
+    // member that is down are rebuilt here from the others.
+    message->set_range(offset, length);
+    message->set_read_bounds(index, 0);
+    const std::vector<int> &members = state.get_members();
+    auto now = std::chrono::steady_clock::now();
+    for (int j = 0; j < code->data_fragments(); j++) {
+      if (j == member) {
+        continue;
+      }
+      bool up = member_up(members[j], now);
+      for (uint64_t c = first; c <= last; c++) {
+        Piece part = piece(j, c);
+        if (part.size == 0) {
+          continue;
+        }
+        if (up) {
+          send(members[j], message);
+          break;
+        }
+        rebuild(j, c, part, true);
+      }
+    }
+  }
+
+  if (member >= code->data_fragments()) {
+    return true;
+  }
+  std::vector<Piece> pieces;
+  uint64_t size = 0;
+  for (uint64_t c = first; c <= last; c++) {
+    Piece part = piece(member, c);
+    if (part.size > 0 && fragment_lost(file.uid, c)) {
+      rebuild(member, c, part, false);
+    } else if (part.size > 0) {
+      pieces.push_back(part);
+      pieces.back().skip += c * code->fragment_size(chunk_size);
+      size += part.size;
+    }
+  }
+  if (pieces.empty()) {
+    return true;
+  }
+  auto buffer = std::make_shared<std::string>(size, '\0');
+  FileCache &cache = *file_caches[io.shard_of(key)];
+  io.submit(
+      key,
+      [&cache, path = path_of(file), uid = file.uid, pieces, buffer] {
+        MPI_File handle = cache.open(uid, path, MPI_MODE_RDWR);
+        if (handle == MPI_FILE_NULL) {
+          return false;
+        }
+        char *at = buffer->data();
+        for (const Piece &piece : pieces) {
+          MPI_Status status;
+          stats::TraceSpan span("mpi-io", "MPI_File_read_at", "bytes", piece.size);
+          if (MPI_File_read_at(handle, piece.skip, at, piece.size, MPI_CHAR, &status) !=
+              MPI_SUCCESS) {
+            return false;
+          }
+          int count;
+          MPI_Get_count(&status, MPI_CHAR, &count);
+          if (static_cast<uint64_t>(count) != piece.size) {
+            return false;
+          }
+          at += piece.size;
+        }
+        return true;
+      },
+      [this, sender, request_id, index, file_size = file.size, pieces, buffer,
+       failure](bool success) {
+        if (!success) {
+          failure();
+          return;
+        }
+        size_t at = 0;
+        for (const Piece &piece : pieces) {
+          auto part = std::make_shared<message::Handshake_message>(
+              message::HandshakeStatus::SUCCESS, sender, state.get_rank());
+          part->set_request_id(request_id);
+          part->set_index(index);
+          part->set_size(file_size);
+          part->set_data(piece.offset, std::string_view(buffer->data() + at, piece.size), buffer);
+          send(sender, part);
+          at += piece.size;
+        }
+      });
+  return true;
+}
+
+void RaftServer::read_fragment(const FileMeta &file, uint64_t chunk,
+                               std::function<void(bool success, std::string data)> done) {
+  uint64_t chunk_size = static_cast<uint64_t>(options.chunk_kb) << 10;
+  uint64_t slot = chunk * code->fragment_size(chunk_size);
+  auto data = std::make_shared<std::string>(
+      code->fragment_size(chunk_length(file.size, chunk_size, chunk)), '\0');
+  size_t key = std::hash<std::string>{}(file.name);
+  FileCache &cache = *file_caches[io.shard_of(key)];
+  bool queued = io.submit(
+      key,
+      [&cache, path = path_of(file), uid = file.uid, slot, data] {
+        MPI_File handle = cache.open(uid, path, MPI_MODE_RDWR);
+        if (handle == MPI_FILE_NULL) {
+          return false;
+        }
+        MPI_Status status;
+        stats::TraceSpan span("mpi-io", "MPI_File_read_at", "bytes", data->size());
+        if (MPI_File_read_at(handle, slot, data->data(), data->size(), MPI_CHAR, &status) !=
+            MPI_SUCCESS) {
+          return false;
+        }
+        int count;
+        MPI_Get_count(&status, MPI_CHAR, &count);
+        return static_cast<size_t>(count) == data->size();
+      },
+      [done, data](bool success) { done(success, success ? std::move(*data) : std::string()); });
+  if (!queued) {
+    done(false, std::string());
+  }
+}
+
+void RaftServer::rebuild_chunk(const FileMeta &file, uint64_t chunk, uint64_t min_index,
+                               bool use_own, RebuildCallback done) {
+  uint64_t chunk_size = static_cast<uint64_t>(options.chunk_kb) << 10;
+  const std::vector<int> &members = state.get_members();
+  uint64_t token = next_rebuild++;
+  Rebuild &rebuild = rebuilds[token];
+  rebuild.fragments.assign(code->fragments(), std::string());
+  rebuild.present.assign(code->fragments(), false);
+  rebuild.waiting = members.size() - (use_own ? 0 : 1);
+  rebuild.size = code->fragment_size(chunk_length(file.size, chunk_size, chunk));
+  rebuild.started = std::chrono::steady_clock::now();
+  rebuild.done = std::move(done);
+
+  for (int rank : members) {
+    if (rank != state.get_rank()) {
+      send(rank, std::make_shared<rpc::FragmentRequest>(rank, state.get_rank(), state.get_term(),
+                                                        file.uid, file.created, chunk,
+                                                        min_index, token));
+    }
+  }
+  if (use_own) {
+    read_fragment(file, chunk, [this, token](bool success, std::string data) {
+      add_fragment(token, member, success, std::move(data));
+    });
+  }
+}
+
+void RaftServer::add_fragment(uint64_t token, int fragment, bool success, std::string data) {
+  auto it = rebuilds.find(token);
+  if (it == rebuilds.end()) {
+    return;
+  }
+  Rebuild &rebuild = it->second;
+  rebuild.waiting--;
+  if (success && fragment >= 0 && fragment < code->fragments() && !rebuild.present[fragment] &&
+      data.size() == rebuild.size) {
+    rebuild.fragments[fragment] = std::move(data);
+    rebuild.present[fragment] = true;
+  }
+  int present = std::count(rebuild.present.begin(), rebuild.present.end(), true);
+  if (present < code->data_fragments() && rebuild.waiting > 0) {
+    return;
+  }
+
+  bool rebuilt = false;
+  if (present >= code->data_fragments()) {
+    std::vector<uint8_t *> pointers;
+    for (std::string &fragment : rebuild.fragments) {
+      fragment.resize(rebuild.size);
+      pointers.push_back(reinterpret_cast<uint8_t *>(fragment.data()));
+    }
+    rebuilt = code->reconstruct(pointers.data(), rebuild.present, rebuild.size);
+  }
+  // The callback may start other rebuilds.
+  RebuildCallback done = std::move(rebuild.done);
+  std::vector<std::string> fragments = std::move(rebuild.fragments);
+  rebuilds.erase(it);
+  done(rebuilt, fragments);
+}
+
+void RaftServer::answer_fragment(const std::shared_ptr<rpc::FragmentRequest> &request) {
+  int sender = request->get_sender_rank();
+  auto answer = [this, sender, token = request->get_token()](bool success, std::string data) {
+    send(sender, std::make_shared<rpc::FragmentResponse>(sender, state.get_rank(),
+                                                         state.get_term(), token, member,
+                                                         success, std::move(data)));
+  };
+  const FileMeta *file = files.find(request->get_uid());
+  if (state.get_last_applied() < request->get_min_index() || !file || !file->coded ||
+      file->created != request->get_created() || file->state == ReplicaState::FAILED ||
+      fragment_lost(file->uid, request->get_chunk())) {
+    answer(false, std::string());
+    return;
+  }
+  read_fragment(*file, request->get_chunk(), answer);
+}
+
+void RaftServer::visit(std::shared_ptr<rpc::FragmentRequest> message) {
+  if (!code) {
+    send(message->get_sender_rank(),
+         std::make_shared<rpc::FragmentResponse>(message->get_sender_rank(), state.get_rank(),
+                                                 state.get_term(), message->get_token(), member,
+                                                 false, std::string()));
+    return;
+  }
+  if (state.get_last_applied() < message->get_min_index()) {
+    fragment_requests.emplace_back(message, std::chrono::steady_clock::now());
+    return;
+  }
+  answer_fragment(message);
+}
+
+void RaftServer::visit(std::shared_ptr<rpc::FragmentResponse> message) {
+  add_fragment(message->get_token(), message->get_fragment(), message->get_success(),
+               message->get_data());
+}
+
+void RaftServer::tick_rebuilds(steady_time now) {
+  if (!code) {
+    return;
+  }
+  for (auto it = fragment_requests.begin(); it != fragment_requests.end();) {
+    if (state.get_last_applied() >= it->first->get_min_index() ||
+        now - it->second > REBUILD_TIMEOUT) {
+      answer_fragment(it->first);
+      it = fragment_requests.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  std::vector<RebuildCallback> expired;
+  for (auto it = rebuilds.begin(); it != rebuilds.end();) {
+    if (now - it->second.started > REBUILD_TIMEOUT) {
+      expired.push_back(std::move(it->second.done));
+      it = rebuilds.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (const auto &done : expired) {
+    done(false, {});
+  }
+
+  if (repairing > 0 || repairs.empty() || now < next_repair) {
+    return;
+  }
+  auto [uid, chunk] = repairs.front();
+  repairs.pop_front();
+  const FileMeta *file = files.find(uid);
+  uint64_t chunk_size = static_cast<uint64_t>(options.chunk_kb) << 10;
+  if (!file || !file->coded || chunk * chunk_size >= file->size) {
+    return;
+  }
+  repairing = uid + 1;
+  repairing_chunk = chunk;
+  // The members that applied the latest change of the file have the chunk.
+  rebuild_chunk(*file, chunk, file->version, false,
+                [this, uid, chunk, created = file->created,
+                 chunk_size](bool success, const std::vector<std::string> &fragments) {
+    repairing = 0;
+    const FileMeta *file = files.find(uid);
+    if (!file || file->created != created) {
+      return;
+    }
+    if (!success) {
+      repairs.emplace_back(uid, chunk);
+      next_repair = std::chrono::steady_clock::now() + REBUILD_TIMEOUT;
+      return;
+    }
+    size_t key = std::hash<std::string>{}(file->name);
+    FileCache &cache = *file_caches[io.shard_of(key)];
+    bool queued = io.submit(
+        key,
+        [&cache, path = path_of(*file), uid, slot = chunk * code->fragment_size(chunk_size),
+         fragment = fragments[member]] {
+          MPI_File handle = cache.open(uid, path, MPI_MODE_CREATE | MPI_MODE_RDWR);
+          return handle != MPI_FILE_NULL && write_at(handle, nullptr, slot, fragment);
+        },
+        [this, uid, chunk](bool success) {
+          if (!success) {
+            repairs.emplace_back(uid, chunk);
+          }
+        });
+    if (!queued) {
+      repairs.emplace_back(uid, chunk);
+    }
+  });
+}
+
+void RaftServer::find_lost_fragments(uint64_t applied) {
+  if (!code) {
+    return;
+  }
+  uint64_t chunk_size = static_cast<uint64_t>(options.chunk_kb) << 10;
+  uint64_t slot = code->fragment_size(chunk_size);
+  for (const FileMeta &file : files.entries()) {
+    if (!file.coded) {
+      continue;
+    }
+    std::error_code error;
+    uint64_t stored = std::filesystem::file_size(path_of(file), error);
+    if (error) {
+      stored = 0;
+    }
+    for (uint64_t c = 0; c * chunk_size < file.size; c++) {
+      if (file.version > applied ||
+          c * slot + code->fragment_size(chunk_length(file.size, chunk_size, c)) > stored) {
+        repairs.emplace_back(file.uid, c);
+      }
+    }
+  }
+  if (!repairs.empty()) {
+    AFS_LOG(INFO, "RaftServer(" << state.get_rank() << ") lost " << repairs.size()
+                                << " fragments, rebuilding them");
+  }
+}
+
+bool RaftServer::fragment_lost(int uid, uint64_t chunk) const {
+  return (repairing == static_cast<uint64_t>(uid) + 1 && repairing_chunk == chunk) ||
+         std::find(repairs.begin(), repairs.end(), std::make_pair(uid, chunk)) != repairs.end();
+}
+
+bool RaftServer::member_up(int rank, steady_time now) const {
+  // Answered an AppendEntries sent lately: the pipeline restart of
+  // replicate() does not count.
+  auto it = peers.find(rank);
+  return it == peers.end() ||
+         now - it->second.acked_sent < 10 * std::chrono::milliseconds(options.heartbeat_ms);
+}
+
+bool RaftServer::read_chunks(const std::shared_ptr<message::Client_message> &message,
+                             const FileMeta &file, uint64_t offset, uint64_t length) {
+  size_t key = std::hash<std::string>{}(file.name);
+  if (io.full(key)) {
+    return false;
+  }
+  // Part of the range in a chunk: where it starts in the file, in the
+  // chunk, and its size.
+  struct Piece {
+    std::string path;
+    uint64_t offset;
+    uint64_t skip;
+    uint64_t size;
+  };
+  std::vector<Piece> pieces;
+  uint64_t end = offset + length;
+  uint64_t at = 0;
+  for (const ChunkRef &ref : chunk_store->recipe(file.uid)) {
+    uint64_t next = at + ref.size;
+    if (next > offset) {
+      // Written by an operation still queued on another worker.
+      if (!chunk_store->ready(ref.id)) {
+        return false;
+      }
+      uint64_t start = std::max(at, offset);
+      pieces.push_back(Piece{chunk_store->path(ref.id), start, start - at,
+                             std::min(next, end) - start});
+    }
+    at = next;
+    if (at >= end) {
+      break;
+    }
+  }
+
+  auto mappings = std::make_shared<std::vector<std::shared_ptr<MappedFile>>>();
+  io.submit(
+      key,
+      [pieces, mappings] {
+        for (const Piece &piece : pieces) {
+          auto mapping = MappedFile::map(piece.path);
+          if (!mapping || mapping->size() < piece.skip + piece.size) {
+            return false;
+          }
+          mappings->push_back(std::move(mapping));
+        }
+        return true;
+      },
+      [this, sender = message->get_sender_rank(), request_id = message->get_request_id(),
+       index = state.get_last_applied(), file_size = file.size, pieces, mappings](bool success) {
+        int rank = state.get_rank();
+        auto part = [&](uint64_t offset, std::string_view data, std::shared_ptr<const void> owner) {
+          auto reply = std::make_shared<message::Handshake_message>(
+              message::HandshakeStatus::SUCCESS, sender, rank);
+          reply->set_request_id(request_id);
+          reply->set_index(index);
+          reply->set_size(file_size);
+          reply->set_data(offset, data, std::move(owner));
+          send(sender, reply);
+        };
+        if (!success) {
+          auto failure = std::make_shared<message::Handshake_message>(
+              message::HandshakeStatus::FAILURE, sender, rank);
+          failure->set_request_id(request_id);
+          send(sender, failure);
+          return;
+        }
+        // Large chunks are sent from their mapping, small ones copied
+        // together into parts of up to a transfer chunk.
+        uint64_t limit = static_cast<uint64_t>(options.chunk_kb) << 10;
+        std::shared_ptr<std::string> buffer;
+        uint64_t buffer_offset = 0;
+        auto flush = [&] {
+          if (buffer) {
+            part(buffer_offset, *buffer, buffer);
+            buffer.reset();
+          }
+        };
+        for (size_t i = 0; i < pieces.size(); i++) {
+          const Piece &piece = pieces[i];
+          const std::shared_ptr<MappedFile> &mapping = (*mappings)[i];
+          if (piece.size >= limit / 8) {
+            flush();
+            for (uint64_t sent = 0; sent < piece.size; sent += limit) {
+              uint64_t size = std::min(limit, piece.size - sent);
+              part(piece.offset + sent,
+                   std::string_view(mapping->data() + piece.skip + sent, size), mapping);
+            }
+            continue;
+          }
+          if (buffer && buffer->size() + piece.size > limit) {
+            flush();
+          }
+          if (!buffer) {
+            buffer = std::make_shared<std::string>();
+            buffer_offset = piece.offset;
+          }
+          buffer->append(mapping->data() + piece.skip, piece.size);
+        }
+        flush();
+      });
+  return true;
+}
+
+bool RaftServer::read_packed(const std::shared_ptr<message::Client_message> &message,
+                             const FileMeta &file, uint64_t offset, uint64_t length) {
+  size_t key = std::hash<std::string>{}(file.name);
+  if (io.full(key)) {
+    return false;
+  }
+  // Read after the writes of the file queued before, on the same worker.
+  std::vector<Extent> extents = segments->slice(file.uid, offset, length);
+  auto buffer = std::make_shared<std::string>(length, '\0');
+  io.submit(
+      key,
+      [extents, buffer] { return SegmentStore::read(extents, buffer->data()); },
+      [this, sender = message->get_sender_rank(), request_id = message->get_request_id(),
+       index = state.get_last_applied(), file_size = file.size, offset, buffer](bool success) {
+        int rank = state.get_rank();
+        if (!success) {
+          auto failure = std::make_shared<message::Handshake_message>(
+              message::HandshakeStatus::FAILURE, sender, rank);
+          failure->set_request_id(request_id);
+          send(sender, failure);
+          return;
+        }
+        uint64_t chunk = static_cast<uint64_t>(options.chunk_kb) << 10;
+        for (uint64_t at = 0; at < buffer->size(); at += chunk) {
+          uint64_t size = std::min<uint64_t>(chunk, buffer->size() - at);
+          auto part = std::make_shared<message::Handshake_message>(
+              message::HandshakeStatus::SUCCESS, sender, rank);
+          part->set_request_id(request_id);
+          part->set_index(index);
+          part->set_size(file_size);
+          part->set_data(offset + at, std::string_view(buffer->data() + at, size), buffer);
+          send(sender, part);
+        }
+      });
+  return true;
+}
+
+void RaftServer::compact_segments() {
+  if (!segments) {
+    return;
+  }
+  std::shared_ptr<Segment> victim = segments->victim();
+  if (!victim) {
+    return;
+  }
+  // Each file is copied whole by its worker, after its queued writes;
+  // reads queued after it see the new extent.
+  for (int uid : segments->files_in(*victim)) {
+    const FileMeta *file = files.find(uid);
+    size_t key = std::hash<std::string>{}(file->name);
+    if (io.full(key)) {
+      return;
+    }
+    std::vector<Extent> from = segments->relocate(uid, segments->stream_of(file->name));
+    Extent to = segments->extents(uid).front();
+    io.submit(
+        key,
+        [from, to] {
+          std::string buffer(to.size, '\0');
+          return SegmentStore::read(from, buffer.data()) &&
+                 SegmentStore::write(to, buffer.data());
+        },
+        [this, uid, version = file->version](bool success) {
+          FileMeta *file = files.find(uid);
+          if (!success && file && file->version == version) {
+            file->state = ReplicaState::FAILED;
+          }
+        });
+  }
+}
+
+void RaftServer::reply_list(const std::shared_ptr<message::Client_message> &message) {
+  int sender = message->get_sender_rank();
+  AFS_LOG(DEBUG, "RaftServer(" << state.get_rank() << ") is going to list all files");
+
+  //LIST FILES
+  auto reply = std::make_shared<message::Handshake_message>(
+      message::HandshakeStatus::SUCCESS, sender, state.get_rank(), files.list());
+  reply->set_request_id(message->get_request_id());
+  reply->set_index(state.get_last_applied());
+  if (message->get_callback() && state.is_leader()) {
+    promise_callback(-1, sender);
+  }
+  send(sender, reply);
+}
+
+void RaftServer::promise_callback(int uid, int client) {
+  std::vector<int> &clients = callbacks[uid];
+  if (std::find(clients.begin(), clients.end(), client) == clients.end()) {
+    clients.push_back(client);
+  }
+}
+
+void RaftServer::break_callbacks(int uid, uint64_t index) {
+  auto it = callbacks.find(uid);
+  if (it == callbacks.end()) {
+    return;
+  }
+  // A promise is kept once: the client asks again when it reads again.
+  for (int client : it->second) {
+    auto notice = std::make_shared<message::Handshake_message>(
+        message::HandshakeStatus::CALLBACK_BREAK, client, state.get_rank(), uid);
+    notice->set_index(index);
+    send(client, notice);
+  }
+  callbacks.erase(it);
+}
+
+void RaftServer::visit(std::shared_ptr<rpc::InstallSnapshot> message) {
+  int leader = message->get_sender_rank();
+  uint64_t index = message->get_last_index();
+  auto reply = [&](uint64_t next_offset, bool done) {
+    send(leader, std::make_shared<rpc::InstallSnapshotResponse>(
+                     leader, state.get_rank(), state.get_term(), index,
+                     next_offset, done));
+  };
+
+  if (message->get_term() < state.get_term()) {
+    reply(0, false);
+    return;
+  }
+  follow(message->get_term(), leader);
+  leader_contact = std::chrono::steady_clock::now();
+  state.reset_election_timer(leader_contact);
+
+  // Already applied past this snapshot: nothing to install.
+  if (index <= state.get_last_applied()) {
+    reply(message->get_offset() + message->get_data().size(), true);
+    return;
+  }
+
+  if (message->get_offset() == 0) {
+    receiving_index = index;
+    receiving_offset = 0;
+  }
+  if (index != receiving_index || message->get_offset() != receiving_offset) {
+    reply(index == receiving_index ? receiving_offset : 0, false);
+    return;
+  }
+
+  std::string partial = snapshot_path + ".recv";
+  Snapshot::write_chunk(partial, receiving_offset, message->get_data(),
+                        message->get_done());
+  receiving_offset += message->get_data().size();
+
+  if (message->get_done()) {
+    std::filesystem::rename(partial, snapshot_path);
+    install_snapshot(SnapshotMeta{index, message->get_last_term()});
+    AFS_LOG(INFO, "RaftServer(" << state.get_rank() << ") installed snapshot at " << index);
+  }
+  reply(receiving_offset, message->get_done());
+}
+
+void RaftServer::visit(std::shared_ptr<rpc::InstallSnapshotResponse> message) {
+  if (message->get_term() > state.get_term()) {
+    follow(message->get_term(), -1);
+    return;
+  }
+  auto it = peers.find(message->get_sender_rank());
+  if (!state.is_leader() || it == peers.end()) {
+    return;
+  }
+
+  Peer &peer = it->second;
+  peer.inflight = std::max(0, peer.inflight - 1);
+  peer.last_response = std::chrono::steady_clock::now();
+
+  if (message->get_done()) {
+    peer.match_index = std::max(peer.match_index, message->get_last_index());
+    peer.next_index = std::max(peer.next_index, peer.match_index + 1);
+    peer.sending_snapshot = false;
+    peer.inflight = 0;
+    advance_commit_index();
+  } else if (message->get_last_index() == peer.snapshot_index) {
+    if (message->get_next_offset() > peer.snapshot_acked) {
+      peer.snapshot_acked = message->get_next_offset();
+    } else {
+      // The follower lost the stream: resend from what it has.
+      peer.snapshot_offset = message->get_next_offset();
+      peer.snapshot_acked = message->get_next_offset();
+      peer.inflight = 0;
+    }
+  }
+}
+
+void RaftServer::follow(uint64_t term, int leader) {
+  bool led = state.is_leader();
+  state.follow(term, leader);
+  wal.save_vote(state.get_term(), state.get_voted_for());
+  campaign.reset();
+  if (led) {
+    AFS_LOG(INFO, "RaftServer(" << state.get_rank() << ") steps down in term " << term);
+    // Promises and coded chunks are the leader's: the next one starts
+    // without them, clients expire their cached copies.
+    callbacks.clear();
+    fragment_entries.clear();
+    transfer_to = -1;
+  }
+}
+
+int RaftServer::reachable_leader(steady_time now) {
+  return now - leader_contact <= 2 * std::chrono::milliseconds(options.heartbeat_ms)
+             ? state.get_leader()
+             : -1;
+}
+
+bool RaftServer::leader_alive(steady_time now) {
+  return state.is_leader() ||
+         (state.get_leader() > 0 &&
+          now - leader_contact < std::chrono::milliseconds(options.election_ms));
+}
+
+void RaftServer::start_campaign(bool pre_vote, bool transfer, steady_time now) {
+  int rank = state.get_rank();
+  if (pre_vote) {
+    // The leader is presumed gone: requests wait for the next one.
+    state.follow(state.get_term(), -1);
+    campaign = Campaign{true, state.get_term() + 1, transfer, {rank}};
+  } else {
+    state.become_candidate();
+    wal.save_vote(state.get_term(), rank);
+    stats::metrics().count(stats::ELECTIONS);
+    campaign = Campaign{false, state.get_term(), transfer, {rank}};
+    AFS_LOG(INFO, "RaftServer(" << rank << ") runs for leader of term " << state.get_term());
+  }
+  state.reset_election_timer(now);
+  if (static_cast<int>(campaign->granted.size()) >= state.get_quorum()) {
+    if (pre_vote) {
+      start_campaign(false, transfer, now);
+    } else {
+      become_leader();
+    }
+    return;
+  }
+
+  RaftLog &log = state.get_log();
+  for (int member : state.get_members()) {
+    if (member != rank) {
+      send(member, std::make_shared<rpc::RequestVote>(member, rank, campaign->term,
+                                                      log.last_index(), log.last_term(),
+                                                      pre_vote, transfer));
+    }
+  }
+}
+
+void RaftServer::become_leader() {
+  state.become_leader();
+  campaign.reset();
+  transfer_to = -1;
+  lease_revoked = false;
+  serving = false;
+  RaftLog &log = state.get_log();
+  AFS_LOG(INFO, "RaftServer(" << state.get_rank() << ") leads term " << state.get_term()
+                              << " from index " << log.last_index());
+
+  peers.clear();
+  for (int rank : state.get_members()) {
+    if (rank != state.get_rank()) {
+      peers[rank].next_index = log.last_index() + 1;
+    }
+  }
+  // Entries up to here may have been committed by a previous leader: reads
+  // wait until they are applied, which an entry of this term brings.
+  read_floor = log.last_index();
+  auto noop = std::make_shared<LogEntry>(LogEntry{
+      state.get_term(), message::ClientAction::NOOP, -1, std::string(), std::string(), -1,
+      0, 0, 0, LogEntry::PLAIN, {}});
+  uint64_t index = log.append(noop);
+  wal.append(index, *noop);
+  // The other groups forward the requests about this group's files here.
+  for (int g = 0; g < routing.groups(); g++) {
+    if (g != group) {
+      for (int rank : routing.members(g)) {
+        send(rank, std::make_shared<rpc::LeaderNotice>(rank, state.get_rank(), state.get_term()));
+      }
+    }
+  }
+  // The promises of the previous leader are lost: clients drop what it
+  // handed out.
+  int size;
+  MPI_Comm_size(state.get_comm(), &size);
+  for (int client = state.get_nb_servers() + 1; client < size; client++) {
+    send(client, std::make_shared<message::Handshake_message>(
+        message::HandshakeStatus::CALLBACK_BREAK, client, state.get_rank(), message::ALL_FILES));
+  }
+  // Requests held while no leader was reachable: the reads among them skip
+  // the log.
+  std::queue<std::shared_ptr<message::Client_message>> held;
+  std::swap(held, message_queue);
+  for (; !held.empty(); held.pop()) {
+    visit(held.front());
+  }
+  replicate();
+}
+
+void RaftServer::visit(std::shared_ptr<rpc::RequestVote> message) {
+  int candidate = message->get_sender_rank();
+  uint64_t term = message->get_term();
+  bool pre_vote = message->get_pre_vote();
+  auto reply = [&](uint64_t reply_term, bool granted) {
+    send(candidate, std::make_shared<rpc::RequestVoteResponse>(
+                        candidate, state.get_rank(), reply_term, granted, pre_vote));
+  };
+
+  // Members still hearing from a leader do not help replacing it, unless
+  // it hands its leadership over.
+  auto now = std::chrono::steady_clock::now();
+  if (!hears_campaign(state, *message, leader_alive(now))) {
+    reply(state.get_term(), false);
+    return;
+  }
+  if (pre_vote) {
+    bool granted = grants_vote(state, *message);
+    reply(granted ? term : state.get_term(), granted);
+    return;
+  }
+
+  if (term > state.get_term()) {
+    follow(term, -1);
+  }
+  bool granted = grants_vote(state, *message);
+  if (granted) {
+    // Durable before the answer: a restart must not vote again.
+    state.vote(candidate);
+    wal.save_vote(state.get_term(), candidate);
+    state.reset_election_timer(now);
+  }
+  reply(state.get_term(), granted);
+}
+
+void RaftServer::visit(std::shared_ptr<rpc::RequestVoteResponse> message) {
+  if (!message->get_granted()) {
+    if (message->get_term() > state.get_term()) {
+      follow(message->get_term(), -1);
+    }
+    return;
+  }
+  if (!campaign || campaign->pre_vote != message->get_pre_vote() ||
+      campaign->term != message->get_term()) {
+    return;
+  }
+  campaign->granted.insert(message->get_sender_rank());
+  if (static_cast<int>(campaign->granted.size()) < state.get_quorum()) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (campaign->pre_vote) {
+    start_campaign(false, campaign->transfer, now);
+  } else {
+    become_leader();
+  }
+}
+
+void RaftServer::visit(std::shared_ptr<rpc::TimeoutNow> message) {
+  if (message->get_term() != state.get_term() || state.is_leader()) {
+    return;
+  }
+  start_campaign(false, true, std::chrono::steady_clock::now());
+}
+
+void RaftServer::visit(std::shared_ptr<rpc::LeaderNotice> message) {
+  auto &[term, leader] = group_leaders[routing.group_of_rank(message->get_sender_rank())];
+  if (message->get_term() >= term) {
+    term = message->get_term();
+    leader = message->get_sender_rank();
+  }
+}
+
+void RaftServer::transfer_leadership(std::shared_ptr<repl::REPL_message> message) {
+  int sender = message->get_sender_rank();
+  // The REPL addresses the new leader, which hands the request to the
+  // current one.
+  int to = message->get_target_rank();
+  auto status = message::HandshakeStatus::SUCCESS;
+  if (!state.is_leader()) {
+    if (to == state.get_rank() && state.get_leader() > 0) {
+      send(state.get_leader(), message);
+      return;
+    }
+    status = message::HandshakeStatus::FAILURE;
+  } else if (to != state.get_rank()) {
+    if (peers.count(to) == 0) {
+      status = message::HandshakeStatus::FAILURE;
+    } else {
+      AFS_LOG(INFO, "RaftServer(" << state.get_rank() << ") hands its leadership over to "
+                                  << to);
+      transfer_to = to;
+      transfer_deadline =
+          std::chrono::steady_clock::now() + std::chrono::milliseconds(options.election_ms);
+      transfer_sent = false;
+    }
+  }
+  send(sender, std::make_shared<message::Handshake_message>(status, sender, state.get_rank()));
+}
+
+void RaftServer::tick_transfer(steady_time now) {
+  if (transfer_to < 0) {
+    return;
+  }
+  if (now >= transfer_deadline) {
+    AFS_LOG(INFO, "RaftServer(" << state.get_rank() << ") keeps its leadership: "
+                                << transfer_to << " was not elected in time");
+    transfer_to = -1;
+    return;
+  }
+  if (!transfer_sent && peers[transfer_to].match_index == state.get_log().last_index()) {
+    transfer_sent = true;
+    lease_revoked = true;
+    send(transfer_to,
+         std::make_shared<rpc::TimeoutNow>(transfer_to, state.get_rank(), state.get_term()));
+  }
+}
+
+void RaftServer::on_message_callback(
+    std::shared_ptr<message::Message> message) {
+  if (crashed && message->get_type() != message::MessageType::REPL) {
+    return;
+  }
+  if (!started && message->get_type() == message::MessageType::RPC) {
+    return;
+  }
+
+  message->accept(*this);
+}
+
+void RaftServer::visit(std::shared_ptr<repl::REPL_message> message) {
+  on_receive_repl(message);
+}
+
+void RaftServer::visit(std::shared_ptr<message::Client_message> message) {
+  AFS_LOG(DEBUG, "RaftServer(" << state.get_rank() << "): Received CLIENT message");
+  // Requests about another group's files go to that group.
+  int owner = owner_group(*message);
+  if (owner != group) {
+    send(group_leaders[owner].second, message);
+    return;
+  }
+
+  // Followers hand client requests over to the leader, which answers the
+  // client directly.
+  auto now = std::chrono::steady_clock::now();
+  if (!state.is_leader()) {
+    // Relaxed reads are answered locally once the follower caught up.
+    if (message->is_read() && message->is_relaxed_read()) {
+      pending_reads.push_back(PendingRead{message, message->get_min_index(), now});
+      serve_reads();
+    } else if (reachable_leader(now) > 0) {
+      send(state.get_leader(), message);
+    } else {
+      // Handed over once the leader is heard from again, or a new one is
+      // elected: the current one may be gone.
+      message_queue.push(message);
+    }
+    return;
+  }
+
+  // Reads skip the log: they only wait for the entries committed before
+  // they arrived to be applied, and for the leadership to be confirmed.
+  if (message->is_read()) {
+    uint64_t read_index = std::max({state.get_commit_index(), read_floor,
+                                    message->get_min_index()});
+    pending_reads.push_back(PendingRead{message, read_index, now});
+    serve_reads();
+    return;
+  }
+  message_queue.push(message);
+}
+
+int RaftServer::owner_group(const message::Client_message &message) const {
+  switch (message.get_action()) {
+  case message::ClientAction::LOAD:
+    return routing.group_of_name(message.get_filename());
+  case message::ClientAction::UPLOAD_BEGIN:
+    return message.get_uid() >= 0 ? routing.group_of_uid(message.get_uid())
+                                  : routing.group_of_name(message.get_filename());
+  case message::ClientAction::APPEND:
+  case message::ClientAction::DELETE:
+  case message::ClientAction::READ:
+  case message::ClientAction::UPLOAD_CHUNK:
+  case message::ClientAction::UPLOAD_COMMIT:
+    return message.get_uid() >= 0 ? routing.group_of_uid(message.get_uid()) : group;
+  default:
+    return group;
+  }
 }
 } // namespace raft
\ No newline at end of file
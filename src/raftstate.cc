@@ -1,38 +1,106 @@
 #include "raftstate.hh"
 
-#include <ctime>
+#include <numeric>
 #include <mpi.h>
 
 RaftState::RaftState(MPI_Comm comm, int nb_servers)
     : role(Role::FOLLOWER)
-    , clock(0)
     , leader_uid(-1)
-    , last_checked(std::chrono::system_clock::now())
-    , timeout(RaftState::INITIAL_TIMEOUT)
     , comm(comm)
     , nb_servers(nb_servers)
+    , term(0)
+    , voted_for(-1)
+    , commit_index(0)
+    , last_applied(0)
+    , election_timeout(std::chrono::milliseconds(150))
+    , election_deadline(std::chrono::steady_clock::time_point::max())
 
 {
     MPI_Comm_rank(comm, &uid);
     MPI_Comm_size(comm, &nb_states);
+    // Distinct draws per rank and per run.
+    rng.seed(uid * 7919 + std::chrono::steady_clock::now().time_since_epoch().count());
+
+    members.resize(nb_servers);
+    std::iota(members.begin(), members.end(), 1);
+}
+
+void RaftState::set_group(MPI_Comm group_comm)
+{
+    MPI_Group all;
+    MPI_Group group;
+    MPI_Comm_group(comm, &all);
+    MPI_Comm_group(group_comm, &group);
+
+    int size;
+    MPI_Group_size(group, &size);
+    std::vector<int> ranks(size);
+    std::iota(ranks.begin(), ranks.end(), 0);
+    members.resize(size);
+    MPI_Group_translate_ranks(group, size, ranks.data(), all, members.data());
+    MPI_Group_free(&group);
+    MPI_Group_free(&all);
+}
+
+void RaftState::restart()
+{
+    role = Role::FOLLOWER;
+    leader_uid = -1;
+    commit_index = 0;
+    last_applied = 0;
+    log = raft::RaftLog();
+}
+
+void RaftState::restore(uint64_t saved_term, int saved_vote)
+{
+    term = saved_term;
+    voted_for = saved_vote;
+}
+
+void RaftState::bootstrap()
+{
+    term = 1;
+    leader_uid = members.front();
+    voted_for = leader_uid;
+    role = uid == leader_uid ? Role::LEADER : Role::FOLLOWER;
 }
 
-void RaftState::update()
+void RaftState::follow(uint64_t new_term, int leader)
 {
-    if (role == Role::FOLLOWER)
-    {
-        auto time_delta = std::chrono::system_clock::now() - last_checked;
-        timeout -= std::chrono::duration_cast<microseconds>(time_delta);
+    if (new_term > term)
+        voted_for = -1;
+    term = new_term;
+    leader_uid = leader;
+    role = Role::FOLLOWER;
+}
 
-        last_checked = std::chrono::system_clock::now();
+void RaftState::become_candidate()
+{
+    term++;
+    voted_for = uid;
+    leader_uid = -1;
+    role = Role::CANDIDATE;
+}
 
-        if (timeout <= 0us)
-        {
-            MPI_Request request;
-            MPI_Ibcast(&clock, 1, MPI_UNSIGNED_LONG, MPI_ROOT, comm, &request);
+void RaftState::become_leader()
+{
+    leader_uid = uid;
+    role = Role::LEADER;
+}
 
-            timeout = RaftState::INITIAL_TIMEOUT;
-            role = Role::CANDIDATE;
-        }
-    }
+void RaftState::vote(int candidate)
+{
+    voted_for = candidate;
+}
+
+void RaftState::set_election_timeout(std::chrono::milliseconds timeout)
+{
+    election_timeout = timeout;
+}
+
+void RaftState::reset_election_timer(steady_time now)
+{
+    std::uniform_int_distribution<int64_t> draw(
+        0, std::chrono::duration_cast<std::chrono::microseconds>(election_timeout).count() - 1);
+    election_deadline = now + election_timeout + std::chrono::microseconds(draw(rng));
 }
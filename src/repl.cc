@@ -1,5 +1,6 @@
 #include "repl.hh"
 
+#include <algorithm>
 #include <cstdlib>
 #include <exception>
 #include <memory>
@@ -8,6 +9,8 @@
 
 #include "repl_message.hh"
 #include "handshake_message.hh"
+#include "metrics.hh"
+#include "log.hh"
 
 namespace repl
 {
@@ -15,6 +18,7 @@ namespace repl
     REPL::REPL(MPI_Comm com, int nb_servers)
     : Server(com, nb_servers)
     , running(true)
+    , awaiting_stats(0)
     {
     }
 
@@ -22,7 +26,16 @@ namespace repl
       std::string input;
       while (running) {
         std::cout << "REPL(" << state.get_rank() << ")$ ";
-        std::cin >> input;
+        // Commands piped in: nothing left to read once they ran out.
+        if (!(std::cin >> input)) {
+          running = false;
+          break;
+        }
+        if (input == "STATS") {
+          input.clear();
+          running = !request_stats();
+          continue;
+        }
         std::shared_ptr<REPL_message> bite = process_message(input);
         input.clear();
         if (bite != nullptr) {
@@ -32,19 +45,73 @@ namespace repl
       }
     }
 
+    std::chrono::steady_clock::time_point REPL::next_deadline()
+    {
+      // Waiting for a handshake: only messages can wake us up.
+      if (!running)
+        return Server::next_deadline();
+      return std::chrono::steady_clock::now();
+    }
+
     void REPL::on_message_callback(std::shared_ptr<message::Message> message)
     {
-      json j = message->serialize_json();
-      std::cout << "REPL(" << state.get_rank() << "): Received message" << std::endl;
-      if (j["MESSAGE_TYPE"] == message::MessageType::HANDSHAKE)
+      AFS_LOG(DEBUG, "REPL(" << state.get_rank() << "): Received message");
+      message->accept(*this);
+    }
+
+    void REPL::visit(std::shared_ptr<message::Handshake_message> message)
+    {
+      if (awaiting_stats > 0)
       {
-        std::cout << message::HandshakeStatus::SUCCESS << std::endl;
-        if (j["HANDSHAKE"]["STATUS"] == message::HandshakeStatus::SUCCESS)
+        stats_replies.push_back(json::parse(message->get_data()));
+        stats_replies.back()["RANK"] = message->get_sender_rank();
+        if (--awaiting_stats == 0)
         {
-          std::cout << "REPL(" << state.get_rank() << "): Handshake successul" << std::endl;
+          std::sort(stats_replies.begin(), stats_replies.end(),
+                    [](const json &a, const json &b) { return a["RANK"] < b["RANK"]; });
+          stats::Metrics::print(std::cout, stats_replies);
+          stats_replies.clear();
           running = true;
         }
+        return;
+      }
+      std::cout << message::HandshakeStatus::SUCCESS << std::endl;
+      if (message->get_status() == message::HandshakeStatus::SUCCESS)
+      {
+        std::cout << "REPL(" << state.get_rank() << "): Handshake successul" << std::endl;
+      }
+      else
+      {
+        std::cout << "REPL(" << state.get_rank() << "): Command refused" << std::endl;
+      }
+      running = true;
+    }
+
+    bool REPL::request_stats()
+    {
+      std::string res;
+      std::cout << "REPL: Stats of which one (rank or all) ? ";
+      std::cin >> res;
+      int nb_servers = state.get_nb_servers();
+      int first = 1;
+      int last = nb_servers;
+      if (res != "all")
+      {
+        try {
+          first = last = std::stoi(res);
+        } catch (std::invalid_argument &e) {
+          first = -1;
+        }
+        if (first < 1 || first > nb_servers)
+        {
+          std::cout << "REPL: Invalid rank" << std::endl;
+          return false;
+        }
       }
+      for (int rank = first; rank <= last; rank++)
+        send(rank, std::make_shared<REPL_message>(ReplType::STATS, rank, state.get_rank()));
+      awaiting_stats = last - first + 1;
+      return true;
     }
 
     std::shared_ptr<REPL_message> REPL::process_message(std::string input)
@@ -95,6 +162,26 @@ namespace repl
         return nullptr;
       }
         return std::make_shared<REPL_message>(ReplType::START, target_rank, state.get_rank());
+      } else if (input == "RECOVER") {
+        std::cout << "REPL: Recovering which one ? ";
+        std::cin >> res;
+      try {
+        target_rank = std::stoi(res);
+      } catch (std::invalid_argument &e) {
+        std::cout << "REPL: Invalid rank" << std::endl;
+        return nullptr;
+      }
+        return std::make_shared<REPL_message>(ReplType::RECOVER, target_rank, state.get_rank());
+      } else if (input == "TRANSFER") {
+        std::cout << "REPL: Transfer the leadership to which one ? ";
+        std::cin >> res;
+      try {
+        target_rank = std::stoi(res);
+      } catch (std::invalid_argument &e) {
+        std::cout << "REPL: Invalid rank" << std::endl;
+        return nullptr;
+      }
+        return std::make_shared<REPL_message>(ReplType::TRANSFER, target_rank, state.get_rank());
       }
         return nullptr;
     }
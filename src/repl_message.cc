@@ -30,9 +30,19 @@ namespace repl
         return j;
     }
 
-    std::shared_ptr<REPL_message> REPL_message::deserialize(const std::string &message)
+    void REPL_message::accept(Visitor &visitor)
+    {
+        visitor.visit(std::static_pointer_cast<REPL_message>(shared_from_this()));
+    }
+
+    void REPL_message::serialize_payload(wire::Writer &writer) const
+    {
+        writer.put<uint8_t>(this->repl_type);
+        writer.put<uint8_t>(this->speed);
+    }
+
+    std::shared_ptr<REPL_message> REPL_message::deserialize(const json &j)
     {
-       json j = json::parse(message); 
        json data = j["REPL"];
        ReplType type = static_cast<ReplType>(data["REPL_TYPE"]);
        if (type == ReplType::SPEED)
@@ -41,4 +51,15 @@ namespace repl
        }
        return std::make_shared<REPL_message>(type, j["TARGET"], j["SENDER"]);
     }
+
+    std::shared_ptr<REPL_message> REPL_message::deserialize(wire::Reader &reader, int sender_rank, int target_rank)
+    {
+       ReplType type = static_cast<ReplType>(reader.get<uint8_t>());
+       ReplSpeed speed = static_cast<ReplSpeed>(reader.get<uint8_t>());
+       if (type == ReplType::SPEED)
+       {
+        return std::make_shared<REPL_message>(target_rank, sender_rank, speed);
+       }
+       return std::make_shared<REPL_message>(type, target_rank, sender_rank);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,42 @@
+#include "routing.hh"
+
+#include <cstdint>
+#include <stdexcept>
+
+namespace raft
+{
+    RoutingTable::RoutingTable(int nb_servers, int groups)
+    {
+        if (groups < 1 || groups > nb_servers)
+            throw std::invalid_argument("Invalid number of groups: " + std::to_string(groups));
+
+        // The first nb_servers % groups groups get one more server.
+        int rank = 1;
+        group_members.resize(groups);
+        for (int g = 0; g < groups; g++)
+        {
+            int size = nb_servers / groups + (g < nb_servers % groups ? 1 : 0);
+            for (int i = 0; i < size; i++)
+                group_members[g].push_back(rank++);
+        }
+    }
+
+    int RoutingTable::group_of_rank(int rank) const
+    {
+        for (int g = 0; g < groups(); g++)
+        {
+            if (rank >= group_members[g].front() && rank <= group_members[g].back())
+                return g;
+        }
+        return -1;
+    }
+
+    int RoutingTable::group_of_name(const std::string &filename) const
+    {
+        // FNV-1a: the same on every rank, unlike std::hash across builds.
+        uint32_t hash = 2166136261u;
+        for (unsigned char c : filename)
+            hash = (hash ^ c) * 16777619u;
+        return hash % groups();
+    }
+}
@@ -0,0 +1,551 @@
+#include "rpc_message.hh"
+
+namespace rpc
+{
+    RPC_message::RPC_message(RpcType rpc_type, int target_rank, int sender_rank, uint64_t term)
+        : Message(MessageType::RPC, sender_rank, target_rank)
+        , rpc_type(rpc_type)
+        , term(term)
+    {}
+
+    json RPC_message::serialize_json() const
+    {
+        json j;
+        json data;
+        data["RPC_TYPE"] = this->rpc_type;
+        data["TERM"] = this->term;
+        serialize_rpc_json(data);
+        j["MESSAGE_TYPE"] = MessageType::RPC;
+        j["SENDER"] = this->sender_rank;
+        j["TARGET"] = this->target_rank;
+        j["RPC"] = data;
+        return j;
+    }
+
+    void RPC_message::serialize_payload(wire::Writer &writer) const
+    {
+        writer.put<uint8_t>(this->rpc_type);
+        writer.put<uint64_t>(this->term);
+        serialize_rpc_payload(writer);
+    }
+
+    std::shared_ptr<RPC_message> RPC_message::deserialize(const json &j)
+    {
+        RpcType type = static_cast<RpcType>(j["RPC"]["RPC_TYPE"]);
+        uint64_t term = j["RPC"]["TERM"];
+        switch (type)
+        {
+        case RpcType::APPEND_ENTRIES:
+            return AppendEntries::deserialize(j, term);
+        case RpcType::APPEND_ENTRIES_RESPONSE:
+            return AppendEntriesResponse::deserialize(j, term);
+        case RpcType::INSTALL_SNAPSHOT:
+            return InstallSnapshot::deserialize(j, term);
+        case RpcType::INSTALL_SNAPSHOT_RESPONSE:
+            return InstallSnapshotResponse::deserialize(j, term);
+        case RpcType::FRAGMENT_REQUEST:
+            return FragmentRequest::deserialize(j, term);
+        case RpcType::FRAGMENT_RESPONSE:
+            return FragmentResponse::deserialize(j, term);
+        case RpcType::REQUEST_VOTE:
+            return RequestVote::deserialize(j, term);
+        case RpcType::REQUEST_VOTE_RESPONSE:
+            return RequestVoteResponse::deserialize(j, term);
+        case RpcType::TIMEOUT_NOW:
+            return TimeoutNow::deserialize(j, term);
+        case RpcType::LEADER_NOTICE:
+            return LeaderNotice::deserialize(j, term);
+        default:
+            throw std::runtime_error("Unknown RPC type");
+        }
+    }
+
+    std::shared_ptr<RPC_message> RPC_message::deserialize(wire::Reader &reader, int sender_rank, int target_rank)
+    {
+        RpcType type = static_cast<RpcType>(reader.get<uint8_t>());
+        uint64_t term = reader.get<uint64_t>();
+        switch (type)
+        {
+        case RpcType::APPEND_ENTRIES:
+            return AppendEntries::deserialize(reader, sender_rank, target_rank, term);
+        case RpcType::APPEND_ENTRIES_RESPONSE:
+            return AppendEntriesResponse::deserialize(reader, sender_rank, target_rank, term);
+        case RpcType::INSTALL_SNAPSHOT:
+            return InstallSnapshot::deserialize(reader, sender_rank, target_rank, term);
+        case RpcType::INSTALL_SNAPSHOT_RESPONSE:
+            return InstallSnapshotResponse::deserialize(reader, sender_rank, target_rank, term);
+        case RpcType::FRAGMENT_REQUEST:
+            return FragmentRequest::deserialize(reader, sender_rank, target_rank, term);
+        case RpcType::FRAGMENT_RESPONSE:
+            return FragmentResponse::deserialize(reader, sender_rank, target_rank, term);
+        case RpcType::REQUEST_VOTE:
+            return RequestVote::deserialize(reader, sender_rank, target_rank, term);
+        case RpcType::REQUEST_VOTE_RESPONSE:
+            return RequestVoteResponse::deserialize(reader, sender_rank, target_rank, term);
+        case RpcType::TIMEOUT_NOW:
+            return TimeoutNow::deserialize(reader, sender_rank, target_rank, term);
+        case RpcType::LEADER_NOTICE:
+            return LeaderNotice::deserialize(reader, sender_rank, target_rank, term);
+        default:
+            throw std::runtime_error("Unknown RPC type");
+        }
+    }
+
+    AppendEntries::AppendEntries(int target_rank, int sender_rank, uint64_t term,
+                                 uint64_t prev_log_index, uint64_t prev_log_term,
+                                 uint64_t leader_commit, std::vector<raft::EntryPtr> entries,
+                                 uint64_t sent_at)
+        : RPC_message(RpcType::APPEND_ENTRIES, target_rank, sender_rank, term)
+        , prev_log_index(prev_log_index)
+        , prev_log_term(prev_log_term)
+        , leader_commit(leader_commit)
+        , entries(std::move(entries))
+        , sent_at(sent_at)
+    {}
+
+    void AppendEntries::accept(Visitor &visitor)
+    {
+        visitor.visit(std::static_pointer_cast<AppendEntries>(shared_from_this()));
+    }
+
+    void AppendEntries::serialize_rpc_json(json &data) const
+    {
+        data["PREV_LOG_INDEX"] = prev_log_index;
+        data["PREV_LOG_TERM"] = prev_log_term;
+        data["LEADER_COMMIT"] = leader_commit;
+        json entries_json = json::array();
+        for (const auto &entry : entries)
+            entries_json.push_back(entry->serialize_json());
+        data["ENTRIES"] = entries_json;
+        data["SENT_AT"] = sent_at;
+    }
+
+    void AppendEntries::serialize_rpc_payload(wire::Writer &writer) const
+    {
+        writer.put<uint64_t>(prev_log_index);
+        writer.put<uint64_t>(prev_log_term);
+        writer.put<uint64_t>(leader_commit);
+        writer.put<uint64_t>(sent_at);
+        writer.put<uint32_t>(entries.size());
+        for (const auto &entry : entries)
+            entry->serialize(writer);
+    }
+
+    std::shared_ptr<AppendEntries> AppendEntries::deserialize(const json &j, uint64_t term)
+    {
+        const json &data = j["RPC"];
+        std::vector<raft::EntryPtr> entries;
+        for (const auto &entry : data["ENTRIES"])
+            entries.push_back(std::make_shared<raft::LogEntry>(raft::LogEntry::deserialize(entry)));
+        return std::make_shared<AppendEntries>(j["TARGET"], j["SENDER"], term,
+                                               data["PREV_LOG_INDEX"], data["PREV_LOG_TERM"],
+                                               data["LEADER_COMMIT"], std::move(entries),
+                                               data["SENT_AT"]);
+    }
+
+    std::shared_ptr<AppendEntries> AppendEntries::deserialize(wire::Reader &reader, int sender_rank,
+                                                              int target_rank, uint64_t term)
+    {
+        uint64_t prev_log_index = reader.get<uint64_t>();
+        uint64_t prev_log_term = reader.get<uint64_t>();
+        uint64_t leader_commit = reader.get<uint64_t>();
+        uint64_t sent_at = reader.get<uint64_t>();
+        uint32_t count = reader.get<uint32_t>();
+        std::vector<raft::EntryPtr> entries;
+        entries.reserve(count);
+        for (uint32_t i = 0; i < count; i++)
+            entries.push_back(std::make_shared<raft::LogEntry>(raft::LogEntry::deserialize(reader)));
+        return std::make_shared<AppendEntries>(target_rank, sender_rank, term, prev_log_index,
+                                               prev_log_term, leader_commit, std::move(entries),
+                                               sent_at);
+    }
+
+    AppendEntriesResponse::AppendEntriesResponse(int target_rank, int sender_rank, uint64_t term,
+                                                 bool success, uint64_t match_index,
+                                                 uint64_t sent_at, bool whole)
+        : RPC_message(RpcType::APPEND_ENTRIES_RESPONSE, target_rank, sender_rank, term)
+        , success(success)
+        , match_index(match_index)
+        , sent_at(sent_at)
+        , whole(whole)
+    {}
+
+    void AppendEntriesResponse::accept(Visitor &visitor)
+    {
+        visitor.visit(std::static_pointer_cast<AppendEntriesResponse>(shared_from_this()));
+    }
+
+    void AppendEntriesResponse::serialize_rpc_json(json &data) const
+    {
+        data["SUCCESS"] = success;
+        data["MATCH_INDEX"] = match_index;
+        data["SENT_AT"] = sent_at;
+        data["WHOLE"] = whole;
+    }
+
+    void AppendEntriesResponse::serialize_rpc_payload(wire::Writer &writer) const
+    {
+        writer.put<uint8_t>(success);
+        writer.put<uint64_t>(match_index);
+        writer.put<uint64_t>(sent_at);
+        writer.put<uint8_t>(whole);
+    }
+
+    std::shared_ptr<AppendEntriesResponse> AppendEntriesResponse::deserialize(const json &j, uint64_t term)
+    {
+        const json &data = j["RPC"];
+        return std::make_shared<AppendEntriesResponse>(j["TARGET"], j["SENDER"], term,
+                                                       data["SUCCESS"], data["MATCH_INDEX"],
+                                                       data["SENT_AT"], data.value("WHOLE", false));
+    }
+
+    std::shared_ptr<AppendEntriesResponse> AppendEntriesResponse::deserialize(wire::Reader &reader, int sender_rank,
+                                                                              int target_rank, uint64_t term)
+    {
+        bool success = reader.get<uint8_t>();
+        uint64_t match_index = reader.get<uint64_t>();
+        uint64_t sent_at = reader.get<uint64_t>();
+        bool whole = reader.get<uint8_t>();
+        return std::make_shared<AppendEntriesResponse>(target_rank, sender_rank, term, success,
+                                                       match_index, sent_at, whole);
+    }
+
+    InstallSnapshot::InstallSnapshot(int target_rank, int sender_rank, uint64_t term,
+                                     uint64_t last_index, uint64_t last_term, uint64_t offset,
+                                     std::string data, bool done)
+        : RPC_message(RpcType::INSTALL_SNAPSHOT, target_rank, sender_rank, term)
+        , last_index(last_index)
+        , last_term(last_term)
+        , offset(offset)
+        , data(std::move(data))
+        , done(done)
+    {}
+
+    void InstallSnapshot::accept(Visitor &visitor)
+    {
+        visitor.visit(std::static_pointer_cast<InstallSnapshot>(shared_from_this()));
+    }
+
+    void InstallSnapshot::serialize_rpc_json(json &data) const
+    {
+        data["LAST_INDEX"] = last_index;
+        data["LAST_TERM"] = last_term;
+        data["OFFSET"] = offset;
+        // Chunks are raw bytes, not UTF-8 text.
+        data["DATA"] = std::vector<uint8_t>(this->data.begin(), this->data.end());
+        data["DONE"] = done;
+    }
+
+    void InstallSnapshot::serialize_rpc_payload(wire::Writer &writer) const
+    {
+        writer.put<uint64_t>(last_index);
+        writer.put<uint64_t>(last_term);
+        writer.put<uint64_t>(offset);
+        writer.put_string(data);
+        writer.put<uint8_t>(done);
+    }
+
+    std::shared_ptr<InstallSnapshot> InstallSnapshot::deserialize(const json &j, uint64_t term)
+    {
+        const json &data = j["RPC"];
+        std::vector<uint8_t> bytes = data["DATA"];
+        return std::make_shared<InstallSnapshot>(j["TARGET"], j["SENDER"], term,
+                                                 data["LAST_INDEX"], data["LAST_TERM"], data["OFFSET"],
+                                                 std::string(bytes.begin(), bytes.end()), data["DONE"]);
+    }
+
+    std::shared_ptr<InstallSnapshot> InstallSnapshot::deserialize(wire::Reader &reader, int sender_rank,
+                                                                  int target_rank, uint64_t term)
+    {
+        uint64_t last_index = reader.get<uint64_t>();
+        uint64_t last_term = reader.get<uint64_t>();
+        uint64_t offset = reader.get<uint64_t>();
+        std::string data = reader.get_string();
+        bool done = reader.get<uint8_t>();
+        return std::make_shared<InstallSnapshot>(target_rank, sender_rank, term, last_index,
+                                                 last_term, offset, std::move(data), done);
+    }
+
+    InstallSnapshotResponse::InstallSnapshotResponse(int target_rank, int sender_rank, uint64_t term,
+                                                     uint64_t last_index, uint64_t next_offset, bool done)
+        : RPC_message(RpcType::INSTALL_SNAPSHOT_RESPONSE, target_rank, sender_rank, term)
+        , last_index(last_index)
+        , next_offset(next_offset)
+        , done(done)
+    {}
+
+    void InstallSnapshotResponse::accept(Visitor &visitor)
+    {
+        visitor.visit(std::static_pointer_cast<InstallSnapshotResponse>(shared_from_this()));
+    }
+
+    void InstallSnapshotResponse::serialize_rpc_json(json &data) const
+    {
+        data["LAST_INDEX"] = last_index;
+        data["NEXT_OFFSET"] = next_offset;
+        data["DONE"] = done;
+    }
+
+    void InstallSnapshotResponse::serialize_rpc_payload(wire::Writer &writer) const
+    {
+        writer.put<uint64_t>(last_index);
+        writer.put<uint64_t>(next_offset);
+        writer.put<uint8_t>(done);
+    }
+
+    std::shared_ptr<InstallSnapshotResponse> InstallSnapshotResponse::deserialize(const json &j, uint64_t term)
+    {
+        const json &data = j["RPC"];
+        return std::make_shared<InstallSnapshotResponse>(j["TARGET"], j["SENDER"], term,
+                                                         data["LAST_INDEX"], data["NEXT_OFFSET"], data["DONE"]);
+    }
+
+    std::shared_ptr<InstallSnapshotResponse> InstallSnapshotResponse::deserialize(wire::Reader &reader, int sender_rank,
+                                                                                  int target_rank, uint64_t term)
+    {
+        uint64_t last_index = reader.get<uint64_t>();
+        uint64_t next_offset = reader.get<uint64_t>();
+        bool done = reader.get<uint8_t>();
+        return std::make_shared<InstallSnapshotResponse>(target_rank, sender_rank, term,
+                                                         last_index, next_offset, done);
+    }
+
+    FragmentRequest::FragmentRequest(int target_rank, int sender_rank, uint64_t term, int uid,
+                                     uint64_t created, uint64_t chunk, uint64_t min_index,
+                                     uint64_t token)
+        : RPC_message(RpcType::FRAGMENT_REQUEST, target_rank, sender_rank, term)
+        , uid(uid)
+        , created(created)
+        , chunk(chunk)
+        , min_index(min_index)
+        , token(token)
+    {}
+
+    void FragmentRequest::accept(Visitor &visitor)
+    {
+        visitor.visit(std::static_pointer_cast<FragmentRequest>(shared_from_this()));
+    }
+
+    void FragmentRequest::serialize_rpc_json(json &data) const
+    {
+        data["UID"] = uid;
+        data["CREATED"] = created;
+        data["CHUNK"] = chunk;
+        data["MIN_INDEX"] = min_index;
+        data["TOKEN"] = token;
+    }
+
+    void FragmentRequest::serialize_rpc_payload(wire::Writer &writer) const
+    {
+        writer.put<int32_t>(uid);
+        writer.put<uint64_t>(created);
+        writer.put<uint64_t>(chunk);
+        writer.put<uint64_t>(min_index);
+        writer.put<uint64_t>(token);
+    }
+
+    std::shared_ptr<FragmentRequest> FragmentRequest::deserialize(const json &j, uint64_t term)
+    {
+        const json &data = j["RPC"];
+        return std::make_shared<FragmentRequest>(j["TARGET"], j["SENDER"], term, data["UID"],
+                                                 data["CREATED"], data["CHUNK"],
+                                                 data["MIN_INDEX"], data["TOKEN"]);
+    }
+
+    std::shared_ptr<FragmentRequest> FragmentRequest::deserialize(wire::Reader &reader, int sender_rank,
+                                                                  int target_rank, uint64_t term)
+    {
+        int uid = reader.get<int32_t>();
+        uint64_t created = reader.get<uint64_t>();
+        uint64_t chunk = reader.get<uint64_t>();
+        uint64_t min_index = reader.get<uint64_t>();
+        uint64_t token = reader.get<uint64_t>();
+        return std::make_shared<FragmentRequest>(target_rank, sender_rank, term, uid, created,
+                                                 chunk, min_index, token);
+    }
+
+    FragmentResponse::FragmentResponse(int target_rank, int sender_rank, uint64_t term,
+                                       uint64_t token, int fragment, bool success,
+                                       std::string data)
+        : RPC_message(RpcType::FRAGMENT_RESPONSE, target_rank, sender_rank, term)
+        , token(token)
+        , fragment(fragment)
+        , success(success)
+        , data(std::move(data))
+    {}
+
+    void FragmentResponse::accept(Visitor &visitor)
+    {
+        visitor.visit(std::static_pointer_cast<FragmentResponse>(shared_from_this()));
+    }
+
+    void FragmentResponse::serialize_rpc_json(json &data) const
+    {
+        data["TOKEN"] = token;
+        data["FRAGMENT"] = fragment;
+        data["SUCCESS"] = success;
+        // Fragments are raw bytes, not UTF-8 text.
+        data["DATA"] = std::vector<uint8_t>(this->data.begin(), this->data.end());
+    }
+
+    void FragmentResponse::serialize_rpc_payload(wire::Writer &writer) const
+    {
+        writer.put<uint64_t>(token);
+        writer.put<int32_t>(fragment);
+        writer.put<uint8_t>(success);
+        writer.put_string(data);
+    }
+
+    std::shared_ptr<FragmentResponse> FragmentResponse::deserialize(const json &j, uint64_t term)
+    {
+        const json &data = j["RPC"];
+        std::vector<uint8_t> bytes = data["DATA"];
+        return std::make_shared<FragmentResponse>(j["TARGET"], j["SENDER"], term, data["TOKEN"],
+                                                  data["FRAGMENT"], data["SUCCESS"],
+                                                  std::string(bytes.begin(), bytes.end()));
+    }
+
+    std::shared_ptr<FragmentResponse> FragmentResponse::deserialize(wire::Reader &reader, int sender_rank,
+                                                                    int target_rank, uint64_t term)
+    {
+        uint64_t token = reader.get<uint64_t>();
+        int fragment = reader.get<int32_t>();
+        bool success = reader.get<uint8_t>();
+        std::string data = reader.get_string();
+        return std::make_shared<FragmentResponse>(target_rank, sender_rank, term, token, fragment,
+                                                  success, std::move(data));
+    }
+
+    RequestVote::RequestVote(int target_rank, int sender_rank, uint64_t term,
+                             uint64_t last_log_index, uint64_t last_log_term, bool pre_vote,
+                             bool transfer)
+        : RPC_message(RpcType::REQUEST_VOTE, target_rank, sender_rank, term)
+        , last_log_index(last_log_index)
+        , last_log_term(last_log_term)
+        , pre_vote(pre_vote)
+        , transfer(transfer)
+    {}
+
+    void RequestVote::accept(Visitor &visitor)
+    {
+        visitor.visit(std::static_pointer_cast<RequestVote>(shared_from_this()));
+    }
+
+    void RequestVote::serialize_rpc_json(json &data) const
+    {
+        data["LAST_LOG_INDEX"] = last_log_index;
+        data["LAST_LOG_TERM"] = last_log_term;
+        data["PRE_VOTE"] = pre_vote;
+        data["TRANSFER"] = transfer;
+    }
+
+    void RequestVote::serialize_rpc_payload(wire::Writer &writer) const
+    {
+        writer.put<uint64_t>(last_log_index);
+        writer.put<uint64_t>(last_log_term);
+        writer.put<uint8_t>(pre_vote);
+        writer.put<uint8_t>(transfer);
+    }
+
+    std::shared_ptr<RequestVote> RequestVote::deserialize(const json &j, uint64_t term)
+    {
+        const json &data = j["RPC"];
+        return std::make_shared<RequestVote>(j["TARGET"], j["SENDER"], term,
+                                             data["LAST_LOG_INDEX"], data["LAST_LOG_TERM"],
+                                             data["PRE_VOTE"], data["TRANSFER"]);
+    }
+
+    std::shared_ptr<RequestVote> RequestVote::deserialize(wire::Reader &reader, int sender_rank,
+                                                          int target_rank, uint64_t term)
+    {
+        uint64_t last_log_index = reader.get<uint64_t>();
+        uint64_t last_log_term = reader.get<uint64_t>();
+        bool pre_vote = reader.get<uint8_t>();
+        bool transfer = reader.get<uint8_t>();
+        return std::make_shared<RequestVote>(target_rank, sender_rank, term, last_log_index,
+                                             last_log_term, pre_vote, transfer);
+    }
+
+    RequestVoteResponse::RequestVoteResponse(int target_rank, int sender_rank, uint64_t term,
+                                             bool granted, bool pre_vote)
+        : RPC_message(RpcType::REQUEST_VOTE_RESPONSE, target_rank, sender_rank, term)
+        , granted(granted)
+        , pre_vote(pre_vote)
+    {}
+
+    void RequestVoteResponse::accept(Visitor &visitor)
+    {
+        visitor.visit(std::static_pointer_cast<RequestVoteResponse>(shared_from_this()));
+    }
+
+    void RequestVoteResponse::serialize_rpc_json(json &data) const
+    {
+        data["GRANTED"] = granted;
+        data["PRE_VOTE"] = pre_vote;
+    }
+
+    void RequestVoteResponse::serialize_rpc_payload(wire::Writer &writer) const
+    {
+        writer.put<uint8_t>(granted);
+        writer.put<uint8_t>(pre_vote);
+    }
+
+    std::shared_ptr<RequestVoteResponse> RequestVoteResponse::deserialize(const json &j,
+                                                                          uint64_t term)
+    {
+        const json &data = j["RPC"];
+        return std::make_shared<RequestVoteResponse>(j["TARGET"], j["SENDER"], term,
+                                                     data["GRANTED"], data["PRE_VOTE"]);
+    }
+
+    std::shared_ptr<RequestVoteResponse> RequestVoteResponse::deserialize(wire::Reader &reader,
+                                                                          int sender_rank,
+                                                                          int target_rank,
+                                                                          uint64_t term)
+    {
+        bool granted = reader.get<uint8_t>();
+        bool pre_vote = reader.get<uint8_t>();
+        return std::make_shared<RequestVoteResponse>(target_rank, sender_rank, term, granted,
+                                                     pre_vote);
+    }
+
+    TimeoutNow::TimeoutNow(int target_rank, int sender_rank, uint64_t term)
+        : RPC_message(RpcType::TIMEOUT_NOW, target_rank, sender_rank, term)
+    {}
+
+    void TimeoutNow::accept(Visitor &visitor)
+    {
+        visitor.visit(std::static_pointer_cast<TimeoutNow>(shared_from_this()));
+    }
+
+    std::shared_ptr<TimeoutNow> TimeoutNow::deserialize(const json &j, uint64_t term)
+    {
+        return std::make_shared<TimeoutNow>(j["TARGET"], j["SENDER"], term);
+    }
+
+    std::shared_ptr<TimeoutNow> TimeoutNow::deserialize(wire::Reader &, int sender_rank,
+                                                        int target_rank, uint64_t term)
+    {
+        return std::make_shared<TimeoutNow>(target_rank, sender_rank, term);
+    }
+
+    LeaderNotice::LeaderNotice(int target_rank, int sender_rank, uint64_t term)
+        : RPC_message(RpcType::LEADER_NOTICE, target_rank, sender_rank, term)
+    {}
+
+    void LeaderNotice::accept(Visitor &visitor)
+    {
+        visitor.visit(std::static_pointer_cast<LeaderNotice>(shared_from_this()));
+    }
+
+    std::shared_ptr<LeaderNotice> LeaderNotice::deserialize(const json &j, uint64_t term)
+    {
+        return std::make_shared<LeaderNotice>(j["TARGET"], j["SENDER"], term);
+    }
+
+    std::shared_ptr<LeaderNotice> LeaderNotice::deserialize(wire::Reader &, int sender_rank,
+                                                            int target_rank, uint64_t term)
+    {
+        return std::make_shared<LeaderNotice>(target_rank, sender_rank, term);
+    }
+}
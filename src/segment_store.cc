@@ -0,0 +1,208 @@
+#include "segment_store.hh"
+#include "trace.hh"
+
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <stdexcept>
+
+namespace raft
+{
+    Segment::Segment(uint64_t id, size_t stream, std::string path)
+        : id(id)
+        , stream(stream)
+        , path(std::move(path))
+        , file(MPI_FILE_NULL)
+        , size(0)
+        , live(0)
+        , open(true)
+    {
+        if (MPI_File_open(MPI_COMM_SELF, this->path.c_str(), MPI_MODE_CREATE | MPI_MODE_RDWR,
+                          MPI_INFO_NULL, &file) != MPI_SUCCESS)
+            throw std::runtime_error("SegmentStore: cannot open " + this->path);
+    }
+
+    Segment::~Segment()
+    {
+        if (file != MPI_FILE_NULL)
+            MPI_File_close(&file);
+    }
+
+    SegmentStore::SegmentStore(std::string dir, size_t streams, uint64_t segment_size)
+        : dir(std::move(dir))
+        , streams(std::max<size_t>(streams, 1))
+        , segment_size(segment_size)
+        , next_id(0)
+        , open_segments(this->streams)
+        , live(0)
+        , stored(0)
+    {
+        reset();
+    }
+
+    void SegmentStore::reset()
+    {
+        // Handles still held by operations close when those are dropped.
+        files.clear();
+        segments.clear();
+        std::fill(open_segments.begin(), open_segments.end(), nullptr);
+        live = 0;
+        stored = 0;
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+    }
+
+    size_t SegmentStore::stream_of(const std::string &name) const
+    {
+        return std::hash<std::string>{}(name) % streams;
+    }
+
+    Extent SegmentStore::append(int uid, size_t stream, uint64_t size)
+    {
+        if (size == 0)
+            return Extent{nullptr, 0, 0};
+        std::shared_ptr<Segment> &segment = open_segments[stream];
+        if (segment && segment->size > 0 && segment->size + size > segment_size)
+        {
+            segment->open = false;
+            if (segment->live == 0)
+                drop(segment);
+            segment = nullptr;
+        }
+        if (!segment)
+        {
+            uint64_t id = next_id++;
+            segment = std::make_shared<Segment>(id, stream, dir + "/segment_" + std::to_string(id));
+            segments.emplace(id, segment);
+        }
+
+        Extent extent{segment, segment->size, size};
+        segment->size += size;
+        segment->live += size;
+        stored += size;
+        live += size;
+        std::vector<Extent> &extents = files[uid];
+        // Appends written right after the previous bytes of the file extend
+        // its last extent.
+        if (!extents.empty() && extents.back().segment == segment &&
+            extents.back().offset + extents.back().size == extent.offset)
+            extents.back().size += size;
+        else
+            extents.push_back(extent);
+        segment->files.insert(uid);
+        return extent;
+    }
+
+    const std::vector<Extent> &SegmentStore::extents(int uid) const
+    {
+        static const std::vector<Extent> none;
+        auto it = files.find(uid);
+        return it == files.end() ? none : it->second;
+    }
+
+    std::vector<Extent> SegmentStore::slice(int uid, uint64_t offset, uint64_t length) const
+    {
+        std::vector<Extent> result;
+        uint64_t end = offset + length;
+        uint64_t at = 0;
+        for (const Extent &extent : extents(uid))
+        {
+            uint64_t next = at + extent.size;
+            if (next > offset && at < end)
+            {
+                uint64_t start = std::max(at, offset);
+                result.push_back(Extent{extent.segment, extent.offset + (start - at),
+                                        std::min(next, end) - start});
+            }
+            at = next;
+        }
+        return result;
+    }
+
+    void SegmentStore::erase(int uid)
+    {
+        auto it = files.find(uid);
+        if (it == files.end())
+            return;
+        std::vector<Extent> extents = std::move(it->second);
+        files.erase(it);
+        for (const Extent &extent : extents)
+            extent.segment->files.erase(uid);
+        for (const Extent &extent : extents)
+            release(extent);
+    }
+
+    std::shared_ptr<Segment> SegmentStore::victim() const
+    {
+        std::shared_ptr<Segment> best;
+        for (const auto &[id, segment] : segments)
+            if (!segment->open && segment->live * 2 < segment->size &&
+                (!best || segment->live < best->live))
+                best = segment;
+        return best;
+    }
+
+    std::vector<Extent> SegmentStore::relocate(int uid, size_t stream)
+    {
+        auto it = files.find(uid);
+        if (it == files.end())
+            return {};
+        std::vector<Extent> old = std::move(it->second);
+        it->second.clear();
+        uint64_t size = 0;
+        for (const Extent &extent : old)
+        {
+            size += extent.size;
+            extent.segment->files.erase(uid);
+        }
+        // Reserved before the old extents are released: the segment being
+        // compacted stays until the copy is queued.
+        append(uid, stream, size);
+        for (const Extent &extent : old)
+            release(extent);
+        return old;
+    }
+
+    bool SegmentStore::write(const Extent &extent, const char *data)
+    {
+        if (extent.size == 0)
+            return true;
+        stats::TraceSpan span("mpi-io", "MPI_File_write_at", "bytes", extent.size);
+        return MPI_File_write_at(extent.segment->file, extent.offset, data, extent.size, MPI_CHAR,
+                                 MPI_STATUS_IGNORE) == MPI_SUCCESS;
+    }
+
+    bool SegmentStore::read(const std::vector<Extent> &extents, char *buffer)
+    {
+        for (const Extent &extent : extents)
+        {
+            MPI_Status status;
+            stats::TraceSpan span("mpi-io", "MPI_File_read_at", "bytes", extent.size);
+            if (MPI_File_read_at(extent.segment->file, extent.offset, buffer, extent.size,
+                                 MPI_CHAR, &status) != MPI_SUCCESS)
+                return false;
+            int count;
+            MPI_Get_count(&status, MPI_CHAR, &count);
+            if (static_cast<uint64_t>(count) != extent.size)
+                return false;
+            buffer += extent.size;
+        }
+        return true;
+    }
+
+    void SegmentStore::release(const Extent &extent)
+    {
+        extent.segment->live -= extent.size;
+        live -= extent.size;
+        if (!extent.segment->open && extent.segment->live == 0)
+            drop(extent.segment);
+    }
+
+    void SegmentStore::drop(const std::shared_ptr<Segment> &segment)
+    {
+        stored -= segment->size;
+        std::error_code error;
+        std::filesystem::remove(segment->path, error);
+        segments.erase(segment->id);
+    }
+}
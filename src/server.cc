@@ -1,68 +1,406 @@
 #include "server.hh"
+#include <algorithm>
+#include <csignal>
+#include <cstring>
 #include <mpi.h>
+#include <numeric>
+#include <thread>
+#include "client_message.hh"
+#include "handshake_message.hh"
 #include "raftstate.hh"
 #include "repl.hh"
+#include "rpc_message.hh"
+#include "metrics.hh"
+#include "trace.hh"
+#include "log.hh"
+
+using namespace std::chrono_literals;
+
+static constexpr auto MIN_BACKOFF = 5us;
+static constexpr auto MAX_BACKOFF = 1000us;
+static constexpr auto IDLE_DEADLINE = 100ms;
+
+static volatile std::sig_atomic_t interrupted = 0;
+
+static void on_signal(int)
+{
+    interrupted = 1;
+}
+
+static stats::MessageKind kind_of(const message::Message &message)
+{
+    switch (message.get_type())
+    {
+    case message::MessageType::REPL:
+        return stats::REPL_MESSAGE;
+    case message::MessageType::HANDSHAKE:
+        return stats::HANDSHAKE_MESSAGE;
+    case message::MessageType::CLIENT:
+        return stats::CLIENT_MESSAGE;
+    default:
+        return static_cast<stats::MessageKind>(
+            static_cast<int>(stats::APPEND_ENTRIES_MESSAGE) +
+            static_cast<const rpc::RPC_message &>(message).get_rpc_type());
+    }
+}
+
+// Marks the span handling message as a step of the path of the client
+// request it carries, if any.
+static void trace_request(const message::Message &message, bool sent, int rank)
+{
+    if (!stats::Trace::enabled())
+        return;
+    if (message.get_type() == message::MessageType::CLIENT)
+    {
+        // Servers forward requests with their client as the sender.
+        auto &request = static_cast<const message::Client_message &>(message);
+        int client = request.get_sender_rank();
+        if (request.get_request_id() != 0)
+            stats::Trace::flow(sent && client == rank ? 's' : 't', client,
+                               request.get_request_id());
+    }
+    else if (message.get_type() == message::MessageType::HANDSHAKE)
+    {
+        auto &reply = static_cast<const message::Handshake_message &>(message);
+        if (reply.get_request_id() != 0)
+            stats::Trace::flow(sent ? 't' : 'f', reply.get_target_rank(),
+                               reply.get_request_id());
+    }
+}
 
 Server::Server(MPI_Comm com, int nb_servers)
     : state(com, nb_servers)
+    , recv_buffers(RECV_SLOTS, std::vector<char>(RECV_SLOT_SIZE))
+    , recv_requests(RECV_SLOTS)
+    , recv_posted(RECV_SLOTS)
+    , next_post(0)
+    , stopping(false)
+    , completed(RECV_SLOTS)
+    , completed_status(RECV_SLOTS)
+{
+    int size;
+    MPI_Comm_size(state.get_comm(), &size);
+    outbox.resize(size);
+    send_sequence.resize(size);
+    receive_sequence.resize(size);
+    early.resize(size);
+
+    for (int i = 0; i < RECV_SLOTS; i++)
+    {
+        MPI_Recv_init(recv_buffers[i].data(), RECV_SLOT_SIZE, MPI_CHAR, MPI_ANY_SOURCE,
+                      TAG_SMALL, state.get_comm(), &recv_requests[i]);
+        recv_posted[i] = next_post++;
+    }
+    MPI_Startall(RECV_SLOTS, recv_requests.data());
+}
+
+Server::~Server()
 {
+    flush();
+    MPI_Waitall(send_requests.size(), send_requests.data(), MPI_STATUSES_IGNORE);
+    for (auto &request : recv_requests)
+    {
+        MPI_Cancel(&request);
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+        MPI_Request_free(&request);
+    }
 }
 
+void Server::receive(int source, const char *data, int size)
+{
+    uint64_t sequence;
+    std::memcpy(&sequence, data, SEQUENCE_BYTES);
+    if (sequence != receive_sequence[source])
+    {
+        // A large message overtook a small one sent before it, or the other way.
+        early[source].emplace(sequence, std::vector<char>(data, data + size));
+        return;
+    }
+    deliver(data + SEQUENCE_BYTES, size - SEQUENCE_BYTES);
+    receive_sequence[source]++;
+    auto &waiting = early[source];
+    while (!waiting.empty() && waiting.begin()->first == receive_sequence[source])
+    {
+        // Delivering may send, and never receives: the node stays valid.
+        std::vector<char> buffer = std::move(waiting.begin()->second);
+        waiting.erase(waiting.begin());
+        deliver(buffer.data() + SEQUENCE_BYTES, buffer.size() - SEQUENCE_BYTES);
+        receive_sequence[source]++;
+    }
+}
 
-std::shared_ptr<message::Message> Server::listen()
+void Server::deliver(const char *data, int size)
 {
-    int flag;
-    MPI_Status status;
-    MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, state.get_comm(), &flag, &status);
-    int source = status.MPI_SOURCE;
-    auto tag = status.MPI_TAG;
+    std::shared_ptr<message::Message> message;
+    if (!wire::is_binary(data, size))
+    {
+        {
+            stats::ScopedTimer timer(stats::DESERIALIZE);
+            message = message::Message::deserialize(data, size);
+        }
+        dispatch(std::move(message), size);
+        return;
+    }
 
-    if (!flag)
-        return nullptr;
+    // A binary MPI message may carry several coalesced frames.
+    wire::Reader reader(data, size);
+    while (reader.remaining() > 0)
+    {
+        size_t start = reader.position();
+        {
+            stats::ScopedTimer timer(stats::DESERIALIZE);
+            message = message::Message::deserialize_binary(reader);
+        }
+        dispatch(std::move(message), reader.position() - start);
+    }
+}
 
-    int count = 0;
-    MPI_Get_count(&status, MPI_CHAR, &count);
+void Server::dispatch(std::shared_ptr<message::Message> message, size_t bytes)
+{
+    stats::MessageKind kind = kind_of(*message);
+    stats::metrics().received(kind, bytes);
+    stats::TraceSpan span("receive", stats::Metrics::name_of(kind), "from",
+                          message->get_sender_rank());
+    trace_request(*message, false, state.get_rank());
+    on_message_callback(std::move(message));
+}
 
-    auto buffer = std::vector<char>(count);
-    int err = MPI_Recv(buffer.data(), count, MPI_CHAR, source, tag, state.get_comm(), &status);
-    if (err != 0)
+int Server::poll()
+{
+    uint64_t begin = stats::Trace::enabled() ? stats::Metrics::now() : 0;
+    int handled = 0;
+    while (true)
     {
-      char *error_string =
-          (char *)malloc((sizeof(char)) * MPI_MAX_ERROR_STRING);
-      int len;
-      MPI_Error_string(err, error_string, &len);
-      std::cout << "Receiving: " << error_string << std::endl;
+        int count = 0;
+        MPI_Testsome(RECV_SLOTS, recv_requests.data(), &count, completed.data(),
+                     completed_status.data());
+        if (count == MPI_UNDEFINED || count == 0)
+            break;
+
+        // Dispatch in matching order, the order small messages of one
+        // sender were sent in: fewer wait in early.
+        std::vector<int> order(count);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [this](int a, int b) {
+            return recv_posted[completed[a]] < recv_posted[completed[b]];
+        });
+
+        for (int i : order)
+        {
+            int slot = completed[i];
+            int size = 0;
+            MPI_Get_count(&completed_status[i], MPI_CHAR, &size);
+            receive(completed_status[i].MPI_SOURCE, recv_buffers[slot].data(), size);
+            recv_posted[slot] = next_post++;
+            MPI_Start(&recv_requests[slot]);
+        }
+        handled += count;
+    }
+
+    while (true)
+    {
+        int flag = 0;
+        MPI_Message handle;
+        MPI_Status status;
+        MPI_Improbe(MPI_ANY_SOURCE, TAG_LARGE, state.get_comm(), &flag, &handle, &status);
+        if (!flag)
+            break;
+
+        int size = 0;
+        MPI_Get_count(&status, MPI_CHAR, &size);
+        std::vector<char> buffer(size);
+        MPI_Mrecv(buffer.data(), size, MPI_CHAR, &handle, MPI_STATUS_IGNORE);
+        receive(status.MPI_SOURCE, buffer.data(), size);
+        handled++;
     }
-    std::string s(buffer.begin(), buffer.end());
-    std::shared_ptr<message::Message> message = message::Message::deserialize(s);
-    return message;
+
+    flush();
+    if (begin != 0 && handled > 0)
+        stats::Trace::record("mpi", "poll", begin, stats::Metrics::now(), "messages", handled);
+    return handled;
 }
 
 void Server::send(int target_rank, std::shared_ptr<message::Message> message)
 {
-    auto serialization = message->serialize();
-    int err =
-        MPI_Send(serialization.data(), serialization.length(), MPI_CHAR,
-                 target_rank, 0, state.get_comm());
+    stats::MessageKind kind = kind_of(*message);
+    stats::TraceSpan span("send", stats::Metrics::name_of(kind), "to", target_rank);
+    trace_request(*message, true, state.get_rank());
+    if (message::Message::get_wire_format() == wire::Format::JSON)
+    {
+        // JSON documents cannot be concatenated: one MPI message each.
+        std::string serialization(SEQUENCE_BYTES, '\0');
+        {
+            stats::ScopedTimer timer(stats::SERIALIZE);
+            serialization += message->serialize();
+        }
+        stats::metrics().sent(kind, serialization.size() - SEQUENCE_BYTES);
+        int tag = serialization.size() <= static_cast<size_t>(RECV_SLOT_SIZE) ? TAG_SMALL : TAG_LARGE;
+        post_send(target_rank, tag, serialization);
+        return;
+    }
+
+    std::string &box = outbox[target_rank];
+    if (message->get_trailer().size() >= ZERO_COPY_MIN)
+    {
+        // Sent after the frames already queued, to keep them in order.
+        if (!box.empty())
+            post_send(target_rank, TAG_SMALL, box);
+        std::string frame(SEQUENCE_BYTES, '\0');
+        {
+            stats::ScopedTimer timer(stats::SERIALIZE);
+            message->serialize_binary(frame, false);
+        }
+        size_t size = frame.size() + message->get_trailer().size();
+        stats::metrics().sent(kind, size - SEQUENCE_BYTES);
+        post_send(target_rank, size <= static_cast<size_t>(RECV_SLOT_SIZE) ? TAG_SMALL : TAG_LARGE,
+                  frame, std::move(message));
+        return;
+    }
+
+    bool fresh = box.empty();
+    if (fresh)
+        box.assign(SEQUENCE_BYTES, '\0');
+    size_t queued = box.size();
+    {
+        stats::ScopedTimer timer(stats::SERIALIZE);
+        message->serialize_binary(box);
+    }
+    stats::metrics().sent(kind, box.size() - queued);
+
+    if (!fresh && box.size() > static_cast<size_t>(RECV_SLOT_SIZE))
+    {
+        // The new frame does not fit in the batch: send the batch alone.
+        std::string frame(SEQUENCE_BYTES, '\0');
+        frame.append(box, queued);
+        box.resize(queued);
+        post_send(target_rank, TAG_SMALL, box);
+        box = std::move(frame);
+        fresh = true;
+    }
+
+    if (box.size() > static_cast<size_t>(RECV_SLOT_SIZE))
+        post_send(target_rank, TAG_LARGE, box);
+    else if (fresh)
+        dirty_outboxes.push_back(target_rank);
+}
+
+void Server::flush()
+{
+    for (int rank : dirty_outboxes)
+    {
+        if (!outbox[rank].empty())
+            post_send(rank, TAG_SMALL, outbox[rank]);
+    }
+    dirty_outboxes.clear();
+    complete_sends();
+}
+
+void Server::post_send(int target_rank, int tag, std::string &buffer,
+                       std::shared_ptr<message::Message> message)
+{
+    int slot;
+    if (free_sends.empty())
+    {
+        slot = send_requests.size();
+        send_buffers.emplace_back();
+        send_messages.emplace_back();
+        send_requests.push_back(MPI_REQUEST_NULL);
+        completed_sends.resize(send_requests.size());
+    }
+    else
+    {
+        slot = free_sends.back();
+        free_sends.pop_back();
+    }
+
+    std::swap(send_buffers[slot], buffer);
+    uint64_t sequence = send_sequence[target_rank]++;
+    std::memcpy(send_buffers[slot].data(), &sequence, SEQUENCE_BYTES);
+    stats::TraceSpan span("mpi", "MPI_Isend", "bytes",
+                          send_buffers[slot].size() + (message ? message->get_trailer().size() : 0));
+    int err;
+    if (message)
+    {
+        // One MPI message from two places: the frame, then the trailer.
+        std::string_view trailer = message->get_trailer();
+        int lengths[2] = {static_cast<int>(send_buffers[slot].size()),
+                          static_cast<int>(trailer.size())};
+        MPI_Aint displacements[2];
+        MPI_Get_address(send_buffers[slot].data(), &displacements[0]);
+        MPI_Get_address(trailer.data(), &displacements[1]);
+        MPI_Datatype gather;
+        MPI_Type_create_hindexed(2, lengths, displacements, MPI_CHAR, &gather);
+        MPI_Type_commit(&gather);
+        err = MPI_Isend(MPI_BOTTOM, 1, gather, target_rank, tag, state.get_comm(),
+                        &send_requests[slot]);
+        // Freed once the send completes.
+        MPI_Type_free(&gather);
+        send_messages[slot] = std::move(message);
+    }
+    else
+        err = MPI_Isend(send_buffers[slot].data(), send_buffers[slot].size(), MPI_CHAR,
+                        target_rank, tag, state.get_comm(), &send_requests[slot]);
     if (err != 0)
     {
-      char *error_string =
-          (char *)malloc((sizeof(char)) * MPI_MAX_ERROR_STRING);
+      char error_string[MPI_MAX_ERROR_STRING];
       int len;
       MPI_Error_string(err, error_string, &len);
-      std::cout << "Send: " << error_string << std::endl;
+      AFS_LOG(ERROR, "Send: " << error_string);
+    }
+}
+
+void Server::complete_sends()
+{
+    if (send_requests.size() == free_sends.size())
+        return;
+
+    int count = 0;
+    MPI_Testsome(send_requests.size(), send_requests.data(), &count,
+                 completed_sends.data(), MPI_STATUSES_IGNORE);
+    if (count == MPI_UNDEFINED)
+        return;
+    for (int i = 0; i < count; i++)
+    {
+        send_buffers[completed_sends[i]].clear();
+        send_messages[completed_sends[i]].reset();
+        free_sends.push_back(completed_sends[i]);
+    }
+}
+
+void Server::stop_on_signals()
+{
+    // Without SA_RESTART: a blocking read of the REPL returns too.
+    struct sigaction action = {};
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+}
+
+std::chrono::steady_clock::time_point Server::next_deadline()
+{
+    return std::chrono::steady_clock::now() + IDLE_DEADLINE;
+}
+
+void Server::progress(std::chrono::steady_clock::time_point deadline)
+{
+    auto backoff = std::chrono::duration_cast<std::chrono::steady_clock::duration>(MIN_BACKOFF);
+    while (poll() == 0)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline)
+            return;
+        std::this_thread::sleep_for(std::min(backoff, deadline - now));
+        backoff = std::min<std::chrono::steady_clock::duration>(2 * backoff, MAX_BACKOFF);
     }
 }
 
 void Server::run()
 {
-    while (true)
+    while (!stopping && !interrupted)
     {
-        std::shared_ptr<message::Message> message = listen();
-        if (message.get() != nullptr)
-        {
-          on_message_callback(message);
-        }
+        progress(next_deadline());
         work();
+        flush();
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,148 @@
+#include "sha256.hh"
+
+#include <bit>
+#include <cstring>
+
+#include <immintrin.h>
+
+namespace raft
+{
+    static const uint32_t K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4,
+        0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe,
+        0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f,
+        0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+        0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+        0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+        0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116,
+        0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7,
+        0xc67178f2,
+    };
+
+    static uint32_t load_be32(const uint8_t *p)
+    {
+        return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+    }
+
+    static void blocks_scalar(uint32_t state[8], const uint8_t *data, size_t blocks)
+    {
+        for (; blocks > 0; blocks--, data += 64)
+        {
+            uint32_t w[64];
+            for (int t = 0; t < 16; t++)
+                w[t] = load_be32(data + 4 * t);
+            for (int t = 16; t < 64; t++)
+            {
+                uint32_t s0 = std::rotr(w[t - 15], 7) ^ std::rotr(w[t - 15], 18) ^ (w[t - 15] >> 3);
+                uint32_t s1 = std::rotr(w[t - 2], 17) ^ std::rotr(w[t - 2], 19) ^ (w[t - 2] >> 10);
+                w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+            }
+            uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+            uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+            for (int t = 0; t < 64; t++)
+            {
+                uint32_t t1 = h + (std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25)) +
+                              ((e & f) ^ (~e & g)) + K[t] + w[t];
+                uint32_t t2 = (std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22)) +
+                              ((a & b) ^ (a & c) ^ (b & c));
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+            state[4] += e;
+            state[5] += f;
+            state[6] += g;
+            state[7] += h;
+        }
+    }
+
+    // The SHA extensions keep the state as ABEF and CDGH, each instruction
+    // running two rounds.
+    __attribute__((target("sha,sse4.1")))
+    static void blocks_sha(uint32_t state[8], const uint8_t *data, size_t blocks)
+    {
+        const __m128i swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+        __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(state)), 0xB1);
+        __m128i cdgh = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(state + 4)), 0x1B);
+        __m128i abef = _mm_alignr_epi8(tmp, cdgh, 8);
+        cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+        for (; blocks > 0; blocks--, data += 64)
+        {
+            __m128i abef_saved = abef;
+            __m128i cdgh_saved = cdgh;
+            // Words 4r to 4r + 3 of the schedule, for the 4 groups of rounds
+            // in flight.
+            __m128i w[4];
+            for (int i = 0; i < 4; i++)
+                w[i] = _mm_shuffle_epi8(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16 * i)), swap);
+            for (int r = 0; r < 16; r++)
+            {
+                __m128i &words = w[r % 4];
+                __m128i message =
+                    _mm_add_epi32(words, _mm_loadu_si128(reinterpret_cast<const __m128i *>(K + 4 * r)));
+                cdgh = _mm_sha256rnds2_epu32(cdgh, abef, message);
+                abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(message, 0x0E));
+                if (r < 12)
+                {
+                    // Words of the group r + 4, from the groups r to r + 3.
+                    __m128i next = _mm_sha256msg1_epu32(words, w[(r + 1) % 4]);
+                    next = _mm_add_epi32(next, _mm_alignr_epi8(w[(r + 3) % 4], w[(r + 2) % 4], 4));
+                    words = _mm_sha256msg2_epu32(next, w[(r + 3) % 4]);
+                }
+            }
+            abef = _mm_add_epi32(abef, abef_saved);
+            cdgh = _mm_add_epi32(cdgh, cdgh_saved);
+        }
+
+        tmp = _mm_shuffle_epi32(abef, 0x1B);
+        cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(state), _mm_blend_epi16(tmp, cdgh, 0xF0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(state + 4), _mm_alignr_epi8(cdgh, tmp, 8));
+    }
+
+    bool sha_extensions()
+    {
+        static const bool supported =
+            __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+        return supported;
+    }
+
+    Sha256Digest sha256(std::string_view data, bool accelerated)
+    {
+        auto blocks = accelerated && sha_extensions() ? blocks_sha : blocks_scalar;
+        uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                             0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.data());
+        size_t whole = data.size() / 64;
+        blocks(state, bytes, whole);
+
+        // The rest, a 1 bit, zeros and the length in bits: one or two blocks.
+        uint8_t tail[128] = {};
+        size_t rest = data.size() - whole * 64;
+        std::memcpy(tail, bytes + whole * 64, rest);
+        tail[rest] = 0x80;
+        size_t tail_blocks = rest < 56 ? 1 : 2;
+        uint64_t bits = static_cast<uint64_t>(data.size()) * 8;
+        for (int i = 0; i < 8; i++)
+            tail[tail_blocks * 64 - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+        blocks(state, tail, tail_blocks);
+
+        Sha256Digest digest;
+        for (int i = 0; i < 8; i++)
+            for (int j = 0; j < 4; j++)
+                digest[4 * i + j] = static_cast<uint8_t>(state[i] >> (24 - 8 * j));
+        return digest;
+    }
+}
@@ -0,0 +1,307 @@
+#include "snapshot.hh"
+
+#include <filesystem>
+#include <stdexcept>
+#include <vector>
+
+#include <mpi.h>
+
+#include "wire.hh"
+
+namespace raft
+{
+    static constexpr uint32_t SNAPSHOT_MAGIC = 0x53534641; // "AFSS"
+    static constexpr uint32_t SNAPSHOT_VERSION = 8;
+    static constexpr uint8_t UPLOADING = 1;
+    static constexpr uint8_t STRIPED = 2;
+    static constexpr uint8_t CODED = 4;
+    static constexpr uint8_t DEDUPED = 8;
+    static constexpr uint8_t PACKED = 16;
+    static constexpr size_t HEADER_SIZE = 28;
+    static constexpr size_t COPY_CHUNK = 1 << 20;
+
+    static void read_exact(MPI_File file, void *data, size_t size)
+    {
+        MPI_Status status;
+        MPI_File_read(file, data, size, MPI_CHAR, &status);
+        int count;
+        MPI_Get_count(&status, MPI_CHAR, &count);
+        if (static_cast<size_t>(count) != size)
+            throw std::runtime_error("Snapshot: truncated file");
+    }
+
+    template <typename T>
+    static T read_value(MPI_File file)
+    {
+        T value;
+        read_exact(file, &value, sizeof(T));
+        return value;
+    }
+
+    // Copies size bytes between two open files through a bounded buffer.
+    static void copy(MPI_File from, MPI_File to, uint64_t size, std::vector<char> &buffer)
+    {
+        while (size > 0)
+        {
+            size_t n = std::min<uint64_t>(size, buffer.size());
+            read_exact(from, buffer.data(), n);
+            MPI_File_write(to, buffer.data(), n, MPI_CHAR, MPI_STATUS_IGNORE);
+            size -= n;
+        }
+    }
+
+    void Snapshot::save(const std::string &path, SnapshotMeta meta,
+                        const MetadataIndex &files,
+                        const std::string &storage_dir,
+                        const ChunkStore *chunks,
+                        const SegmentStore *segments)
+    {
+        std::string tmp = path + ".tmp";
+        MPI_File out;
+        if (MPI_File_open(MPI_COMM_SELF, tmp.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                          MPI_INFO_NULL, &out) != MPI_SUCCESS)
+            throw std::runtime_error("Snapshot: cannot open " + tmp);
+        MPI_File_set_size(out, 0);
+
+        std::string header;
+        wire::Writer writer(header);
+        writer.put<uint32_t>(SNAPSHOT_MAGIC);
+        writer.put<uint32_t>(SNAPSHOT_VERSION);
+        writer.put<uint64_t>(meta.last_index);
+        writer.put<uint64_t>(meta.last_term);
+        writer.put<uint32_t>(files.size());
+        MPI_File_write(out, header.data(), header.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+
+        std::vector<char> buffer(COPY_CHUNK);
+        for (const FileMeta &file : files.entries())
+        {
+            const std::string &filename = file.name;
+            MPI_File in;
+            bool whole = !file.striped && !file.coded && !file.deduped && !file.packed;
+            MPI_Offset size = whole ? 0 : file.size;
+            bool exists = whole &&
+                          MPI_File_open(MPI_COMM_SELF, (storage_dir + "/" + filename).c_str(),
+                                        MPI_MODE_RDONLY, MPI_INFO_NULL, &in) == MPI_SUCCESS;
+            if (exists)
+                MPI_File_get_size(in, &size);
+
+            header.clear();
+            writer.put<int32_t>(file.uid);
+            writer.put_string(filename);
+            writer.put<uint64_t>(size);
+            writer.put<uint8_t>((file.uploading ? UPLOADING : 0) | (file.striped ? STRIPED : 0) |
+                                (file.coded ? CODED : 0) | (file.deduped ? DEDUPED : 0) |
+                                (file.packed ? PACKED : 0));
+            if (file.striped || file.coded)
+            {
+                writer.put<uint64_t>(file.created);
+                writer.put<uint64_t>(file.version);
+            }
+            if (file.deduped)
+            {
+                const std::vector<ChunkRef> &recipe = chunks->recipe(file.uid);
+                writer.put<uint32_t>(recipe.size());
+                for (const ChunkRef &chunk : recipe)
+                {
+                    writer.put(chunk.id.digest);
+                    writer.put<uint32_t>(chunk.size);
+                }
+            }
+            MPI_File_write(out, header.data(), header.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+
+            if (exists)
+            {
+                copy(in, out, size, buffer);
+                MPI_File_close(&in);
+            }
+            if (file.packed)
+            {
+                std::string content(size, '\0');
+                if (!SegmentStore::read(segments->extents(file.uid), content.data()))
+                    throw std::runtime_error("Snapshot: cannot read packed file " + filename);
+                MPI_File_write(out, content.data(), content.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+            }
+        }
+
+        std::vector<ChunkRef> referenced = chunks ? chunks->referenced() : std::vector<ChunkRef>();
+        header.clear();
+        writer.put<uint32_t>(referenced.size());
+        MPI_File_write(out, header.data(), header.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+        for (const ChunkRef &chunk : referenced)
+        {
+            MPI_File in;
+            if (MPI_File_open(MPI_COMM_SELF, chunks->path(chunk.id).c_str(), MPI_MODE_RDONLY,
+                              MPI_INFO_NULL, &in) != MPI_SUCCESS)
+                throw std::runtime_error("Snapshot: missing chunk " + chunk.id.hex());
+            header.clear();
+            writer.put(chunk.id.digest);
+            writer.put<uint32_t>(chunk.size);
+            MPI_File_write(out, header.data(), header.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+            copy(in, out, chunk.size, buffer);
+            MPI_File_close(&in);
+        }
+
+        header.clear();
+        writer.put<int32_t>(files.next_uid());
+        writer.put_vector(files.free_uids());
+        MPI_File_write(out, header.data(), header.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+
+        MPI_File_sync(out);
+        MPI_File_close(&out);
+        std::filesystem::rename(tmp, path);
+    }
+
+    std::optional<SnapshotMeta> Snapshot::load(const std::string &path,
+                                               MetadataIndex &files,
+                                               const std::string &storage_dir,
+                                               ChunkStore *chunks,
+                                               SegmentStore *segments)
+    {
+        MPI_File in;
+        if (!std::filesystem::exists(path) ||
+            MPI_File_open(MPI_COMM_SELF, path.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &in) != MPI_SUCCESS)
+            return std::nullopt;
+
+        if (read_value<uint32_t>(in) != SNAPSHOT_MAGIC || read_value<uint32_t>(in) != SNAPSHOT_VERSION)
+            throw std::runtime_error("Snapshot: bad header in " + path);
+        SnapshotMeta meta;
+        meta.last_index = read_value<uint64_t>(in);
+        meta.last_term = read_value<uint64_t>(in);
+        uint32_t count = read_value<uint32_t>(in);
+
+        std::vector<char> buffer(COPY_CHUNK);
+        files.clear();
+        for (uint32_t i = 0; i < count; i++)
+        {
+            int uid = read_value<int32_t>(in);
+            std::string filename(read_value<uint32_t>(in), '\0');
+            read_exact(in, filename.data(), filename.size());
+            uint64_t size = read_value<uint64_t>(in);
+            uint8_t flags = read_value<uint8_t>(in);
+            bool whole = !(flags & (STRIPED | CODED | DEDUPED | PACKED));
+            uint64_t created = flags & (STRIPED | CODED) ? read_value<uint64_t>(in) : 0;
+            uint64_t version = flags & (STRIPED | CODED) ? read_value<uint64_t>(in) : 0;
+            std::vector<ChunkRef> recipe(flags & DEDUPED ? read_value<uint32_t>(in) : 0);
+            for (ChunkRef &chunk : recipe)
+            {
+                chunk.id.digest = read_value<Sha256Digest>(in);
+                chunk.size = read_value<uint32_t>(in);
+                chunk.inlined = false;
+            }
+            if ((flags & DEDUPED) && !chunks)
+                throw std::runtime_error("Snapshot: deduplicated files need a chunk store");
+            if ((flags & PACKED) && !segments)
+                throw std::runtime_error("Snapshot: packed files need a segment store");
+
+            if (whole)
+            {
+                MPI_File out;
+                MPI_File_open(MPI_COMM_SELF, (storage_dir + "/" + filename).c_str(),
+                              MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &out);
+                MPI_File_set_size(out, 0);
+                copy(in, out, size, buffer);
+                MPI_File_close(&out);
+            }
+            if (flags & PACKED)
+            {
+                std::string content(size, '\0');
+                read_exact(in, content.data(), size);
+                Extent extent = segments->append(uid, segments->stream_of(filename), size);
+                if (!SegmentStore::write(extent, content.data()))
+                    throw std::runtime_error("Snapshot: cannot write packed file " + filename);
+            }
+            FileMeta &file = files.insert(uid, std::move(filename), size);
+            file.uploading = flags & UPLOADING;
+            file.striped = flags & STRIPED;
+            file.coded = flags & CODED;
+            file.deduped = flags & DEDUPED;
+            file.packed = flags & PACKED;
+            file.created = created;
+            file.version = version;
+            if (file.deduped)
+                chunks->add(uid, recipe, 0);
+        }
+
+        // Chunks written to a temporary name first: a chunk file is whole.
+        uint32_t chunk_count = read_value<uint32_t>(in);
+        for (uint32_t i = 0; i < chunk_count; i++)
+        {
+            ChunkId id;
+            id.digest = read_value<Sha256Digest>(in);
+            uint32_t size = read_value<uint32_t>(in);
+            if (!chunks || chunks->ready(id))
+            {
+                MPI_File_seek(in, size, MPI_SEEK_CUR);
+                continue;
+            }
+            std::string path = chunks->path(id);
+            MPI_File out;
+            MPI_File_open(MPI_COMM_SELF, (path + ".tmp").c_str(),
+                          MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &out);
+            MPI_File_set_size(out, 0);
+            copy(in, out, size, buffer);
+            MPI_File_close(&out);
+            std::filesystem::rename(path + ".tmp", path);
+            chunks->set_ready(id);
+        }
+
+        int next_uid = read_value<int32_t>(in);
+        std::vector<int> free_uids(read_value<uint32_t>(in));
+        read_exact(in, free_uids.data(), free_uids.size() * sizeof(int));
+        files.restore_allocator(next_uid, std::move(free_uids));
+
+        MPI_File_close(&in);
+        return meta;
+    }
+
+    std::optional<SnapshotMeta> Snapshot::read_meta(const std::string &path)
+    {
+        if (size(path) < HEADER_SIZE)
+            return std::nullopt;
+        std::string header = read_chunk(path, 0, HEADER_SIZE);
+        wire::Reader reader(header.data(), header.size());
+        if (reader.get<uint32_t>() != SNAPSHOT_MAGIC || reader.get<uint32_t>() != SNAPSHOT_VERSION)
+            return std::nullopt;
+        SnapshotMeta meta;
+        meta.last_index = reader.get<uint64_t>();
+        meta.last_term = reader.get<uint64_t>();
+        return meta;
+    }
+
+    uint64_t Snapshot::size(const std::string &path)
+    {
+        std::error_code error;
+        uint64_t size = std::filesystem::file_size(path, error);
+        return error ? 0 : size;
+    }
+
+    std::string Snapshot::read_chunk(const std::string &path, uint64_t offset, size_t size)
+    {
+        MPI_File in;
+        if (MPI_File_open(MPI_COMM_SELF, path.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &in) != MPI_SUCCESS)
+            throw std::runtime_error("Snapshot: cannot open " + path);
+        std::string data(size, '\0');
+        MPI_Status status;
+        MPI_File_read_at(in, offset, data.data(), size, MPI_CHAR, &status);
+        int count;
+        MPI_Get_count(&status, MPI_CHAR, &count);
+        data.resize(count);
+        MPI_File_close(&in);
+        return data;
+    }
+
+    void Snapshot::write_chunk(const std::string &path, uint64_t offset,
+                               const std::string &data, bool last)
+    {
+        MPI_File out;
+        if (MPI_File_open(MPI_COMM_SELF, path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                          MPI_INFO_NULL, &out) != MPI_SUCCESS)
+            throw std::runtime_error("Snapshot: cannot open " + path);
+        if (offset == 0)
+            MPI_File_set_size(out, 0);
+        MPI_File_write_at(out, offset, data.data(), data.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+        if (last)
+            MPI_File_sync(out);
+        MPI_File_close(&out);
+    }
+}
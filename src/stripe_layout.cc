@@ -0,0 +1,140 @@
+#include "stripe_layout.hh"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace raft
+{
+    StripeLayout::StripeLayout(uint64_t unit, int members, int member)
+        : unit(unit)
+        , members(members)
+        , member(member)
+    {
+        if (unit == 0 || members <= 0 || member < 0 || member >= members)
+            throw std::invalid_argument("StripeLayout: bad layout");
+        // A unit followed by the units of the other members, which the view
+        // skips.
+        MPI_Datatype contiguous;
+        MPI_Type_contiguous(unit, MPI_CHAR, &contiguous);
+        MPI_Type_create_resized(contiguous, 0, unit * members, &filetype);
+        MPI_Type_commit(&filetype);
+        MPI_Type_free(&contiguous);
+    }
+
+    StripeLayout::~StripeLayout()
+    {
+        MPI_Type_free(&filetype);
+    }
+
+    bool StripeLayout::stores(int member, uint64_t offset, uint64_t size) const
+    {
+        if (size == 0)
+            return false;
+        uint64_t first = offset / unit;
+        uint64_t last = (offset + size - 1) / unit;
+        if (last - first + 1 >= static_cast<uint64_t>(members))
+            return true;
+        for (uint64_t u = first; u <= last; u++)
+            if (u % members == static_cast<uint64_t>(member))
+                return true;
+        return false;
+    }
+
+    std::vector<StripeLayout::Piece> StripeLayout::pieces(int member, uint64_t offset,
+                                                          uint64_t size) const
+    {
+        std::vector<Piece> result;
+        if (size == 0)
+            return result;
+        uint64_t end = offset + size;
+        uint64_t first = offset / unit;
+        uint64_t last = (end - 1) / unit;
+        // First unit of this member from first on.
+        uint64_t u = first + (member + members - first % members) % members;
+        for (; u <= last; u += members)
+        {
+            uint64_t start = std::max(offset, u * unit);
+            result.push_back(Piece{start, std::min(end, (u + 1) * unit) - start});
+        }
+        return result;
+    }
+
+    MPI_Offset StripeLayout::view_offset(uint64_t offset) const
+    {
+        return offset / unit / members * unit + offset % unit;
+    }
+
+    void StripeLayout::set_view(MPI_File file, int member) const
+    {
+        MPI_File_set_view(file, static_cast<MPI_Offset>(member) * unit, MPI_CHAR, filetype,
+                          "native", MPI_INFO_NULL);
+    }
+
+    bool StripeLayout::write(MPI_File file, int member, uint64_t offset, const char *data,
+                             uint64_t size) const
+    {
+        std::vector<Piece> mine = pieces(member, offset, size);
+        if (mine.empty())
+            return true;
+
+        // The pieces are scattered in data but back to back in the view.
+        std::vector<int> lengths;
+        std::vector<MPI_Aint> addresses;
+        for (const Piece &piece : mine)
+        {
+            MPI_Aint address;
+            MPI_Get_address(data + (piece.offset - offset), &address);
+            lengths.push_back(piece.size);
+            addresses.push_back(address);
+        }
+        MPI_Datatype memtype;
+        MPI_Type_create_hindexed(mine.size(), lengths.data(), addresses.data(), MPI_CHAR, &memtype);
+        MPI_Type_commit(&memtype);
+
+        set_view(file, member);
+        int error = MPI_File_write_at(file, view_offset(mine.front().offset), MPI_BOTTOM, 1,
+                                      memtype, MPI_STATUS_IGNORE);
+        MPI_Type_free(&memtype);
+        return error == MPI_SUCCESS;
+    }
+
+    bool StripeLayout::write(MPI_File file, const std::vector<Piece> &pieces,
+                             const char *buffer) const
+    {
+        if (pieces.empty())
+            return true;
+        uint64_t size = 0;
+        for (const Piece &piece : pieces)
+            size += piece.size;
+
+        set_view(file, member);
+        return MPI_File_write_at(file, view_offset(pieces.front().offset), buffer, size,
+                                 MPI_CHAR, MPI_STATUS_IGNORE) == MPI_SUCCESS;
+    }
+
+    bool StripeLayout::write_all(MPI_File file, uint64_t offset, const char *data,
+                                 uint64_t size) const
+    {
+        MPI_File_set_view(file, 0, MPI_CHAR, MPI_CHAR, "native", MPI_INFO_NULL);
+        return MPI_File_write_at(file, offset, data, size, MPI_CHAR, MPI_STATUS_IGNORE) ==
+               MPI_SUCCESS;
+    }
+
+    bool StripeLayout::read(MPI_File file, const std::vector<Piece> &pieces, char *buffer) const
+    {
+        if (pieces.empty())
+            return true;
+        uint64_t size = 0;
+        for (const Piece &piece : pieces)
+            size += piece.size;
+
+        set_view(file, member);
+        MPI_Status status;
+        if (MPI_File_read_at(file, view_offset(pieces.front().offset), buffer, size, MPI_CHAR,
+                             &status) != MPI_SUCCESS)
+            return false;
+        int count;
+        MPI_Get_count(&status, MPI_CHAR, &count);
+        return static_cast<uint64_t>(count) == size;
+    }
+}
@@ -0,0 +1,178 @@
+#include "trace.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <stdexcept>
+
+namespace stats
+{
+    static constexpr int CLOCK_ROUNDS = 16;
+
+    // Small per-thread number, the thread of start() being 0.
+    static uint32_t thread_id(std::atomic<uint32_t> &threads)
+    {
+        thread_local uint32_t id = threads.fetch_add(1);
+        return id;
+    }
+
+    void Trace::start(MPI_Comm world, const std::string &path, size_t capacity)
+    {
+        MPI_Comm_dup(world, &comm);
+        int rank, size;
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &size);
+
+        double offset = 0;
+        int *global = nullptr;
+        int flag = 0;
+        MPI_Comm_get_attr(MPI_COMM_WORLD, MPI_WTIME_IS_GLOBAL, &global, &flag);
+        if (!flag || !*global)
+        {
+            if (rank == 0)
+            {
+                for (int peer = 1; peer < size; peer++)
+                    for (int i = 0; i < CLOCK_ROUNDS; i++)
+                    {
+                        MPI_Recv(nullptr, 0, MPI_CHAR, peer, 0, comm, MPI_STATUS_IGNORE);
+                        double now = MPI_Wtime();
+                        MPI_Send(&now, 1, MPI_DOUBLE, peer, 0, comm);
+                    }
+            }
+            else
+            {
+                // The reply left rank 0 around the middle of the round trip.
+                double best = std::numeric_limits<double>::infinity();
+                for (int i = 0; i < CLOCK_ROUNDS; i++)
+                {
+                    double sent = MPI_Wtime();
+                    double root;
+                    MPI_Send(nullptr, 0, MPI_CHAR, 0, 0, comm);
+                    MPI_Recv(&root, 1, MPI_DOUBLE, 0, 0, comm, MPI_STATUS_IGNORE);
+                    double received = MPI_Wtime();
+                    if (received - sent < best)
+                    {
+                        best = received - sent;
+                        offset = root - (sent + received) / 2;
+                    }
+                }
+            }
+        }
+
+        double epoch = MPI_Wtime();
+        MPI_Bcast(&epoch, 1, MPI_DOUBLE, 0, comm);
+        base_now = Metrics::now();
+        base_us = (MPI_Wtime() + offset - epoch) * 1e6;
+
+        Trace::path = path;
+        Trace::capacity = std::max<size_t>(capacity, 1);
+        ring = std::make_unique<Event[]>(Trace::capacity);
+        head = 0;
+        thread_id(threads);
+        active.store(true, std::memory_order_release);
+    }
+
+    void Trace::record(const char *category, const char *name, uint64_t begin, uint64_t end,
+                       const char *arg_name, int64_t arg)
+    {
+        if (enabled())
+            write('X', category, name, begin, end, arg_name, arg);
+    }
+
+    void Trace::flow(char phase, int client, uint64_t request_id)
+    {
+        // Request ids are counted by each client.
+        if (enabled())
+            write(phase, "flow", "request", Metrics::now(), 0, nullptr,
+                  static_cast<int64_t>(static_cast<uint64_t>(client) << 40 | request_id));
+    }
+
+    void Trace::write(char phase, const char *category, const char *name, uint64_t begin,
+                      uint64_t end, const char *arg_name, int64_t arg)
+    {
+        uint64_t index = head.fetch_add(1, std::memory_order_relaxed);
+        Event &event = ring[index % capacity];
+        event.sequence.store(0, std::memory_order_relaxed);
+        event.phase = phase;
+        event.category = category;
+        event.name = name;
+        event.arg_name = arg_name;
+        event.arg = arg;
+        event.begin = begin;
+        event.end = end;
+        event.thread = thread_id(threads);
+        event.sequence.store(index + 1, std::memory_order_release);
+    }
+
+    void Trace::dump(const std::string &role)
+    {
+        // Events recorded after this are not written.
+        if (!active.exchange(false, std::memory_order_acq_rel))
+            return;
+        int rank, size;
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &size);
+
+        // Every event but the first of rank 0 starts with a comma, so the
+        // parts of the ranks concatenate.
+        std::string text = rank == 0 ? "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n" : ",\n";
+        text += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + std::to_string(rank) +
+                ",\"args\":{\"name\":\"" + role + " " + std::to_string(rank) + "\"}}";
+        text += ",\n{\"name\":\"process_sort_index\",\"ph\":\"M\",\"pid\":" + std::to_string(rank) +
+                ",\"args\":{\"sort_index\":" + std::to_string(rank) + "}}";
+
+        uint64_t end = head.load();
+        uint64_t first = end > capacity ? end - capacity : 0;
+        char line[512];
+        for (uint64_t i = first; i < end; i++)
+        {
+            const Event &event = ring[i % capacity];
+            if (event.sequence.load(std::memory_order_acquire) != i + 1)
+                continue;
+            double ts = base_us + (static_cast<double>(event.begin) - base_now) / 1000;
+            if (event.phase != 'X')
+            {
+                int length = std::snprintf(
+                    line, sizeof(line),
+                    ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"id\":%lld,"
+                    "\"bp\":\"e\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u}",
+                    event.name, event.category, event.phase, static_cast<long long>(event.arg),
+                    ts, rank, event.thread);
+                text.append(line, length);
+                continue;
+            }
+            double duration = (event.end - event.begin) / 1000.0;
+            int length = std::snprintf(
+                line, sizeof(line),
+                ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                "\"pid\":%d,\"tid\":%u",
+                event.name, event.category, ts, duration, rank, event.thread);
+            text.append(line, length);
+            if (event.arg_name)
+            {
+                length = std::snprintf(line, sizeof(line), ",\"args\":{\"%s\":%lld}",
+                                       event.arg_name, static_cast<long long>(event.arg));
+                text.append(line, length);
+            }
+            text += "}";
+        }
+        if (rank == size - 1)
+            text += "\n]}\n";
+
+        uint64_t bytes = text.size();
+        uint64_t offset = 0;
+        MPI_Exscan(&bytes, &offset, 1, MPI_UINT64_T, MPI_SUM, comm);
+        if (rank == 0)
+            offset = 0;
+
+        MPI_File file;
+        if (MPI_File_open(comm, path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL,
+                          &file) != MPI_SUCCESS)
+            throw std::runtime_error("Trace: cannot open " + path);
+        MPI_File_set_size(file, 0);
+        MPI_File_write_at_all(file, offset, text.data(), text.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+        MPI_File_close(&file);
+        MPI_Comm_free(&comm);
+        ring.reset();
+    }
+}
@@ -0,0 +1,431 @@
+#include "wal.hh"
+#include "trace.hh"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+
+namespace raft
+{
+    static constexpr size_t RECORD_HEADER = 8;
+    static constexpr size_t REPLAY_CHUNK = 1 << 20;
+
+    static uint32_t crc32(const char *data, size_t size)
+    {
+        static const std::array<uint32_t, 256> table = [] {
+            std::array<uint32_t, 256> t{};
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                t[i] = c;
+            }
+            return t;
+        }();
+
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = 0; i < size; i++)
+            crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    Wal::Wal(std::string dir, const Options &options)
+        : dir(std::move(dir))
+        , policy(options.fsync)
+        , group_entries(options.group_entries)
+        , group_delay(options.group_us)
+        , segment_bytes(static_cast<size_t>(options.segment_mb) << 20)
+        , file_open(false)
+        , segment_seq(0)
+        , segment_size(0)
+        , unsynced_entries(0)
+        , buffered_index(0)
+        , written_index(0)
+        , synced_index(0)
+        , vote_term(0)
+        , voted_for(-1)
+        , vote_buffered(false)
+        , vote_segment(0)
+    {
+        std::filesystem::create_directories(this->dir);
+    }
+
+    Wal::~Wal()
+    {
+        if (file_open)
+        {
+            flush();
+            if (policy != Options::FsyncPolicy::NONE)
+                MPI_File_sync(file);
+            close_segment();
+        }
+    }
+
+    void Wal::append(uint64_t index, const LogEntry &entry)
+    {
+        std::string body;
+        wire::Writer writer(body);
+        writer.put<uint64_t>(index);
+        entry.serialize(writer);
+        positions[index] = Position{segment_seq, segment_size + buffer.size()};
+        add_record(RecordKind::ENTRY, body);
+        buffered_index = index;
+        segment_last_index[segment_seq] = std::max(segment_last_index[segment_seq], index);
+
+        if (unsynced_entries++ == 0)
+            first_unsynced = std::chrono::steady_clock::now();
+        if (policy == Options::FsyncPolicy::ALWAYS)
+            sync();
+    }
+
+    void Wal::truncate_from(uint64_t index)
+    {
+        std::string body;
+        wire::Writer writer(body);
+        writer.put<uint64_t>(index);
+        add_record(RecordKind::TRUNCATE, body);
+        positions.erase(positions.lower_bound(index), positions.end());
+
+        buffered_index = std::min(buffered_index, index - 1);
+        written_index = std::min(written_index, index - 1);
+        synced_index = std::min(synced_index, index - 1);
+    }
+
+    void Wal::save_vote(uint64_t term, int voted_for)
+    {
+        if (term == vote_term && voted_for == this->voted_for)
+            return;
+        vote_term = term;
+        this->voted_for = voted_for;
+        add_vote_record();
+        sync();
+    }
+
+    void Wal::add_vote_record()
+    {
+        std::string body;
+        wire::Writer writer(body);
+        writer.put<uint64_t>(vote_term);
+        writer.put<int32_t>(voted_for);
+        add_record(RecordKind::VOTE, body);
+        vote_buffered = true;
+    }
+
+    void Wal::tick()
+    {
+        if (buffer.empty() && unsynced_entries == 0)
+            return;
+
+        switch (policy)
+        {
+        case Options::FsyncPolicy::ALWAYS:
+            sync();
+            break;
+        case Options::FsyncPolicy::GROUP:
+            if (unsynced_entries >= group_entries ||
+                std::chrono::steady_clock::now() - first_unsynced >= group_delay)
+                sync();
+            break;
+        case Options::FsyncPolicy::NONE:
+            flush();
+            synced_index = written_index;
+            unsynced_entries = 0;
+            break;
+        }
+    }
+
+    std::chrono::steady_clock::time_point Wal::next_deadline() const
+    {
+        if (buffer.empty() && unsynced_entries == 0)
+            return std::chrono::steady_clock::time_point::max();
+        if (policy == Options::FsyncPolicy::GROUP && unsynced_entries < group_entries)
+            return first_unsynced + group_delay;
+        return std::chrono::steady_clock::now();
+    }
+
+    void Wal::sync()
+    {
+        flush();
+        if (policy != Options::FsyncPolicy::NONE)
+        {
+            stats::TraceSpan span("mpi-io", "MPI_File_sync");
+            MPI_File_sync(file);
+        }
+        synced_index = written_index;
+        unsynced_entries = 0;
+    }
+
+    void Wal::compact(uint64_t index)
+    {
+        auto vote_it = segment_last_index.find(vote_segment);
+        if (vote_term > 0 && vote_segment != segment_seq &&
+            (vote_it == segment_last_index.end() || vote_it->second <= index))
+        {
+            add_vote_record();
+            sync();
+        }
+        for (uint64_t seq : list_segments())
+        {
+            auto it = segment_last_index.find(seq);
+            uint64_t last = it == segment_last_index.end() ? 0 : it->second;
+            if (seq == segment_seq || seq == vote_segment || last > index)
+                break;
+            MPI_File_delete(segment_path(seq).c_str(), MPI_INFO_NULL);
+            if (it != segment_last_index.end())
+                segment_last_index.erase(it);
+        }
+        positions.erase(positions.begin(), positions.upper_bound(index));
+    }
+
+    void Wal::reset(uint64_t index)
+    {
+        if (file_open)
+            close_segment();
+        buffer.clear();
+        unsynced_entries = 0;
+        for (uint64_t seq : list_segments())
+            MPI_File_delete(segment_path(seq).c_str(), MPI_INFO_NULL);
+        segment_last_index.clear();
+        positions.clear();
+
+        buffered_index = index;
+        written_index = index;
+        synced_index = index;
+        open_segment(segment_seq + 1);
+        if (vote_term > 0)
+        {
+            add_vote_record();
+            sync();
+        }
+    }
+
+    LogEntry Wal::read(uint64_t index)
+    {
+        auto it = positions.find(index);
+        if (it == positions.end())
+            throw std::runtime_error("Wal: no record of entry " + std::to_string(index));
+        Position position = it->second;
+        if (position.segment == segment_seq && position.offset >= segment_size)
+            flush();
+
+        stats::TraceSpan span("mpi-io", "MPI_File_read_at", "index", index);
+        std::string path = segment_path(position.segment);
+        MPI_File in;
+        if (MPI_File_open(MPI_COMM_SELF, path.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &in) !=
+            MPI_SUCCESS)
+            throw std::runtime_error("Wal: cannot open " + path);
+        uint32_t header[2] = {0, 0};
+        MPI_File_read_at(in, position.offset, header, RECORD_HEADER, MPI_CHAR, MPI_STATUS_IGNORE);
+        std::string record(header[0], '\0');
+        MPI_File_read_at(in, position.offset + RECORD_HEADER, record.data(), record.size(),
+                         MPI_CHAR, MPI_STATUS_IGNORE);
+        MPI_File_close(&in);
+        if (record.empty() || crc32(record.data(), record.size()) != header[1] ||
+            record[0] != static_cast<char>(RecordKind::ENTRY))
+            throw std::runtime_error("Wal: corrupted record of entry " + std::to_string(index));
+
+        wire::Reader reader(record.data() + 1, record.size() - 1);
+        if (reader.get<uint64_t>() != index)
+            throw std::runtime_error("Wal: misplaced record of entry " + std::to_string(index));
+        return LogEntry::deserialize(reader);
+    }
+
+    void Wal::add_record(RecordKind kind, const std::string &body)
+    {
+        std::string record(1, static_cast<char>(kind));
+        record += body;
+        wire::Writer writer(buffer);
+        writer.put<uint32_t>(record.size());
+        writer.put<uint32_t>(crc32(record.data(), record.size()));
+        writer.put_bytes(record.data(), record.size());
+    }
+
+    void Wal::flush()
+    {
+        if (!file_open)
+            open_segment(segment_seq);
+        if (!buffer.empty())
+        {
+            stats::TraceSpan span("mpi-io", "MPI_File_write", "bytes", buffer.size());
+            MPI_File_write(file, buffer.data(), buffer.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+            segment_size += buffer.size();
+            buffer.clear();
+            if (vote_buffered)
+            {
+                vote_segment = segment_seq;
+                vote_buffered = false;
+            }
+        }
+        written_index = buffered_index;
+
+        // Records never span segments: rotate between writes only.
+        if (segment_size >= segment_bytes)
+        {
+            if (policy != Options::FsyncPolicy::NONE)
+                MPI_File_sync(file);
+            close_segment();
+            open_segment(segment_seq + 1);
+        }
+    }
+
+    void Wal::open_segment(uint64_t seq)
+    {
+        std::string path = segment_path(seq);
+        if (MPI_File_open(MPI_COMM_SELF, path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY | MPI_MODE_APPEND,
+                          MPI_INFO_NULL, &file) != MPI_SUCCESS)
+            throw std::runtime_error("Wal: cannot open " + path);
+        MPI_Offset size;
+        MPI_File_get_size(file, &size);
+        segment_seq = seq;
+        segment_size = size;
+        file_open = true;
+    }
+
+    void Wal::close_segment()
+    {
+        MPI_File_close(&file);
+        file_open = false;
+    }
+
+    std::string Wal::segment_path(uint64_t seq) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "segment_%08llu.wal", static_cast<unsigned long long>(seq));
+        return dir + "/" + name;
+    }
+
+    std::vector<uint64_t> Wal::list_segments() const
+    {
+        std::vector<uint64_t> seqs;
+        for (const auto &file : std::filesystem::directory_iterator(dir))
+        {
+            unsigned long long seq;
+            if (std::sscanf(file.path().filename().c_str(), "segment_%llu.wal", &seq) == 1)
+                seqs.push_back(seq);
+        }
+        std::sort(seqs.begin(), seqs.end());
+        return seqs;
+    }
+
+    void Wal::replay(const EntryCallback &on_entry, const TruncateCallback &on_truncate,
+                     const VoteCallback &on_vote)
+    {
+        if (file_open)
+            close_segment();
+        buffer.clear();
+        vote_term = 0;
+        voted_for = -1;
+        vote_buffered = false;
+        vote_segment = 0;
+        unsynced_entries = 0;
+        buffered_index = 0;
+        segment_last_index.clear();
+        positions.clear();
+
+        std::vector<uint64_t> seqs = list_segments();
+        std::vector<char> chunk;
+        bool torn = false;
+
+        for (size_t s = 0; s < seqs.size(); s++)
+        {
+            std::string path = segment_path(seqs[s]);
+            if (torn)
+            {
+                // Nothing after a torn record can be trusted.
+                MPI_File_delete(path.c_str(), MPI_INFO_NULL);
+                continue;
+            }
+
+            MPI_File in;
+            MPI_File_open(MPI_COMM_SELF, path.c_str(), MPI_MODE_RDWR, MPI_INFO_NULL, &in);
+            MPI_Offset size;
+            MPI_File_get_size(in, &size);
+
+            // Streams the segment through a bounded window: records are
+            // decoded as soon as they are complete.
+            MPI_Offset offset = 0;
+            MPI_Offset valid = 0;
+            size_t begin = 0;
+            chunk.clear();
+            while (true)
+            {
+                size_t available = chunk.size() - begin;
+                if (available >= RECORD_HEADER)
+                {
+                    uint32_t length;
+                    uint32_t crc;
+                    std::memcpy(&length, chunk.data() + begin, 4);
+                    std::memcpy(&crc, chunk.data() + begin + 4, 4);
+                    if (length == 0)
+                    {
+                        torn = true;
+                        break;
+                    }
+                    if (available >= RECORD_HEADER + length)
+                    {
+                        const char *body = chunk.data() + begin + RECORD_HEADER;
+                        if (crc32(body, length) != crc)
+                        {
+                            torn = true;
+                            break;
+                        }
+                        wire::Reader reader(body + 1, length - 1);
+                        RecordKind kind = static_cast<RecordKind>(body[0]);
+                        if (kind == RecordKind::VOTE)
+                        {
+                            vote_term = reader.get<uint64_t>();
+                            voted_for = reader.get<int32_t>();
+                            vote_segment = seqs[s];
+                            on_vote(vote_term, voted_for);
+                            begin += RECORD_HEADER + length;
+                            valid += RECORD_HEADER + length;
+                            continue;
+                        }
+                        uint64_t index = reader.get<uint64_t>();
+                        if (kind == RecordKind::ENTRY)
+                        {
+                            on_entry(index, LogEntry::deserialize(reader));
+                            positions[index] = Position{seqs[s], static_cast<uint64_t>(valid)};
+                            buffered_index = index;
+                            segment_last_index[seqs[s]] = std::max(segment_last_index[seqs[s]], index);
+                        }
+                        else
+                        {
+                            on_truncate(index);
+                            positions.erase(positions.lower_bound(index), positions.end());
+                            buffered_index = std::min(buffered_index, index - 1);
+                        }
+                        begin += RECORD_HEADER + length;
+                        valid += RECORD_HEADER + length;
+                        continue;
+                    }
+                }
+
+                if (offset >= size)
+                {
+                    torn = begin != chunk.size();
+                    break;
+                }
+                // Keep the partial record and read the next window after it.
+                chunk.erase(chunk.begin(), chunk.begin() + begin);
+                begin = 0;
+                size_t n = std::min<MPI_Offset>(REPLAY_CHUNK, size - offset);
+                size_t used = chunk.size();
+                chunk.resize(used + n);
+                MPI_File_read_at(in, offset, chunk.data() + used, n, MPI_CHAR, MPI_STATUS_IGNORE);
+                offset += n;
+            }
+
+            if (torn)
+                MPI_File_set_size(in, valid);
+            MPI_File_close(&in);
+        }
+
+        written_index = buffered_index;
+        synced_index = buffered_index;
+        open_segment(seqs.empty() ? 0 : seqs.back());
+    }
+}
@@ -0,0 +1,41 @@
+#include "wire.hh"
+
+namespace wire
+{
+    size_t Writer::begin_frame(uint8_t type, int32_t sender, int32_t target)
+    {
+        const size_t offset = buffer.size();
+        put<uint8_t>(MAGIC);
+        put<uint8_t>(VERSION);
+        put<uint8_t>(type);
+        put<uint8_t>(0);
+        put<int32_t>(sender);
+        put<int32_t>(target);
+        put<uint32_t>(0);
+        return offset;
+    }
+
+    void Writer::end_frame(size_t frame_offset, size_t trailing)
+    {
+        const uint32_t payload_size = buffer.size() - frame_offset - HEADER_SIZE + trailing;
+        std::memcpy(buffer.data() + frame_offset + 12, &payload_size, sizeof(payload_size));
+    }
+
+    Header Reader::get_header()
+    {
+        if (get<uint8_t>() != MAGIC)
+            throw std::runtime_error("wire: bad magic");
+        Header header;
+        header.version = get<uint8_t>();
+        if (header.version != VERSION)
+            throw std::runtime_error("wire: unsupported version " + std::to_string(header.version));
+        header.type = get<uint8_t>();
+        get<uint8_t>();
+        header.sender = get<int32_t>();
+        header.target = get<int32_t>();
+        header.payload_size = get<uint32_t>();
+        if (header.payload_size > remaining())
+            throw std::runtime_error("wire: truncated payload");
+        return header;
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+
+// Checks of the tests: a failed one is reported with its place and the
+// test goes on, main returns tests::status().
+namespace tests
+{
+    inline int failures = 0;
+
+    inline void check(bool passed, const char *condition, const char *file, int line)
+    {
+        if (passed)
+            return;
+        std::cerr << file << ":" << line << ": failed: " << condition << std::endl;
+        failures++;
+    }
+
+    inline int status(const char *name)
+    {
+        std::cout << name << ": "
+                  << (failures == 0 ? "ok" : std::to_string(failures) + " checks failed")
+                  << std::endl;
+        return failures == 0 ? 0 : 1;
+    }
+}
+
+#define CHECK(condition) tests::check((condition), #condition, __FILE__, __LINE__)
+
+// Checks that statement throws an exception of type.
+#define CHECK_THROWS(statement, type)                                              \
+    do                                                                             \
+    {                                                                              \
+        bool thrown = false;                                                       \
+        try                                                                        \
+        {                                                                          \
+            statement;                                                             \
+        }                                                                          \
+        catch (const type &)                                                       \
+        {                                                                          \
+            thrown = true;                                                         \
+        }                                                                          \
+        tests::check(thrown, #statement " throws " #type, __FILE__, __LINE__);     \
+    } while (false)
@@ -0,0 +1,170 @@
+// Content-defined chunking and the chunk store: cuts stay within their
+// bounds and move only near an insertion, chunks shared by files are stored
+// once and only collected once no file references them.
+//
+//   make test, or ./bin/test_chunk_store
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <unistd.h>
+
+#include "check.hh"
+#include "chunk_store.hh"
+
+using raft::ChunkId;
+using raft::ChunkIdHash;
+using raft::ChunkRef;
+using raft::ChunkStore;
+
+static const std::string dir =
+    (std::filesystem::temp_directory_path() / ("afs_test_chunks_" + std::to_string(getpid()))).string();
+
+static std::string random_bytes(size_t size, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::string data(size, '\0');
+    for (char &c : data)
+        c = static_cast<char>(rng());
+    return data;
+}
+
+static void cuts_within_bounds()
+{
+    const size_t average = 4096;
+    std::string data = random_bytes(1 << 20, 1);
+    std::vector<ChunkRef> chunks = raft::cut_chunks(data, average);
+
+    size_t at = 0;
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        const ChunkRef &chunk = chunks[i];
+        CHECK(chunk.size <= average * 4);
+        CHECK(chunk.size >= average / 4 || i + 1 == chunks.size());
+        CHECK(chunk.inlined);
+        CHECK(chunk.id == ChunkId::of(std::string_view(data).substr(at, chunk.size)));
+        at += chunk.size;
+    }
+    CHECK(at == data.size());
+    // About average bytes each.
+    CHECK(chunks.size() > data.size() / average / 2 && chunks.size() < data.size() / average * 2);
+
+    CHECK(raft::cut_chunks("", average).empty());
+    // Same bytes, same cuts.
+    std::vector<ChunkRef> again = raft::cut_chunks(data, average);
+    CHECK(again.size() == chunks.size());
+    for (size_t i = 0; i < chunks.size() && i < again.size(); i++)
+        CHECK(again[i].id == chunks[i].id);
+}
+
+static void cuts_move_locally()
+{
+    std::string data = random_bytes(1 << 20, 2);
+    std::string edited = data;
+    edited.insert(data.size() / 2, "inserted");
+
+    std::unordered_set<ChunkId, ChunkIdHash> before;
+    for (const ChunkRef &chunk : raft::cut_chunks(data, 4096))
+        before.insert(chunk.id);
+    std::vector<ChunkRef> after = raft::cut_chunks(edited, 4096);
+    size_t changed = 0;
+    for (const ChunkRef &chunk : after)
+        changed += before.count(chunk.id) == 0;
+    CHECK(changed >= 1 && changed <= 3);
+}
+
+static void parses_ids()
+{
+    ChunkId id = ChunkId::of("chunk");
+    CHECK(id.hex().size() == 64);
+    CHECK(ChunkId::from_hex(id.hex()) == id);
+    CHECK_THROWS(ChunkId::from_hex("abc"), std::invalid_argument);
+    CHECK_THROWS(ChunkId::from_hex(std::string(64, 'g')), std::invalid_argument);
+    CHECK_THROWS(ChunkId::from_hex(std::string(64, 'A')), std::invalid_argument);
+}
+
+static ChunkRef ref(const std::string &data)
+{
+    return ChunkRef{ChunkId::of(data), static_cast<uint32_t>(data.size()), true};
+}
+
+// Writes the chunk where the store looks for it, as applying an entry does.
+static void write_chunk(ChunkStore &store, const ChunkRef &chunk, const std::string &data)
+{
+    std::ofstream(store.path(chunk.id), std::ios::binary) << data;
+    store.set_ready(chunk.id);
+}
+
+static void counts_references()
+{
+    std::filesystem::remove_all(dir);
+    ChunkStore store(dir);
+    ChunkRef a = ref("aaaa"), b = ref("bbbbbb"), c = ref("cc");
+
+    // A chunk twice in one file is stored once, and new only once.
+    std::vector<ChunkRef> fresh = store.add(1, {a, b, a}, 10);
+    CHECK(fresh.size() == 2);
+    CHECK(store.has(a.id) && !store.ready(a.id));
+    write_chunk(store, a, "aaaa");
+    write_chunk(store, b, "bbbbbb");
+    CHECK(store.ready(a.id));
+    CHECK(store.logical_bytes() == 14 && store.stored_bytes() == 10);
+    CHECK(store.recipe(1).size() == 3);
+    CHECK(!store.recipe(1)[0].inlined);
+
+    // Entries before 10 did not know a, those after may send it by reference.
+    CHECK(!store.known_before(a.id, 10) && store.known_before(a.id, 11));
+
+    fresh = store.add(2, {b, c}, 20);
+    CHECK(fresh.size() == 1 && fresh[0].id == c.id);
+    write_chunk(store, c, "cc");
+    CHECK(store.logical_bytes() == 22 && store.stored_bytes() == 12);
+
+    // b is still referenced by file 2.
+    store.erase(1);
+    CHECK(store.recipe(1).empty());
+    CHECK(store.logical_bytes() == 8 && store.stored_bytes() == 8);
+    CHECK(store.referenced().size() == 2);
+
+    // Unreferenced chunks stay until collected, and those still needed by
+    // entries to apply are kept.
+    CHECK(store.has(a.id));
+    std::unordered_set<ChunkId, ChunkIdHash> keep;
+    keep.insert(a.id);
+    CHECK(store.collect(keep) == 0);
+    CHECK(store.collect({}) == 1);
+    CHECK(!store.has(a.id));
+    CHECK(!std::filesystem::exists(store.path(a.id)));
+    CHECK(std::filesystem::exists(store.path(b.id)));
+
+    // A chunk referenced again before collection is not written twice.
+    store.erase(2);
+    fresh = store.add(3, {b}, 30);
+    CHECK(fresh.empty());
+    CHECK(store.collect({}) == 1);
+    CHECK(store.has(b.id) && !store.has(c.id));
+
+    // A restart registers the chunks on disk, without references, and
+    // drops what is not a chunk.
+    std::ofstream(dir + "/" + b.id.hex() + ".tmp") << "partial";
+    store.reload();
+    CHECK(store.has(b.id) && store.ready(b.id));
+    CHECK(store.recipe(3).empty());
+    CHECK(store.stored_bytes() == 0);
+    CHECK(!std::filesystem::exists(dir + "/" + b.id.hex() + ".tmp"));
+    CHECK(store.collect({}) == 1);
+    std::filesystem::remove_all(dir);
+}
+
+int main()
+{
+    cuts_within_bounds();
+    cuts_move_locally();
+    parses_ids();
+    counts_references();
+    return tests::status("chunk_store");
+}
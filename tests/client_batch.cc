@@ -0,0 +1,96 @@
+// Client request batches: requests on one file are moved next to each
+// other, but never ahead of an earlier request of the same client.
+//
+//   make test, or ./bin/test_client_batch
+
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "check.hh"
+#include "raft_server.hh"
+
+using Batch = std::vector<std::shared_ptr<message::Client_message>>;
+
+static std::shared_ptr<message::Client_message> request(message::ClientAction action, int sender,
+                                                        int uid, uint64_t id)
+{
+    return std::make_shared<message::Client_message>(action, 1, sender, uid, "", "", id);
+}
+
+static std::vector<uint64_t> ids(const Batch &batch)
+{
+    std::vector<uint64_t> result;
+    for (const auto &message : batch)
+        result.push_back(message->get_request_id());
+    return result;
+}
+
+static void keeps_client_order()
+{
+    // One client appends to 3, deletes 7, appends to 3 again: the second
+    // append must not go before the delete.
+    Batch batch = {request(message::APPEND, 5, 3, 1), request(message::DELETE, 5, 7, 2),
+                   request(message::APPEND, 5, 3, 3)};
+    CHECK(ids(raft::group_by_file(batch)) == (std::vector<uint64_t>{1, 2, 3}));
+}
+
+static void groups_clients()
+{
+    // Another client's append to 3 joins the first one.
+    Batch batch = {request(message::APPEND, 5, 3, 1), request(message::DELETE, 6, 7, 2),
+                   request(message::APPEND, 8, 3, 3), request(message::APPEND, 6, 7, 4)};
+    CHECK(ids(raft::group_by_file(batch)) == (std::vector<uint64_t>{1, 3, 2, 4}));
+
+    // Client 6 appends to 7 after its request on 3: that append starts a
+    // group of its own, after the one on 3, and the later append of client 5
+    // to 7 joins it rather than going before it.
+    batch = {request(message::APPEND, 5, 7, 1), request(message::APPEND, 6, 3, 2),
+             request(message::APPEND, 6, 7, 3), request(message::APPEND, 5, 7, 4)};
+    CHECK(ids(raft::group_by_file(batch)) == (std::vector<uint64_t>{1, 2, 3, 4}));
+
+    // New files keep their place.
+    batch = {request(message::APPEND, 5, 3, 1), request(message::LOAD, 6, -1, 2),
+             request(message::APPEND, 7, 3, 3), request(message::LOAD, 8, -1, 4)};
+    CHECK(ids(raft::group_by_file(batch)) == (std::vector<uint64_t>{1, 3, 2, 4}));
+}
+
+static void keeps_orders_at_random()
+{
+    std::mt19937 rng(3);
+    for (int round = 0; round < 200; round++)
+    {
+        Batch batch;
+        for (uint64_t id = 0; id < 64; id++)
+            batch.push_back(request(message::APPEND, 10 + rng() % 4,
+                                    static_cast<int>(rng() % 6) - 1, id));
+        Batch grouped = raft::group_by_file(batch);
+        CHECK(grouped.size() == batch.size());
+
+        // Requests of each client, and on each file, in the order sent.
+        std::map<int, uint64_t> last_of_sender;
+        std::map<int, uint64_t> last_of_uid;
+        std::vector<bool> seen(batch.size(), false);
+        for (const auto &message : grouped)
+        {
+            uint64_t id = message->get_request_id();
+            CHECK(!seen[id]);
+            seen[id] = true;
+            auto sender = last_of_sender.find(message->get_sender_rank());
+            CHECK(sender == last_of_sender.end() || sender->second < id);
+            last_of_sender[message->get_sender_rank()] = id;
+            auto uid = last_of_uid.find(message->get_uid());
+            CHECK(uid == last_of_uid.end() || uid->second < id);
+            last_of_uid[message->get_uid()] = id;
+        }
+    }
+}
+
+int main()
+{
+    keeps_client_order();
+    groups_clients();
+    keeps_orders_at_random();
+    return tests::status("client_batch");
+}
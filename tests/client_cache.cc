@@ -0,0 +1,117 @@
+// Client file cache: the least recently used files are evicted to stay
+// within the byte budget, callback breaks erase the files they cover, and
+// expired or oversized files are not served.
+//
+//   make test, or ./bin/test_client_cache
+
+#include <chrono>
+#include <string>
+
+#include "check.hh"
+#include "client_cache.hh"
+
+using client::ClientCache;
+
+using namespace std::chrono_literals;
+
+static const ClientCache::time_point now{};
+static const ClientCache::time_point later = now + 1h;
+
+static bool cached(ClientCache &cache, int uid)
+{
+    return cache.find(uid, now) != nullptr;
+}
+
+static void evicts_least_recently_used()
+{
+    ClientCache cache(100);
+    CHECK(cache.capacity() == 100);
+    cache.insert(1, std::string(40, 'a'), later);
+    cache.insert(2, std::string(30, 'b'), later);
+    cache.insert(3, std::string(30, 'c'), later);
+    CHECK(cache.bytes() == 100 && cache.evictions() == 0);
+
+    // A read makes 1 the most recently used: 2 goes first.
+    const std::string *data = cache.find(1, now);
+    CHECK(data != nullptr && *data == std::string(40, 'a'));
+    cache.insert(4, std::string(20, 'd'), later);
+    CHECK(!cached(cache, 2));
+    CHECK(cache.evictions() == 1 && cache.bytes() == 90);
+
+    // As many files as needed to fit, oldest first: 3, then 1.
+    cache.insert(5, std::string(70, 'e'), later);
+    CHECK(!cached(cache, 3) && !cached(cache, 1));
+    CHECK(cached(cache, 4) && cached(cache, 5));
+    CHECK(cache.evictions() == 3 && cache.bytes() == 90);
+
+    // A new copy replaces the old one, without evicting.
+    cache.insert(4, std::string(30, 'D'), later);
+    CHECK(cache.bytes() == 100 && cache.evictions() == 3);
+    CHECK(*cache.find(4, now) == std::string(30, 'D'));
+}
+
+static void skips_oversized()
+{
+    ClientCache cache(100);
+    cache.insert(1, std::string(60, 'a'), later);
+    cache.insert(2, std::string(40, 'b'), later);
+    // A file over the whole budget evicts nothing and is not kept, nor is
+    // its stale copy.
+    cache.insert(2, std::string(101, 'B'), later);
+    CHECK(!cached(cache, 2));
+    CHECK(cached(cache, 1));
+    CHECK(cache.bytes() == 60 && cache.evictions() == 0);
+    // The whole budget fits.
+    cache.insert(3, std::string(100, 'c'), later);
+    CHECK(cached(cache, 3) && cache.bytes() == 100);
+
+    ClientCache disabled(0);
+    disabled.insert(1, "a", later);
+    CHECK(!cached(disabled, 1) && disabled.bytes() == 0);
+}
+
+static void expires()
+{
+    ClientCache cache(100);
+    cache.insert(1, "abc", now + 1s);
+    CHECK(cache.find(1, now) != nullptr);
+    CHECK(cache.find(1, now + 1s) == nullptr);
+    // Gone for good, its bytes freed.
+    CHECK(cache.find(1, now) == nullptr);
+    CHECK(cache.bytes() == 0);
+    CHECK(cache.hits() == 1 && cache.misses() == 2);
+}
+
+static void breaks_callbacks()
+{
+    ClientCache cache(1000);
+    for (int uid = 0; uid < 10; uid++)
+        cache.insert(uid, std::string(10, 'a' + uid), later);
+
+    // A break for one file.
+    cache.erase(3);
+    CHECK(!cached(cache, 3));
+    cache.erase(3);
+
+    // A new leader breaks every promise of its group, here the even uids.
+    cache.erase_if([](int uid) { return uid % 2 == 0; });
+    for (int uid = 0; uid < 10; uid++)
+        CHECK(cached(cache, uid) == (uid % 2 == 1 && uid != 3));
+    CHECK(cache.bytes() == 40);
+    // Not counted as evictions.
+    CHECK(cache.evictions() == 0);
+
+    cache.erase_if([](int) { return true; });
+    CHECK(cache.bytes() == 0);
+    cache.insert(3, std::string(10, 'c'), later);
+    CHECK(cached(cache, 3));
+}
+
+int main()
+{
+    evicts_least_recently_used();
+    skips_oversized();
+    expires();
+    breaks_callbacks();
+    return tests::status("client_cache");
+}
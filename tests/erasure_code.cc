@@ -0,0 +1,137 @@
+// Reed-Solomon code: for each kernel the CPU supports, any m erased
+// fragments of a chunk are rebuilt from the k others, every kernel computes
+// the same parity, and more than m erasures are refused.
+//
+//   make test, or ./bin/test_erasure_code
+
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hh"
+#include "erasure_code.hh"
+
+static std::string random_bytes(size_t size, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::string data(size, '\0');
+    for (char &c : data)
+        c = static_cast<char>(rng());
+    return data;
+}
+
+static std::vector<uint8_t *> pointers(std::vector<std::string> &fragments)
+{
+    std::vector<uint8_t *> result;
+    for (std::string &fragment : fragments)
+        result.push_back(reinterpret_cast<uint8_t *>(fragment.data()));
+    return result;
+}
+
+// Calls visit with every way of erasing count of n fragments.
+template <typename Visit>
+static void erasures(int n, int count, Visit visit)
+{
+    std::vector<bool> present(n, true);
+    std::vector<int> erased;
+    auto next = [&](auto &self, int from) -> void {
+        if (static_cast<int>(erased.size()) == count)
+        {
+            visit(present);
+            return;
+        }
+        for (int i = from; i < n; i++)
+        {
+            present[i] = false;
+            erased.push_back(i);
+            self(self, i + 1);
+            erased.pop_back();
+            present[i] = true;
+        }
+    };
+    next(next, 0);
+}
+
+static void splits(ec::Kernel kernel)
+{
+    ec::ReedSolomon code(4, 2, kernel);
+    // Not a multiple of k: the last data fragment is zero padded.
+    std::string chunk = random_bytes(1001, 1);
+    std::vector<std::string> fragments = code.split(chunk);
+    CHECK(fragments.size() == 6);
+    CHECK(code.fragment_size(chunk.size()) == 251);
+    std::string joined;
+    for (int i = 0; i < 4; i++)
+    {
+        CHECK(fragments[i].size() == 251);
+        joined += fragments[i];
+    }
+    CHECK(joined.substr(0, chunk.size()) == chunk);
+    CHECK(joined.substr(chunk.size()) == std::string(3, '\0'));
+}
+
+static void rebuilds_any_erasures(ec::Kernel kernel, int k, int m, size_t chunk_size)
+{
+    ec::ReedSolomon code(k, m, kernel);
+    std::vector<std::string> expected = code.split(random_bytes(chunk_size, k * 100 + m));
+    size_t size = expected[0].size();
+
+    // Every set of at most m erasures, the erased fragments overwritten.
+    for (int count = 1; count <= m; count++)
+    {
+        erasures(k + m, count, [&](const std::vector<bool> &present) {
+            std::vector<std::string> fragments = expected;
+            for (int i = 0; i < k + m; i++)
+                if (!present[i])
+                    fragments[i].assign(size, '\x5a');
+            std::vector<uint8_t *> buffers = pointers(fragments);
+            CHECK(code.reconstruct(buffers.data(), present, size));
+            CHECK(fragments == expected);
+        });
+    }
+
+    // One more is too many.
+    std::vector<std::string> fragments = expected;
+    std::vector<bool> present(k + m, true);
+    for (int i = 0; i <= m; i++)
+        present[i] = false;
+    std::vector<uint8_t *> buffers = pointers(fragments);
+    CHECK(!code.reconstruct(buffers.data(), present, size));
+}
+
+static void kernels_agree(int k, int m, size_t chunk_size)
+{
+    std::string chunk = random_bytes(chunk_size, 7);
+    std::vector<std::string> scalar = ec::ReedSolomon(k, m, ec::Kernel::SCALAR).split(chunk);
+    for (auto kernel : {ec::Kernel::SSSE3, ec::Kernel::AVX2})
+        if (ec::supported(kernel))
+            CHECK(ec::ReedSolomon(k, m, kernel).split(chunk) == scalar);
+}
+
+int main()
+{
+    for (auto kernel : {ec::Kernel::SCALAR, ec::Kernel::SSSE3, ec::Kernel::AVX2})
+    {
+        if (!ec::supported(kernel))
+        {
+            std::cout << "erasure_code: " << ec::kernel_name(kernel)
+                      << " not supported by this CPU, skipped" << std::endl;
+            continue;
+        }
+        splits(kernel);
+        // Fragment sizes around the 16 and 32 bytes the SIMD kernels take
+        // at a time, with a tail.
+        for (size_t chunk_size : {1, 63, 4096 + 40})
+        {
+            rebuilds_any_erasures(kernel, 2, 1, chunk_size);
+            rebuilds_any_erasures(kernel, 4, 2, chunk_size);
+            rebuilds_any_erasures(kernel, 6, 3, chunk_size);
+            rebuilds_any_erasures(kernel, 10, 4, chunk_size);
+        }
+    }
+    kernels_agree(4, 2, 4096 + 40);
+    kernels_agree(10, 4, 64 << 10);
+    return tests::status("erasure_code");
+}
@@ -0,0 +1,113 @@
+// Cache of open files: handles and mappings are reused until the least
+// recently used one is closed to make room, which a failed open does not
+// take, mappings are redone once the file outgrew them, and evicted
+// mappings stay valid while in use.
+//
+//   make test, or ./bin/test_file_cache
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include <mpi.h>
+#include <unistd.h>
+
+#include "check.hh"
+#include "file_cache.hh"
+
+using raft::FileCache;
+using raft::MappedFile;
+
+static const std::string dir =
+    (std::filesystem::temp_directory_path() / ("afs_test_file_cache_" + std::to_string(getpid()))).string();
+
+static std::string path_of(int uid)
+{
+    return dir + "/" + std::to_string(uid);
+}
+
+static void write_file(int uid, const std::string &data)
+{
+    std::ofstream(path_of(uid), std::ios::binary | std::ios::app) << data;
+}
+
+// Opens uid, true if its handle was cached.
+static bool open_hit(FileCache &cache, int uid)
+{
+    uint64_t hits = cache.hits();
+    CHECK(cache.open(uid, path_of(uid), MPI_MODE_RDONLY) != MPI_FILE_NULL);
+    return cache.hits() == hits + 1;
+}
+
+static void evicts_least_recently_used()
+{
+    FileCache cache(2);
+    CHECK(!open_hit(cache, 1));
+    CHECK(!open_hit(cache, 2));
+    CHECK(open_hit(cache, 1));
+    // 2 is the least recently used.
+    CHECK(!open_hit(cache, 3));
+    CHECK(open_hit(cache, 1));
+    CHECK(!open_hit(cache, 2));
+    // Then 3.
+    CHECK(open_hit(cache, 1));
+    CHECK(!open_hit(cache, 3));
+    CHECK(cache.hits() == 3 && cache.misses() == 5);
+
+    cache.evict(1);
+    CHECK(!open_hit(cache, 1));
+    cache.close_all();
+    CHECK(!open_hit(cache, 3));
+
+    // A file that cannot be opened closes nothing to make room.
+    CHECK(!open_hit(cache, 1));
+    CHECK(cache.open(9, path_of(9), MPI_MODE_RDONLY) == MPI_FILE_NULL);
+    CHECK(cache.map(9, path_of(9), 1) == nullptr);
+    CHECK(open_hit(cache, 3));
+    CHECK(open_hit(cache, 1));
+}
+
+static void maps()
+{
+    FileCache cache(2);
+    std::shared_ptr<MappedFile> mapping = cache.map(1, path_of(1), 5);
+    CHECK(mapping && std::string(mapping->data(), mapping->size()) == "first");
+    // The mapping covers the bytes asked for: reused.
+    CHECK(cache.map(1, path_of(1), 5) == mapping);
+    // The handle goes with it, in the same entry.
+    CHECK(!open_hit(cache, 1));
+    CHECK(cache.map(1, path_of(1), 3) == mapping);
+
+    // After an append, the file is mapped again.
+    write_file(1, " more");
+    std::shared_ptr<MappedFile> grown = cache.map(1, path_of(1), 10);
+    CHECK(grown && grown != mapping && grown->size() == 10);
+    CHECK(std::string(mapping->data(), mapping->size()) == "first");
+
+    // Evicted while a read still sends from it: the mapping lives on.
+    cache.map(2, path_of(2), 6);
+    cache.map(3, path_of(3), 5);
+    CHECK(cache.map(1, path_of(1), 10) != grown);
+    CHECK(std::string(grown->data(), grown->size()) == "first more");
+
+    // Every handle of a path, whatever its uid.
+    std::shared_ptr<MappedFile> third = cache.map(3, path_of(3), 5);
+    cache.evict_path(path_of(3));
+    CHECK(cache.map(3, path_of(3), 5) != third);
+}
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    write_file(1, "first");
+    write_file(2, "second");
+    write_file(3, "third");
+    evicts_least_recently_used();
+    maps();
+    std::filesystem::remove_all(dir);
+    MPI_Finalize();
+    return tests::status("file_cache");
+}
@@ -0,0 +1,151 @@
+// Latency histogram: small values are exact and larger ones within
+// 2^-PRECISION, percentiles round up to their bucket, and histograms
+// merged, rebuilt from their buckets or reduced across ranks count the
+// same values.
+//
+//   make test, or ./bin/test_histogram (mpirun -np 4 for the reduction
+//   across several ranks)
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include <mpi.h>
+
+#include "check.hh"
+#include "histogram.hh"
+
+using stats::Histogram;
+
+// The value percentile(0.5) reports for value: with a larger one recorded,
+// the highest value of its bucket.
+static uint64_t bucket_top(uint64_t value)
+{
+    Histogram histogram;
+    histogram.record(value);
+    histogram.record(std::numeric_limits<uint64_t>::max());
+    return histogram.percentile(0.5);
+}
+
+static void bounds_buckets()
+{
+    // Exact below 2^(PRECISION + 1).
+    for (uint64_t value : {0, 1, 127, 128, 200, 255})
+        CHECK(bucket_top(value) == value);
+    // Then 2 values per bucket, 4 from 512...
+    CHECK(bucket_top(256) == 257 && bucket_top(257) == 257 && bucket_top(258) == 259);
+    CHECK(bucket_top(511) == 511 && bucket_top(512) == 515 && bucket_top(515) == 515);
+    CHECK(bucket_top(516) == 519);
+    CHECK(bucket_top(uint64_t(1) << 40) == (uint64_t(1) << 40) + (uint64_t(1) << 33) - 1);
+    // Up to the largest value.
+    uint64_t max = std::numeric_limits<uint64_t>::max();
+    CHECK(bucket_top(max) == max);
+    uint64_t last = max - ((uint64_t(1) << 56) - 1);
+    CHECK(bucket_top(last) == max);
+    CHECK(bucket_top(last - 1) == last - 1);
+}
+
+static void computes_percentiles()
+{
+    Histogram histogram;
+    CHECK(histogram.percentile(0.5) == 0 && histogram.count() == 0);
+
+    for (uint64_t value = 1; value <= 100; value++)
+        histogram.record(value);
+    CHECK(histogram.count() == 100 && histogram.max() == 100);
+    CHECK(histogram.percentile(0) == 1);
+    CHECK(histogram.percentile(0.5) == 50);
+    CHECK(histogram.percentile(0.99) == 99);
+    CHECK(histogram.percentile(1) == 100);
+
+    // Rounded up to the bucket, never past the largest value recorded.
+    std::mt19937_64 rng(5);
+    std::vector<uint64_t> values;
+    histogram.clear();
+    for (int i = 0; i < 100000; i++)
+    {
+        uint64_t value = rng() >> (rng() % 64);
+        values.push_back(value);
+        histogram.record(value);
+    }
+    std::sort(values.begin(), values.end());
+    for (double q : {0.01, 0.25, 0.5, 0.9, 0.99, 0.999, 1.0})
+    {
+        uint64_t exact = values[std::max<size_t>(1, std::ceil(q * values.size())) - 1];
+        uint64_t reported = histogram.percentile(q);
+        CHECK(reported >= exact);
+        CHECK(reported - exact <= exact / Histogram::SUB_BUCKETS);
+    }
+    CHECK(histogram.percentile(1) == values.back());
+}
+
+// The latencies rank records: ranks overlap, and each has a maximum of
+// its own.
+static Histogram of_rank(int rank)
+{
+    Histogram histogram;
+    std::mt19937_64 rng(rank);
+    for (int i = 0; i < 1000 * (rank + 1); i++)
+        histogram.record(rng() % 1000000);
+    histogram.record(2000000 + rank);
+    return histogram;
+}
+
+static void merges()
+{
+    Histogram a = of_rank(0), b = of_rank(1);
+    Histogram merged = a;
+    merged.merge(b);
+    CHECK(merged.count() == a.count() + b.count());
+    CHECK(merged.max() == 2000001);
+
+    // The same values recorded in one histogram.
+    Histogram whole;
+    std::mt19937_64 rng0(0), rng1(1);
+    for (int i = 0; i < 1000; i++)
+        whole.record(rng0() % 1000000);
+    for (int i = 0; i < 2000; i++)
+        whole.record(rng1() % 1000000);
+    whole.record(2000000);
+    whole.record(2000001);
+    CHECK(merged.buckets() == whole.buckets());
+
+    Histogram copy = Histogram::from_buckets(merged.buckets(), merged.max());
+    CHECK(copy.count() == merged.count() && copy.max() == merged.max());
+    for (double q : {0.1, 0.5, 0.99, 1.0})
+        CHECK(copy.percentile(q) == merged.percentile(q));
+    CHECK_THROWS(Histogram::from_buckets({{Histogram::BUCKETS, 1}}, 0), std::invalid_argument);
+}
+
+static void reduces()
+{
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    Histogram histogram = of_rank(rank);
+    histogram.reduce(MPI_COMM_WORLD, 0);
+    if (rank != 0)
+        return;
+
+    Histogram expected;
+    for (int r = 0; r < size; r++)
+        expected.merge(of_rank(r));
+    CHECK(histogram.count() == expected.count());
+    CHECK(histogram.max() == 2000000 + static_cast<uint64_t>(size) - 1);
+    CHECK(histogram.buckets() == expected.buckets());
+}
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    bounds_buckets();
+    computes_percentiles();
+    merges();
+    reduces();
+    MPI_Finalize();
+    return rank == 0 ? tests::status("histogram") : tests::failures > 0;
+}
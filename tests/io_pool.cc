@@ -0,0 +1,127 @@
+// I/O pool: operations on one key run in submission order, operations on
+// different keys run at the same time, and callbacks only run in poll().
+//
+//   make test, or ./bin/test_io_pool
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <mpi.h>
+
+#include "check.hh"
+#include "io_pool.hh"
+
+using raft::IoPool;
+
+static void keeps_key_order(int workers)
+{
+    IoPool pool(workers, 1000);
+    // Each key has a shard of its own, so its operations alone touch its
+    // vector.
+    std::vector<std::vector<int>> ran(pool.shards());
+    std::vector<std::vector<int>> called(pool.shards());
+    for (int i = 0; i < 600; i++)
+    {
+        size_t key = i % 3;
+        size_t shard = pool.shard_of(key);
+        CHECK(pool.submit(
+            key,
+            [&ran, shard, i] {
+                ran[shard].push_back(i);
+                return i % 2 == 0;
+            },
+            [&called, shard, i](bool success) {
+                CHECK(success == (i % 2 == 0));
+                called[shard].push_back(i);
+            }));
+    }
+    pool.drain();
+    CHECK(pool.pending() == 600);
+    CHECK(pool.poll() == 600);
+    CHECK(pool.pending() == 0);
+
+    for (size_t shard = 0; shard < pool.shards(); shard++)
+    {
+        CHECK(ran[shard].size() == 600 / pool.shards());
+        for (size_t i = 1; i < ran[shard].size(); i++)
+            CHECK(ran[shard][i - 1] < ran[shard][i]);
+        CHECK(called[shard] == ran[shard]);
+    }
+}
+
+static void runs_keys_in_parallel()
+{
+    IoPool pool(2, 10);
+    CHECK(pool.shard_of(0) != pool.shard_of(1));
+
+    // Each operation waits for the other one to start: they only both
+    // finish if they run at the same time.
+    std::atomic<int> started(0);
+    auto meet = [&started] {
+        started++;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (started.load() < 2)
+        {
+            if (std::chrono::steady_clock::now() > deadline)
+                return false;
+            std::this_thread::yield();
+        }
+        return true;
+    };
+    int succeeded = 0;
+    auto done = [&succeeded](bool success) { succeeded += success; };
+    CHECK(pool.submit(0, meet, done));
+    CHECK(pool.submit(1, meet, done));
+    pool.drain();
+    // Not before poll().
+    CHECK(succeeded == 0);
+    CHECK(pool.poll() == 2);
+    CHECK(succeeded == 2);
+}
+
+static void bounds_queues()
+{
+    IoPool pool(1, 2);
+    std::atomic<int> started(0);
+    std::atomic<bool> release(false);
+    auto block = [&started, &release] {
+        started++;
+        while (!release.load())
+            std::this_thread::yield();
+        return true;
+    };
+    // One running, two waiting.
+    CHECK(pool.submit(0, block, nullptr));
+    while (started.load() == 0)
+        std::this_thread::yield();
+    CHECK(pool.submit(0, block, nullptr));
+    CHECK(pool.submit(0, block, nullptr));
+    CHECK(pool.full(0));
+    CHECK(!pool.submit(0, block, nullptr));
+    CHECK(pool.pending() == 3);
+    release = true;
+    pool.drain();
+    pool.discard();
+    CHECK(pool.pending() == 0);
+}
+
+int main(int argc, char *argv[])
+{
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+    // Inline, in submit().
+    keeps_key_order(0);
+    if (provided < MPI_THREAD_MULTIPLE)
+        std::cout << "io_pool: no MPI_THREAD_MULTIPLE, workers skipped" << std::endl;
+    else
+    {
+        keeps_key_order(3);
+        runs_keys_in_parallel();
+        bounds_queues();
+    }
+    MPI_Finalize();
+    return tests::status("io_pool");
+}
@@ -0,0 +1,111 @@
+// Metadata index: uids come from the counter of the group then from the
+// free list, and a random mix of creations and deletions leaves the index
+// agreeing with a std::map.
+//
+//   make test, or ./bin/test_metadata_index
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "check.hh"
+#include "metadata_index.hh"
+
+using raft::FileMeta;
+using raft::MetadataIndex;
+
+static void allocates_uids()
+{
+    // The uids of group 2 out of 3.
+    MetadataIndex files(2, 3);
+    CHECK(files.create("a").uid == 2);
+    CHECK(files.create("b").uid == 5);
+    CHECK(files.create("c").uid == 8);
+    CHECK(files.next_uid() == 11);
+
+    CHECK(files.erase(5));
+    CHECK(!files.erase(5));
+    CHECK(files.find(5) == nullptr);
+    CHECK(files.free_uids() == std::vector<int>{5});
+    // Freed uids are taken first.
+    FileMeta &reused = files.create("d");
+    CHECK(reused.uid == 5);
+    CHECK(reused.name == "d" && reused.size == 0);
+    CHECK(files.free_uids().empty());
+    CHECK(files.create("e").uid == 11);
+
+    CHECK_THROWS(files.insert(8, "again", 0), std::runtime_error);
+
+    // A replica restoring the allocator allocates the same uids.
+    MetadataIndex replica(2, 3);
+    replica.insert(2, "a", 10);
+    replica.restore_allocator(files.next_uid(), {8});
+    CHECK(replica.create("f").uid == 8);
+    CHECK(replica.create("g").uid == 14);
+    CHECK(replica.find(2)->size == 10);
+
+    files.clear();
+    CHECK(files.size() == 0 && files.find(2) == nullptr);
+    CHECK(files.create("a").uid == 2);
+}
+
+static void lists_committed()
+{
+    MetadataIndex files;
+    files.create("loaded");
+    files.create("uploading").uploading = true;
+    files.create("uploaded");
+    CHECK(files.list() == (std::vector<int>{0, 2}));
+    files.find(1)->uploading = false;
+    std::vector<int> listed = files.list();
+    std::sort(listed.begin(), listed.end());
+    CHECK(listed == (std::vector<int>{0, 1, 2}));
+}
+
+static void matches_map()
+{
+    MetadataIndex files;
+    std::map<int, std::string> expected;
+    std::mt19937 rng(7);
+    // Enough files for the table to grow several times, with deletions in
+    // every probe chain.
+    for (int step = 0; step < 20000; step++)
+    {
+        if (expected.empty() || rng() % 3 != 0)
+        {
+            std::string name = "file" + std::to_string(step);
+            int uid = files.create(name).uid;
+            CHECK(expected.count(uid) == 0);
+            expected[uid] = name;
+        }
+        else
+        {
+            auto it = expected.begin();
+            std::advance(it, rng() % expected.size());
+            CHECK(files.erase(it->first));
+            expected.erase(it);
+        }
+    }
+
+    CHECK(files.size() == expected.size());
+    for (const auto &[uid, name] : expected)
+    {
+        const FileMeta *file = files.find(uid);
+        CHECK(file != nullptr && file->name == name && file->uid == uid);
+    }
+    for (const FileMeta &file : files.entries())
+        CHECK(expected.count(file.uid) == 1);
+    for (int uid = 0; uid < files.next_uid(); uid++)
+        CHECK((files.find(uid) != nullptr) == (expected.count(uid) == 1));
+}
+
+int main()
+{
+    allocates_uids();
+    lists_committed();
+    matches_map();
+    return tests::status("metadata_index");
+}
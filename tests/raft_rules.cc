@@ -0,0 +1,199 @@
+// Raft rules of the servers: the leader commits by counting replicas only
+// entries of its term, a follower truncates its log at the first entry
+// conflicting with the leader's, and votes and pre-votes are granted to
+// up-to-date candidates, never while a leader is still heard.
+//
+//   make test, or ./bin/test_raft_rules
+
+#include <memory>
+#include <vector>
+
+#include <mpi.h>
+
+#include "check.hh"
+#include "raft_server.hh"
+
+using namespace raft;
+
+static EntryPtr entry(uint64_t term)
+{
+    return std::make_shared<LogEntry>(LogEntry{term, message::ClientAction::NOOP, -1, "", "", -1,
+                                               0, 0, 0, LogEntry::PLAIN, {}});
+}
+
+static void fill(RaftLog &log, const std::vector<uint64_t> &terms)
+{
+    for (uint64_t term : terms)
+        log.append(entry(term));
+}
+
+static std::vector<uint64_t> terms(const RaftLog &log)
+{
+    std::vector<uint64_t> result;
+    for (uint64_t index = log.start_index() + 1; index <= log.last_index(); index++)
+        result.push_back(log.term_at(index));
+    return result;
+}
+
+static std::vector<EntryPtr> entries(const std::vector<uint64_t> &terms)
+{
+    std::vector<EntryPtr> result;
+    for (uint64_t term : terms)
+        result.push_back(entry(term));
+    return result;
+}
+
+static void commits_current_term()
+{
+    // A leader of term 3 among 5 members, quorum 3.
+    RaftState state(MPI_COMM_WORLD, 5);
+    fill(state.get_log(), {1, 1, 2, 2, 3});
+    state.follow(3, -1);
+    state.become_leader();
+    CHECK(state.get_quorum() == 3);
+
+    // Index 4 is on 3 members, but of term 2: not committed by counting.
+    CHECK(quorum_commit_index(state, {5, 5, 4, 2, 0}) == 0);
+    // Index 5, of term 3, commits the ones before with it.
+    CHECK(quorum_commit_index(state, {5, 2, 5, 0, 5}) == 5);
+    // Fewer than a quorum.
+    CHECK(quorum_commit_index(state, {5, 5, 0, 0, 0}) == 0);
+
+    // Never back.
+    state.set_commit_index(5);
+    CHECK(quorum_commit_index(state, {5, 3, 3, 1, 0}) == 5);
+
+    // A leader of term 2 commits its entries.
+    RaftState earlier(MPI_COMM_WORLD, 5);
+    fill(earlier.get_log(), {1, 1, 2, 2});
+    earlier.follow(2, -1);
+    earlier.become_leader();
+    CHECK(quorum_commit_index(earlier, {4, 3, 3, 0, 0}) == 3);
+    CHECK(quorum_commit_index(earlier, {2, 2, 2, 4, 0}) == 0);
+    // The last compacted entry keeps its term.
+    earlier.get_log().compact(3);
+    CHECK(quorum_commit_index(earlier, {4, 4, 3, 0, 0}) == 3);
+}
+
+static void truncates_conflicts()
+{
+    uint64_t truncated;
+
+    // Index 3 matches, index 4 conflicts: the log is cut from there.
+    RaftLog log;
+    fill(log, {1, 1, 2, 2, 2});
+    CHECK(skip_present_entries(log, 2, entries({2, 3, 3}), truncated) == 1);
+    CHECK(truncated == 4);
+    CHECK(terms(log) == (std::vector<uint64_t>{1, 1, 2}));
+
+    // Entries the log holds already, as sent again by a late
+    // AppendEntries: the entries after them stay.
+    log = RaftLog();
+    fill(log, {1, 1, 2, 2, 2});
+    CHECK(skip_present_entries(log, 1, entries({1, 2}), truncated) == 2);
+    CHECK(truncated == 0);
+    CHECK(log.last_index() == 5);
+
+    // Past the end of the log, nothing is skipped.
+    CHECK(skip_present_entries(log, 5, entries({3}), truncated) == 0);
+    CHECK(truncated == 0);
+
+    // Compacted entries are skipped whatever their term.
+    log.reset(3, 2);
+    fill(log, {2});
+    CHECK(skip_present_entries(log, 1, entries({1, 2, 2, 3}), truncated) == 3);
+    CHECK(truncated == 0);
+    CHECK(skip_present_entries(log, 1, entries({1, 2, 3, 3}), truncated) == 2);
+    CHECK(truncated == 4);
+    CHECK(log.last_index() == 3);
+
+    // The leader retries from the first entry of the conflicting term.
+    log = RaftLog();
+    fill(log, {1, 1, 2, 2, 2});
+    CHECK(conflict_retry_index(log, 5) == 3);
+    CHECK(conflict_retry_index(log, 2) == 1);
+    log = RaftLog();
+    fill(log, {3, 3});
+    CHECK(conflict_retry_index(log, 2) == 1);
+}
+
+static rpc::RequestVote request(int candidate, uint64_t term, uint64_t last_index,
+                                uint64_t last_term, bool pre_vote = false, bool transfer = false)
+{
+    return rpc::RequestVote(0, candidate, term, last_index, last_term, pre_vote, transfer);
+}
+
+// As visit(RequestVote) does for a vote.
+static bool vote(RaftState &state, const rpc::RequestVote &request, bool leader_alive)
+{
+    if (!hears_campaign(state, request, leader_alive))
+        return false;
+    if (request.get_term() > state.get_term())
+        state.follow(request.get_term(), -1);
+    if (!grants_vote(state, request))
+        return false;
+    state.vote(request.get_sender_rank());
+    return true;
+}
+
+static void grants_votes()
+{
+    RaftState state(MPI_COMM_WORLD, 5);
+    fill(state.get_log(), {1, 1, 2});
+    state.follow(2, -1);
+
+    // Not to an older term, nor to a log behind this one.
+    CHECK(!vote(state, request(1, 1, 3, 2), false));
+    CHECK(!vote(state, request(1, 3, 10, 1), false));
+    CHECK(!vote(state, request(1, 3, 2, 2), false));
+    // The term is adopted all the same, without a vote.
+    CHECK(state.get_term() == 3 && state.get_voted_for() == -1);
+
+    // A later last term wins over a longer log.
+    CHECK(vote(state, request(2, 3, 1, 3), false));
+    CHECK(state.get_voted_for() == 2);
+    // One vote per term, which the candidate may ask for again.
+    CHECK(!vote(state, request(3, 3, 3, 2), false));
+    CHECK(vote(state, request(2, 3, 1, 3), false));
+    // A new term, a new vote.
+    CHECK(vote(state, request(3, 4, 3, 2), false));
+    CHECK(state.get_term() == 4 && state.get_voted_for() == 3);
+}
+
+static void refuses_pre_votes_under_lease()
+{
+    RaftState state(MPI_COMM_WORLD, 5);
+    fill(state.get_log(), {1, 1, 2});
+    state.follow(2, 1);
+    state.vote(1);
+
+    // While the leader is heard, neither pre-votes nor votes.
+    CHECK(!hears_campaign(state, request(3, 3, 3, 2, true), true));
+    CHECK(!vote(state, request(3, 3, 3, 2), true));
+    CHECK(state.get_term() == 2 && state.get_leader() == 1);
+
+    // Once it went silent, a pre-vote is granted whatever the vote of the
+    // term, and changes nothing.
+    rpc::RequestVote pre_vote = request(3, 3, 3, 2, true);
+    CHECK(hears_campaign(state, pre_vote, false) && grants_vote(state, pre_vote));
+    CHECK(state.get_term() == 2 && state.get_voted_for() == 1);
+    rpc::RequestVote behind = request(3, 3, 2, 2, true);
+    CHECK(hears_campaign(state, behind, false) && !grants_vote(state, behind));
+
+    // The target of a leadership transfer, sent TimeoutNow, is elected
+    // while the leader is still heard.
+    CHECK(hears_campaign(state, request(3, 3, 3, 2, false, true), true));
+    CHECK(vote(state, request(3, 3, 3, 2, false, true), true));
+    CHECK(state.get_term() == 3 && state.get_voted_for() == 3);
+}
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+    commits_current_term();
+    truncates_conflicts();
+    grants_votes();
+    refuses_pre_votes_under_lease();
+    MPI_Finalize();
+    return tests::status("raft_rules");
+}
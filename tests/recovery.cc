@@ -0,0 +1,204 @@
+// Recovery of a server, as RaftServer::recover() does it: the snapshot
+// brings back the files of every kind and the uid allocator, the write-ahead
+// log the entries after it and the vote.
+//
+//   make test, or ./bin/test_recovery
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <mpi.h>
+#include <unistd.h>
+
+#include "check.hh"
+#include "chunk_store.hh"
+#include "metadata_index.hh"
+#include "raft_log.hh"
+#include "segment_store.hh"
+#include "snapshot.hh"
+#include "wal.hh"
+
+using namespace raft;
+
+static const std::string dir =
+    (std::filesystem::temp_directory_path() / ("afs_test_recovery_" + std::to_string(getpid()))).string();
+static const std::string storage_dir = dir + "/server";
+static const std::string chunk_dir = dir + "/chunks";
+static const std::string segment_dir = dir + "/segments";
+static const std::string wal_dir = dir + "/wal";
+static const std::string snapshot_path = dir + "/snapshot.bin";
+
+static LogEntry entry(uint64_t term, std::string content)
+{
+    return LogEntry{term, message::ClientAction::APPEND, 0, "", std::move(content), -1, 0, 0, 0,
+                    LogEntry::PLAIN, {}};
+}
+
+static std::string read_file(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream content;
+    content << in.rdbuf();
+    return content.str();
+}
+
+static const std::string plain(5000, 'p');
+static const std::string deduped = std::string(20000, 'd') + std::string(20000, 'e');
+static const std::string packed(300, 'k');
+
+// State of a server that applied 6 entries and took a snapshot at 4.
+static void write_state(Options options)
+{
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(storage_dir);
+
+    MetadataIndex files;
+    ChunkStore chunks(chunk_dir);
+    SegmentStore segments(segment_dir, 1, 1 << 20);
+
+    FileMeta &whole = files.create("plain");
+    whole.size = plain.size();
+    std::ofstream(storage_dir + "/plain", std::ios::binary) << plain;
+
+    files.create("gone");
+
+    FileMeta &striped = files.create("striped");
+    striped.size = 1 << 20;
+    striped.striped = true;
+    striped.uploading = true;
+    striped.created = 3;
+    striped.version = 4;
+
+    FileMeta &dedup = files.create("deduped");
+    dedup.size = deduped.size();
+    dedup.deduped = true;
+    int dedup_uid = dedup.uid;
+    for (const ChunkRef &chunk : chunks.add(dedup_uid, cut_chunks(deduped, 4096), 2))
+    {
+        uint64_t at = 0;
+        for (const ChunkRef &ref : chunks.recipe(dedup_uid))
+        {
+            if (ref.id == chunk.id)
+                break;
+            at += ref.size;
+        }
+        std::ofstream(chunks.path(chunk.id), std::ios::binary) << deduped.substr(at, chunk.size);
+        chunks.set_ready(chunk.id);
+    }
+
+    FileMeta &pack = files.create("packed");
+    pack.size = packed.size();
+    pack.packed = true;
+    Extent extent = segments.append(pack.uid, segments.stream_of("packed"), packed.size());
+    SegmentStore::write(extent, packed.data());
+
+    files.erase(1);
+
+    Wal wal(wal_dir, options);
+    wal.save_vote(1, 1);
+    for (uint64_t index = 1; index <= 6; index++)
+        wal.append(index, entry(index <= 4 ? 1 : 2, "entry " + std::to_string(index)));
+    wal.save_vote(2, 3);
+    wal.sync();
+
+    Snapshot::save(snapshot_path, SnapshotMeta{4, 1}, files, storage_dir, &chunks, &segments);
+    wal.compact(4);
+}
+
+static void recovers(Options options)
+{
+    write_state(options);
+    // The crash: the replicas of whole files and the chunks are lost too.
+    std::filesystem::remove_all(storage_dir);
+    std::filesystem::create_directories(storage_dir);
+    std::filesystem::remove_all(chunk_dir);
+
+    MetadataIndex files;
+    ChunkStore chunks(chunk_dir);
+    SegmentStore segments(segment_dir, 1, 1 << 20);
+    chunks.reload();
+    std::optional<SnapshotMeta> meta =
+        Snapshot::load(snapshot_path, files, storage_dir, &chunks, &segments);
+    CHECK(meta.has_value());
+    if (!meta)
+        return;
+    CHECK(meta->last_index == 4 && meta->last_term == 1);
+    CHECK(Snapshot::read_meta(snapshot_path)->last_index == 4);
+
+    CHECK(files.size() == 4);
+    CHECK(files.find(1) == nullptr);
+    // The allocator goes on where it was.
+    CHECK(files.free_uids() == std::vector<int>{1});
+    CHECK(files.next_uid() == 5);
+
+    const FileMeta *whole = files.find(0);
+    CHECK(whole && whole->name == "plain" && whole->size == plain.size());
+    CHECK(read_file(storage_dir + "/plain") == plain);
+
+    const FileMeta *striped = files.find(2);
+    CHECK(striped && striped->striped && striped->uploading);
+    CHECK(striped && striped->created == 3 && striped->version == 4);
+    CHECK(striped && striped->size == 1 << 20);
+
+    const FileMeta *dedup = files.find(3);
+    CHECK(dedup && dedup->deduped && dedup->size == deduped.size());
+    std::string rebuilt;
+    for (const ChunkRef &ref : chunks.recipe(3))
+    {
+        CHECK(chunks.ready(ref.id));
+        rebuilt += read_file(chunks.path(ref.id));
+    }
+    CHECK(rebuilt == deduped);
+    CHECK(chunks.logical_bytes() == deduped.size());
+
+    const FileMeta *pack = files.find(4);
+    CHECK(pack && pack->packed && pack->size == packed.size());
+    std::string content(packed.size(), '\0');
+    CHECK(SegmentStore::read(segments.extents(4), content.data()));
+    CHECK(content == packed);
+
+    // The entries after the snapshot, whatever the compaction left before.
+    RaftLog log;
+    log.reset(meta->last_index, meta->last_term);
+    uint64_t term = 0;
+    int voted_for = -1;
+    Wal wal(wal_dir, options);
+    wal.replay(
+        [&log](uint64_t index, LogEntry &&entry) {
+            if (index <= log.start_index())
+                return;
+            log.truncate_from(index);
+            CHECK(index == log.last_index() + 1);
+            log.append(std::make_shared<LogEntry>(std::move(entry)));
+        },
+        [&log](uint64_t index) { log.truncate_from(index); },
+        [&](uint64_t saved_term, int saved_vote) {
+            term = saved_term;
+            voted_for = saved_vote;
+        });
+    CHECK(log.start_index() == 4 && log.last_index() == 6);
+    CHECK(log.term_at(4) == 1 && log.last_term() == 2);
+    CHECK(log.last_index() == 6 && log.at(5)->content == "entry 5");
+    CHECK(log.last_index() == 6 && log.at(6)->content == "entry 6");
+    CHECK(term == 2 && voted_for == 3);
+    CHECK(wal.durable_index() == 6);
+}
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+    Options options;
+    for (auto policy : {Options::FsyncPolicy::ALWAYS, Options::FsyncPolicy::GROUP,
+                        Options::FsyncPolicy::NONE})
+    {
+        options.fsync = policy;
+        recovers(options);
+    }
+    std::filesystem::remove_all(dir);
+    MPI_Finalize();
+    return tests::status("recovery");
+}
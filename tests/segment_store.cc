@@ -0,0 +1,128 @@
+// Segment store: appends get extents at the end of the open segment of
+// their stream, deletions leave dead space, and relocating the files of a
+// mostly dead segment gives each one extent and drops the segment.
+//
+//   make test, or ./bin/test_segment_store
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <mpi.h>
+#include <unistd.h>
+
+#include "check.hh"
+#include "segment_store.hh"
+
+using raft::Extent;
+using raft::SegmentStore;
+
+static const std::string dir =
+    (std::filesystem::temp_directory_path() / ("afs_test_segments_" + std::to_string(getpid()))).string();
+
+// Appends data to uid and writes it, as applying a LOAD or an APPEND does.
+static void append(SegmentStore &store, int uid, size_t stream, const std::string &data)
+{
+    Extent extent = store.append(uid, stream, data.size());
+    CHECK(SegmentStore::write(extent, data.data()));
+}
+
+static std::string read(const SegmentStore &store, int uid, uint64_t offset, uint64_t length)
+{
+    std::vector<Extent> extents = store.slice(uid, offset, length);
+    std::string data(length, '\0');
+    CHECK(SegmentStore::read(extents, data.data()));
+    return data;
+}
+
+static void places_extents()
+{
+    SegmentStore store(dir, 2, 100);
+    append(store, 1, 0, std::string(30, 'a'));
+    // Appends right after the previous bytes extend the last extent.
+    append(store, 1, 0, std::string(20, 'b'));
+    CHECK(store.extents(1).size() == 1);
+    CHECK(store.extents(1)[0].size == 50);
+
+    // Another stream has a segment of its own.
+    append(store, 2, 1, std::string(40, 'c'));
+    CHECK(store.extents(2)[0].segment != store.extents(1)[0].segment);
+    CHECK(store.segment_count() == 2);
+
+    append(store, 3, 0, std::string(40, 'd'));
+    append(store, 1, 0, std::string(10, 'e'));
+    CHECK(store.extents(1).size() == 2);
+    // Full: the next bytes open a new segment.
+    append(store, 3, 0, std::string(30, 'f'));
+    CHECK(store.segment_count() == 3);
+    CHECK(store.extents(3).size() == 2);
+    CHECK(store.extents(3)[1].offset == 0);
+
+    CHECK(read(store, 1, 0, 60) == std::string(30, 'a') + std::string(20, 'b') + std::string(10, 'e'));
+    // A slice across extents.
+    CHECK(read(store, 1, 45, 10) == std::string(5, 'b') + std::string(5, 'e'));
+    CHECK(read(store, 3, 35, 10) == std::string(5, 'd') + std::string(5, 'f'));
+    CHECK(store.slice(1, 60, 10).empty());
+    CHECK(store.live_bytes() == 170 && store.stored_bytes() == 170);
+
+    CHECK(store.append(4, 0, 0).size == 0);
+    CHECK(store.extents(4).empty());
+}
+
+static void relocates()
+{
+    SegmentStore store(dir, 1, 100);
+    append(store, 1, 0, std::string(60, 'a'));
+    append(store, 2, 0, std::string(30, 'b'));
+    append(store, 3, 0, std::string(20, 'c'));
+    append(store, 2, 0, std::string(5, 'd'));
+    CHECK(store.segment_count() == 2);
+
+    // The open segment is never a victim, nor one still mostly live.
+    CHECK(store.victim() == nullptr);
+    store.erase(1);
+    CHECK(store.live_bytes() == 55 && store.stored_bytes() == 115);
+    std::shared_ptr<raft::Segment> victim = store.victim();
+    CHECK(victim != nullptr && victim->id == store.extents(2)[0].segment->id);
+    if (!victim)
+        return;
+    std::vector<int> files = store.files_in(*victim);
+    CHECK(files == std::vector<int>{2});
+
+    // File 2 is in both segments: it ends up in a single extent, with its
+    // bytes in order once copied.
+    std::string content = read(store, 2, 0, 35);
+    CHECK(store.extents(2).size() == 2);
+    std::vector<Extent> old = store.relocate(2, 0);
+    CHECK(old.size() == 2);
+    CHECK(store.extents(2).size() == 1);
+    std::string copied(35, '\0');
+    CHECK(SegmentStore::read(old, copied.data()));
+    CHECK(SegmentStore::write(store.extents(2)[0], copied.data()));
+    CHECK(read(store, 2, 0, 35) == content);
+    CHECK(content == std::string(30, 'b') + std::string(5, 'd'));
+
+    // Nothing lives in the victim anymore: it is gone, its file with it
+    // once the old extents are dropped.
+    std::string path = victim->path;
+    CHECK(store.segment_count() == 1);
+    victim.reset();
+    old.clear();
+    CHECK(!std::filesystem::exists(path));
+    CHECK(store.live_bytes() == 55);
+    CHECK(read(store, 3, 0, 20) == std::string(20, 'c'));
+
+    store.reset();
+    CHECK(store.segment_count() == 0 && store.live_bytes() == 0);
+    CHECK(store.extents(3).empty());
+}
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+    places_extents();
+    relocates();
+    std::filesystem::remove_all(dir);
+    MPI_Finalize();
+    return tests::status("segment_store");
+}
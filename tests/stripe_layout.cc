@@ -0,0 +1,173 @@
+// Stripe layout: the pieces of the members cover any range exactly once,
+// ranges starting or ending inside a unit included, and a member's units
+// are written and read back to back in its view of the shared file.
+//
+//   make test, or ./bin/test_stripe_layout
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <mpi.h>
+#include <unistd.h>
+
+#include "check.hh"
+#include "stripe_layout.hh"
+
+using raft::StripeLayout;
+
+static const std::string dir =
+    (std::filesystem::temp_directory_path() / ("afs_test_stripes_" + std::to_string(getpid()))).string();
+
+static std::string random_bytes(size_t size, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::string data(size, '\0');
+    for (char &c : data)
+        c = static_cast<char>(rng());
+    return data;
+}
+
+static std::string read_file(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream content;
+    content << in.rdbuf();
+    return content.str();
+}
+
+// Bytes of data, which starts at offset in the file, in pieces, back to back.
+static std::string packed(const std::vector<StripeLayout::Piece> &pieces, uint64_t offset,
+                          const std::string &data)
+{
+    std::string result;
+    for (const StripeLayout::Piece &piece : pieces)
+        result += data.substr(piece.offset - offset, piece.size);
+    return result;
+}
+
+static void covers(uint64_t unit, int members, uint64_t offset, uint64_t size)
+{
+    StripeLayout layout(unit, members, 0);
+    std::vector<int> covered(size, 0);
+    for (int member = 0; member < members; member++)
+    {
+        std::vector<StripeLayout::Piece> pieces = layout.pieces(member, offset, size);
+        CHECK(layout.stores(member, offset, size) == !pieces.empty());
+        for (size_t i = 0; i < pieces.size(); i++)
+        {
+            const StripeLayout::Piece &piece = pieces[i];
+            CHECK(piece.size > 0);
+            CHECK(piece.offset >= offset && piece.offset + piece.size <= offset + size);
+            // Within one unit of member, in order.
+            CHECK(layout.owner(piece.offset) == member);
+            CHECK(piece.offset / unit == (piece.offset + piece.size - 1) / unit);
+            CHECK(i == 0 || pieces[i - 1].offset / unit + members == piece.offset / unit);
+            for (uint64_t at = piece.offset; at < piece.offset + piece.size && at < offset + size; at++)
+                covered[at - offset]++;
+        }
+    }
+    for (uint64_t at = 0; at < size; at++)
+        CHECK(covered[at] == 1);
+}
+
+static void covers_ranges()
+{
+    // Whole units, ranges starting or ending inside one, within a single
+    // unit, and shorter than a stripe.
+    for (int members : {1, 2, 3, 5})
+        for (uint64_t offset : {0, 1, 15, 16, 17, 47, 100})
+            for (uint64_t size : {1, 5, 15, 16, 17, 31, 48, 200})
+                covers(16, members, offset, size);
+
+    StripeLayout layout(16, 3, 1);
+    CHECK(layout.pieces(0, 0).empty());
+    CHECK(!layout.stores(1, 20, 0));
+    // Member 1 stores units 1, 4, 7...: [20, 44) touches units 1 and 2.
+    std::vector<StripeLayout::Piece> mine = layout.pieces(20, 24);
+    CHECK(mine.size() == 1 && mine[0].offset == 20 && mine[0].size == 12);
+    CHECK(layout.pieces(2, 20, 24).size() == 1 && layout.pieces(2, 20, 24)[0].size == 12);
+    CHECK(layout.pieces(0, 20, 24).empty());
+    CHECK(!layout.stores(0, 20, 24));
+    CHECK_THROWS(StripeLayout(0, 3, 0), std::invalid_argument);
+    CHECK_THROWS(StripeLayout(16, 3, 3), std::invalid_argument);
+}
+
+// Each member writes ranges of a file through its view, some of them packed
+// from pieces(): the file ends up as if written whole, and each member reads
+// its units back to back.
+static void writes_views(uint64_t unit, int members)
+{
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    std::string path = dir + "/striped";
+    MPI_File file;
+    CHECK(MPI_File_open(MPI_COMM_SELF, path.c_str(), MPI_MODE_CREATE | MPI_MODE_RDWR, MPI_INFO_NULL,
+                        &file) == MPI_SUCCESS);
+
+    std::vector<std::unique_ptr<StripeLayout>> layouts;
+    for (int member = 0; member < members; member++)
+        layouts.push_back(std::make_unique<StripeLayout>(unit, members, member));
+
+    const uint64_t size = unit * members * 7 + unit / 2;
+    std::string expected(size, '\0');
+    std::mt19937 rng(unit * 10 + members);
+    for (int round = 0; round < 40; round++)
+    {
+        // The whole file first, then random ranges over it.
+        uint64_t offset = round == 0 ? 0 : rng() % size;
+        uint64_t length = round == 0 ? size : 1 + rng() % (size - offset);
+        std::string data = random_bytes(length, round);
+        expected.replace(offset, length, data);
+        for (int member = 0; member < members; member++)
+        {
+            const StripeLayout &layout = *layouts[member];
+            if (round % 2 == 0)
+                CHECK(layout.write(file, offset, data.data(), length));
+            else
+            {
+                // As a member writes what the leader packed for it.
+                std::vector<StripeLayout::Piece> pieces = layout.pieces(offset, length);
+                CHECK(layout.write(file, pieces, packed(pieces, offset, data).data()));
+            }
+        }
+    }
+    // One member writing the units of every other, as the leader does for
+    // members that fell behind.
+    std::string data = random_bytes(unit * 3, 99);
+    expected.replace(unit / 2, data.size(), data);
+    CHECK(layouts[0]->write_all(file, unit / 2, data.data(), data.size()));
+    MPI_File_sync(file);
+    CHECK(read_file(path) == expected);
+
+    for (int member = 0; member < members; member++)
+    {
+        const StripeLayout &layout = *layouts[member];
+        for (uint64_t offset : {uint64_t(0), unit / 2, unit * members + 1})
+        {
+            uint64_t length = size - offset - unit / 3;
+            std::vector<StripeLayout::Piece> pieces = layout.pieces(offset, length);
+            std::string wanted = packed(pieces, 0, expected);
+            std::string buffer(wanted.size(), '\0');
+            CHECK(layout.read(file, pieces, buffer.data()));
+            CHECK(buffer == wanted);
+        }
+    }
+    MPI_File_close(&file);
+}
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+    covers_ranges();
+    writes_views(16, 1);
+    writes_views(16, 3);
+    writes_views(4096, 4);
+    std::filesystem::remove_all(dir);
+    MPI_Finalize();
+    return tests::status("stripe_layout");
+}
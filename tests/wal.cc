@@ -0,0 +1,250 @@
+// Write-ahead log replay: entries, truncations and votes come back in order
+// after a restart, a torn or corrupted tail is cut off and appends go on
+// after it, and the vote survives compaction.
+//
+//   make test, or ./bin/test_wal
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <mpi.h>
+#include <unistd.h>
+
+#include "check.hh"
+#include "wal.hh"
+
+using raft::LogEntry;
+using raft::Wal;
+
+static const std::string dir =
+    (std::filesystem::temp_directory_path() / ("afs_test_wal_" + std::to_string(getpid()))).string();
+
+static LogEntry entry(uint64_t term, std::string content)
+{
+    return LogEntry{term, message::ClientAction::APPEND, 7, "file", std::move(content), 3, 1,
+                    0, 0, LogEntry::PLAIN, {}};
+}
+
+// What a restart finds in the log.
+struct Replayed
+{
+    std::map<uint64_t, LogEntry> entries;
+    std::vector<uint64_t> truncations;
+    uint64_t term = 0;
+    int voted_for = -1;
+};
+
+static Replayed replay(Wal &wal)
+{
+    Replayed replayed;
+    wal.replay(
+        [&replayed](uint64_t index, LogEntry &&entry) {
+            replayed.entries.insert_or_assign(index, std::move(entry));
+        },
+        [&replayed](uint64_t index) {
+            replayed.truncations.push_back(index);
+            replayed.entries.erase(replayed.entries.lower_bound(index), replayed.entries.end());
+        },
+        [&replayed](uint64_t term, int voted_for) {
+            replayed.term = term;
+            replayed.voted_for = voted_for;
+        });
+    return replayed;
+}
+
+static Options options(int segment_mb = 64)
+{
+    Options options;
+    options.fsync = Options::FsyncPolicy::ALWAYS;
+    options.segment_mb = segment_mb;
+    return options;
+}
+
+static std::vector<std::string> segments()
+{
+    std::vector<std::string> paths;
+    for (const auto &file : std::filesystem::directory_iterator(dir))
+        paths.push_back(file.path().string());
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+static void fresh_dir()
+{
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+}
+
+static void replays_in_order()
+{
+    fresh_dir();
+    {
+        Wal wal(dir, options());
+        for (uint64_t index = 1; index <= 5; index++)
+            wal.append(index, entry(1, "entry " + std::to_string(index)));
+        wal.save_vote(2, 1);
+        wal.truncate_from(4);
+        wal.append(4, entry(2, "new 4"));
+        wal.sync();
+        CHECK(wal.durable_index() == 4);
+    }
+
+    Wal wal(dir, options());
+    Replayed replayed = replay(wal);
+    CHECK(replayed.entries.size() == 4);
+    CHECK(replayed.entries.at(1).content == "entry 1");
+    CHECK(replayed.entries.at(3).content == "entry 3");
+    CHECK(replayed.entries.at(4).content == "new 4");
+    CHECK(replayed.entries.at(4).term == 2);
+    CHECK(replayed.entries.at(2).uid == 7 && replayed.entries.at(2).filename == "file");
+    CHECK(replayed.truncations == std::vector<uint64_t>{4});
+    CHECK(replayed.term == 2 && replayed.voted_for == 1);
+    CHECK(wal.durable_index() == 4);
+
+    // Entries are read back from their record, even after a restart.
+    CHECK(wal.read(2).content == "entry 2");
+    CHECK(wal.read(4).content == "new 4");
+    CHECK_THROWS(wal.read(5), std::runtime_error);
+
+    wal.append(5, entry(2, "entry 5"));
+    CHECK(wal.read(5).content == "entry 5");
+    wal.sync();
+    Replayed again = replay(wal);
+    CHECK(again.entries.size() == 5);
+    CHECK(again.entries.at(5).content == "entry 5");
+}
+
+static void cuts_torn_tail()
+{
+    fresh_dir();
+    uintmax_t two_records;
+    {
+        Wal wal(dir, options());
+        wal.append(1, entry(1, "one"));
+        wal.append(2, entry(1, "two"));
+        wal.sync();
+        two_records = std::filesystem::file_size(segments().back());
+        wal.append(3, entry(1, std::string(1000, 'x')));
+        wal.sync();
+    }
+    // A crash in the middle of the last write.
+    std::string path = segments().back();
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 100);
+
+    {
+        Wal wal(dir, options());
+        Replayed replayed = replay(wal);
+        CHECK(replayed.entries.size() == 2);
+        CHECK(replayed.entries.count(3) == 0);
+        CHECK(wal.durable_index() == 2);
+        CHECK(std::filesystem::file_size(path) == two_records);
+
+        // Appends go on from the last valid record.
+        wal.append(3, entry(1, "three"));
+        wal.sync();
+    }
+
+    // A file system that extends the file before writing leaves zeros.
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) + 64);
+    Wal wal(dir, options());
+    Replayed replayed = replay(wal);
+    CHECK(replayed.entries.size() == 3);
+    CHECK(replayed.entries.at(3).content == "three");
+}
+
+static void cuts_corrupted_record()
+{
+    fresh_dir();
+    // Segments of 1 MiB: entries of 400 KiB fill one every 3 entries.
+    std::string content(400 << 10, 'a');
+    uintmax_t one_record;
+    {
+        Wal wal(dir, options(1));
+        wal.save_vote(1, 2);
+        wal.append(1, entry(1, content));
+        wal.sync();
+        one_record = std::filesystem::file_size(segments().front());
+        for (uint64_t index = 2; index <= 9; index++)
+            wal.append(index, entry(1, content));
+        wal.sync();
+    }
+    CHECK(segments().size() >= 3);
+
+    // A bit flipped in the body of entry 2, in the first segment.
+    {
+        std::fstream file(segments().front(), std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(one_record + 100);
+        file.put('b');
+    }
+
+    Wal wal(dir, options(1));
+    Replayed replayed = replay(wal);
+    // Nothing after the corrupted record is trusted, not even the
+    // following segments.
+    CHECK(replayed.entries.size() == 1);
+    CHECK(replayed.entries.count(1) == 1);
+    CHECK(replayed.term == 1 && replayed.voted_for == 2);
+    std::vector<std::string> left = segments();
+    CHECK(std::filesystem::file_size(left.front()) == one_record);
+    for (size_t s = 1; s < left.size(); s++)
+        CHECK(std::filesystem::file_size(left[s]) == 0);
+
+    wal.append(2, entry(2, "two"));
+    wal.sync();
+    Replayed again = replay(wal);
+    CHECK(again.entries.size() == 2);
+    CHECK(again.entries.at(2).content == "two");
+}
+
+static void keeps_vote()
+{
+    fresh_dir();
+    std::string content(400 << 10, 'a');
+    {
+        Wal wal(dir, options(1));
+        wal.save_vote(3, 1);
+        for (uint64_t index = 1; index <= 9; index++)
+            wal.append(index, entry(3, content));
+        wal.sync();
+        // The segment with the vote goes: the vote is recorded again.
+        size_t before = segments().size();
+        wal.compact(6);
+        CHECK(segments().size() < before);
+    }
+
+    {
+        Wal wal(dir, options(1));
+        Replayed replayed = replay(wal);
+        CHECK(replayed.term == 3 && replayed.voted_for == 1);
+        CHECK(replayed.entries.count(9) == 1);
+        CHECK(replayed.entries.count(1) == 0);
+        CHECK(wal.read(9).content == content);
+
+        // A snapshot covering the whole log replaces it.
+        wal.reset(9);
+        wal.append(10, entry(3, "ten"));
+        wal.sync();
+    }
+
+    Wal wal(dir, options(1));
+    Replayed replayed = replay(wal);
+    CHECK(replayed.term == 3 && replayed.voted_for == 1);
+    CHECK(replayed.entries.size() == 1);
+    CHECK(replayed.entries.at(10).content == "ten");
+}
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+    replays_in_order();
+    cuts_torn_tail();
+    cuts_corrupted_record();
+    keeps_vote();
+    std::filesystem::remove_all(dir);
+    MPI_Finalize();
+    return tests::status("wal");
+}
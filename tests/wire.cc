@@ -0,0 +1,171 @@
+// Binary wire format: what wire::Writer writes wire::Reader reads back, a
+// truncated frame is refused, and messages and log entries survive a round
+// trip in both formats.
+//
+//   make test, or ./bin/test_wire
+
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "check.hh"
+#include "client_message.hh"
+#include "raft_log.hh"
+#include "wire.hh"
+
+static void round_trips_values()
+{
+    std::string buffer;
+    wire::Writer writer(buffer);
+    writer.put<uint8_t>(0xAB);
+    writer.put<int32_t>(-42);
+    writer.put<uint64_t>(std::numeric_limits<uint64_t>::max());
+    writer.put<double>(0.25);
+    writer.put_string("");
+    writer.put_string(std::string("with\0zero", 9));
+    writer.put_vector(std::vector<int>{1, -2, 3});
+    writer.put_vector(std::vector<uint64_t>{});
+    CHECK(writer.size() == buffer.size());
+
+    wire::Reader reader(buffer.data(), buffer.size());
+    CHECK(reader.get<uint8_t>() == 0xAB);
+    CHECK(reader.get<int32_t>() == -42);
+    CHECK(reader.get<uint64_t>() == std::numeric_limits<uint64_t>::max());
+    CHECK(reader.get<double>() == 0.25);
+    CHECK(reader.get_string().empty());
+    CHECK(reader.get_string() == std::string("with\0zero", 9));
+    CHECK(reader.get_vector<int>() == (std::vector<int>{1, -2, 3}));
+    CHECK(reader.get_vector<uint64_t>().empty());
+    CHECK(reader.remaining() == 0);
+    CHECK(reader.position() == buffer.size());
+    CHECK_THROWS(reader.get<uint8_t>(), std::runtime_error);
+}
+
+static void refuses_truncated()
+{
+    std::string buffer;
+    wire::Writer writer(buffer);
+    writer.put_string("twelve bytes");
+    writer.put_vector(std::vector<uint32_t>{1, 2, 3});
+
+    // Every strict prefix misses part of a length or of what it counts.
+    for (size_t size = 0; size < buffer.size(); size++)
+    {
+        wire::Reader reader(buffer.data(), size);
+        CHECK_THROWS((reader.get_string(), reader.get_vector<uint32_t>()), std::runtime_error);
+    }
+}
+
+static void round_trips_frames()
+{
+    std::string buffer;
+    wire::Writer writer(buffer);
+    size_t frame = writer.begin_frame(7, 3, -1);
+    writer.put<uint64_t>(99);
+    writer.end_frame(frame);
+    CHECK(buffer.size() == wire::HEADER_SIZE + 8);
+    CHECK(wire::is_binary(buffer.data(), buffer.size()));
+
+    wire::Reader reader(buffer.data(), buffer.size());
+    wire::Header header = reader.get_header();
+    CHECK(header.version == wire::VERSION);
+    CHECK(header.type == 7);
+    CHECK(header.sender == 3);
+    CHECK(header.target == -1);
+    CHECK(header.payload_size == 8);
+    CHECK(reader.get<uint64_t>() == 99);
+
+    // The payload announced must be there.
+    wire::Reader cut(buffer.data(), buffer.size() - 1);
+    CHECK_THROWS(cut.get_header(), std::runtime_error);
+
+    std::string bad = buffer;
+    bad[0] = 0;
+    CHECK(!wire::is_binary(bad.data(), bad.size()));
+    wire::Reader magic(bad.data(), bad.size());
+    CHECK_THROWS(magic.get_header(), std::runtime_error);
+
+    bad = buffer;
+    bad[1] = wire::VERSION + 1;
+    wire::Reader version(bad.data(), bad.size());
+    CHECK_THROWS(version.get_header(), std::runtime_error);
+}
+
+static void round_trips_messages()
+{
+    for (auto format : {wire::Format::BINARY, wire::Format::JSON})
+    {
+        message::Message::set_wire_format(format);
+        message::Client_message sent(message::ClientAction::UPLOAD_CHUNK, 2, 5, 17, "name",
+                                     std::string("bytes\0and more", 14), 1234);
+        sent.set_range(4096, 14);
+        sent.set_read_bounds(8, 20);
+        sent.set_callback(true);
+
+        std::string encoded = sent.serialize();
+        CHECK(wire::is_binary(encoded.data(), encoded.size()) == (format == wire::Format::BINARY));
+        auto received =
+            std::dynamic_pointer_cast<message::Client_message>(message::Message::deserialize(encoded));
+        CHECK(received != nullptr);
+        if (!received)
+            continue;
+        CHECK(received->get_action() == message::ClientAction::UPLOAD_CHUNK);
+        CHECK(received->get_target_rank() == 2);
+        CHECK(received->get_sender_rank() == 5);
+        CHECK(received->get_uid() == 17);
+        CHECK(received->get_filename() == "name");
+        CHECK(received->get_content() == sent.get_content());
+        CHECK(received->get_request_id() == 1234);
+        CHECK(received->get_offset() == 4096 && received->get_length() == 14);
+        CHECK(received->get_min_index() == 8 && received->get_staleness_ms() == 20);
+        CHECK(received->get_callback());
+    }
+    message::Message::set_wire_format(wire::Format::BINARY);
+}
+
+static void round_trips_entries()
+{
+    std::string content(3000, 'c');
+    std::vector<raft::ChunkRef> chunks = raft::cut_chunks(content, 1024);
+    chunks.back().inlined = false;
+    raft::LogEntry sent{5, message::ClientAction::APPEND, 9, "file", content, 4, 77, 0, 0,
+                        raft::LogEntry::PLAIN, chunks};
+
+    std::string buffer;
+    wire::Writer writer(buffer);
+    sent.serialize(writer);
+    wire::Reader reader(buffer.data(), buffer.size());
+    raft::LogEntry binary = raft::LogEntry::deserialize(reader);
+    CHECK(reader.remaining() == 0);
+    raft::LogEntry json = raft::LogEntry::deserialize(sent.serialize_json());
+
+    for (const raft::LogEntry &received : {binary, json})
+    {
+        CHECK(received.term == 5);
+        CHECK(received.action == message::ClientAction::APPEND);
+        CHECK(received.uid == 9);
+        CHECK(received.filename == "file");
+        CHECK(received.content == content);
+        CHECK(received.client_rank == 4 && received.request_id == 77);
+        CHECK(received.fragment == raft::LogEntry::PLAIN);
+        CHECK(received.chunks.size() == chunks.size());
+        for (size_t i = 0; i < chunks.size() && i < received.chunks.size(); i++)
+        {
+            CHECK(received.chunks[i].id == chunks[i].id);
+            CHECK(received.chunks[i].size == chunks[i].size);
+            CHECK(received.chunks[i].inlined == chunks[i].inlined);
+        }
+    }
+}
+
+int main()
+{
+    round_trips_values();
+    refuses_truncated();
+    round_trips_frames();
+    round_trips_messages();
+    round_trips_entries();
+    return tests::status("wire");
+}